@@ -1,6 +1,61 @@
 #pragma once
 #define WINDOW_WIDTH 500
 #define WINDOW_HEIGHT 500
+// spirv-opt pass set applied to every compiled shader, see enum ShaderOptimization
+#define SHADER_OPTIMIZATION SHADER_OPTIMIZATION_PERFORMANCE
+// Reordering applied to imported meshes before they are cached, see enum MeshOptimization
+#define MESH_OPTIMIZATION (MESH_OPTIMIZE_VERTEX_CACHE | MESH_OPTIMIZE_OVERDRAW | MESH_OPTIMIZE_VERTEX_FETCH)
+// Levels of detail generated for imported meshes, LOD 0 included. At most MAX_MESH_LODS, 1 disables simplification.
+#define MESH_LOD_COUNT 6
+#define MAX_MESH_LODS 8
+// Instances draw the coarsest LOD whose simplification error projects below this many pixels
+#define LOD_PIXEL_ERROR 1.0f
+// Vertex buffer layout meshes are packed into on upload, see enum VertexFormat
+#define VERTEX_FORMAT VERTEX_FORMAT_SNORM16
+// Instances of the mesh drawn in a grid, the INSTANCE_COUNT environment variable overrides it.
+// Clamped to what fits into one storage buffer.
+#define INSTANCE_COUNT 1
+// Test CPU culled instances against a software hierarchical Z buffer the nearest instances are rasterized into.
+// Culling then stays on the CPU and GPU_CULLING is not used, so it is off by default.
+#define OCCLUSION_CULLING 0
+// Instances rasterized as occluders each frame, the ones covering the most of the screen
+#define OCCLUDER_COUNT 16
+// Occluders are drawn with the coarsest LOD within this error relative to the bounding radius,
+// coarser ones could bulge past the surface and hide what is right behind it
+#define OCCLUDER_MAX_ERROR 0.01f
+// Test CPU culled instances with hardware occlusion queries on their bounding boxes instead, and skip the draws of the
+// instances occluded in the last frame. The draws are predicated on the GPU with VK_EXT_conditional_rendering when
+// supported, the results are read back otherwise. Replaces OCCLUSION_CULLING, instances are then drawn without batching.
+#define OCCLUSION_QUERIES 0
+// Degrees per second the camera orbits the scene around its y axis, 0 keeps it still.
+// Only the camera nodes of the scene graph are then updated each frame.
+#define CAMERA_ORBIT_SPEED 0.0f
+// Pipeline cache blob kept across runs
+#define PIPELINE_CACHE_FILE "pipeline_cache.bin"
+// Pipeline keys used in the last session, created before the first frame
+#define PIPELINE_MANIFEST_FILE "pipeline_manifest.bin"
+// Requested MSAA sample count, 1 disables multisampling. The MSAA_SAMPLES environment variable overrides it,
+// and the highest count the device supports for both color and depth at or below the request is used.
+#define MSAA_SAMPLES 4
+// Render with VK_KHR_dynamic_rendering instead of render pass and framebuffer objects when the device supports it
+#define DYNAMIC_RENDERING 1
+// Set cull mode, front face, topology, depth and blend state at record time through VK_EXT_extended_dynamic_state(2/3)
+// when supported, so pipeline keys differing only in those states share one pipeline
+#define EXTENDED_DYNAMIC_STATE 1
+// Build pipelines from VK_EXT_graphics_pipeline_library parts: fast link on first use, link time optimized link in the background
+#define GRAPHICS_PIPELINE_LIBRARY 1
+// Issue draws sharing pipeline and buffers with one vkCmdDrawIndexedIndirect when multiDrawIndirect is supported,
+// with a vkCmdDrawIndexed loop otherwise
+#define MULTI_DRAW_INDIRECT 1
+// Cull instances in a compute pass that fills indirect draw commands, instead of on the CPU culling threads
+#define GPU_CULLING 1
+// Draw only the meshlets of LOD 0 inside the frustum and facing the camera when a single instance is drawn.
+// They are culled on the CPU, which then also culls the instance.
+#define CLUSTER_CULLING 1
+// Megabytes of index memory the LODs finer than the coarsest are streamed into, in the background and by screen size,
+// evicting the least recently drawn ones. Instances wait on the coarsest LOD, which always stays resident.
+// The STREAMING_BUDGET_MB environment variable overrides it, 0 uploads all LODs at load time.
+#define STREAMING_BUDGET_MB 64
 #include <vulkan/vulkan_core.h>
 #include <vulkan/vulkan.h>
 #include <glm/glm.hpp>
@@ -15,10 +70,76 @@ extern int platform_initialization(VkInstance vkInst, VkSurfaceKHR* surface, str
 extern int platform_deinitialization(void* window_handle);
 const char** get_platform_extension(unsigned int* platform_extension_num);
 
+enum ShaderOptimization
+{
+	SHADER_OPTIMIZATION_NONE,
+	// spirv-opt size passes (-Os)
+	SHADER_OPTIMIZATION_SIZE,
+	// spirv-opt performance passes (-O)
+	SHADER_OPTIMIZATION_PERFORMANCE,
+};
+
+enum MeshOptimization
+{
+	// Triangle order for post-transform vertex cache reuse (Tipsify)
+	MESH_OPTIMIZE_VERTEX_CACHE = 1,
+	// Outward facing triangle clusters first, needs MESH_OPTIMIZE_VERTEX_CACHE
+	MESH_OPTIMIZE_OVERDRAW = 2,
+	// Vertices in first use order for vertex fetch locality
+	MESH_OPTIMIZE_VERTEX_FETCH = 4,
+};
+
+enum VertexFormat
+{
+	// struct Vertex as is, float position and color (24 bytes)
+	VERTEX_FORMAT_FLOAT,
+	// Half float position over the mesh bounds, RGBA8 unorm color (12 bytes)
+	VERTEX_FORMAT_HALF,
+	// Snorm16 position over the mesh bounds, RGBA8 unorm color (12 bytes)
+	VERTEX_FORMAT_SNORM16,
+};
+
 struct GraphicsContext
 {
 	VkPhysicalDevice gpuDevice; 
 	VkDevice device;
+	// Optional device extensions enabled by create_device
+	VkBool32 pipeline_creation_feedback;
+	// render_pass and framebuffers are not created when set
+	VkBool32 dynamic_rendering;
+	PFN_vkCmdBeginRenderingKHR pfn_vkCmdBeginRenderingKHR;
+	PFN_vkCmdEndRenderingKHR pfn_vkCmdEndRenderingKHR;
+	// Cull mode, front face, primitive topology and depth test state are dynamic when set
+	VkBool32 extended_dynamic_state;
+	PFN_vkCmdSetCullModeEXT pfn_vkCmdSetCullModeEXT;
+	PFN_vkCmdSetFrontFaceEXT pfn_vkCmdSetFrontFaceEXT;
+	PFN_vkCmdSetPrimitiveTopologyEXT pfn_vkCmdSetPrimitiveTopologyEXT;
+	PFN_vkCmdSetDepthTestEnableEXT pfn_vkCmdSetDepthTestEnableEXT;
+	PFN_vkCmdSetDepthWriteEnableEXT pfn_vkCmdSetDepthWriteEnableEXT;
+	PFN_vkCmdSetDepthCompareOpEXT pfn_vkCmdSetDepthCompareOpEXT;
+	// Primitive restart is dynamic when set
+	VkBool32 extended_dynamic_state2;
+	PFN_vkCmdSetPrimitiveRestartEnableEXT pfn_vkCmdSetPrimitiveRestartEnableEXT;
+	// Polygon mode and color blend state are dynamic when set
+	VkBool32 extended_dynamic_state3;
+	PFN_vkCmdSetPolygonModeEXT pfn_vkCmdSetPolygonModeEXT;
+	PFN_vkCmdSetColorBlendEnableEXT pfn_vkCmdSetColorBlendEnableEXT;
+	PFN_vkCmdSetColorBlendEquationEXT pfn_vkCmdSetColorBlendEquationEXT;
+	PFN_vkCmdSetColorWriteMaskEXT pfn_vkCmdSetColorWriteMaskEXT;
+	// Pipelines are linked from cached library parts when set, created monolithically otherwise
+	VkBool32 graphics_pipeline_library;
+	// Indirect draws may start at a firstInstance other than 0, which per LOD instance ranges need
+	VkBool32 draw_indirect_first_instance;
+	// Batched draws go through indirect buffers with drawCount > 1 when set
+	VkBool32 multi_draw_indirect;
+	uint32_t max_draw_indirect_count;
+	// GPU culled draws are issued with one vkCmdDrawIndexedIndirectCountKHR when set, one indirect draw per command otherwise
+	VkBool32 draw_indirect_count;
+	PFN_vkCmdDrawIndexedIndirectCountKHR pfn_vkCmdDrawIndexedIndirectCountKHR;
+	// Occlusion tested draws are predicated on the query results with VK_EXT_conditional_rendering when set
+	VkBool32 conditional_rendering;
+	PFN_vkCmdBeginConditionalRenderingEXT pfn_vkCmdBeginConditionalRenderingEXT;
+	PFN_vkCmdEndConditionalRenderingEXT pfn_vkCmdEndConditionalRenderingEXT;
 	VkQueue graphics_queue;
 	VkSurfaceKHR display_surface;
 	VkSurfaceFormatKHR surface_format;
@@ -36,6 +157,13 @@ struct GraphicsContext
 	VkDeviceMemory depth_stencil_mem;
 	VkImage depth_stencil_image;
 	VkImageView depth_stencil_view;
+	VkFormat depth_format;
+	// Sample count of the color and depth attachments, shared by every pipeline
+	VkSampleCountFlagBits sample_count;
+	// Transient multisampled color target resolved into the swapchain image, only when sample_count > 1
+	VkDeviceMemory msaa_color_mem;
+	VkImage msaa_color_image;
+	VkImageView msaa_color_view;
 	// Global render pass for frame buffer writes
 	VkRenderPass render_pass;
 	VkFramebuffer* framebuffers;
@@ -43,15 +171,43 @@ struct GraphicsContext
 	VkCommandPool cmd_pool;
 	VkCommandBuffer* command_buffers;
 
+	// Layout of vertex_buffer, the pipeline vertex input is generated from it
+	enum VertexFormat vertex_format;
 	VkBuffer vertex_buffer;
 	VkDeviceMemory vertex_mem;
 	
 	VkBuffer index_buffer;
 	VkDeviceMemory index_mem;
+	// Draws covering the index buffer, each with its own index type and vertex offset
+	struct MeshDraw* draws;
+	uint32_t draw_count;
+	// Simplification error of each LOD relative to the mesh bounding sphere radius, increasing with the LOD
+	float lod_errors[MAX_MESH_LODS];
+	uint32_t lod_count;
+	// Added to the first index of the draws of each LOD, where the streamer placed it in index_buffer. 0 without streaming.
+	int32_t lod_index_offsets[MAX_MESH_LODS];
+
+	// One glm::mat4 per instance, read by the vertex shader at binding 2
+	VkBuffer instance_buffer;
+	VkDeviceMemory instance_mem;
+	uint32_t instance_count;
+	// Indices of the instances that passed culling this frame, binding 3
+	VkBuffer visible_instance_buffer;
+	VkDeviceMemory visible_instance_mem;
+	uint32_t visible_instance_count;
+	// Set when culling runs in the compute pass, visible_instance_count is then unknown on the CPU
+	VkBool32 gpu_culling;
+	// One vec4 sphere per instance, read by the culling shader
+	VkBuffer instance_bounds_buffer;
+	VkDeviceMemory instance_bounds_mem;
+	// IndirectDrawHeader followed by one VkDrawIndexedIndirectCommand per MeshDraw
+	VkBuffer indirect_buffer;
+	VkDeviceMemory indirect_mem;
 
 	VkBuffer uniform_buffer_vs;
 	VkDeviceMemory uniform_memory_vs;
 
+	// Default pipeline, used as fallback until a requested pipeline is compiled
 	VkPipeline            graphics_pipeline;
 	VkPipelineLayout      pipeline_layout;
 
@@ -59,12 +215,34 @@ struct GraphicsContext
 	VkDescriptorSet       descriptor_set;
 	VkDescriptorSetLayout descriptor_set_layout;
 
-	// List of shader modules created (stored for cleanup)
-	VkShaderModule shader_module_vs;
-	VkShaderModule shader_module_ps;
+	// Instance culling compute pipeline, the layouts belong to the layout cache
+	VkPipeline            culling_pipeline;
+	VkPipelineLayout      culling_pipeline_layout;
+	VkDescriptorSetLayout culling_descriptor_set_layout;
+	VkDescriptorSet       culling_descriptor_set;
+
+	// Pipelines by PipelineKey, owns graphics_pipeline and the shader modules
+	struct PipelineManager* pipeline_manager;
+	// Worker threads shared by frustum and occlusion culling
+	struct JobPool* job_pool;
+	// Frustum culling partitions and kernel
+	struct CullingSystem* culling_system;
+	// Software occlusion culling, NULL when disabled
+	struct OcclusionCuller* occlusion_culler;
+	// Hardware occlusion queries, NULL when disabled
+	struct OcclusionQueries* occlusion_queries;
+	// Streams LOD indices into index_buffer under the budget, NULL when everything is uploaded at load time
+	struct GeometryStreamer* geometry_streamer;
+	// Graphics pipeline library parts shared between linked pipelines
+	struct PipelineLibraryCache* pipeline_library_cache;
+	// Optimization applied to GLSL shaders compiled at load time
+	enum ShaderOptimization shader_optimization;
 
 	// Pipeline cache object
 	VkPipelineCache pipeline_cache;
+
+	// Interned descriptor set and pipeline layouts, owns descriptor_set_layout and pipeline_layout
+	struct LayoutCache* layout_cache;
 };
 struct Vertex
 {
@@ -100,4 +278,22 @@ static inline uint32_t count_bit_set(uint32_t v)
 	c = ((c >> 8) + c) & 0x00FF00FF;
 	c = ((c >> 16) + c) & 0x0000FFFF;
 	return c;
+}
+
+// Stencil aspect is only present on depth + stencil formats (VK_FORMAT_D16_UNORM_S8_UINT..VK_FORMAT_D32_SFLOAT_S8_UINT)
+static inline VkBool32 depth_format_has_stencil(VkFormat format)
+{
+	return format >= VK_FORMAT_D16_UNORM_S8_UINT && format <= VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+// FNV-1a hash, used to key the layout and pipeline caches
+static inline uint64_t hash_data(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
 }
\ No newline at end of file
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <intrin.h>
+#include <immintrin.h>
+#include "culling.h"
+#include "mesh.h"
+#include "job_pool.h"
+
+// Partitions per thread, so threads finishing early pick up more work
+#define CULLING_PARTITIONS_PER_THREAD 4
+#define MAX_CULLING_PARTITIONS (MAX_CULLING_THREADS * CULLING_PARTITIONS_PER_THREAD)
+
+typedef uint32_t (*CullingKernel)(const struct CullingBounds* bounds, const glm::vec4* planes, uint32_t begin, uint32_t end,
+	uint32_t* visible);
+
+struct CullingSystem
+{
+	struct JobPool* pool;
+	CullingKernel kernel;
+
+	// Current job, the pool publishes it to the workers
+	const struct CullingBounds* bounds;
+	glm::vec4 planes[6];
+	uint32_t* visible;
+	uint32_t partition_size;
+	uint32_t partition_count;
+	std::atomic<uint32_t> next_partition;
+	// Visible entries of each partition, written at the partition start in visible
+	uint32_t partition_visible[MAX_CULLING_PARTITIONS];
+};
+
+int alloc_culling_bounds(struct CullingBounds* bounds, uint32_t count)
+{
+	size_t padded = ((size_t)count + CULLING_SIMD_WIDTH - 1) / CULLING_SIMD_WIDTH * CULLING_SIMD_WIDTH;
+	float** arrays[] = { &bounds->center_x, &bounds->center_y, &bounds->center_z, &bounds->radius };
+
+	memset(bounds, 0, sizeof(*bounds));
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		*arrays[i] = (float*)_aligned_malloc((padded ? padded : CULLING_SIMD_WIDTH) * sizeof(float), 32);
+		if (!*arrays[i])
+		{
+			printf("cannot allocate culling bounds for %u objects\n", count);
+			free_culling_bounds(bounds);
+			return -1;
+		}
+	}
+
+	// Padding spheres have a huge negative radius and fail every plane test
+	for (size_t i = count; i < padded; i++)
+	{
+		bounds->center_x[i] = bounds->center_y[i] = bounds->center_z[i] = 0.0f;
+		bounds->radius[i] = -1e30f;
+	}
+	bounds->count = count;
+	return 0;
+}
+
+void free_culling_bounds(struct CullingBounds* bounds)
+{
+	_aligned_free(bounds->center_x);
+	_aligned_free(bounds->center_y);
+	_aligned_free(bounds->center_z);
+	_aligned_free(bounds->radius);
+	memset(bounds, 0, sizeof(*bounds));
+}
+
+void set_culling_bounds(struct CullingBounds* bounds, uint32_t index, glm::vec3 center, float radius)
+{
+	bounds->center_x[index] = center.x;
+	bounds->center_y[index] = center.y;
+	bounds->center_z[index] = center.z;
+	bounds->radius[index] = radius;
+}
+
+// Gribb/Hartmann plane extraction, glm matrices are column major so row i is m[0][i]..m[3][i].
+// The near plane uses the -w <= z convention, which also contains the 0 <= z range.
+void get_frustum_planes(const glm::mat4& view_projection, glm::vec4 planes[6])
+{
+	for (int i = 0; i < 3; i++)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			planes[i * 2][k] = view_projection[k][3] + view_projection[k][i];
+			planes[i * 2 + 1][k] = view_projection[k][3] - view_projection[k][i];
+		}
+	}
+
+	// Normalized, so plane distances compare directly against sphere radii
+	for (int i = 0; i < 6; i++)
+	{
+		float length = sqrtf(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+		if (length > 0.0f)
+			planes[i] = planes[i] * (1.0f / length);
+	}
+}
+
+void get_lod_selection(const glm::mat4& projection, const glm::mat4& view, uint32_t viewport_height,
+	const float* lod_errors, uint32_t lod_count, struct LodSelection* selection)
+{
+	selection->camera_position = glm::vec3(glm::inverse(view)[3]);
+	selection->error_scale = fabsf(projection[1][1]) * viewport_height * 0.5f / LOD_PIXEL_ERROR;
+	selection->lod_count = lod_count;
+	memcpy(selection->errors, lod_errors, lod_count * sizeof(float));
+}
+
+// The projected error of a LOD is errors[lod] * radius * error_scale / distance, distance to the nearest sphere point
+static inline uint32_t select_lod(const struct LodSelection* selection, glm::vec3 center, float radius)
+{
+	float distance = glm::length(center - selection->camera_position) - radius;
+	float error_limit = glm::max(distance, 1e-6f) / (radius * selection->error_scale);
+	uint32_t lod = 0;
+
+	while (lod + 1 < selection->lod_count && selection->errors[lod + 1] <= error_limit)
+		lod++;
+	return lod;
+}
+
+void sort_visible_by_lod(const struct CullingBounds* bounds, const struct LodSelection* selection,
+	uint32_t* visible, uint32_t visible_count, uint32_t* scratch, uint32_t* lod_counts)
+{
+	uint32_t offsets[MAX_MESH_LODS];
+
+	memset(lod_counts, 0, selection->lod_count * sizeof(uint32_t));
+	if (selection->lod_count <= 1)
+	{
+		lod_counts[0] = visible_count;
+		return;
+	}
+
+	// Counting sort, the LOD is kept in scratch between the passes
+	for (uint32_t i = 0; i < visible_count; i++)
+	{
+		uint32_t index = visible[i];
+
+		scratch[i] = select_lod(selection, glm::vec3(bounds->center_x[index], bounds->center_y[index], bounds->center_z[index]),
+			bounds->radius[index]);
+		lod_counts[scratch[i]]++;
+	}
+
+	offsets[0] = 0;
+	for (uint32_t lod = 1; lod < selection->lod_count; lod++)
+		offsets[lod] = offsets[lod - 1] + lod_counts[lod - 1];
+
+	// Instance indices stay below 2^28, a storage buffer cannot hold more transforms, so the LOD fits above them
+	for (uint32_t i = 0; i < visible_count; i++)
+	{
+		scratch[i] = visible[i] | scratch[i] << 28;
+	}
+	for (uint32_t i = 0; i < visible_count; i++)
+	{
+		visible[offsets[scratch[i] >> 28]++] = scratch[i] & 0x0fffffff;
+	}
+}
+
+// Meshlets are few enough next to their triangles that a scalar loop keeps up
+uint32_t cull_meshlets(const struct Meshlet* meshlets, uint32_t meshlet_count, const glm::mat4& model_view_projection,
+	glm::vec3 camera_position, struct IndexRange* ranges)
+{
+	glm::vec4 planes[6];
+	uint32_t range_count = 0;
+
+	get_frustum_planes(model_view_projection, planes);
+	for (uint32_t m = 0; m < meshlet_count; m++)
+	{
+		const struct Meshlet* meshlet = &meshlets[m];
+		glm::vec3 direction = meshlet->cone_apex - camera_position;
+		float distance = glm::length(direction);
+		bool visible = true;
+
+		for (int i = 0; i < 6 && visible; i++)
+			visible = glm::dot(glm::vec3(planes[i]), meshlet->center) + planes[i].w >= -meshlet->radius;
+		if (!visible || (meshlet->cone_cutoff < 1.0f && glm::dot(direction, meshlet->cone_axis) >= meshlet->cone_cutoff * distance))
+			continue;
+
+		if (range_count && ranges[range_count - 1].first_index + ranges[range_count - 1].index_count == meshlet->first_index)
+		{
+			ranges[range_count - 1].index_count += meshlet->index_count;
+			continue;
+		}
+		ranges[range_count].first_index = meshlet->first_index;
+		ranges[range_count].index_count = meshlet->index_count;
+		range_count++;
+	}
+	return range_count;
+}
+
+// Visible indices are written branchless: every lane is stored, the output only advances for visible ones.
+// The write position never passes the object index, so partitions can compact in place.
+static uint32_t cull_bounds_sse(const struct CullingBounds* bounds, const glm::vec4* planes, uint32_t begin, uint32_t end,
+	uint32_t* visible)
+{
+	uint32_t count = 0;
+
+	for (uint32_t i = begin; i < end; i += 4)
+	{
+		__m128 x = _mm_load_ps(bounds->center_x + i);
+		__m128 y = _mm_load_ps(bounds->center_y + i);
+		__m128 z = _mm_load_ps(bounds->center_z + i);
+		__m128 negative_radius = _mm_sub_ps(_mm_setzero_ps(), _mm_load_ps(bounds->radius + i));
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		uint32_t mask;
+
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(planes[p].x)), _mm_mul_ps(y, _mm_set1_ps(planes[p].y))),
+				_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(planes[p].z)), _mm_set1_ps(planes[p].w)));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negative_radius));
+		}
+
+		mask = (uint32_t)_mm_movemask_ps(inside);
+		if (!mask)
+			continue;
+		for (uint32_t k = 0; k < 4; k++)
+		{
+			visible[count] = i + k;
+			count += (mask >> k) & 1;
+		}
+	}
+	return count;
+}
+
+static uint32_t cull_bounds_avx(const struct CullingBounds* bounds, const glm::vec4* planes, uint32_t begin, uint32_t end,
+	uint32_t* visible)
+{
+	uint32_t count = 0;
+
+	for (uint32_t i = begin; i < end; i += 8)
+	{
+		__m256 x = _mm256_load_ps(bounds->center_x + i);
+		__m256 y = _mm256_load_ps(bounds->center_y + i);
+		__m256 z = _mm256_load_ps(bounds->center_z + i);
+		__m256 negative_radius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_load_ps(bounds->radius + i));
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		uint32_t mask;
+
+		for (int p = 0; p < 6; p++)
+		{
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(planes[p].x)), _mm256_mul_ps(y, _mm256_set1_ps(planes[p].y))),
+				_mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(planes[p].z)), _mm256_set1_ps(planes[p].w)));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negative_radius, _CMP_GE_OQ));
+		}
+
+		// Fully culled blocks are the common case away from the camera
+		mask = (uint32_t)_mm256_movemask_ps(inside);
+		if (!mask)
+			continue;
+		for (uint32_t k = 0; k < 8; k++)
+		{
+			visible[count] = i + k;
+			count += (mask >> k) & 1;
+		}
+	}
+	return count;
+}
+
+// AVX needs CPU support and the OS saving the YMM registers
+static VkBool32 cpu_supports_avx(void)
+{
+	int info[4];
+
+	__cpuid(info, 1);
+	if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)))
+		return VK_FALSE;
+	return (_xgetbv(0) & 6) == 6;
+}
+
+// Takes partitions until none are left
+static void run_culling_partitions(void* data)
+{
+	struct CullingSystem* system = (struct CullingSystem*)data;
+	uint32_t partition;
+
+	while ((partition = system->next_partition.fetch_add(1)) < system->partition_count)
+	{
+		uint32_t begin = partition * system->partition_size;
+		uint32_t end = begin + system->partition_size;
+		uint32_t padded_count = (system->bounds->count + CULLING_SIMD_WIDTH - 1) / CULLING_SIMD_WIDTH * CULLING_SIMD_WIDTH;
+
+		end = end < padded_count ? end : padded_count;
+		system->partition_visible[partition] = system->kernel(system->bounds, system->planes, begin, end, system->visible + begin);
+	}
+}
+
+int create_culling_system(struct GraphicsContext* graphics_context)
+{
+	struct CullingSystem* system = new struct CullingSystem();
+
+	system->next_partition = 0;
+	system->kernel = cpu_supports_avx() ? cull_bounds_avx : cull_bounds_sse;
+	// The render thread culls too
+	system->pool = graphics_context->job_pool;
+
+	printf("culling with %s on %u threads\n", system->kernel == cull_bounds_avx ? "AVX" : "SSE",
+		get_job_worker_count(system->pool) + 1);
+	graphics_context->culling_system = system;
+	return 0;
+}
+
+void destroy_culling_system(struct GraphicsContext* graphics_context)
+{
+	struct CullingSystem* system = graphics_context->culling_system;
+
+	if (!system)
+		return;
+
+	delete system;
+	graphics_context->culling_system = NULL;
+}
+
+uint32_t cull_bounds(struct GraphicsContext* graphics_context, const struct CullingBounds* bounds,
+	const glm::mat4& view_projection, uint32_t* visible)
+{
+	struct CullingSystem* system = graphics_context->culling_system;
+	uint32_t padded_count = (bounds->count + CULLING_SIMD_WIDTH - 1) / CULLING_SIMD_WIDTH * CULLING_SIMD_WIDTH;
+	uint32_t worker_count = get_job_worker_count(system->pool);
+	uint32_t visible_count = 0;
+	uint32_t partitions;
+	glm::vec4 planes[6];
+
+	get_frustum_planes(view_projection, planes);
+
+	if (!worker_count || bounds->count < MIN_PARALLEL_CULLING_OBJECTS)
+		return system->kernel(bounds, planes, 0, padded_count, visible);
+
+	// Partitions are whole SIMD blocks
+	partitions = (worker_count + 1) * CULLING_PARTITIONS_PER_THREAD;
+	system->bounds = bounds;
+	memcpy(system->planes, planes, sizeof(planes));
+	system->visible = visible;
+	system->partition_size = (padded_count / CULLING_SIMD_WIDTH + partitions - 1) / partitions * CULLING_SIMD_WIDTH;
+	system->partition_count = (padded_count + system->partition_size - 1) / system->partition_size;
+	system->next_partition = 0;
+	run_job(system->pool, run_culling_partitions, system);
+
+	// Partitions wrote at their start, close the gaps in order
+	for (uint32_t i = 0; i < system->partition_count; i++)
+	{
+		if (visible_count != i * system->partition_size)
+		{
+			memmove(visible + visible_count, visible + i * system->partition_size, system->partition_visible[i] * sizeof(uint32_t));
+		}
+		visible_count += system->partition_visible[i];
+	}
+	return visible_count;
+}
\ No newline at end of file
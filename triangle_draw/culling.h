@@ -0,0 +1,68 @@
+#pragma once
+#include "common.h"
+
+// Bounds arrays are padded to this many entries, the widest SIMD kernel
+#define CULLING_SIMD_WIDTH 8
+// Threads of the job pool shared by frustum and occlusion culling, the render thread included
+#define MAX_CULLING_THREADS 16
+// Below this many objects the render thread culls alone, waking workers would cost more
+#define MIN_PARALLEL_CULLING_OBJECTS 16384
+
+// Bounding spheres in structure of arrays form, 32 byte aligned and padded with never visible entries
+struct CullingBounds
+{
+	float* center_x;
+	float* center_y;
+	float* center_z;
+	float* radius;
+	uint32_t count;
+};
+
+extern int alloc_culling_bounds(struct CullingBounds* bounds, uint32_t count);
+extern void free_culling_bounds(struct CullingBounds* bounds);
+extern void set_culling_bounds(struct CullingBounds* bounds, uint32_t index, glm::vec3 center, float radius);
+
+// Left, right, bottom, top, near and far planes of a clip space transform, pointing inwards.
+// A point p is inside when dot(plane.xyz, p) + plane.w >= 0.
+extern void get_frustum_planes(const glm::mat4& view_projection, glm::vec4 planes[6]);
+
+// Camera and LOD errors instance LODs are picked with
+struct LodSelection
+{
+	glm::vec3 camera_position;
+	// Pixels one unit of error covers at distance one, over LOD_PIXEL_ERROR
+	float error_scale;
+	uint32_t lod_count;
+	// Relative to the bounding sphere radius, increasing with the LOD
+	float errors[MAX_MESH_LODS];
+};
+
+extern void get_lod_selection(const glm::mat4& projection, const glm::mat4& view, uint32_t viewport_height,
+	const float* lod_errors, uint32_t lod_count, struct LodSelection* selection);
+// Stably reorders visible by the coarsest LOD whose error projects below LOD_PIXEL_ERROR pixels for each sphere.
+// lod_counts receives the instances per LOD, scratch holds visible_count entries.
+extern void sort_visible_by_lod(const struct CullingBounds* bounds, const struct LodSelection* selection,
+	uint32_t* visible, uint32_t visible_count, uint32_t* scratch, uint32_t* lod_counts);
+
+struct Meshlet;
+
+// Index range of consecutive visible meshlets
+struct IndexRange
+{
+	uint32_t first_index;
+	uint32_t index_count;
+};
+
+// Culls the meshlets of one instance in its object space. Meshlets outside the frustum of model_view_projection or
+// facing away from camera_position are dropped, the rest are merged into ranges, which holds meshlet_count entries.
+// Returns the range count.
+extern uint32_t cull_meshlets(const struct Meshlet* meshlets, uint32_t meshlet_count, const glm::mat4& model_view_projection,
+	glm::vec3 camera_position, struct IndexRange* ranges);
+
+// Culls on the threads of graphics_context->job_pool
+extern int create_culling_system(struct GraphicsContext* graphics_context);
+extern void destroy_culling_system(struct GraphicsContext* graphics_context);
+// Writes the indices of the spheres intersecting the frustum of view_projection to visible in ascending order,
+// returns how many. visible must hold bounds->count rounded up to CULLING_SIMD_WIDTH entries.
+extern uint32_t cull_bounds(struct GraphicsContext* graphics_context, const struct CullingBounds* bounds,
+	const glm::mat4& view_projection, uint32_t* visible);
\ No newline at end of file
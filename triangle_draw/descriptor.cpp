@@ -1,7 +1,36 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <mutex>
 #include "common.h"
 #include "descriptor.h"
+#include "reflection.h"
+
+struct LayoutCacheEntry
+{
+	uint64_t hash;
+	uint32_t key_size;
+	uint8_t* key;
+	VkDescriptorSetLayout set_layout;
+	VkPipelineLayout pipeline_layout;
+};
+
+// Open addressing hash table, capacity is a power of two
+struct LayoutTable
+{
+	uint32_t capacity;
+	uint32_t count;
+	struct LayoutCacheEntry* entries;
+};
+
+struct LayoutCache
+{
+	struct LayoutTable set_layouts;
+	struct LayoutTable pipeline_layouts;
+};
+
+// Pipeline compiler threads resolve layouts concurrently with the render thread
+static std::mutex layout_cache_mutex;
 
 static inline VkDescriptorSetLayoutBinding descriptor_set_layout_binding(
 	VkDescriptorType   type,
@@ -55,50 +84,346 @@ inline VkWriteDescriptorSet write_descriptor_set(
 	return write_descriptor_set;
 }
 
-int setup_descriptor_set_layout(struct GraphicsContext* graphics_context)
+static struct LayoutCache* get_layout_cache(struct GraphicsContext* graphics_context)
 {
-	VkDescriptorSetLayoutBinding set_layout_bindings[] =
+	if (!graphics_context->layout_cache)
 	{
-		// Binding 0 : Vertex shader uniform buffer
-		descriptor_set_layout_binding(
-			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-			VK_SHADER_STAGE_VERTEX_BIT,
-			0),
-			// Binding 1 : Fragment shader image sampler
-	    descriptor_set_layout_binding(
-			VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-			VK_SHADER_STAGE_FRAGMENT_BIT,
-			1)
-	};
+		graphics_context->layout_cache = (struct LayoutCache*)calloc(1, sizeof(struct LayoutCache));
+	}
+	return graphics_context->layout_cache;
+}
+
+static struct LayoutCacheEntry* layout_table_find(struct LayoutTable* table, uint64_t hash, const void* key, uint32_t key_size)
+{
+	if (!table->capacity)
+		return NULL;
+
+	for (uint32_t i = (uint32_t)hash & (table->capacity - 1);; i = (i + 1) & (table->capacity - 1))
+	{
+		struct LayoutCacheEntry* entry = &table->entries[i];
+		if (!entry->key)
+			return NULL;
+		if (entry->hash == hash && entry->key_size == key_size && !memcmp(entry->key, key, key_size))
+			return entry;
+	}
+}
+
+static struct LayoutCacheEntry* layout_table_insert(struct LayoutTable* table, uint64_t hash, const void* key, uint32_t key_size)
+{
+	uint32_t i;
+
+	// Keep the load factor below one half
+	if ((table->count + 1) * 2 > table->capacity)
+	{
+		uint32_t old_capacity = table->capacity;
+		struct LayoutCacheEntry* old_entries = table->entries;
+		uint32_t new_capacity = old_capacity ? old_capacity * 2 : 16;
+		struct LayoutCacheEntry* new_entries = (struct LayoutCacheEntry*)calloc(new_capacity, sizeof(struct LayoutCacheEntry));
+		if (!new_entries)
+			return NULL;
+
+		for (uint32_t j = 0; j < old_capacity; j++)
+		{
+			if (!old_entries[j].key)
+				continue;
+			for (i = (uint32_t)old_entries[j].hash & (new_capacity - 1); new_entries[i].key; i = (i + 1) & (new_capacity - 1));
+			new_entries[i] = old_entries[j];
+		}
+		free(old_entries);
+		table->entries = new_entries;
+		table->capacity = new_capacity;
+	}
+
+	for (i = (uint32_t)hash & (table->capacity - 1); table->entries[i].key; i = (i + 1) & (table->capacity - 1));
+
+	// Empty keys (no bindings) still need a non-null key to mark the slot used
+	table->entries[i].key = (uint8_t*)malloc(key_size + 1);
+	if (!table->entries[i].key)
+		return NULL;
+	memcpy(table->entries[i].key, key, key_size);
+	table->entries[i].key_size = key_size;
+	table->entries[i].hash = hash;
+	table->count++;
+	return &table->entries[i];
+}
+
+VkDescriptorSetLayout get_descriptor_set_layout(struct GraphicsContext* graphics_context, const VkDescriptorSetLayoutBinding* bindings, uint32_t binding_count)
+{
+	std::lock_guard<std::mutex> lock(layout_cache_mutex);
+	struct LayoutCache* cache = get_layout_cache(graphics_context);
+	struct LayoutCacheEntry* entry;
+	VkDescriptorSetLayoutBinding sorted_bindings[MAX_REFLECTED_BINDINGS];
+	// binding, type, count and stage flags for every binding
+	uint32_t key[MAX_REFLECTED_BINDINGS * 4];
+	uint64_t hash;
+	VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+
+	if (!cache || binding_count > MAX_REFLECTED_BINDINGS)
+		return VK_NULL_HANDLE;
+
+	// Canonical order, so the same bindings declared in a different order share the layout
+	for (uint32_t i = 0; i < binding_count; i++)
+	{
+		uint32_t j;
+		for (j = i; j > 0 && sorted_bindings[j - 1].binding > bindings[i].binding; j--)
+		{
+			sorted_bindings[j] = sorted_bindings[j - 1];
+		}
+		sorted_bindings[j] = bindings[i];
+	}
+
+	for (uint32_t i = 0; i < binding_count; i++)
+	{
+		key[i * 4 + 0] = sorted_bindings[i].binding;
+		key[i * 4 + 1] = sorted_bindings[i].descriptorType;
+		key[i * 4 + 2] = sorted_bindings[i].descriptorCount;
+		key[i * 4 + 3] = sorted_bindings[i].stageFlags;
+	}
+
+	hash = hash_data(key, binding_count * 4 * sizeof(uint32_t));
+	entry = layout_table_find(&cache->set_layouts, hash, key, binding_count * 4 * sizeof(uint32_t));
+	if (entry)
+		return entry->set_layout;
+
+	VkDescriptorSetLayoutCreateInfo descriptor_layout = descriptor_set_layout_create_info(sorted_bindings, binding_count);
+	VK_CHECK(vkCreateDescriptorSetLayout(graphics_context->device, &descriptor_layout, nullptr, &set_layout));
+
+	entry = layout_table_insert(&cache->set_layouts, hash, key, binding_count * 4 * sizeof(uint32_t));
+	if (!entry)
+	{
+		vkDestroyDescriptorSetLayout(graphics_context->device, set_layout, nullptr);
+		return VK_NULL_HANDLE;
+	}
+	entry->set_layout = set_layout;
+	return set_layout;
+}
+
+VkPipelineLayout get_pipeline_layout(struct GraphicsContext* graphics_context, const VkDescriptorSetLayout* set_layouts, uint32_t set_layout_count,
+	const VkPushConstantRange* push_constant_ranges, uint32_t push_constant_range_count)
+{
+	std::lock_guard<std::mutex> lock(layout_cache_mutex);
+	struct LayoutCache* cache = get_layout_cache(graphics_context);
+	struct LayoutCacheEntry* entry;
+	uint8_t key[MAX_DESCRIPTOR_SETS * sizeof(VkDescriptorSetLayout) + 8 * sizeof(VkPushConstantRange)];
+	uint32_t key_size = 0;
+	uint64_t hash;
+	VkPipelineLayoutCreateInfo pipeline_layout_create_info = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+	VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+
+	if (!cache || set_layout_count > MAX_DESCRIPTOR_SETS || push_constant_range_count > 8)
+		return VK_NULL_HANDLE;
+
+	// Set layouts are interned, so their handles identify them
+	memcpy(key, set_layouts, set_layout_count * sizeof(VkDescriptorSetLayout));
+	key_size += set_layout_count * sizeof(VkDescriptorSetLayout);
+	memcpy(key + key_size, push_constant_ranges, push_constant_range_count * sizeof(VkPushConstantRange));
+	key_size += push_constant_range_count * sizeof(VkPushConstantRange);
+
+	hash = hash_data(key, key_size, hash_data(&set_layout_count, sizeof(set_layout_count)));
+	entry = layout_table_find(&cache->pipeline_layouts, hash, key, key_size);
+	if (entry)
+		return entry->pipeline_layout;
+
+	pipeline_layout_create_info.setLayoutCount = set_layout_count;
+	pipeline_layout_create_info.pSetLayouts = set_layouts;
+	pipeline_layout_create_info.pushConstantRangeCount = push_constant_range_count;
+	pipeline_layout_create_info.pPushConstantRanges = push_constant_ranges;
+	VK_CHECK(vkCreatePipelineLayout(graphics_context->device, &pipeline_layout_create_info, nullptr, &pipeline_layout));
+
+	entry = layout_table_insert(&cache->pipeline_layouts, hash, key, key_size);
+	if (!entry)
+	{
+		vkDestroyPipelineLayout(graphics_context->device, pipeline_layout, nullptr);
+		return VK_NULL_HANDLE;
+	}
+	entry->pipeline_layout = pipeline_layout;
+	return pipeline_layout;
+}
+
+VkPipelineLayout get_reflected_pipeline_layout(struct GraphicsContext* graphics_context, const struct ShaderReflection* reflections, uint32_t reflection_count,
+	VkDescriptorSetLayout* set_layouts, uint32_t* set_layout_count)
+{
+	struct ReflectedBinding merged[MAX_REFLECTED_BINDINGS];
+	uint32_t merged_count = 0;
+	VkPushConstantRange push_constant_ranges[8];
+	uint32_t push_constant_range_count = 0;
+	uint32_t set_count = 0;
 
-	VkDescriptorSetLayoutCreateInfo descriptor_layout = descriptor_set_layout_create_info(
-		set_layout_bindings, sizeof(set_layout_bindings)/sizeof(set_layout_bindings[0]));
-	VkPipelineLayoutCreateInfo pipeline_layout_create_info;
+	// Union of the bindings of all stages, a binding used by several stages gets all their stage flags
+	for (uint32_t i = 0; i < reflection_count; i++)
+	{
+		for (uint32_t j = 0; j < reflections[i].binding_count; j++)
+		{
+			const struct ReflectedBinding* binding = &reflections[i].bindings[j];
+			uint32_t k;
+
+			for (k = 0; k < merged_count; k++)
+			{
+				if (merged[k].set == binding->set && merged[k].binding == binding->binding)
+					break;
+			}
+
+			if (k < merged_count)
+			{
+				if (merged[k].type != binding->type || merged[k].count != binding->count)
+				{
+					printf("set %u binding %u declared differently across shader stages\n", binding->set, binding->binding);
+				}
+				merged[k].stages |= binding->stages;
+			}
+			else if (merged_count < MAX_REFLECTED_BINDINGS && binding->set < MAX_DESCRIPTOR_SETS)
+			{
+				merged[merged_count++] = *binding;
+			}
+		}
+
+		if (reflections[i].push_constant_size && push_constant_range_count < 8)
+		{
+			push_constant_ranges[push_constant_range_count].stageFlags = reflections[i].stage;
+			push_constant_ranges[push_constant_range_count].offset = reflections[i].push_constant_offset;
+			push_constant_ranges[push_constant_range_count].size = reflections[i].push_constant_size;
+			push_constant_range_count++;
+		}
+	}
+
+	for (uint32_t i = 0; i < merged_count; i++)
+	{
+		set_count = merged[i].set + 1 > set_count ? merged[i].set + 1 : set_count;
+	}
+
+	// Sets below the highest used one need a layout too, even when empty
+	for (uint32_t set = 0; set < set_count; set++)
+	{
+		VkDescriptorSetLayoutBinding bindings[MAX_REFLECTED_BINDINGS];
+		uint32_t binding_count = 0;
+
+		for (uint32_t i = 0; i < merged_count; i++)
+		{
+			if (merged[i].set == set)
+			{
+				bindings[binding_count++] = descriptor_set_layout_binding(merged[i].type, merged[i].stages, merged[i].binding, merged[i].count);
+			}
+		}
+		set_layouts[set] = get_descriptor_set_layout(graphics_context, bindings, binding_count);
+	}
+
+	*set_layout_count = set_count;
+	return get_pipeline_layout(graphics_context, set_layouts, set_count, push_constant_ranges, push_constant_range_count);
+}
+
+void destroy_layout_cache(struct GraphicsContext* graphics_context)
+{
+	struct LayoutCache* cache = graphics_context->layout_cache;
+	if (!cache)
+		return;
+
+	for (uint32_t i = 0; i < cache->pipeline_layouts.capacity; i++)
+	{
+		if (cache->pipeline_layouts.entries[i].key)
+		{
+			vkDestroyPipelineLayout(graphics_context->device, cache->pipeline_layouts.entries[i].pipeline_layout, nullptr);
+			free(cache->pipeline_layouts.entries[i].key);
+		}
+	}
 
-	VK_CHECK(vkCreateDescriptorSetLayout(graphics_context->device, &descriptor_layout, nullptr, &graphics_context->descriptor_set_layout));
+	for (uint32_t i = 0; i < cache->set_layouts.capacity; i++)
+	{
+		if (cache->set_layouts.entries[i].key)
+		{
+			vkDestroyDescriptorSetLayout(graphics_context->device, cache->set_layouts.entries[i].set_layout, nullptr);
+			free(cache->set_layouts.entries[i].key);
+		}
+	}
+
+	free(cache->pipeline_layouts.entries);
+	free(cache->set_layouts.entries);
+	free(cache);
+	graphics_context->layout_cache = NULL;
+	graphics_context->descriptor_set_layout = VK_NULL_HANDLE;
+	graphics_context->pipeline_layout = VK_NULL_HANDLE;
+}
 
-	pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipeline_layout_create_info.setLayoutCount = 1;
-	pipeline_layout_create_info.pSetLayouts = &graphics_context->descriptor_set_layout;
-	pipeline_layout_create_info.pNext = nullptr;
-	pipeline_layout_create_info.flags = 0;
-	pipeline_layout_create_info.pushConstantRangeCount = 0;
+int setup_descriptor_set_layout(struct GraphicsContext* graphics_context, const struct ShaderReflection* reflections, uint32_t reflection_count)
+{
+	VkDescriptorSetLayout set_layouts[MAX_DESCRIPTOR_SETS] = { VK_NULL_HANDLE };
+	uint32_t set_layout_count = 0;
 
-	VK_CHECK(vkCreatePipelineLayout(graphics_context->device, &pipeline_layout_create_info, nullptr, &graphics_context->pipeline_layout));
+	graphics_context->pipeline_layout = get_reflected_pipeline_layout(graphics_context, reflections, reflection_count, set_layouts, &set_layout_count);
+	// Descriptors are allocated for set 0 only
+	graphics_context->descriptor_set_layout = set_layouts[0];
 
+	if (graphics_context->pipeline_layout == VK_NULL_HANDLE || set_layout_count == 0)
+	{
+		printf("failed to build the pipeline layout from shader reflection\n");
+		return -1;
+	}
 	return 0;
 }
 
+// Set of the instance culling compute pipeline, allocated from descriptor_pool next to descriptor_set
+static void setup_culling_descriptors(struct GraphicsContext* graphics_context)
+{
+	VkDescriptorSetAllocateInfo alloc_info{ };
+	VkDescriptorBufferInfo bounds_descriptor{ };
+	VkDescriptorBufferInfo visible_instance_descriptor{ };
+	VkDescriptorBufferInfo indirect_descriptor{ };
+
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.descriptorPool = graphics_context->descriptor_pool;
+	alloc_info.pSetLayouts = &graphics_context->culling_descriptor_set_layout;
+	alloc_info.descriptorSetCount = 1;
+
+	VK_CHECK(vkAllocateDescriptorSets(graphics_context->device, &alloc_info, &graphics_context->culling_descriptor_set));
+
+	bounds_descriptor.buffer = graphics_context->instance_bounds_buffer;
+	bounds_descriptor.offset = 0;
+	bounds_descriptor.range = VK_WHOLE_SIZE;
+	visible_instance_descriptor.buffer = graphics_context->visible_instance_buffer;
+	visible_instance_descriptor.offset = 0;
+	visible_instance_descriptor.range = VK_WHOLE_SIZE;
+	indirect_descriptor.buffer = graphics_context->indirect_buffer;
+	indirect_descriptor.offset = 0;
+	indirect_descriptor.range = VK_WHOLE_SIZE;
+
+	VkWriteDescriptorSet write_descriptor_sets[] =
+	{
+		// Binding 0 : Instance bounding spheres
+		write_descriptor_set(
+			graphics_context->culling_descriptor_set,
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			0,
+			&bounds_descriptor),
+		// Binding 1 : Visible instance indices, read by the vertex shader afterwards
+		write_descriptor_set(
+			graphics_context->culling_descriptor_set,
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			1,
+			&visible_instance_descriptor),
+		// Binding 2 : Indirect draw header with the visible count
+		write_descriptor_set(
+			graphics_context->culling_descriptor_set,
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			2,
+			&indirect_descriptor),
+	};
+
+	vkUpdateDescriptorSets(graphics_context->device, sizeof(write_descriptor_sets) / sizeof(write_descriptor_sets[0]), write_descriptor_sets, 0, NULL);
+}
+
 int setup_descriptors(struct GraphicsContext* graphics_context)
 {
 	VkDescriptorPoolSize pool_sizes[] =
 	{
 		descriptor_pool_size(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1),
+		// Instance transforms and visible list, plus bounds, visible list and indirect buffer of the culling set
+		descriptor_pool_size(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5),
 		descriptor_pool_size(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1) };
 
 	VkDescriptorPoolCreateInfo descriptor_pool_create_info{ };
 	VkDescriptorSetAllocateInfo alloc_info{ };
 	VkDescriptorBufferInfo buffer_descriptor{ };
+	VkDescriptorBufferInfo instance_descriptor{ };
+	VkDescriptorBufferInfo visible_instance_descriptor{ };
 
 	descriptor_pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	descriptor_pool_create_info.poolSizeCount = sizeof(pool_sizes) / sizeof(pool_sizes[0]);
@@ -117,6 +442,12 @@ int setup_descriptors(struct GraphicsContext* graphics_context)
 	buffer_descriptor.buffer = graphics_context->uniform_buffer_vs;
 	buffer_descriptor.offset = 0;
 	buffer_descriptor.range = VK_WHOLE_SIZE;
+	instance_descriptor.buffer = graphics_context->instance_buffer;
+	instance_descriptor.offset = 0;
+	instance_descriptor.range = VK_WHOLE_SIZE;
+	visible_instance_descriptor.buffer = graphics_context->visible_instance_buffer;
+	visible_instance_descriptor.offset = 0;
+	visible_instance_descriptor.range = VK_WHOLE_SIZE;
 	// Setup a descriptor image info for the current texture to be used as a combined image sampler
 	//VkDescriptorImageInfo image_descriptor;
 	//image_descriptor.imageView = texture.view;                // The image's view (images are never directly accessed by the shader, but rather through views defining subresources)
@@ -138,16 +469,37 @@ int setup_descriptors(struct GraphicsContext* graphics_context)
 			//  VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,        // The descriptor set will use a combined image sampler (sampler and image could be split)
 			//  1,                                                // Shader binding point 1
 			//  &image_descriptor)                                // Pointer to the descriptor image for our texture
+		// Binding 2 : Vertex shader instance transforms
+		write_descriptor_set(
+			graphics_context->descriptor_set,
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			2,
+			&instance_descriptor),
+		// Binding 3 : Vertex shader visible instance indices
+		write_descriptor_set(
+			graphics_context->descriptor_set,
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			3,
+			&visible_instance_descriptor),
 	};
 
 	vkUpdateDescriptorSets(graphics_context->device, sizeof(write_descriptor_sets) / sizeof(write_descriptor_sets[0]), write_descriptor_sets, 0, NULL);
+
+	if (graphics_context->culling_descriptor_set_layout != VK_NULL_HANDLE)
+	{
+		setup_culling_descriptors(graphics_context);
+	}
 	return 0;
 }
 
 int destroy_descriptors(struct GraphicsContext* graphics_context)
 {
+	// descriptor_set_layout belongs to the layout cache
 	vkFreeDescriptorSets(graphics_context->device, graphics_context->descriptor_pool, 1, &graphics_context->descriptor_set);
-	vkDestroyDescriptorSetLayout(graphics_context->device, graphics_context->descriptor_set_layout, nullptr);
+	if (graphics_context->culling_descriptor_set != VK_NULL_HANDLE)
+	{
+		vkFreeDescriptorSets(graphics_context->device, graphics_context->descriptor_pool, 1, &graphics_context->culling_descriptor_set);
+	}
 	vkDestroyDescriptorPool(graphics_context->device, graphics_context->descriptor_pool, nullptr);
 	return 0;
 }
\ No newline at end of file
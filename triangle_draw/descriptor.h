@@ -1,5 +1,16 @@
 #pragma once
+#include "common.h"
 struct GraphicsContext;
-extern int setup_descriptor_set_layout(struct GraphicsContext* graphics_context);
+struct ShaderReflection;
+extern int setup_descriptor_set_layout(struct GraphicsContext* graphics_context, const struct ShaderReflection* reflections, uint32_t reflection_count);
 extern int setup_descriptors(struct GraphicsContext* graphics_context);
-extern int destroy_descriptors(struct GraphicsContext* graphics_context);
\ No newline at end of file
+extern int destroy_descriptors(struct GraphicsContext* graphics_context);
+
+// Layouts are interned: identical bindings or set layouts/push constant ranges return the same handle.
+// The handles are owned by the layout cache and released by destroy_layout_cache.
+extern VkDescriptorSetLayout get_descriptor_set_layout(struct GraphicsContext* graphics_context, const VkDescriptorSetLayoutBinding* bindings, uint32_t binding_count);
+extern VkPipelineLayout get_pipeline_layout(struct GraphicsContext* graphics_context, const VkDescriptorSetLayout* set_layouts, uint32_t set_layout_count,
+	const VkPushConstantRange* push_constant_ranges, uint32_t push_constant_range_count);
+extern VkPipelineLayout get_reflected_pipeline_layout(struct GraphicsContext* graphics_context, const struct ShaderReflection* reflections, uint32_t reflection_count,
+	VkDescriptorSetLayout* set_layouts, uint32_t* set_layout_count);
+extern void destroy_layout_cache(struct GraphicsContext* graphics_context);
\ No newline at end of file
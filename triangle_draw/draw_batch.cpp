@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "draw_batch.h"
+#include "buffer.h"
+#include "memory.h"
+
+struct BatchDraw
+{
+	struct DrawBatchKey key;
+	VkDrawIndexedIndirectCommand command;
+	// Submission order, keeps the sort stable
+	uint32_t order;
+};
+
+static int compare_handles(uint64_t a, uint64_t b)
+{
+	return a < b ? -1 : a > b;
+}
+
+static int compare_batch_keys(const struct DrawBatchKey* a, const struct DrawBatchKey* b)
+{
+	int result;
+
+	if ((result = compare_handles((uint64_t)a->pipeline, (uint64_t)b->pipeline)))
+		return result;
+	if ((result = compare_handles((uint64_t)a->vertex_buffer, (uint64_t)b->vertex_buffer)))
+		return result;
+	if ((result = compare_handles((uint64_t)a->index_buffer, (uint64_t)b->index_buffer)))
+		return result;
+	return compare_handles(a->index_type, b->index_type);
+}
+
+static int compare_batch_draws(const void* a, const void* b)
+{
+	const struct BatchDraw* draw_a = (const struct BatchDraw*)a;
+	const struct BatchDraw* draw_b = (const struct BatchDraw*)b;
+	int result = compare_batch_keys(&draw_a->key, &draw_b->key);
+
+	return result ? result : compare_handles(draw_a->order, draw_b->order);
+}
+
+void reset_draw_batches(struct DrawBatches* batches)
+{
+	batches->draw_count = 0;
+	batches->batch_count = 0;
+}
+
+int add_batch_draw(struct DrawBatches* batches, const struct DrawBatchKey* key, const VkDrawIndexedIndirectCommand* command)
+{
+	if (batches->draw_count == batches->draw_capacity)
+	{
+		uint32_t capacity = batches->draw_capacity ? batches->draw_capacity * 2 : 64;
+		struct BatchDraw* draws = (struct BatchDraw*)realloc(batches->draws, capacity * sizeof(struct BatchDraw));
+		struct DrawBatch* batch_array = (struct DrawBatch*)realloc(batches->batches, capacity * sizeof(struct DrawBatch));
+		VkDrawIndexedIndirectCommand* commands = (VkDrawIndexedIndirectCommand*)realloc(batches->commands,
+			capacity * sizeof(VkDrawIndexedIndirectCommand));
+
+		// Whatever was reallocated stays valid at the old capacity
+		batches->draws = draws ? draws : batches->draws;
+		batches->batches = batch_array ? batch_array : batches->batches;
+		batches->commands = commands ? commands : batches->commands;
+		if (!draws || !batch_array || !commands)
+		{
+			printf("cannot allocate %u batch draws\n", capacity);
+			return -1;
+		}
+		batches->draw_capacity = capacity;
+	}
+
+	batches->draws[batches->draw_count].key = *key;
+	batches->draws[batches->draw_count].command = *command;
+	batches->draws[batches->draw_count].order = batches->draw_count;
+	batches->draw_count++;
+	return 0;
+}
+
+// Grows the indirect buffer to hold count commands
+static int reserve_indirect_buffer(struct GraphicsContext* graphics_context, struct DrawBatches* batches, uint32_t count)
+{
+	uint32_t capacity = batches->indirect_capacity ? batches->indirect_capacity : 64;
+	VkDeviceSize size;
+
+	if (count <= batches->indirect_capacity)
+		return 0;
+
+	while (capacity < count)
+		capacity *= 2;
+	size = (VkDeviceSize)capacity * sizeof(VkDrawIndexedIndirectCommand);
+
+	if (batches->indirect_buffer)
+	{
+		destroy_buffer(graphics_context->device, batches->indirect_buffer);
+		free_memory(graphics_context->device, batches->indirect_mem);
+	}
+	batches->indirect_buffer = create_buffer(graphics_context->device, size, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+	batches->indirect_mem = alloc_bind_bufer_memory(graphics_context, batches->indirect_buffer,
+		size, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (!batches->indirect_buffer || !batches->indirect_mem)
+	{
+		printf("cannot allocate indirect buffer for %u draws\n", capacity);
+		batches->indirect_capacity = 0;
+		return -1;
+	}
+	batches->indirect_capacity = capacity;
+	return 0;
+}
+
+int build_draw_batches(struct GraphicsContext* graphics_context, struct DrawBatches* batches)
+{
+	batches->batch_count = 0;
+	if (!batches->draw_count)
+		return 0;
+
+	qsort(batches->draws, batches->draw_count, sizeof(struct BatchDraw), compare_batch_draws);
+
+	for (uint32_t i = 0; i < batches->draw_count; i++)
+	{
+		struct DrawBatch* batch = batches->batch_count ? &batches->batches[batches->batch_count - 1] : NULL;
+
+		if (!batch || compare_batch_keys(&batch->key, &batches->draws[i].key))
+		{
+			batch = &batches->batches[batches->batch_count++];
+			batch->key = batches->draws[i].key;
+			batch->first_command = i;
+			batch->command_count = 0;
+		}
+		batch->command_count++;
+		batches->commands[i] = batches->draws[i].command;
+	}
+
+	// The loop fallback draws from the CPU copy alone
+	if (!graphics_context->multi_draw_indirect)
+		return 0;
+
+	if (reserve_indirect_buffer(graphics_context, batches, batches->draw_count))
+		return -1;
+	return update_data_to_memory(graphics_context, batches->indirect_mem, 0, batches->commands,
+		batches->draw_count * sizeof(VkDrawIndexedIndirectCommand)) == VK_SUCCESS ? 0 : -1;
+}
+
+void record_draw_batches(struct GraphicsContext* graphics_context, VkCommandBuffer cmd, const struct DrawBatches* batches,
+	VkPipeline bound_pipeline)
+{
+	VkBuffer bound_vertex_buffer = VK_NULL_HANDLE;
+	VkBuffer bound_index_buffer = VK_NULL_HANDLE;
+	VkIndexType bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
+	VkDeviceSize offsets[1] = { 0 };
+
+	for (uint32_t i = 0; i < batches->batch_count; i++)
+	{
+		const struct DrawBatch* batch = &batches->batches[i];
+
+		if (batch->key.pipeline != bound_pipeline)
+		{
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, batch->key.pipeline);
+			bound_pipeline = batch->key.pipeline;
+		}
+		if (batch->key.vertex_buffer != bound_vertex_buffer)
+		{
+			vkCmdBindVertexBuffers(cmd, 0, 1, &batch->key.vertex_buffer, offsets);
+			bound_vertex_buffer = batch->key.vertex_buffer;
+		}
+		if (batch->key.index_buffer != bound_index_buffer || batch->key.index_type != bound_index_type)
+		{
+			vkCmdBindIndexBuffer(cmd, batch->key.index_buffer, 0, batch->key.index_type);
+			bound_index_buffer = batch->key.index_buffer;
+			bound_index_type = batch->key.index_type;
+		}
+
+		if (graphics_context->multi_draw_indirect)
+		{
+			// Split at the device limit on drawCount
+			for (uint32_t first = 0; first < batch->command_count; first += graphics_context->max_draw_indirect_count)
+			{
+				uint32_t count = batch->command_count - first;
+
+				count = count < graphics_context->max_draw_indirect_count ? count : graphics_context->max_draw_indirect_count;
+				vkCmdDrawIndexedIndirect(cmd, batches->indirect_buffer,
+					(VkDeviceSize)(batch->first_command + first) * sizeof(VkDrawIndexedIndirectCommand),
+					count, sizeof(VkDrawIndexedIndirectCommand));
+			}
+			continue;
+		}
+
+		for (uint32_t c = batch->first_command; c < batch->first_command + batch->command_count; c++)
+		{
+			const VkDrawIndexedIndirectCommand* command = &batches->commands[c];
+			vkCmdDrawIndexed(cmd, command->indexCount, command->instanceCount, command->firstIndex, command->vertexOffset,
+				command->firstInstance);
+		}
+	}
+}
+
+void destroy_draw_batches(struct GraphicsContext* graphics_context, struct DrawBatches* batches)
+{
+	if (batches->indirect_buffer)
+	{
+		destroy_buffer(graphics_context->device, batches->indirect_buffer);
+		free_memory(graphics_context->device, batches->indirect_mem);
+	}
+	free(batches->draws);
+	free(batches->batches);
+	free(batches->commands);
+	memset(batches, 0, sizeof(*batches));
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+#include "common.h"
+
+// State a run of indirect draws has to share. Draws with equal keys end up in one vkCmdDrawIndexedIndirect.
+struct DrawBatchKey
+{
+	VkPipeline pipeline;
+	VkBuffer vertex_buffer;
+	VkBuffer index_buffer;
+	VkIndexType index_type;
+};
+
+struct DrawBatch
+{
+	struct DrawBatchKey key;
+	// Range of commands in the indirect buffer
+	uint32_t first_command;
+	uint32_t command_count;
+};
+
+struct BatchDraw;
+
+// Draws collected for a frame, grouped into batches by build_draw_batches
+struct DrawBatches
+{
+	struct BatchDraw* draws;
+	uint32_t draw_count;
+	uint32_t draw_capacity;
+
+	struct DrawBatch* batches;
+	uint32_t batch_count;
+	// Commands in batch order, drawn from here when multiDrawIndirect is unavailable
+	VkDrawIndexedIndirectCommand* commands;
+
+	VkBuffer indirect_buffer;
+	VkDeviceMemory indirect_mem;
+	uint32_t indirect_capacity;
+};
+
+// Starts a new set of draws, buffers are kept for reuse
+extern void reset_draw_batches(struct DrawBatches* batches);
+extern int add_batch_draw(struct DrawBatches* batches, const struct DrawBatchKey* key, const VkDrawIndexedIndirectCommand* command);
+// Sorts the draws by key into batches and uploads the commands.
+// The GPU must be done with the previous contents of the indirect buffer.
+extern int build_draw_batches(struct GraphicsContext* graphics_context, struct DrawBatches* batches);
+// Binds what each batch needs and draws it. bound_pipeline is the pipeline the caller already bound to cmd.
+extern void record_draw_batches(struct GraphicsContext* graphics_context, VkCommandBuffer cmd, const struct DrawBatches* batches,
+	VkPipeline bound_pipeline);
+extern void destroy_draw_batches(struct GraphicsContext* graphics_context, struct DrawBatches* batches);
\ No newline at end of file
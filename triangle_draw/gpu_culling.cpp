@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gpu_culling.h"
+#include "culling.h"
+#include "index_format.h"
+#include "buffer.h"
+#include "memory.h"
+#include "pipeline.h"
+
+// Instance count copies issued per vkCmdCopyBuffer
+#define MAX_INSTANCE_COUNT_COPIES 16
+
+struct CullingPushConstants
+{
+	glm::vec4 planes[6];
+	// xyz camera position, w LodSelection::error_scale
+	glm::vec4 camera;
+	uint32_t instance_count;
+	uint32_t lod_count;
+};
+
+static inline VkDeviceSize get_draw_command_offset(uint32_t draw)
+{
+	return sizeof(struct IndirectDrawHeader) + (VkDeviceSize)draw * sizeof(VkDrawIndexedIndirectCommand);
+}
+
+int setup_gpu_culling(struct GraphicsContext* graphics_context, const struct CullingBounds* bounds)
+{
+	VkDeviceSize bounds_size = (VkDeviceSize)bounds->count * sizeof(glm::vec4);
+	VkDeviceSize indirect_size = get_draw_command_offset(graphics_context->draw_count);
+	glm::vec4* spheres = (glm::vec4*)malloc((size_t)bounds_size);
+	uint8_t* indirect = (uint8_t*)calloc(1, (size_t)indirect_size);
+	struct IndirectDrawHeader* header = (struct IndirectDrawHeader*)indirect;
+	VkDeviceSize visible_size = (VkDeviceSize)graphics_context->lod_count * graphics_context->instance_count * sizeof(uint32_t);
+
+	// LODs past the first draw from their own visible list region
+	if (graphics_context->lod_count > 1 && !graphics_context->draw_indirect_first_instance)
+	{
+		printf("gpu culling of mesh LODs needs drawIndirectFirstInstance\n");
+		return -1;
+	}
+
+	if (!spheres || !indirect)
+	{
+		printf("cannot allocate gpu culling buffers\n");
+		free(spheres);
+		free(indirect);
+		return -1;
+	}
+
+	// The shader reads one sphere per instance instead of the four SoA streams
+	for (uint32_t i = 0; i < bounds->count; i++)
+	{
+		spheres[i] = glm::vec4(bounds->center_x[i], bounds->center_y[i], bounds->center_z[i], bounds->radius[i]);
+	}
+
+	// Everything except instanceCount is static
+	header->draw_count = graphics_context->draw_count;
+	memcpy(header->lod_errors, graphics_context->lod_errors, graphics_context->lod_count * sizeof(float));
+	for (uint32_t lod = 0; lod < MAX_MESH_LODS; lod++)
+	{
+		header->resident_lods[lod] = lod;
+	}
+	for (uint32_t i = 0; i < graphics_context->draw_count; i++)
+	{
+		VkDrawIndexedIndirectCommand* command = (VkDrawIndexedIndirectCommand*)(indirect + get_draw_command_offset(i));
+
+		command->indexCount = graphics_context->draws[i].index_count;
+		command->instanceCount = 0;
+		command->firstIndex = graphics_context->draws[i].first_index + graphics_context->lod_index_offsets[graphics_context->draws[i].lod];
+		command->vertexOffset = graphics_context->draws[i].vertex_offset;
+		command->firstInstance = graphics_context->draws[i].lod * graphics_context->instance_count;
+	}
+
+	graphics_context->instance_bounds_buffer = create_buffer(graphics_context->device, bounds_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	graphics_context->instance_bounds_mem = alloc_bind_bufer_memory(graphics_context, graphics_context->instance_bounds_buffer,
+		bounds_size, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	update_data_to_memory(graphics_context, graphics_context->instance_bounds_mem, 0, spheres, (uint32_t)bounds_size);
+
+	graphics_context->indirect_buffer = create_buffer(graphics_context->device, indirect_size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	graphics_context->indirect_mem = alloc_bind_bufer_memory(graphics_context, graphics_context->indirect_buffer,
+		indirect_size, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	update_data_to_memory(graphics_context, graphics_context->indirect_mem, 0, indirect, (uint32_t)indirect_size);
+
+	free(spheres);
+	free(indirect);
+
+	if (setup_compute_pipeline(graphics_context, GPU_CULLING_SHADER, &graphics_context->culling_pipeline,
+		&graphics_context->culling_pipeline_layout, &graphics_context->culling_descriptor_set_layout) != VK_SUCCESS)
+	{
+		destroy_gpu_culling(graphics_context);
+		graphics_context->culling_descriptor_set_layout = VK_NULL_HANDLE;
+		return -1;
+	}
+
+	if (graphics_context->lod_count > 1)
+	{
+		destroy_buffer(graphics_context->device, graphics_context->visible_instance_buffer);
+		free_memory(graphics_context->device, graphics_context->visible_instance_mem);
+		graphics_context->visible_instance_buffer = create_buffer(graphics_context->device, visible_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		graphics_context->visible_instance_mem = alloc_bind_bufer_memory(graphics_context, graphics_context->visible_instance_buffer,
+			visible_size, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	}
+	return 0;
+}
+
+void destroy_gpu_culling(struct GraphicsContext* graphics_context)
+{
+	destroy_buffer(graphics_context->device, graphics_context->instance_bounds_buffer);
+	free_memory(graphics_context->device, graphics_context->instance_bounds_mem);
+	destroy_buffer(graphics_context->device, graphics_context->indirect_buffer);
+	free_memory(graphics_context->device, graphics_context->indirect_mem);
+	graphics_context->instance_bounds_buffer = VK_NULL_HANDLE;
+	graphics_context->indirect_buffer = VK_NULL_HANDLE;
+}
+
+void update_gpu_culling_bounds(struct GraphicsContext* graphics_context, const struct CullingBounds* bounds, uint32_t first,
+	uint32_t count)
+{
+	glm::vec4* spheres = (glm::vec4*)malloc((size_t)count * sizeof(glm::vec4));
+
+	if (!spheres)
+	{
+		printf("cannot allocate %u instance bounds\n", count);
+		return;
+	}
+	for (uint32_t i = 0; i < count; i++)
+	{
+		spheres[i] = glm::vec4(bounds->center_x[first + i], bounds->center_y[first + i], bounds->center_z[first + i], bounds->radius[first + i]);
+	}
+	update_data_to_memory(graphics_context, graphics_context->instance_bounds_mem, first * sizeof(glm::vec4), spheres,
+		count * sizeof(glm::vec4));
+	free(spheres);
+}
+
+void record_gpu_culling(struct GraphicsContext* graphics_context, VkCommandBuffer cmd, const glm::mat4& view_projection,
+	const struct LodSelection* lod_selection)
+{
+	VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+	VkBufferCopy copies[MAX_INSTANCE_COUNT_COPIES];
+	struct CullingPushConstants push_constants;
+
+	get_frustum_planes(view_projection, push_constants.planes);
+	push_constants.camera = glm::vec4(lod_selection->camera_position, lod_selection->error_scale);
+	push_constants.instance_count = graphics_context->instance_count;
+	push_constants.lod_count = graphics_context->lod_count;
+
+	vkCmdFillBuffer(cmd, graphics_context->indirect_buffer, offsetof(struct IndirectDrawHeader, visible_counts),
+		sizeof(((struct IndirectDrawHeader*)0)->visible_counts), 0);
+	vkCmdFillBuffer(cmd, graphics_context->indirect_buffer, offsetof(struct IndirectDrawHeader, lod_priorities),
+		sizeof(((struct IndirectDrawHeader*)0)->lod_priorities), 0);
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, graphics_context->culling_pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, graphics_context->culling_pipeline_layout, 0, 1,
+		&graphics_context->culling_descriptor_set, 0, NULL);
+	vkCmdPushConstants(cmd, graphics_context->culling_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+	vkCmdDispatch(cmd, (graphics_context->instance_count + GPU_CULLING_GROUP_SIZE - 1) / GPU_CULLING_GROUP_SIZE, 1, 1);
+
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+	// Regions of one copy never overlap, so source and destination can be the same buffer
+	for (uint32_t first = 0; first < graphics_context->draw_count; first += MAX_INSTANCE_COUNT_COPIES)
+	{
+		uint32_t count = graphics_context->draw_count - first;
+
+		count = count < MAX_INSTANCE_COUNT_COPIES ? count : MAX_INSTANCE_COUNT_COPIES;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			copies[i].srcOffset = offsetof(struct IndirectDrawHeader, visible_counts) + graphics_context->draws[first + i].lod * sizeof(uint32_t);
+			copies[i].dstOffset = get_draw_command_offset(first + i) + offsetof(VkDrawIndexedIndirectCommand, instanceCount);
+			copies[i].size = sizeof(uint32_t);
+		}
+		vkCmdCopyBuffer(cmd, graphics_context->indirect_buffer, graphics_context->indirect_buffer, count, copies);
+	}
+
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+void read_gpu_lod_priorities(struct GraphicsContext* graphics_context, float* priorities)
+{
+	VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE };
+	struct IndirectDrawHeader* header;
+
+	VK_CHECK(vkMapMemory(graphics_context->device, graphics_context->indirect_mem, 0, sizeof(struct IndirectDrawHeader), 0, (void**)&header));
+	// The memory may not be host coherent
+	range.memory = graphics_context->indirect_mem;
+	range.offset = 0;
+	range.size = VK_WHOLE_SIZE;
+	VK_CHECK(vkInvalidateMappedMemoryRanges(graphics_context->device, 1, &range));
+	memcpy(priorities, header->lod_priorities, graphics_context->lod_count * sizeof(float));
+	vkUnmapMemory(graphics_context->device, graphics_context->indirect_mem);
+}
+
+void update_gpu_culling_residency(struct GraphicsContext* graphics_context, const uint32_t* resident_lods)
+{
+	uint8_t* indirect;
+
+	VK_CHECK(vkMapMemory(graphics_context->device, graphics_context->indirect_mem, 0, get_draw_command_offset(graphics_context->draw_count), 0,
+		(void**)&indirect));
+	memcpy(((struct IndirectDrawHeader*)indirect)->resident_lods, resident_lods, graphics_context->lod_count * sizeof(uint32_t));
+	// Resident LODs may have moved in the index buffer
+	for (uint32_t i = 0; i < graphics_context->draw_count; i++)
+	{
+		VkDrawIndexedIndirectCommand* command = (VkDrawIndexedIndirectCommand*)(indirect + get_draw_command_offset(i));
+
+		command->firstIndex = graphics_context->draws[i].first_index + graphics_context->lod_index_offsets[graphics_context->draws[i].lod];
+	}
+	vkUnmapMemory(graphics_context->device, graphics_context->indirect_mem);
+}
+
+void draw_gpu_culled(struct GraphicsContext* graphics_context, VkCommandBuffer cmd)
+{
+	if (graphics_context->draw_indirect_count)
+	{
+		graphics_context->pfn_vkCmdDrawIndexedIndirectCountKHR(cmd, graphics_context->indirect_buffer, get_draw_command_offset(0),
+			graphics_context->indirect_buffer, offsetof(struct IndirectDrawHeader, draw_count), graphics_context->draw_count,
+			sizeof(VkDrawIndexedIndirectCommand));
+		return;
+	}
+
+	if (graphics_context->multi_draw_indirect && graphics_context->draw_count <= graphics_context->max_draw_indirect_count)
+	{
+		vkCmdDrawIndexedIndirect(cmd, graphics_context->indirect_buffer, get_draw_command_offset(0), graphics_context->draw_count,
+			sizeof(VkDrawIndexedIndirectCommand));
+		return;
+	}
+
+	for (uint32_t i = 0; i < graphics_context->draw_count; i++)
+	{
+		vkCmdDrawIndexedIndirect(cmd, graphics_context->indirect_buffer, get_draw_command_offset(i), 1, sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+#include "common.h"
+
+#define GPU_CULLING_SHADER "cull.comp"
+// Matches local_size_x of the culling shader
+#define GPU_CULLING_GROUP_SIZE 64
+
+struct CullingBounds;
+struct LodSelection;
+
+// Start of the indirect buffer, VkDrawIndexedIndirectCommands for the mesh draws follow.
+// The culling shader counts the visible instances of each LOD, the counts are copied into the instanceCount of the
+// LOD's commands. LOD l draws from the visible list region starting at l * instance_count.
+// With geometry streaming instances of a LOD that is not resident are counted for the LOD drawn instead.
+struct IndirectDrawHeader
+{
+	uint32_t visible_counts[MAX_MESH_LODS];
+	// Count for vkCmdDrawIndexedIndirectCount
+	uint32_t draw_count;
+	uint32_t reserved[3];
+	// Relative LOD errors the shader selects with, as in LodSelection
+	float lod_errors[MAX_MESH_LODS];
+	// LOD drawn instead of each LOD, each LOD itself without streaming
+	uint32_t resident_lods[MAX_MESH_LODS];
+	// Float bits of the biggest radius over distance each LOD was selected at, cleared every frame. Positive floats
+	// compare like their bits, so the shader keeps the maximum with atomicMax.
+	uint32_t lod_priorities[MAX_MESH_LODS];
+};
+
+// Creates the instance bounds and indirect buffers and the culling compute pipeline.
+// Returns -1 when GPU culling is unavailable, culling then stays on the CPU.
+extern int setup_gpu_culling(struct GraphicsContext* graphics_context, const struct CullingBounds* bounds);
+extern void destroy_gpu_culling(struct GraphicsContext* graphics_context);
+// Uploads the spheres of instances [first, first + count) after they moved
+extern void update_gpu_culling_bounds(struct GraphicsContext* graphics_context, const struct CullingBounds* bounds, uint32_t first,
+	uint32_t count);
+// Records the culling and LOD selection dispatch and the instance count copies, outside of the render pass
+extern void record_gpu_culling(struct GraphicsContext* graphics_context, VkCommandBuffer cmd, const glm::mat4& view_projection,
+	const struct LodSelection* lod_selection);
+// Reads the LOD priorities of the last culling dispatch for update_geometry_streaming, with the device idle
+extern void read_gpu_lod_priorities(struct GraphicsContext* graphics_context, float* priorities);
+// Uploads the LODs drawn instead of each LOD and the first indices of the resident LODs, with the device idle
+extern void update_gpu_culling_residency(struct GraphicsContext* graphics_context, const uint32_t* resident_lods);
+// Draws the mesh from the indirect buffer, inside the render pass with the graphics pipeline bound
+extern void draw_gpu_culled(struct GraphicsContext* graphics_context, VkCommandBuffer cmd);
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mesh.h"
+#include "index_format.h"
+
+// 0xffff is left out, it is the primitive restart index of 16 bit indices
+#define MAX_INDEX_CHUNK_RANGE 0xffff
+
+uint32_t get_index_size(VkIndexType index_type)
+{
+	return index_type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+// Greedy split of one LOD in triangle order. Vertex fetch optimized meshes use vertices in order, so ranges stay narrow.
+// Fails on a triangle whose own range does not fit into 16 bits, coarse LODs of big meshes can have those.
+static int split_index_chunks(const struct Mesh* mesh, uint32_t lod, struct MeshDraw* draws, uint32_t* chunk_count)
+{
+	uint32_t draw_count = 0;
+	uint32_t chunk_min = UINT32_MAX;
+	uint32_t chunk_max = 0;
+	uint32_t chunk_start = mesh->lods[lod].first_index;
+	uint32_t end = mesh->lods[lod].first_index + mesh->lods[lod].index_count;
+
+	for (uint32_t i = chunk_start; i + 2 < end; i += 3)
+	{
+		uint32_t triangle_min = mesh->indices[i];
+		uint32_t triangle_max = mesh->indices[i];
+		uint32_t new_min, new_max;
+
+		for (uint32_t k = 1; k < 3; k++)
+		{
+			triangle_min = mesh->indices[i + k] < triangle_min ? mesh->indices[i + k] : triangle_min;
+			triangle_max = mesh->indices[i + k] > triangle_max ? mesh->indices[i + k] : triangle_max;
+		}
+		if (triangle_max - triangle_min >= MAX_INDEX_CHUNK_RANGE)
+			return -1;
+		new_min = triangle_min < chunk_min ? triangle_min : chunk_min;
+		new_max = triangle_max > chunk_max ? triangle_max : chunk_max;
+
+		if (new_max - new_min >= MAX_INDEX_CHUNK_RANGE && i > chunk_start)
+		{
+			if (draws)
+			{
+				draws[draw_count].first_index = chunk_start;
+				draws[draw_count].index_count = i - chunk_start;
+				draws[draw_count].vertex_offset = (int32_t)chunk_min;
+				draws[draw_count].index_type = VK_INDEX_TYPE_UINT16;
+				draws[draw_count].lod = lod;
+			}
+			draw_count++;
+			chunk_start = i;
+			new_min = triangle_min;
+			new_max = triangle_max;
+		}
+		chunk_min = new_min;
+		chunk_max = new_max;
+	}
+
+	if (chunk_start < end)
+	{
+		if (draws)
+		{
+			draws[draw_count].first_index = chunk_start;
+			draws[draw_count].index_count = end - chunk_start;
+			draws[draw_count].vertex_offset = chunk_min == UINT32_MAX ? 0 : (int32_t)chunk_min;
+			draws[draw_count].index_type = VK_INDEX_TYPE_UINT16;
+			draws[draw_count].lod = lod;
+		}
+		draw_count++;
+	}
+	*chunk_count = draw_count;
+	return 0;
+}
+
+int build_mesh_draws(const struct Mesh* mesh, struct MeshDraw** draws, uint32_t* draw_count)
+{
+	// A mesh with fewer vertices than the range is one chunk per LOD without splitting
+	VkBool32 single_chunk = mesh->vertex_count < MAX_INDEX_CHUNK_RANGE;
+	uint32_t chunk_count = 0;
+	VkBool32 splittable = VK_TRUE;
+	VkBool32 use_16bit;
+
+	for (uint32_t lod = 0; lod < mesh->lod_count && splittable; lod++)
+	{
+		uint32_t lod_chunks = 1;
+
+		if (!single_chunk && split_index_chunks(mesh, lod, NULL, &lod_chunks))
+			splittable = VK_FALSE;
+		chunk_count += lod_chunks;
+	}
+	// The index buffer holds one index type, so a LOD that cannot be split keeps the whole mesh on 32 bits
+	use_16bit = splittable &&
+		(chunk_count == mesh->lod_count || (uint64_t)chunk_count * MIN_INDEX_CHUNK_TRIANGLES * 3 <= mesh->index_count);
+
+	*draw_count = use_16bit ? chunk_count : mesh->lod_count;
+	*draws = (struct MeshDraw*)calloc(*draw_count, sizeof(struct MeshDraw));
+	if (!*draws)
+		return -1;
+
+	for (uint32_t lod = 0, draw = 0; lod < mesh->lod_count; lod++)
+	{
+		if (use_16bit && !single_chunk)
+		{
+			uint32_t lod_chunks;
+
+			split_index_chunks(mesh, lod, *draws + draw, &lod_chunks);
+			draw += lod_chunks;
+			continue;
+		}
+		(*draws)[draw].first_index = mesh->lods[lod].first_index;
+		(*draws)[draw].index_count = mesh->lods[lod].index_count;
+		(*draws)[draw].index_type = use_16bit ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+		(*draws)[draw].lod = lod;
+		draw++;
+	}
+
+	printf("%u draws with %u bit indices over %u LODs\n", *draw_count, (*draws)->index_type == VK_INDEX_TYPE_UINT16 ? 16 : 32,
+		mesh->lod_count);
+	return 0;
+}
+
+void pack_indices(const struct Mesh* mesh, const struct MeshDraw* draws, uint32_t draw_count, void* destination)
+{
+	pack_index_range(mesh->indices, draws, draw_count, 0, mesh->index_count, destination);
+}
+
+void pack_index_range(const uint32_t* indices, const struct MeshDraw* draws, uint32_t draw_count, uint32_t first_index,
+	uint32_t index_count, void* destination)
+{
+	uint16_t* indices16 = (uint16_t*)destination;
+	uint32_t end = first_index + index_count;
+
+	if (draws[0].index_type == VK_INDEX_TYPE_UINT32)
+	{
+		memcpy(destination, indices + first_index, (size_t)index_count * sizeof(uint32_t));
+		return;
+	}
+
+	// build_mesh_draws only makes 16 bit draws whose indices fit once rebased
+	for (uint32_t d = 0; d < draw_count; d++)
+	{
+		uint32_t draw_first = draws[d].first_index > first_index ? draws[d].first_index : first_index;
+		uint32_t draw_end = draws[d].first_index + draws[d].index_count < end ? draws[d].first_index + draws[d].index_count : end;
+
+		for (uint32_t i = draw_first; i < draw_end; i++)
+			indices16[i - first_index] = (uint16_t)(indices[i] - (uint32_t)draws[d].vertex_offset);
+	}
+}
\ No newline at end of file
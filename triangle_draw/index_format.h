@@ -0,0 +1,28 @@
+#pragma once
+#include "common.h"
+
+// 16 bit chunks are only used while they average at least this many triangles, each chunk costs a draw
+#define MIN_INDEX_CHUNK_TRIANGLES 1024
+
+struct Mesh;
+
+// One vkCmdDrawIndexed of a mesh. Indices are relative to vertex_offset, first_index counts index_type elements.
+struct MeshDraw
+{
+	uint32_t first_index;
+	uint32_t index_count;
+	int32_t vertex_offset;
+	VkIndexType index_type;
+	// Mesh LOD the draw belongs to, draws are sorted by it
+	uint32_t lod;
+};
+
+// Splits each LOD of the mesh into 16 bit addressable draws, or a single 32 bit draw per LOD when that is not profitable.
+// All draws of a mesh share one index type. draws is allocated, release with free.
+extern int build_mesh_draws(const struct Mesh* mesh, struct MeshDraw** draws, uint32_t* draw_count);
+extern uint32_t get_index_size(VkIndexType index_type);
+// Writes the mesh indices rebased to each draw's vertex_offset, in the draws' index type
+extern void pack_indices(const struct Mesh* mesh, const struct MeshDraw* draws, uint32_t draw_count, void* destination);
+// Same for the indices [first_index, first_index + index_count) of the mesh, written from the start of destination
+extern void pack_index_range(const uint32_t* indices, const struct MeshDraw* draws, uint32_t draw_count, uint32_t first_index,
+	uint32_t index_count, void* destination);
\ No newline at end of file
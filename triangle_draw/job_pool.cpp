@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "job_pool.h"
+
+struct JobPool
+{
+	std::mutex mutex;
+	std::condition_variable work_ready;
+	std::condition_variable work_done;
+	bool shutting_down;
+	uint32_t worker_count;
+	std::thread workers[MAX_JOB_THREADS];
+
+	// Current job, written under the lock before generation changes
+	uint32_t generation;
+	uint32_t busy_workers;
+	JobFunction job;
+	void* data;
+};
+
+static void job_thread(struct JobPool* pool)
+{
+	uint32_t seen_generation = 0;
+
+	for (;;)
+	{
+		JobFunction job;
+		void* data;
+
+		{
+			std::unique_lock<std::mutex> lock(pool->mutex);
+			pool->work_ready.wait(lock, [&] { return pool->shutting_down || pool->generation != seen_generation; });
+			if (pool->shutting_down)
+				return;
+			seen_generation = pool->generation;
+			job = pool->job;
+			data = pool->data;
+		}
+
+		job(data);
+
+		{
+			std::lock_guard<std::mutex> lock(pool->mutex);
+			if (--pool->busy_workers == 0)
+				pool->work_done.notify_one();
+		}
+	}
+}
+
+struct JobPool* create_job_pool(uint32_t max_threads)
+{
+	struct JobPool* pool = new struct JobPool();
+	uint32_t hardware_threads = std::thread::hardware_concurrency();
+
+	if (max_threads > MAX_JOB_THREADS)
+		max_threads = MAX_JOB_THREADS;
+	pool->shutting_down = false;
+	pool->generation = 0;
+	pool->busy_workers = 0;
+
+	pool->worker_count = hardware_threads > 1 ? hardware_threads - 1 : 0;
+	if (pool->worker_count + 1 > max_threads)
+		pool->worker_count = max_threads > 1 ? max_threads - 1 : 0;
+	for (uint32_t i = 0; i < pool->worker_count; i++)
+	{
+		pool->workers[i] = std::thread(job_thread, pool);
+	}
+	return pool;
+}
+
+void destroy_job_pool(struct JobPool* pool)
+{
+	if (!pool)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+		pool->shutting_down = true;
+	}
+	pool->work_ready.notify_all();
+	for (uint32_t i = 0; i < pool->worker_count; i++)
+	{
+		pool->workers[i].join();
+	}
+	delete pool;
+}
+
+uint32_t get_job_worker_count(const struct JobPool* pool)
+{
+	return pool->worker_count;
+}
+
+void run_job(struct JobPool* pool, JobFunction job, void* data)
+{
+	if (!pool->worker_count)
+	{
+		job(data);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+		pool->job = job;
+		pool->data = data;
+		pool->busy_workers = pool->worker_count;
+		pool->generation++;
+	}
+	pool->work_ready.notify_all();
+
+	job(data);
+	{
+		std::unique_lock<std::mutex> lock(pool->mutex);
+		pool->work_done.wait(lock, [&] { return pool->busy_workers == 0; });
+	}
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+#include "common.h"
+
+#define MAX_JOB_THREADS 16
+
+typedef void (*JobFunction)(void* data);
+
+struct JobPool;
+
+// Starts one thread less than the hardware has, the calling thread runs jobs too. At most max_threads run a job.
+extern struct JobPool* create_job_pool(uint32_t max_threads);
+extern void destroy_job_pool(struct JobPool* pool);
+// Threads besides the calling one, 0 runs jobs on the calling thread alone
+extern uint32_t get_job_worker_count(const struct JobPool* pool);
+// Runs job on every worker and the calling thread and returns when all of them are done. The job takes its own work
+// items, from an atomic counter in data for instance.
+extern void run_job(struct JobPool* pool, JobFunction job, void* data);
\ No newline at end of file
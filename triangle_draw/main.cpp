@@ -2,12 +2,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <chrono>
 
 #include "common.h"
 #include "buffer.h"
 #include "memory.h"
 #include "pipeline.h"
 #include "descriptor.h"
+#include "pipeline_cache.h"
+#include "pipeline_manager.h"
+#include "mesh.h"
+#include "vertex_format.h"
+#include "index_format.h"
+#include "culling.h"
+#include "gpu_culling.h"
+#include "draw_batch.h"
+#include "scene_graph.h"
+#include "occlusion.h"
+#include "occlusion_query.h"
+#include "streaming.h"
+#include "job_pool.h"
 
 struct Vertex  vertices[] = {
 		{{0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}},        // Vertex 0: Red
@@ -55,7 +69,47 @@ struct
 	glm::vec4 view_pos;
 } ubo_vs;
 
+// Drawn mesh, loaded from the file given on the command line or the cube above
+struct Mesh scene_mesh;
+// Mesh cache of the loaded file, its LODs are streamed from it
+char scene_mesh_cache_name[MAX_MESH_PATH];
+// Fits a loaded mesh into the view, identity for the cube. Part of every instance transform.
+glm::mat4 scene_mesh_transform = glm::mat4(1.0f);
+// Camera and instance transforms. Instance i is node scene_first_instance_node + i, the world transform of the
+// orbit node is ubo_vs.model.
+struct SceneGraph scene_graph;
+uint32_t scene_first_instance_node;
+uint32_t scene_camera_node;
+uint32_t scene_orbit_node;
+glm::vec3 scene_camera_rotation = glm::vec3(-45.0f, -45.0f, 0.0f);
+// Pushed to the vertex shader, undoes the position quantization of the packed vertex formats
+struct VertexDequantization scene_vertex_dequantization;
+
+// Pipeline the scene is drawn with, compiled in the background
+struct PipelineKey scene_pipeline_key;
+// Instance bounding spheres culled every frame and the resulting visible list
+struct CullingBounds scene_instance_bounds;
+uint32_t* scene_visible_instances;
+// Visible instances of each LOD, the visible list holds them in LOD order
+uint32_t scene_lod_instances[MAX_MESH_LODS];
+uint32_t* scene_lod_scratch;
+// Meshlets of LOD 0 and the index ranges of the visible ones, culled when a single instance is drawn
+struct Meshlet* scene_meshlets;
+uint32_t scene_meshlet_count;
+struct IndexRange* scene_meshlet_ranges;
+uint32_t scene_meshlet_range_count;
+VkBool32 scene_cluster_culling;
+// Draws of the CPU culled path, rebuilt with the visible instance count every frame
+struct DrawBatches scene_draw_batches;
+// Accumulated between frame time reports
+double frame_culling_seconds;
+uint64_t frame_visible_instances;
+uint64_t frame_occluded_instances;
+uint64_t frame_triangles;
+
 PFN_vkGetDeviceProcAddr pfn_vkGetDeviceProcAddr = NULL;
+PFN_vkGetPhysicalDeviceFeatures2KHR pfn_vkGetPhysicalDeviceFeatures2KHR = NULL;
+PFN_vkGetPhysicalDeviceProperties2KHR pfn_vkGetPhysicalDeviceProperties2KHR = NULL;
 
 int findSuitableInstanceExtensions(char*** requestedExtensions, int* requestCount)
 {
@@ -174,7 +228,19 @@ static int extension_supported(VkExtensionProperties* extensions, unsigned int e
 static const char* requestedDeviceExt[] = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 };
-static VkDevice create_device(VkPhysicalDevice physDevice)
+static int extension_enabled(const char** enabled_extensions, unsigned int ext_cnt, const char* ext_name)
+{
+	for (unsigned int i = 0; i < ext_cnt; i++)
+	{
+		if (!strcmp(enabled_extensions[i], ext_name))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static VkDevice create_device(VkPhysicalDevice physDevice, struct GraphicsContext* graphics_context)
 {
 	VkDevice device = VK_NULL_HANDLE;
 	VkPhysicalDeviceFeatures features;
@@ -193,7 +259,34 @@ static VkDevice create_device(VkPhysicalDevice physDevice)
 		"VK_KHR_get_memory_requirements2",
 		"VK_KHR_dedicated_allocation",
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+		VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME,
+		// VK_KHR_dynamic_rendering and what it depends on before Vulkan 1.3
+		VK_KHR_MULTIVIEW_EXTENSION_NAME,
+		VK_KHR_MAINTENANCE2_EXTENSION_NAME,
+		VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+		VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+		VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+		VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME,
+		VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME,
+		VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME,
+		VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME,
+		VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME,
+		VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME,
+		VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME,
 	};
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR };
+	VkPhysicalDeviceExtendedDynamicStateFeaturesEXT extended_dynamic_state_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT };
+	VkPhysicalDeviceExtendedDynamicState2FeaturesEXT extended_dynamic_state2_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_2_FEATURES_EXT };
+	VkPhysicalDeviceExtendedDynamicState3FeaturesEXT extended_dynamic_state3_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT };
+	VkPhysicalDeviceConditionalRenderingFeaturesEXT conditional_rendering_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_CONDITIONAL_RENDERING_FEATURES_EXT };
+	VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT graphics_pipeline_library_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT };
+	VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT graphics_pipeline_library_properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT };
+	VkPhysicalDeviceProperties2KHR properties2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR };
+	VkPhysicalDeviceFeatures2KHR features2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR };
+	// Core features are enabled one by one, only where the renderer has a fallback
+	VkPhysicalDeviceFeatures enabled_features = {};
+	// Feature structs of the enabled extensions, queried and then enabled as reported
+	void* feature_chain = NULL;
 	vkGetPhysicalDeviceFeatures(physDevice, &features);
 	vkGetPhysicalDeviceProperties(physDevice, &physDeviceProperties);
 	printf("selected gpu device %s\n", physDeviceProperties.deviceName);
@@ -272,15 +365,137 @@ static VkDevice create_device(VkPhysicalDevice physDevice)
 	if (missing_device_extension)
 		goto failed;
 
+	graphics_context->pipeline_creation_feedback = extension_enabled(enabledExtensionName, enableExtensionCount, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+	graphics_context->draw_indirect_count = extension_enabled(enabledExtensionName, enableExtensionCount, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
+	// Extension support alone is not enough, the feature has to be reported and enabled
+	if (pfn_vkGetPhysicalDeviceFeatures2KHR)
+	{
+		if (DYNAMIC_RENDERING && extension_enabled(enabledExtensionName, enableExtensionCount, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME))
+		{
+			dynamic_rendering_features.pNext = feature_chain;
+			feature_chain = &dynamic_rendering_features;
+		}
+		if (EXTENDED_DYNAMIC_STATE && extension_enabled(enabledExtensionName, enableExtensionCount, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME))
+		{
+			extended_dynamic_state_features.pNext = feature_chain;
+			feature_chain = &extended_dynamic_state_features;
+		}
+		if (EXTENDED_DYNAMIC_STATE && extension_enabled(enabledExtensionName, enableExtensionCount, VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME))
+		{
+			extended_dynamic_state2_features.pNext = feature_chain;
+			feature_chain = &extended_dynamic_state2_features;
+		}
+		if (EXTENDED_DYNAMIC_STATE && extension_enabled(enabledExtensionName, enableExtensionCount, VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME))
+		{
+			extended_dynamic_state3_features.pNext = feature_chain;
+			feature_chain = &extended_dynamic_state3_features;
+		}
+
+		if (GRAPHICS_PIPELINE_LIBRARY && extension_enabled(enabledExtensionName, enableExtensionCount, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME))
+		{
+			graphics_pipeline_library_features.pNext = feature_chain;
+			feature_chain = &graphics_pipeline_library_features;
+		}
+		if (OCCLUSION_QUERIES && extension_enabled(enabledExtensionName, enableExtensionCount, VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME))
+		{
+			conditional_rendering_features.pNext = feature_chain;
+			feature_chain = &conditional_rendering_features;
+		}
+
+		features2.pNext = feature_chain;
+		pfn_vkGetPhysicalDeviceFeatures2KHR(physDevice, &features2);
+		graphics_context->dynamic_rendering = dynamic_rendering_features.dynamicRendering;
+		graphics_context->extended_dynamic_state = extended_dynamic_state_features.extendedDynamicState;
+		// Depends on the topology and depth state of the first level being dynamic as well
+		graphics_context->extended_dynamic_state2 = graphics_context->extended_dynamic_state && extended_dynamic_state2_features.extendedDynamicState2;
+		graphics_context->extended_dynamic_state3 = graphics_context->extended_dynamic_state &&
+			extended_dynamic_state3_features.extendedDynamicState3PolygonMode &&
+			extended_dynamic_state3_features.extendedDynamicState3ColorBlendEnable &&
+			extended_dynamic_state3_features.extendedDynamicState3ColorBlendEquation &&
+			extended_dynamic_state3_features.extendedDynamicState3ColorWriteMask;
+		graphics_context->conditional_rendering = conditional_rendering_features.conditionalRendering;
+
+		// Without fast linking the first use of a pipeline would wait on a full link, monolithic creation is as good
+		if (graphics_pipeline_library_features.graphicsPipelineLibrary && pfn_vkGetPhysicalDeviceProperties2KHR)
+		{
+			properties2.pNext = &graphics_pipeline_library_properties;
+			pfn_vkGetPhysicalDeviceProperties2KHR(physDevice, &properties2);
+			graphics_context->graphics_pipeline_library = graphics_pipeline_library_properties.graphicsPipelineLibraryFastLinking;
+		}
+	}
+
 	create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-	create_info.pNext = NULL;
+	create_info.pNext = feature_chain;
 	create_info.pQueueCreateInfos = queueCreateInfo;
 	create_info.queueCreateInfoCount = queueFamilyCount;
 	create_info.enabledExtensionCount = enableExtensionCount;
 	create_info.ppEnabledExtensionNames = enabledExtensionName;
-	create_info.pEnabledFeatures = NULL;
+	enabled_features.multiDrawIndirect = MULTI_DRAW_INDIRECT && features.multiDrawIndirect;
+	enabled_features.drawIndirectFirstInstance = features.drawIndirectFirstInstance;
+	create_info.pEnabledFeatures = &enabled_features;
 	ret = vkCreateDevice(physDevice, &create_info, NULL, &device);
 
+	if (ret == VK_SUCCESS && graphics_context->dynamic_rendering)
+	{
+		graphics_context->pfn_vkCmdBeginRenderingKHR = (PFN_vkCmdBeginRenderingKHR)pfn_vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR");
+		graphics_context->pfn_vkCmdEndRenderingKHR = (PFN_vkCmdEndRenderingKHR)pfn_vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR");
+		graphics_context->dynamic_rendering = graphics_context->pfn_vkCmdBeginRenderingKHR && graphics_context->pfn_vkCmdEndRenderingKHR;
+	}
+	printf("rendering with %s\n", graphics_context->dynamic_rendering ? "dynamic rendering" : "render pass objects");
+
+	if (ret == VK_SUCCESS && graphics_context->extended_dynamic_state)
+	{
+		graphics_context->pfn_vkCmdSetCullModeEXT = (PFN_vkCmdSetCullModeEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdSetCullModeEXT");
+		graphics_context->pfn_vkCmdSetFrontFaceEXT = (PFN_vkCmdSetFrontFaceEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdSetFrontFaceEXT");
+		graphics_context->pfn_vkCmdSetPrimitiveTopologyEXT = (PFN_vkCmdSetPrimitiveTopologyEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdSetPrimitiveTopologyEXT");
+		graphics_context->pfn_vkCmdSetDepthTestEnableEXT = (PFN_vkCmdSetDepthTestEnableEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdSetDepthTestEnableEXT");
+		graphics_context->pfn_vkCmdSetDepthWriteEnableEXT = (PFN_vkCmdSetDepthWriteEnableEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdSetDepthWriteEnableEXT");
+		graphics_context->pfn_vkCmdSetDepthCompareOpEXT = (PFN_vkCmdSetDepthCompareOpEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdSetDepthCompareOpEXT");
+		graphics_context->extended_dynamic_state = graphics_context->pfn_vkCmdSetCullModeEXT && graphics_context->pfn_vkCmdSetFrontFaceEXT &&
+			graphics_context->pfn_vkCmdSetPrimitiveTopologyEXT && graphics_context->pfn_vkCmdSetDepthTestEnableEXT &&
+			graphics_context->pfn_vkCmdSetDepthWriteEnableEXT && graphics_context->pfn_vkCmdSetDepthCompareOpEXT;
+	}
+	if (ret == VK_SUCCESS && graphics_context->extended_dynamic_state2)
+	{
+		graphics_context->pfn_vkCmdSetPrimitiveRestartEnableEXT = (PFN_vkCmdSetPrimitiveRestartEnableEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdSetPrimitiveRestartEnableEXT");
+		graphics_context->extended_dynamic_state2 = graphics_context->extended_dynamic_state && graphics_context->pfn_vkCmdSetPrimitiveRestartEnableEXT;
+	}
+	if (ret == VK_SUCCESS && graphics_context->extended_dynamic_state3)
+	{
+		graphics_context->pfn_vkCmdSetPolygonModeEXT = (PFN_vkCmdSetPolygonModeEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdSetPolygonModeEXT");
+		graphics_context->pfn_vkCmdSetColorBlendEnableEXT = (PFN_vkCmdSetColorBlendEnableEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEnableEXT");
+		graphics_context->pfn_vkCmdSetColorBlendEquationEXT = (PFN_vkCmdSetColorBlendEquationEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEquationEXT");
+		graphics_context->pfn_vkCmdSetColorWriteMaskEXT = (PFN_vkCmdSetColorWriteMaskEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdSetColorWriteMaskEXT");
+		graphics_context->extended_dynamic_state3 = graphics_context->extended_dynamic_state &&
+			graphics_context->pfn_vkCmdSetPolygonModeEXT && graphics_context->pfn_vkCmdSetColorBlendEnableEXT &&
+			graphics_context->pfn_vkCmdSetColorBlendEquationEXT && graphics_context->pfn_vkCmdSetColorWriteMaskEXT;
+	}
+	if (ret == VK_SUCCESS && graphics_context->draw_indirect_count)
+	{
+		graphics_context->pfn_vkCmdDrawIndexedIndirectCountKHR = (PFN_vkCmdDrawIndexedIndirectCountKHR)pfn_vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+		graphics_context->draw_indirect_count = graphics_context->pfn_vkCmdDrawIndexedIndirectCountKHR != NULL;
+	}
+	if (ret == VK_SUCCESS && graphics_context->conditional_rendering)
+	{
+		graphics_context->pfn_vkCmdBeginConditionalRenderingEXT = (PFN_vkCmdBeginConditionalRenderingEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdBeginConditionalRenderingEXT");
+		graphics_context->pfn_vkCmdEndConditionalRenderingEXT = (PFN_vkCmdEndConditionalRenderingEXT)pfn_vkGetDeviceProcAddr(device, "vkCmdEndConditionalRenderingEXT");
+		graphics_context->conditional_rendering = graphics_context->pfn_vkCmdBeginConditionalRenderingEXT &&
+			graphics_context->pfn_vkCmdEndConditionalRenderingEXT;
+	}
+	if (ret == VK_SUCCESS)
+	{
+		graphics_context->draw_indirect_first_instance = enabled_features.drawIndirectFirstInstance;
+		// Batches start each LOD at its instance range
+		graphics_context->multi_draw_indirect = enabled_features.multiDrawIndirect && enabled_features.drawIndirectFirstInstance &&
+			physDeviceProperties.limits.maxDrawIndirectCount > 1;
+		graphics_context->max_draw_indirect_count = graphics_context->multi_draw_indirect ? physDeviceProperties.limits.maxDrawIndirectCount : 1;
+	}
+	printf("batched draws issued %s\n", graphics_context->multi_draw_indirect ? "with multi draw indirect" : "one by one");
+	printf("pipelines %s\n", graphics_context->graphics_pipeline_library ? "linked from graphics pipeline libraries" : "created monolithically");
+	printf("extended dynamic state: %s%s%s\n", graphics_context->extended_dynamic_state ? "1" : "none",
+		graphics_context->extended_dynamic_state2 ? " 2" : "", graphics_context->extended_dynamic_state3 ? " 3" : "");
+
 failed:
 	if (deviceExtensions)
 		free(deviceExtensions);
@@ -322,6 +537,35 @@ static VkFormat get_suitable_depth_format(VkPhysicalDevice physical_device)
 	}
 	return depth_format;
 }
+
+static VkSampleCountFlagBits get_suitable_sample_count(VkPhysicalDevice physical_device)
+{
+	VkPhysicalDeviceProperties properties;
+	VkSampleCountFlags supported_counts;
+	uint32_t requested = MSAA_SAMPLES;
+	char* env_samples = NULL;
+	size_t env_length = 0;
+
+	if (!_dupenv_s(&env_samples, &env_length, "MSAA_SAMPLES") && env_samples)
+	{
+		requested = (uint32_t)atoi(env_samples);
+		free(env_samples);
+	}
+
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+	supported_counts = properties.limits.framebufferColorSampleCounts & properties.limits.framebufferDepthSampleCounts;
+
+	// Sample count bits equal the count they stand for
+	for (uint32_t samples = VK_SAMPLE_COUNT_64_BIT; samples > VK_SAMPLE_COUNT_1_BIT; samples >>= 1)
+	{
+		if (samples <= requested && (supported_counts & samples))
+		{
+			printf("using %ux MSAA (requested %u)\n", samples, requested);
+			return (VkSampleCountFlagBits)samples;
+		}
+	}
+	return VK_SAMPLE_COUNT_1_BIT;
+}
 static int create_cmd_pool(VkDevice device, VkQueueFamilyProperties* queueFamilyProperties, uint32_t propertyCount, VkCommandPool *pCmdPool)
 {
 	VkQueue queue = VK_NULL_HANDLE;
@@ -342,7 +586,8 @@ static int create_cmd_pool(VkDevice device, VkQueueFamilyProperties* queueFamily
 		return -1;
 
 	createCmdPool.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	createCmdPool.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	// Command buffers are re-recorded individually every frame
+	createCmdPool.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 	createCmdPool.queueFamilyIndex = queueFamilyIndex;
 	createCmdPool.pNext = nullptr;
 	vkCreateCommandPool(device, &createCmdPool, NULL, pCmdPool);
@@ -648,7 +893,7 @@ static uint32_t get_memory_type(uint32_t bits, VkMemoryPropertyFlags properties,
 	}
 	return -1;
 }
-static int setup_depth_stencil(VkPhysicalDevice gpuDevice, VkDevice device, VkExtent2D surface_extent,
+static int setup_depth_stencil(VkPhysicalDevice gpuDevice, VkDevice device, VkExtent2D surface_extent, VkSampleCountFlagBits samples,
 	VkImage* depth_stencil_image, VkDeviceMemory* depth_stencil_mem, VkImageView* depth_stencil_view)
 {
 	VkBool32 mem_type_found;
@@ -664,9 +909,14 @@ static int setup_depth_stencil(VkPhysicalDevice gpuDevice, VkDevice device, VkEx
 	image_create_info.extent = { surface_extent.width, surface_extent.height, 1 };
 	image_create_info.mipLevels = 1;
 	image_create_info.arrayLayers = 1;
-	image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_create_info.samples = samples;
 	image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
 	image_create_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	// Multisampled depth is never resolved or read back, tile based GPUs can keep it on chip
+	if (samples != VK_SAMPLE_COUNT_1_BIT)
+	{
+		image_create_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+	}
 
 	vkCreateImage(device, &image_create_info, nullptr, depth_stencil_image);
 	VkMemoryRequirements memReqs{};
@@ -675,7 +925,11 @@ static int setup_depth_stencil(VkPhysicalDevice gpuDevice, VkDevice device, VkEx
 	vkGetPhysicalDeviceMemoryProperties(gpuDevice, &memory_properties);
 	memory_allocation.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 	memory_allocation.allocationSize = memReqs.size;
-	memory_allocation.memoryTypeIndex = get_memory_type(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory_properties, &mem_type_found);
+	memory_allocation.memoryTypeIndex = get_memory_type(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, memory_properties, &mem_type_found);
+	if (!mem_type_found)
+	{
+		memory_allocation.memoryTypeIndex = get_memory_type(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory_properties, &mem_type_found);
+	}
 	vkAllocateMemory(device, &memory_allocation, nullptr, depth_stencil_mem);
 	vkBindImageMemory(device, *depth_stencil_image, *depth_stencil_mem, 0);
 
@@ -689,8 +943,7 @@ static int setup_depth_stencil(VkPhysicalDevice gpuDevice, VkDevice device, VkEx
 	image_view_create_info.subresourceRange.baseArrayLayer = 0;
 	image_view_create_info.subresourceRange.layerCount = 1;
 	image_view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-	// Stencil aspect should only be set on depth + stencil formats (VK_FORMAT_D16_UNORM_S8_UINT..VK_FORMAT_D32_SFLOAT_S8_UINT
-	if (depth_format >= VK_FORMAT_D16_UNORM_S8_UINT)
+	if (depth_format_has_stencil(depth_format))
 	{
 		image_view_create_info.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
 	}
@@ -698,12 +951,88 @@ static int setup_depth_stencil(VkPhysicalDevice gpuDevice, VkDevice device, VkEx
 	return 0;
 }
 
-static int setup_render_pass(VkDevice device, VkFormat color_format, VkFormat depth_format, VkRenderPass* render_pass)
+static int setup_msaa_color(VkPhysicalDevice gpuDevice, VkDevice device, VkExtent2D surface_extent, VkFormat color_format, VkSampleCountFlagBits samples,
+	VkImage* color_image, VkDeviceMemory* color_mem, VkImageView* color_view)
 {
-	VkAttachmentDescription attachments[2] = { };
+	VkBool32 mem_type_found;
+	VkImageCreateInfo image_create_info{};
+	VkMemoryAllocateInfo memory_allocation{};
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	VkMemoryRequirements memReqs{};
+	VkImageViewCreateInfo image_view_create_info{};
+
+	// Only resolved at the end of the render pass, never stored
+	image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_create_info.imageType = VK_IMAGE_TYPE_2D;
+	image_create_info.format = color_format;
+	image_create_info.extent = { surface_extent.width, surface_extent.height, 1 };
+	image_create_info.mipLevels = 1;
+	image_create_info.arrayLayers = 1;
+	image_create_info.samples = samples;
+	image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_create_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+	vkCreateImage(device, &image_create_info, nullptr, color_image);
+	vkGetImageMemoryRequirements(device, *color_image, &memReqs);
+
+	vkGetPhysicalDeviceMemoryProperties(gpuDevice, &memory_properties);
+	memory_allocation.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memory_allocation.allocationSize = memReqs.size;
+	memory_allocation.memoryTypeIndex = get_memory_type(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, memory_properties, &mem_type_found);
+	if (!mem_type_found)
+	{
+		memory_allocation.memoryTypeIndex = get_memory_type(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory_properties, &mem_type_found);
+	}
+	vkAllocateMemory(device, &memory_allocation, nullptr, color_mem);
+	vkBindImageMemory(device, *color_image, *color_mem, 0);
+
+	image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	image_view_create_info.image = *color_image;
+	image_view_create_info.format = color_format;
+	image_view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	image_view_create_info.subresourceRange.baseMipLevel = 0;
+	image_view_create_info.subresourceRange.levelCount = 1;
+	image_view_create_info.subresourceRange.baseArrayLayer = 0;
+	image_view_create_info.subresourceRange.layerCount = 1;
+	vkCreateImageView(device, &image_view_create_info, nullptr, color_view);
+	return 0;
+}
+
+// With MSAA the framebuffer is multisampled color, depth and the swapchain image as resolve target,
+// otherwise the swapchain image and depth
+static void setup_framebuffers(VkDevice device, VkRenderPass render_pass, VkExtent2D surface_extent, VkImageView* swapchain_image_views, uint32_t image_num,
+	VkImageView depth_stencil_view, VkImageView msaa_color_view, VkFramebuffer* framebuffers)
+{
+	VkImageView attachments[3];
+	VkFramebufferCreateInfo framebuffer_create_info = {};
+
+	framebuffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebuffer_create_info.pNext = NULL;
+	framebuffer_create_info.renderPass = render_pass;
+	framebuffer_create_info.attachmentCount = msaa_color_view ? 3 : 2;
+	framebuffer_create_info.pAttachments = attachments;
+	framebuffer_create_info.width = surface_extent.width;
+	framebuffer_create_info.height = surface_extent.height;
+	framebuffer_create_info.layers = 1;
+
+	// Depth/Stencil and multisampled color attachments are the same for all frame buffers
+	attachments[0] = msaa_color_view;
+	attachments[1] = depth_stencil_view;
+	for (uint32_t i = 0; i < image_num; i++)
+	{
+		attachments[msaa_color_view ? 2 : 0] = swapchain_image_views[i];
+		vkCreateFramebuffer(device, &framebuffer_create_info, nullptr, &framebuffers[i]);
+	}
+}
+
+static int setup_render_pass(VkDevice device, VkFormat color_format, VkFormat depth_format, VkSampleCountFlagBits samples, VkRenderPass* render_pass)
+{
+	VkAttachmentDescription attachments[3] = { };
 	VkRenderPassCreateInfo render_pass_create_info = {};
 	VkAttachmentReference color_reference = {};
 	VkAttachmentReference depth_reference = {};
+	VkAttachmentReference resolve_reference = {};
 	// Subpass dependencies for layout transitions
 	VkSubpassDependency dependencies[2];
 	VkSubpassDescription subpass_description = {};
@@ -725,6 +1054,24 @@ static int setup_render_pass(VkDevice device, VkFormat color_format, VkFormat de
 	attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	// Multisampled color is rendered to and resolved into the swapchain image, its samples are discarded
+	if (samples != VK_SAMPLE_COUNT_1_BIT)
+	{
+		attachments[0].samples = samples;
+		attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		attachments[1].samples = samples;
+
+		attachments[2].format = color_format;
+		attachments[2].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[2].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachments[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachments[2].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	}
 	
 	color_reference.attachment = 0;
 	color_reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
@@ -732,6 +1079,9 @@ static int setup_render_pass(VkDevice device, VkFormat color_format, VkFormat de
 	depth_reference.attachment = 1;
 	depth_reference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
+	resolve_reference.attachment = 2;
+	resolve_reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
 	subpass_description.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	subpass_description.colorAttachmentCount = 1;
 	subpass_description.pColorAttachments = &color_reference;
@@ -740,7 +1090,7 @@ static int setup_render_pass(VkDevice device, VkFormat color_format, VkFormat de
 	subpass_description.pInputAttachments = nullptr;
 	subpass_description.preserveAttachmentCount = 0;
 	subpass_description.pPreserveAttachments = nullptr;
-	subpass_description.pResolveAttachments = nullptr;
+	subpass_description.pResolveAttachments = samples != VK_SAMPLE_COUNT_1_BIT ? &resolve_reference : nullptr;
 
 	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
 	dependencies[0].dstSubpass = 0;
@@ -759,7 +1109,7 @@ static int setup_render_pass(VkDevice device, VkFormat color_format, VkFormat de
 	dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
 	render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	render_pass_create_info.attachmentCount = sizeof(attachments)/sizeof(attachments[0]);
+	render_pass_create_info.attachmentCount = samples != VK_SAMPLE_COUNT_1_BIT ? 3 : 2;
 	render_pass_create_info.pAttachments = attachments;
 	render_pass_create_info.subpassCount = 1;
 	render_pass_create_info.pSubpasses = &subpass_description;
@@ -856,30 +1206,203 @@ inline VkCompositeAlphaFlagBitsKHR choose_composite_alpha(VkCompositeAlphaFlagBi
 	return composite_alpha;
 }
 
-static void build_command_buffers(struct GraphicsContext* graphics_context)
+static void image_layout_barrier(VkCommandBuffer command_buffer, VkImage image, VkImageAspectFlags aspect_mask,
+	VkImageLayout old_layout, VkImageLayout new_layout, VkAccessFlags src_access_mask, VkAccessFlags dst_access_mask,
+	VkPipelineStageFlags src_stage_mask, VkPipelineStageFlags dst_stage_mask)
+{
+	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+
+	barrier.srcAccessMask = src_access_mask;
+	barrier.dstAccessMask = dst_access_mask;
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = new_layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = aspect_mask;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	vkCmdPipelineBarrier(command_buffer, src_stage_mask, dst_stage_mask, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+// Starts rendering into swapchain image image_index, either through render_pass or with dynamic rendering.
+// The layout transitions the render pass does through its attachment descriptions are explicit barriers here.
+static void begin_rendering(struct GraphicsContext* graphics_context, VkCommandBuffer command_buffer, uint32_t image_index, const VkClearValue* clear_values)
+{
+	VkRenderPassBeginInfo render_pass_begin_info{ };
+	VkRenderingInfoKHR rendering_info = { VK_STRUCTURE_TYPE_RENDERING_INFO_KHR };
+	VkRenderingAttachmentInfoKHR color_attachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR };
+	VkRenderingAttachmentInfoKHR depth_attachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR };
+	VkImageAspectFlags depth_aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+	VkRect2D render_area = { { 0, 0 }, graphics_context->surface_extent };
+
+	if (!graphics_context->dynamic_rendering)
+	{
+		render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		render_pass_begin_info.renderPass = graphics_context->render_pass;
+		render_pass_begin_info.framebuffer = graphics_context->framebuffers[image_index];
+		render_pass_begin_info.renderArea = render_area;
+		render_pass_begin_info.clearValueCount = 2;
+		render_pass_begin_info.pClearValues = clear_values;
+		vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+		return;
+	}
+
+	if (depth_format_has_stencil(graphics_context->depth_format))
+	{
+		depth_aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+	}
+
+	// Previous contents are cleared, so every transition starts from UNDEFINED
+	image_layout_barrier(command_buffer, graphics_context->swapchain_images[image_index], VK_IMAGE_ASPECT_COLOR_BIT,
+		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	image_layout_barrier(command_buffer, graphics_context->depth_stencil_image, depth_aspect,
+		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
+
+	color_attachment.imageView = graphics_context->swapchain_image_views[image_index];
+	color_attachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	color_attachment.clearValue = clear_values[0];
+
+	// Render to the multisampled target and resolve into the swapchain image
+	if (graphics_context->msaa_color_view)
+	{
+		image_layout_barrier(command_buffer, graphics_context->msaa_color_image, VK_IMAGE_ASPECT_COLOR_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+		color_attachment.imageView = graphics_context->msaa_color_view;
+		color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		color_attachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT_KHR;
+		color_attachment.resolveImageView = graphics_context->swapchain_image_views[image_index];
+		color_attachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	}
+
+	depth_attachment.imageView = graphics_context->depth_stencil_view;
+	depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depth_attachment.clearValue = clear_values[1];
+
+	rendering_info.renderArea = render_area;
+	rendering_info.layerCount = 1;
+	rendering_info.colorAttachmentCount = 1;
+	rendering_info.pColorAttachments = &color_attachment;
+	rendering_info.pDepthAttachment = &depth_attachment;
+	rendering_info.pStencilAttachment = depth_format_has_stencil(graphics_context->depth_format) ? &depth_attachment : NULL;
+	graphics_context->pfn_vkCmdBeginRenderingKHR(command_buffer, &rendering_info);
+}
+
+static void end_rendering(struct GraphicsContext* graphics_context, VkCommandBuffer command_buffer, uint32_t image_index)
+{
+	if (!graphics_context->dynamic_rendering)
+	{
+		vkCmdEndRenderPass(command_buffer);
+		return;
+	}
+
+	graphics_context->pfn_vkCmdEndRenderingKHR(command_buffer);
+	image_layout_barrier(command_buffer, graphics_context->swapchain_images[image_index], VK_IMAGE_ASPECT_COLOR_BIT,
+		VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, 0,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+}
+
+static void get_scene_lod_selection(struct GraphicsContext* graphics_context, struct LodSelection* selection)
+{
+	get_lod_selection(ubo_vs.projection, ubo_vs.model, graphics_context->surface_extent.height,
+		graphics_context->lod_errors, graphics_context->lod_count, selection);
+}
+
+// Recorded again every frame before submission, so the visible instance count and pipelines
+// compiled in the background are picked up. vkBeginCommandBuffer resets the previous recording.
+// The device is idle when this runs, so the indirect buffer is overwritten in place
+static void build_scene_draw_batches(struct GraphicsContext* graphics_context, VkPipeline pipeline)
+{
+	struct DrawBatchKey key;
+	uint32_t lod_first_instance[MAX_MESH_LODS];
+	uint32_t range = 0;
+
+	lod_first_instance[0] = 0;
+	for (uint32_t lod = 1; lod < graphics_context->lod_count; lod++)
+		lod_first_instance[lod] = lod_first_instance[lod - 1] + scene_lod_instances[lod - 1];
+
+	key.pipeline = pipeline;
+	key.vertex_buffer = graphics_context->vertex_buffer;
+	key.index_buffer = graphics_context->index_buffer;
+	reset_draw_batches(&scene_draw_batches);
+	for (uint32_t d = 0; d < graphics_context->draw_count; d++)
+	{
+		const struct MeshDraw* draw = &graphics_context->draws[d];
+		VkDrawIndexedIndirectCommand command;
+
+		if (!scene_lod_instances[draw->lod])
+			continue;
+
+		// LOD 0 of a single instance only draws the parts of its visible meshlets inside this draw, the ranges
+		// ascend like the draws
+		if (draw->lod == 0 && scene_cluster_culling)
+		{
+			for (; range < scene_meshlet_range_count; range++)
+			{
+				const struct IndexRange* index_range = &scene_meshlet_ranges[range];
+				uint32_t first = glm::max(index_range->first_index, draw->first_index);
+				uint32_t end = glm::min(index_range->first_index + index_range->index_count, draw->first_index + draw->index_count);
+
+				if (index_range->first_index >= draw->first_index + draw->index_count)
+					break;
+				if (first < end)
+				{
+					key.index_type = draw->index_type;
+					command.indexCount = end - first;
+					command.instanceCount = 1;
+					command.firstIndex = first + graphics_context->lod_index_offsets[0];
+					command.vertexOffset = draw->vertex_offset;
+					command.firstInstance = 0;
+					add_batch_draw(&scene_draw_batches, &key, &command);
+					frame_triangles += command.indexCount / 3;
+				}
+				// Continues into the next draw
+				if (index_range->first_index + index_range->index_count > draw->first_index + draw->index_count)
+					break;
+			}
+			continue;
+		}
+
+		key.index_type = draw->index_type;
+		command.indexCount = draw->index_count;
+		command.instanceCount = scene_lod_instances[draw->lod];
+		command.firstIndex = draw->first_index + graphics_context->lod_index_offsets[draw->lod];
+		command.vertexOffset = draw->vertex_offset;
+		command.firstInstance = lod_first_instance[draw->lod];
+		add_batch_draw(&scene_draw_batches, &key, &command);
+		frame_triangles += (uint64_t)(draw->index_count / 3) * command.instanceCount;
+	}
+	build_draw_batches(graphics_context, &scene_draw_batches);
+}
+
+static void record_command_buffer(struct GraphicsContext* graphics_context, uint32_t i)
 {
 	VkCommandBufferBeginInfo command_buffer_begin_info{ };
 	VkClearColorValue default_clear_color = { {0.01f, 0.01f, 0.033f, 1.0f} };
 	VkClearValue clear_values[2];
-	VkRenderPassBeginInfo render_pass_begin_info{ };
 	VkViewport viewport{ };
 	VkRect2D scissor{ };
 	VkDeviceSize offsets[1] = { 0 };
+	VkPipeline pipeline;
+
+	pipeline = get_pipeline_async(graphics_context, &scene_pipeline_key, graphics_context->graphics_pipeline);
 
 	command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
 	clear_values[0].color = default_clear_color;
 	clear_values[1].depthStencil = { 0.0f, 0 };
 
-	render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	render_pass_begin_info.renderPass = graphics_context->render_pass;
-	render_pass_begin_info.renderArea.offset.x = 0;
-	render_pass_begin_info.renderArea.offset.y = 0;
-	render_pass_begin_info.renderArea.extent.width = graphics_context->surface_extent.width;
-	render_pass_begin_info.renderArea.extent.height = graphics_context->surface_extent.height;
-	render_pass_begin_info.clearValueCount = 2;
-	render_pass_begin_info.pClearValues = clear_values;
-
 	viewport.width = graphics_context->surface_extent.width;
 	viewport.height = graphics_context->surface_extent.height;
 	viewport.minDepth = 0;
@@ -890,31 +1413,78 @@ static void build_command_buffers(struct GraphicsContext* graphics_context)
 	scissor.offset.x = 0;
 	scissor.offset.y = 0;
 
-	for (uint32_t i = 0; i < graphics_context->image_num; i++)
+	VK_CHECK(vkBeginCommandBuffer(graphics_context->command_buffers[i], &command_buffer_begin_info));
+
+	// Fills the visible list and the indirect instance counts the draws below read
+	if (graphics_context->gpu_culling)
 	{
-		// Set target frame buffer
-		render_pass_begin_info.framebuffer = graphics_context->framebuffers[i];
+		struct LodSelection lod_selection;
 
-		VK_CHECK(vkBeginCommandBuffer(graphics_context->command_buffers[i], &command_buffer_begin_info));
+		get_scene_lod_selection(graphics_context, &lod_selection);
+		record_gpu_culling(graphics_context, graphics_context->command_buffers[i], ubo_vs.projection * ubo_vs.model, &lod_selection);
+	}
+	if (graphics_context->occlusion_queries)
+	{
+		record_occlusion_query_reset(graphics_context, graphics_context->occlusion_queries, graphics_context->command_buffers[i]);
+	}
 
-		vkCmdBeginRenderPass(graphics_context->command_buffers[i], &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+	// Set target frame buffer
+	begin_rendering(graphics_context, graphics_context->command_buffers[i], i, clear_values);
 
-		vkCmdSetViewport(graphics_context->command_buffers[i], 0, 1, &viewport);
-		vkCmdSetScissor(graphics_context->command_buffers[i], 0, 1, &scissor);
+	vkCmdSetViewport(graphics_context->command_buffers[i], 0, 1, &viewport);
+	vkCmdSetScissor(graphics_context->command_buffers[i], 0, 1, &scissor);
 
-		vkCmdBindDescriptorSets(graphics_context->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_context->pipeline_layout, 0, 1, &graphics_context->descriptor_set, 0, NULL);
-		vkCmdBindPipeline(graphics_context->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_context->graphics_pipeline);
+	vkCmdBindDescriptorSets(graphics_context->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_context->pipeline_layout, 0, 1, &graphics_context->descriptor_set, 0, NULL);
+	// Without a fallback the draw is skipped until the pipeline is ready
+	if (pipeline != VK_NULL_HANDLE)
+	{
+		vkCmdBindPipeline(graphics_context->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		set_pipeline_dynamic_state(graphics_context, graphics_context->command_buffers[i], &scene_pipeline_key);
+		vkCmdPushConstants(graphics_context->command_buffers[i], graphics_context->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT,
+			0, sizeof(scene_vertex_dequantization), &scene_vertex_dequantization);
 
-		vkCmdBindVertexBuffers(graphics_context->command_buffers[i], 0, 1, &graphics_context->vertex_buffer, offsets);
-		vkCmdBindIndexBuffer(graphics_context->command_buffers[i], graphics_context->index_buffer, 0, VK_INDEX_TYPE_UINT32);
+		if (graphics_context->gpu_culling)
+		{
+			vkCmdBindVertexBuffers(graphics_context->command_buffers[i], 0, 1, &graphics_context->vertex_buffer, offsets);
+			vkCmdBindIndexBuffer(graphics_context->command_buffers[i], graphics_context->index_buffer, 0, graphics_context->draws[0].index_type);
+			draw_gpu_culled(graphics_context, graphics_context->command_buffers[i]);
+		}
+		else if (graphics_context->occlusion_queries)
+		{
+			vkCmdBindVertexBuffers(graphics_context->command_buffers[i], 0, 1, &graphics_context->vertex_buffer, offsets);
+			vkCmdBindIndexBuffer(graphics_context->command_buffers[i], graphics_context->index_buffer, 0, graphics_context->draws[0].index_type);
+			frame_triangles += draw_occlusion_tested(graphics_context, graphics_context->occlusion_queries, graphics_context->command_buffers[i],
+				scene_lod_instances);
+		}
+		else
+		{
+			// Batches bind the buffers they draw from
+			build_scene_draw_batches(graphics_context, pipeline);
+			record_draw_batches(graphics_context, graphics_context->command_buffers[i], &scene_draw_batches, pipeline);
+		}
+	}
+	// Tested against the depth of the whole scene, whether the scene pipeline was ready or not
+	if (graphics_context->occlusion_queries)
+	{
+		draw_occlusion_proxies(graphics_context, graphics_context->occlusion_queries, graphics_context->command_buffers[i]);
+	}
+	//vkCmdDraw(graphics_context->command_buffers[i], 3, 1, 0, 0);
+	//draw_ui(draw_cmd_buffers[i]);
 
-		vkCmdDrawIndexed(graphics_context->command_buffers[i], sizeof(indices) / sizeof(indices[0]), 1, 0, 0, 0);
-		//vkCmdDraw(graphics_context->command_buffers[i], 3, 1, 0, 0);
-		//draw_ui(draw_cmd_buffers[i]);
+	end_rendering(graphics_context, graphics_context->command_buffers[i], i);
+	if (graphics_context->occlusion_queries)
+	{
+		record_occlusion_query_copy(graphics_context, graphics_context->occlusion_queries, graphics_context->command_buffers[i]);
+	}
 
-		vkCmdEndRenderPass(graphics_context->command_buffers[i]);
+	VK_CHECK(vkEndCommandBuffer(graphics_context->command_buffers[i]));
+}
 
-		VK_CHECK(vkEndCommandBuffer(graphics_context->command_buffers[i]));
+static void build_command_buffers(struct GraphicsContext* graphics_context)
+{
+	for (uint32_t i = 0; i < graphics_context->image_num; i++)
+	{
+		record_command_buffer(graphics_context, i);
 	}
 }
 
@@ -942,8 +1512,6 @@ bool resize(struct GraphicsContext* graphics_context,const uint32_t width, const
 	VkImageView depth_stencil_view = VK_NULL_HANDLE;
 	VkDeviceMemory depth_stencil_mem = VK_NULL_HANDLE;
 
-	VkImageView attachments[2];
-
 	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(graphics_context->gpuDevice, graphics_context->display_surface, &surface_properties);
 
 	if (surface_properties.currentExtent.width == 0 || 
@@ -1012,20 +1580,24 @@ bool resize(struct GraphicsContext* graphics_context,const uint32_t width, const
 	}
 	vkDestroySwapchainKHR(graphics_context->device, graphics_context->swapchain, nullptr);
 
-	for (uint32_t i = 0; i < graphics_context->image_num; i++)
+	if (graphics_context->framebuffers)
 	{
-		vkDestroyFramebuffer(graphics_context->device, graphics_context->framebuffers[i], nullptr);
-		graphics_context->framebuffers[i] = VK_NULL_HANDLE;
+		for (uint32_t i = 0; i < graphics_context->image_num; i++)
+		{
+			vkDestroyFramebuffer(graphics_context->device, graphics_context->framebuffers[i], nullptr);
+			graphics_context->framebuffers[i] = VK_NULL_HANDLE;
+		}
+		free(graphics_context->framebuffers);
 	}
 
 	free(graphics_context->swapchain_images);
 	free(graphics_context->swapchain_image_views);
-	free(graphics_context->framebuffers);
 
 	vkGetSwapchainImagesKHR(graphics_context->device, swapchain_handle, &image_available, nullptr);
 	graphics_context->swapchain_images = (VkImage*)malloc(image_available * sizeof(VkImage));
 	graphics_context->swapchain_image_views = (VkImageView*)malloc(image_available * sizeof(VkImageView));
-	graphics_context->framebuffers = (VkFramebuffer*)malloc(image_available * sizeof(VkFramebuffer));
+	// Dynamic rendering takes the attachments when recording, there is nothing to rebuild
+	graphics_context->framebuffers = graphics_context->dynamic_rendering ? NULL : (VkFramebuffer*)malloc(image_available * sizeof(VkFramebuffer));
 	graphics_context->image_num = image_available;
 	graphics_context->swapchain = swapchain_handle;
 	vkGetSwapchainImagesKHR(graphics_context->device, swapchain_handle, &image_available, graphics_context->swapchain_images);
@@ -1060,29 +1632,26 @@ bool resize(struct GraphicsContext* graphics_context,const uint32_t width, const
 	vkDestroyImageView(graphics_context->device, graphics_context->depth_stencil_view, nullptr);
 	vkDestroyImage(graphics_context->device, graphics_context->depth_stencil_image, nullptr);
 	vkFreeMemory(graphics_context->device, graphics_context->depth_stencil_mem, nullptr);
-	setup_depth_stencil(graphics_context->gpuDevice, graphics_context->device, graphics_context->surface_extent, &depth_stencil_image, &depth_stencil_mem, &depth_stencil_view);
+	setup_depth_stencil(graphics_context->gpuDevice, graphics_context->device, graphics_context->surface_extent, graphics_context->sample_count,
+		&depth_stencil_image, &depth_stencil_mem, &depth_stencil_view);
 
 	graphics_context->depth_stencil_view = depth_stencil_view;
 	graphics_context->depth_stencil_image = depth_stencil_image;
 	graphics_context->depth_stencil_mem = depth_stencil_mem;
 
-	// Depth/Stencil attachment is the same for all frame buffers
-	attachments[1] = depth_stencil_view;
-
-	VkFramebufferCreateInfo framebuffer_create_info = {};
-	framebuffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	framebuffer_create_info.pNext = NULL;
-	framebuffer_create_info.renderPass = graphics_context->render_pass;
-	framebuffer_create_info.attachmentCount = 2;
-	framebuffer_create_info.pAttachments = attachments;
-	framebuffer_create_info.width = graphics_context->surface_extent.width;
-	framebuffer_create_info.height = graphics_context->surface_extent.height;
-	framebuffer_create_info.layers = 1;
+	if (graphics_context->msaa_color_view)
+	{
+		vkDestroyImageView(graphics_context->device, graphics_context->msaa_color_view, nullptr);
+		vkDestroyImage(graphics_context->device, graphics_context->msaa_color_image, nullptr);
+		vkFreeMemory(graphics_context->device, graphics_context->msaa_color_mem, nullptr);
+		setup_msaa_color(graphics_context->gpuDevice, graphics_context->device, graphics_context->surface_extent, graphics_context->surface_format.format,
+			graphics_context->sample_count, &graphics_context->msaa_color_image, &graphics_context->msaa_color_mem, &graphics_context->msaa_color_view);
+	}
 
-	for (uint32_t i = 0; i < graphics_context->image_num; i++)
+	if (graphics_context->framebuffers)
 	{
-        attachments[0] = graphics_context->swapchain_image_views[i];
-		vkCreateFramebuffer(graphics_context->device, &framebuffer_create_info, nullptr, &graphics_context->framebuffers[i]);
+		setup_framebuffers(graphics_context->device, graphics_context->render_pass, graphics_context->surface_extent, graphics_context->swapchain_image_views,
+			graphics_context->image_num, depth_stencil_view, graphics_context->msaa_color_view, graphics_context->framebuffers);
 	}
 
 	vkResetCommandPool(graphics_context->device, graphics_context->cmd_pool, 0);
@@ -1127,6 +1696,160 @@ static void present_frame(struct GraphicsContext* graphics_context, uint32_t cur
 	}
 }
 
+static glm::mat4 get_orbit_transform(glm::vec3 rotation)
+{
+	glm::mat4 transform = glm::rotate(glm::mat4(1.0f), glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+
+	transform = glm::rotate(transform, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+	return glm::rotate(transform, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+static void orbit_camera(struct GraphicsContext* graphics_context)
+{
+	static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	glm::vec3 rotation = scene_camera_rotation;
+
+	rotation.y += fmodf(seconds * CAMERA_ORBIT_SPEED, 360.0f);
+	set_local_transform(&scene_graph, scene_orbit_node, get_orbit_transform(rotation));
+}
+
+// Uploads what moved since the last call: the view uniforms when the camera moved, the transforms and culling bounds
+// of moved instances in runs of neighboring nodes. The device is idle, so buffers are written in place.
+static void update_scene_transforms(struct GraphicsContext* graphics_context)
+{
+	uint32_t updated_count = update_scene_graph(&scene_graph);
+
+	for (uint32_t i = 0; i < updated_count; i++)
+	{
+		uint32_t node = scene_graph.updated[i];
+		uint32_t instance = node - scene_first_instance_node;
+		uint32_t count = 1;
+		const glm::mat4* transforms = &get_world_transform(&scene_graph, node);
+
+		if (node == scene_orbit_node)
+		{
+			ubo_vs.model = *transforms;
+			update_data_to_memory(graphics_context, graphics_context->uniform_memory_vs, offsetof(decltype(ubo_vs), model),
+				&ubo_vs.model, sizeof(ubo_vs.model));
+			continue;
+		}
+		if (node < scene_first_instance_node || instance >= graphics_context->instance_count)
+			continue;
+
+		// Neighbors in the graph arrays go out with one copy
+		while (i + 1 < updated_count && scene_graph.updated[i + 1] == node + count && instance + count < graphics_context->instance_count &&
+			&get_world_transform(&scene_graph, node + count) == transforms + count)
+		{
+			count++;
+			i++;
+		}
+		// The grid only scales uniformly, the fit transform too
+		for (uint32_t k = 0; k < count; k++)
+		{
+			set_culling_bounds(&scene_instance_bounds, instance + k, glm::vec3(transforms[k] * glm::vec4(scene_mesh.sphere_center, 1.0f)),
+				scene_mesh.sphere_radius * glm::length(glm::vec3(transforms[k][0])));
+		}
+		update_data_to_memory(graphics_context, graphics_context->instance_mem, instance * sizeof(glm::mat4), (void*)transforms,
+			count * sizeof(glm::mat4));
+		if (graphics_context->gpu_culling)
+			update_gpu_culling_bounds(graphics_context, &scene_instance_bounds, instance, count);
+	}
+}
+
+// The instances covering the most of the screen occlude the rest of the visible list
+static uint32_t cull_scene_occlusion(struct GraphicsContext* graphics_context, const glm::mat4& view_projection,
+	glm::vec3 camera_position)
+{
+	glm::mat4 transforms[OCCLUDER_COUNT];
+	float sizes[OCCLUDER_COUNT];
+	uint32_t occluders[OCCLUDER_COUNT];
+	uint32_t occluder_count = 0;
+
+	// Insertion into a short sorted list, the visible list is long
+	for (uint32_t i = 0; i < graphics_context->visible_instance_count; i++)
+	{
+		uint32_t index = scene_visible_instances[i];
+		glm::vec3 center = glm::vec3(scene_instance_bounds.center_x[index], scene_instance_bounds.center_y[index],
+			scene_instance_bounds.center_z[index]);
+		float size = scene_instance_bounds.radius[index] / glm::max(glm::length(center - camera_position), 1e-6f);
+		uint32_t slot = occluder_count < OCCLUDER_COUNT ? occluder_count++ : OCCLUDER_COUNT;
+
+		if (slot == OCCLUDER_COUNT && size <= sizes[OCCLUDER_COUNT - 1])
+			continue;
+		for (slot = slot < OCCLUDER_COUNT ? slot : OCCLUDER_COUNT - 1; slot > 0 && sizes[slot - 1] < size; slot--)
+		{
+			sizes[slot] = sizes[slot - 1];
+			occluders[slot] = occluders[slot - 1];
+		}
+		sizes[slot] = size;
+		occluders[slot] = index;
+	}
+
+	for (uint32_t i = 0; i < occluder_count; i++)
+	{
+		transforms[i] = get_world_transform(&scene_graph, scene_first_instance_node + occluders[i]);
+	}
+	render_occluders(graphics_context->occlusion_culler, view_projection, transforms, occluder_count);
+	return cull_occluded(graphics_context->occlusion_culler, &scene_instance_bounds, scene_visible_instances,
+		graphics_context->visible_instance_count);
+}
+
+// The device is idle at this point, so the visible list is overwritten in place
+static void cull_instances(struct GraphicsContext* graphics_context)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	glm::mat4 view_projection = ubo_vs.projection * ubo_vs.model;
+	struct LodSelection lod_selection;
+	uint32_t occluded = 0;
+
+	graphics_context->visible_instance_count = cull_bounds(graphics_context, &scene_instance_bounds, view_projection, scene_visible_instances);
+	get_scene_lod_selection(graphics_context, &lod_selection);
+	if (graphics_context->occlusion_culler)
+	{
+		uint32_t frustum_visible = graphics_context->visible_instance_count;
+
+		graphics_context->visible_instance_count = cull_scene_occlusion(graphics_context, view_projection, lod_selection.camera_position);
+		frame_occluded_instances += frustum_visible - graphics_context->visible_instance_count;
+	}
+	sort_visible_by_lod(&scene_instance_bounds, &lod_selection, scene_visible_instances, graphics_context->visible_instance_count,
+		scene_lod_scratch, scene_lod_instances);
+	// Instances of LODs still loading draw a coarser one
+	if (graphics_context->geometry_streamer)
+	{
+		float priorities[MAX_MESH_LODS];
+		uint32_t resident_lods[MAX_MESH_LODS];
+
+		get_lod_priorities(&scene_instance_bounds, scene_visible_instances, scene_lod_instances, graphics_context->lod_count,
+			lod_selection.camera_position, priorities);
+		update_geometry_streaming(graphics_context, priorities, resident_lods);
+		merge_lod_counts(resident_lods, graphics_context->lod_count, scene_lod_instances);
+	}
+	// Occluded instances stay in the visible list, their proxies are tested again
+	if (graphics_context->occlusion_queries)
+	{
+		occluded = update_occlusion_queries(graphics_context, graphics_context->occlusion_queries, &scene_instance_bounds,
+			scene_visible_instances, graphics_context->visible_instance_count, lod_selection.camera_position);
+		frame_occluded_instances += occluded;
+	}
+	// The single instance keeps the fit transform as is
+	if (scene_cluster_culling && scene_lod_instances[0])
+	{
+		glm::mat4 model_view = ubo_vs.model * get_world_transform(&scene_graph, scene_first_instance_node);
+
+		scene_meshlet_range_count = cull_meshlets(scene_meshlets, scene_meshlet_count, ubo_vs.projection * model_view,
+			glm::vec3(glm::inverse(model_view)[3]), scene_meshlet_ranges);
+	}
+	frame_culling_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	frame_visible_instances += graphics_context->visible_instance_count - occluded;
+
+	if (graphics_context->visible_instance_count)
+	{
+		update_data_to_memory(graphics_context, graphics_context->visible_instance_mem, 0, scene_visible_instances,
+			graphics_context->visible_instance_count * sizeof(uint32_t));
+	}
+}
+
 static int update(struct GraphicsContext* graphics_context)
 {
 	VkSurfaceCapabilitiesKHR surface_properties;
@@ -1155,6 +1878,27 @@ static int update(struct GraphicsContext* graphics_context)
 		resize(graphics_context, graphics_context->surface_extent.width, graphics_context->surface_extent.height);
 	}
 
+	if (CAMERA_ORBIT_SPEED != 0.0f)
+	{
+		orbit_camera(graphics_context);
+	}
+	update_scene_transforms(graphics_context);
+	if (!graphics_context->gpu_culling)
+	{
+		cull_instances(graphics_context);
+	}
+	else if (graphics_context->geometry_streamer)
+	{
+		// Streams for the LODs the last dispatch selected
+		float priorities[MAX_MESH_LODS];
+		uint32_t resident_lods[MAX_MESH_LODS];
+
+		read_gpu_lod_priorities(graphics_context, priorities);
+		update_geometry_streaming(graphics_context, priorities, resident_lods);
+		update_gpu_culling_residency(graphics_context, resident_lods);
+	}
+	record_command_buffer(graphics_context, image_index);
+
 	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
 	submit_info.waitSemaphoreCount = 1;
@@ -1174,54 +1918,266 @@ static int update(struct GraphicsContext* graphics_context)
 	return 0;
 }
 
+// Seconds between frame time reports
+#define FRAME_REPORT_INTERVAL 2.0
+
 static int application_handler(struct GraphicsContext* graphics_context, struct Window* win)
 {
 	event_param_t param = { 0 };
+	std::chrono::steady_clock::time_point report_start = std::chrono::steady_clock::now();
+	uint32_t frames = 0;
+
 	while (win->close != 1)
 	{
+		double seconds;
+
 		update(graphics_context);
 		platform_process_event(&param);
+
+		// update waits for the device, so this is the full CPU + GPU frame time
+		frames++;
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - report_start).count();
+		if (seconds >= FRAME_REPORT_INTERVAL)
+		{
+			printf("%u instances: %.3f ms per frame (%.1f fps, %.1f M instances/s), ",
+				graphics_context->instance_count, seconds * 1000.0 / frames, frames / seconds,
+				graphics_context->instance_count * (frames / seconds) / 1000000.0);
+			// The visible count never comes back from the GPU
+			if (graphics_context->gpu_culling)
+			{
+				printf("culled on the gpu\n");
+			}
+			else
+			{
+				printf("culling %.3f ms, %llu visible, %llu occluded, %.2f M triangles\n",
+					frame_culling_seconds * 1000.0 / frames, (unsigned long long)(frame_visible_instances / frames),
+					(unsigned long long)(frame_occluded_instances / frames), frame_triangles / 1000000.0 / frames);
+			}
+			frames = 0;
+			frame_culling_seconds = 0.0;
+			frame_visible_instances = 0;
+			frame_occluded_instances = 0;
+			frame_triangles = 0;
+			report_start = std::chrono::steady_clock::now();
+		}
 	}
 	return 0;
 }
 
-static int setup_vertex_buffer(struct GraphicsContext* graphics_context)
+// With a streaming budget and LODs to stream, index_buffer is filled by the geometry streamer from cache_name
+static int setup_vertex_buffer(struct GraphicsContext* graphics_context, const struct Mesh* mesh, const char* cache_name,
+	VkDeviceSize streaming_budget)
 {
-	graphics_context->vertex_buffer = create_buffer(graphics_context->device, sizeof(vertices), 
+	VkDeviceSize vertex_size = (VkDeviceSize)mesh->vertex_count * get_vertex_stride(graphics_context->vertex_format);
+	VkDeviceSize index_size;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	void* vertex_data;
+	void* index_data;
+	double seconds;
+
+	if (build_mesh_draws(mesh, &graphics_context->draws, &graphics_context->draw_count))
+		return -1;
+	graphics_context->lod_count = mesh->lod_count;
+	for (uint32_t i = 0; i < mesh->lod_count; i++)
+		graphics_context->lod_errors[i] = mesh->lods[i].error;
+	index_size = (VkDeviceSize)mesh->index_count * get_index_size(graphics_context->draws[0].index_type);
+
+	graphics_context->vertex_buffer = create_buffer(graphics_context->device, vertex_size,
 		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
 	graphics_context->vertex_mem = alloc_bind_bufer_memory(graphics_context, graphics_context->vertex_buffer,
-		sizeof(vertices), VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		vertex_size, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-	update_data_to_memory(graphics_context, graphics_context->vertex_mem, 0, vertices, sizeof(vertices));
+	// Packed straight into the mapped buffer, float vertices are copied as they are
+	get_vertex_dequantization(graphics_context->vertex_format, mesh, &scene_vertex_dequantization);
+	if (vkMapMemory(graphics_context->device, graphics_context->vertex_mem, 0, vertex_size, 0, &vertex_data) != VK_SUCCESS)
+	{
+		printf("cannot map the vertex buffer\n");
+		return -1;
+	}
+	pack_vertices(graphics_context->vertex_format, mesh, &scene_vertex_dequantization, vertex_data);
+	vkUnmapMemory(graphics_context->device, graphics_context->vertex_mem);
 
-	graphics_context->index_buffer = create_buffer(graphics_context->device, sizeof(indices),
+	if (streaming_budget && mesh->lod_count > 1)
+	{
+		if (create_geometry_streamer(graphics_context, mesh, cache_name, streaming_budget))
+			return -1;
+		index_size = get_streamed_index_size(graphics_context);
+		goto uploaded;
+	}
+
+	graphics_context->index_buffer = create_buffer(graphics_context->device, index_size,
 		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
 
 	graphics_context->index_mem = alloc_bind_bufer_memory(graphics_context, graphics_context->index_buffer,
-		sizeof(indices), VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		index_size, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	// 16 bit indices are rebased per draw straight into the mapped buffer, 32 bit ones are copied as they are
+	if (vkMapMemory(graphics_context->device, graphics_context->index_mem, 0, index_size, 0, &index_data) != VK_SUCCESS)
+	{
+		printf("cannot map the index buffer\n");
+		return -1;
+	}
+	pack_indices(mesh, graphics_context->draws, graphics_context->draw_count, index_data);
+	vkUnmapMemory(graphics_context->device, graphics_context->index_mem);
 
-	update_data_to_memory(graphics_context, graphics_context->index_mem, 0, indices, sizeof(indices));
+uploaded:
+	// For a mapped mesh cache this is where the file is actually read
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("uploaded %.1f MB of geometry in %.1f ms (%.1f MB/s)\n", (vertex_size + index_size) / (1024.0 * 1024.0),
+		seconds * 1000.0, seconds > 0.0 ? (vertex_size + index_size) / (1024.0 * 1024.0) / seconds : 0.0);
 
 	return 0;
 }
 
+// The mesh is released after upload, its meshlets are kept for culling
+static int setup_scene_meshlets(const struct Mesh* mesh)
+{
+	if (!mesh->meshlet_count)
+		return 0;
+
+	scene_meshlets = (struct Meshlet*)malloc((size_t)mesh->meshlet_count * sizeof(struct Meshlet));
+	scene_meshlet_ranges = (struct IndexRange*)malloc((size_t)mesh->meshlet_count * sizeof(struct IndexRange));
+	if (!scene_meshlets || !scene_meshlet_ranges)
+	{
+		printf("cannot allocate %u meshlets\n", mesh->meshlet_count);
+		return -1;
+	}
+	memcpy(scene_meshlets, mesh->meshlets, (size_t)mesh->meshlet_count * sizeof(struct Meshlet));
+	scene_meshlet_count = mesh->meshlet_count;
+	return 0;
+}
+
+// Occlusion between instances needs more than one, the occluders draw the coarsest LOD within OCCLUDER_MAX_ERROR
+static int setup_occlusion_culling(struct GraphicsContext* graphics_context, const struct Mesh* mesh, uint32_t instance_count)
+{
+	uint32_t lod = 0;
+
+	if (!OCCLUSION_CULLING || OCCLUSION_QUERIES || instance_count < 2)
+		return 0;
+
+	while (lod + 1 < mesh->lod_count && mesh->lods[lod + 1].error <= OCCLUDER_MAX_ERROR)
+		lod++;
+
+	graphics_context->occlusion_culler = create_occlusion_culler(graphics_context->job_pool);
+	if (!graphics_context->occlusion_culler)
+		return -1;
+	return set_occluder_mesh(graphics_context->occlusion_culler, mesh->vertices, mesh->vertex_count,
+		mesh->indices + mesh->lods[lod].first_index, mesh->lods[lod].index_count);
+}
+
+// The built-in cube, used when no mesh file is given
+static int load_default_mesh(struct Mesh* mesh)
+{
+	if (alloc_mesh(mesh, sizeof(vertices) / sizeof(vertices[0]), sizeof(indices) / sizeof(indices[0])))
+		return -1;
+
+	memcpy(mesh->vertices, vertices, sizeof(vertices));
+	memcpy(mesh->indices, indices, sizeof(indices));
+	compute_mesh_bounds(mesh);
+	return 0;
+}
+
+static uint32_t get_instance_count(VkPhysicalDevice physical_device)
+{
+	VkPhysicalDeviceProperties properties;
+	uint32_t requested = INSTANCE_COUNT;
+	uint32_t max_instances;
+	char* env_instances = NULL;
+	size_t env_length = 0;
+
+	if (!_dupenv_s(&env_instances, &env_length, "INSTANCE_COUNT") && env_instances)
+	{
+		requested = (uint32_t)atoi(env_instances);
+		free(env_instances);
+	}
+
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+	max_instances = properties.limits.maxStorageBufferRange / sizeof(glm::mat4);
+	if (requested > max_instances)
+	{
+		printf("%u instances do not fit into one storage buffer, drawing %u\n", requested, max_instances);
+		requested = max_instances;
+	}
+	return requested ? requested : 1;
+}
+
+static VkDeviceSize get_streaming_budget()
+{
+	uint32_t budget_mb = STREAMING_BUDGET_MB;
+	char* env_budget = NULL;
+	size_t env_length = 0;
+
+	if (!_dupenv_s(&env_budget, &env_length, "STREAMING_BUDGET_MB") && env_budget)
+	{
+		budget_mb = (uint32_t)atoi(env_budget);
+		free(env_budget);
+	}
+	return (VkDeviceSize)budget_mb * 1024 * 1024;
+}
+
+// Instances fill a cube grid of the size the mesh is fit into, a single instance keeps the fit transform as is.
+// Adds one scene graph node per instance and creates the culling bounds and the visible instance list.
+static int setup_instance_buffer(struct GraphicsContext* graphics_context, uint32_t instance_count)
+{
+	VkDeviceSize size = (VkDeviceSize)instance_count * sizeof(glm::mat4);
+	VkDeviceSize visible_size = (VkDeviceSize)instance_count * sizeof(uint32_t);
+	uint32_t side = 1;
+	float cell, scale;
+
+	while ((uint64_t)side * side * side < instance_count)
+		side++;
+	cell = 1.0f / side;
+	scale = side > 1 ? cell * 0.7f : 1.0f;
+
+	scene_visible_instances = (uint32_t*)malloc(((size_t)instance_count + CULLING_SIMD_WIDTH) * sizeof(uint32_t));
+	scene_lod_scratch = (uint32_t*)malloc(((size_t)instance_count + 1) * sizeof(uint32_t));
+	if (!scene_visible_instances || !scene_lod_scratch || alloc_culling_bounds(&scene_instance_bounds, instance_count))
+	{
+		printf("cannot allocate %u instance transforms\n", instance_count);
+		return -1;
+	}
+
+	// Transforms and bounds are filled by the first update_scene_transforms
+	for (uint32_t i = 0; i < instance_count; i++)
+	{
+		glm::vec3 offset = glm::vec3((float)(i % side), (float)(i / side % side), (float)(i / side / side));
+		uint32_t node;
+
+		offset = (offset - glm::vec3((side - 1) * 0.5f)) * cell;
+		node = add_scene_node(&scene_graph, SCENE_NODE_NONE, glm::scale(glm::translate(glm::mat4(1.0f), offset), glm::vec3(scale)) * scene_mesh_transform);
+		if (node == SCENE_NODE_NONE)
+			return -1;
+		scene_first_instance_node = i ? scene_first_instance_node : node;
+	}
+
+	graphics_context->instance_buffer = create_buffer(graphics_context->device, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	graphics_context->instance_mem = alloc_bind_bufer_memory(graphics_context, graphics_context->instance_buffer,
+		size, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	graphics_context->instance_count = instance_count;
+
+	graphics_context->visible_instance_buffer = create_buffer(graphics_context->device, visible_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	graphics_context->visible_instance_mem = alloc_bind_bufer_memory(graphics_context, graphics_context->visible_instance_buffer,
+		visible_size, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	return 0;
+}
+
 static int setup_uniform_buffer(struct GraphicsContext* graphics_context)
 {
 	float zoom = -2.5f;
 	uint32_t width = graphics_context->surface_extent.width;
 	uint32_t height = graphics_context->surface_extent.height;
 	glm::vec3 camera_pos = glm::vec3();
-	glm::vec3 rotation = glm::vec3(-45.0, -45.0, 0.0);
 
 	graphics_context->uniform_buffer_vs = create_buffer(graphics_context->device, sizeof(ubo_vs), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
 	graphics_context->uniform_memory_vs = alloc_bind_bufer_memory(graphics_context, graphics_context->uniform_buffer_vs,
 		sizeof(ubo_vs), VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	glm::mat4 view_matrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, zoom));
 
-	ubo_vs.model = view_matrix * glm::translate(glm::mat4(1.0f), camera_pos);
-	ubo_vs.model = glm::rotate(ubo_vs.model, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-	ubo_vs.model = glm::rotate(ubo_vs.model, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-	ubo_vs.model = glm::rotate(ubo_vs.model, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+	// ubo_vs.model is the world transform of the orbit node, written by update_scene_transforms
+	scene_camera_node = add_scene_node(&scene_graph, SCENE_NODE_NONE, view_matrix * glm::translate(glm::mat4(1.0f), camera_pos));
+	scene_orbit_node = add_scene_node(&scene_graph, scene_camera_node, get_orbit_transform(scene_camera_rotation));
+	if (scene_orbit_node == SCENE_NODE_NONE)
+		return -1;
 
 	ubo_vs.view_pos = glm::vec4(0.0f, 0.0f, -zoom, 0.0f);
 	ubo_vs.projection = glm::perspective(glm::radians(60.0f), static_cast<float>(width) / static_cast<float>(height), 0.001f, 256.0f);
@@ -1231,7 +2187,7 @@ static int setup_uniform_buffer(struct GraphicsContext* graphics_context)
 	return 0;
 }
 
-int main()
+int main(int argc, char** argv)
 {
 	uint32_t api_version;
 	VkInstanceCreateInfo createInstanceInfo = { VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO };
@@ -1266,6 +2222,7 @@ int main()
 	VkImage* pSwapchainImages = NULL;
 	VkImageView* pSwapchainImageViews = NULL;
 	uint32_t image_num = 0;
+	uint32_t instance_count;
 
 	VkSemaphoreCreateInfo sema_create_info;
 	// Swap chain image presentation
@@ -1280,15 +2237,13 @@ int main()
 	VkImage depth_stencil_image;
 	VkDeviceMemory depth_stencil_mem;
 	VkImageView depth_stencil_view;
+	VkSampleCountFlagBits sample_count = VK_SAMPLE_COUNT_1_BIT;
 
 	VkRenderPass render_pass = VK_NULL_HANDLE;
 	// Pipeline cache object
-	VkPipelineCacheCreateInfo pipeline_cache_create_info = {};
 	VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
 
 	VkFramebuffer* framebuffers;
-	VkImageView attachments[2];
-	VkFramebufferCreateInfo framebuffer_create_info = {};
 
 	struct GraphicsContext* graphics_context = (struct GraphicsContext*)calloc(1, sizeof(struct GraphicsContext));
 
@@ -1311,6 +2266,8 @@ int main()
 	if (!physicalDeviceCount)
 		return -1;
 	pfn_vkGetDeviceProcAddr = (PFN_vkGetDeviceProcAddr)vkGetInstanceProcAddr(hInstance, "vkGetDeviceProcAddr");
+	pfn_vkGetPhysicalDeviceFeatures2KHR = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(hInstance, "vkGetPhysicalDeviceFeatures2KHR");
+	pfn_vkGetPhysicalDeviceProperties2KHR = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(hInstance, "vkGetPhysicalDeviceProperties2KHR");
 
 	physicalDevices = (VkPhysicalDevice*)malloc(sizeof(VkPhysicalDevice) * physicalDeviceCount);
 	vkEnumeratePhysicalDevices(hInstance, &physicalDeviceCount, physicalDevices);
@@ -1321,6 +2278,7 @@ int main()
 	curPhysDevice = get_suitable_gpu(display_surface, physicalDevices, physicalDeviceCount);
 
 	depth_format = get_suitable_depth_format(curPhysDevice);
+	sample_count = get_suitable_sample_count(curPhysDevice);
 	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(curPhysDevice, display_surface, &surface_properties);
 	if (surface_properties.currentExtent.width != 0xFFFFFFFFF)
 	{
@@ -1333,7 +2291,7 @@ int main()
 		surface_extent.height = WINDOW_HEIGHT;
 	}
 
-	device = create_device(curPhysDevice);
+	device = create_device(curPhysDevice, graphics_context);
 
 	vkGetPhysicalDeviceQueueFamilyProperties(curPhysDevice, &queueFamilyCount, NULL);
 	pQueueFamilyProperties = (VkQueueFamilyProperties*)malloc(sizeof(VkQueueFamilyProperties) * queueFamilyCount);
@@ -1400,31 +2358,24 @@ int main()
 		vkCreateFence(device, &fence_create_info, nullptr, &wait_fences[i]);
 	}
 
-	setup_depth_stencil(curPhysDevice, device, surface_extent, 
+	setup_depth_stencil(curPhysDevice, device, surface_extent, sample_count,
 		&depth_stencil_image, &depth_stencil_mem, &depth_stencil_view);
+	if (sample_count != VK_SAMPLE_COUNT_1_BIT)
+	{
+		setup_msaa_color(curPhysDevice, device, surface_extent, surface_format.format, sample_count,
+			&graphics_context->msaa_color_image, &graphics_context->msaa_color_mem, &graphics_context->msaa_color_view);
+	}
 
-	setup_render_pass(device, surface_format.format, depth_format, &render_pass);
-	pipeline_cache_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-	vkCreatePipelineCache(device, &pipeline_cache_create_info, nullptr, &pipeline_cache);
+	pipeline_cache = load_pipeline_cache(curPhysDevice, device, PIPELINE_CACHE_FILE);
 
 	// Create frame buffers for every swap chain image
-	framebuffers = (VkFramebuffer*)malloc(image_num * sizeof(VkFramebuffer));
-
-	framebuffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	framebuffer_create_info.pNext = NULL;
-	framebuffer_create_info.renderPass = render_pass;
-	framebuffer_create_info.attachmentCount = 2;
-	framebuffer_create_info.pAttachments = attachments;
-	framebuffer_create_info.width = surface_extent.width;
-	framebuffer_create_info.height = surface_extent.height;
-	framebuffer_create_info.layers = 1;
-
-	// Depth/Stencil attachment is the same for all frame buffers
-	attachments[1] = depth_stencil_view;
-	for (uint32_t i = 0; i < image_num; i++)
+	framebuffers = NULL;
+	if (!graphics_context->dynamic_rendering)
 	{
-		attachments[0] = pSwapchainImageViews[i];
-		vkCreateFramebuffer(device, &framebuffer_create_info, nullptr, &framebuffers[i]);
+		setup_render_pass(device, surface_format.format, depth_format, sample_count, &render_pass);
+		framebuffers = (VkFramebuffer*)malloc(image_num * sizeof(VkFramebuffer));
+		setup_framebuffers(device, render_pass, surface_extent, pSwapchainImageViews, image_num,
+			depth_stencil_view, graphics_context->msaa_color_view, framebuffers);
 	}
 
 	graphics_context->gpuDevice = curPhysDevice;
@@ -1442,16 +2393,57 @@ int main()
 	graphics_context->depth_stencil_mem = depth_stencil_mem;
 	graphics_context->depth_stencil_image = depth_stencil_image;
 	graphics_context->depth_stencil_view = depth_stencil_view;
+	graphics_context->depth_format = depth_format;
+	graphics_context->sample_count = sample_count;
 	graphics_context->render_pass = render_pass;
 	graphics_context->framebuffers = framebuffers;
 	graphics_context->cmd_pool = cmdPool;
 	graphics_context->command_buffers = draw_cmd_buffers;
 	graphics_context->pipeline_cache = pipeline_cache;
+	graphics_context->shader_optimization = SHADER_OPTIMIZATION;
+	graphics_context->vertex_format = get_supported_vertex_format(curPhysDevice, VERTEX_FORMAT);
 
-	setup_vertex_buffer(graphics_context);
-	setup_uniform_buffer(graphics_context);
-	setup_descriptor_set_layout(graphics_context);
+	// Mesh file from the command line, the cube otherwise
+	if (argc > 1 && !load_mesh(argv[1], &scene_mesh))
+	{
+		scene_mesh_transform = get_mesh_fit_transform(&scene_mesh);
+	}
+	else if (load_default_mesh(&scene_mesh))
+	{
+		goto failed;
+	}
+	instance_count = get_instance_count(curPhysDevice);
+	graphics_context->job_pool = create_job_pool(MAX_CULLING_THREADS);
+	if (argc > 1)
+		get_mesh_cache_name(argv[1], scene_mesh_cache_name, sizeof(scene_mesh_cache_name));
+	if (setup_vertex_buffer(graphics_context, &scene_mesh, argc > 1 ? scene_mesh_cache_name : NULL, get_streaming_budget()) ||
+		setup_scene_meshlets(&scene_mesh) || setup_occlusion_culling(graphics_context, &scene_mesh, instance_count))
+		goto failed;
+	// Everything lives in the vertex and index buffers now
+	free_mesh(&scene_mesh);
+	// Instance nodes and the camera and orbit nodes
+	if (create_scene_graph(&scene_graph, instance_count + 2) ||
+		setup_instance_buffer(graphics_context, instance_count) ||
+		create_culling_system(graphics_context) || setup_uniform_buffer(graphics_context))
+		goto failed;
+	// Nothing was computed yet, so this uploads every transform
+	update_scene_transforms(graphics_context);
 	setup_graphics_pipeline(graphics_context);
+	// Culling one instance on the GPU gains nothing, culling its meshlets on the CPU does
+	scene_cluster_culling = CLUSTER_CULLING && scene_meshlet_count && graphics_context->instance_count == 1;
+	// Queries between instances need more than one, like the software occlusion culling they replace
+	if (OCCLUSION_QUERIES && graphics_context->instance_count > 1)
+		graphics_context->occlusion_queries = create_occlusion_queries(graphics_context, &scene_mesh);
+	graphics_context->gpu_culling = GPU_CULLING && !scene_cluster_culling && !graphics_context->occlusion_culler &&
+		!graphics_context->occlusion_queries && !setup_gpu_culling(graphics_context, &scene_instance_bounds);
+	printf("instances culled %s\n", graphics_context->gpu_culling ?
+		(graphics_context->draw_indirect_count ? "on the gpu, drawn with indirect count" : "on the gpu, drawn indirect") :
+		(scene_cluster_culling ? "on the cpu, with their meshlets" :
+		(graphics_context->occlusion_culler ? "on the cpu, with occlusion culling" :
+		(graphics_context->occlusion_queries ? (graphics_context->conditional_rendering ?
+			"on the cpu, with occlusion queries and conditional rendering" : "on the cpu, with occlusion queries read back") :
+		"on the cpu"))));
+	init_pipeline_key(graphics_context, &scene_pipeline_key);
 	setup_descriptors(graphics_context);
 	build_command_buffers(graphics_context);
 
@@ -1479,8 +2471,28 @@ failed:
 	destroy_buffer(device, graphics_context->vertex_buffer);
 	free_memory(device, graphics_context->vertex_mem);
 
+	// The streaming threads write to index_buffer
+	destroy_geometry_streamer(graphics_context);
 	destroy_buffer(device, graphics_context->index_buffer);
 	free_memory(device, graphics_context->index_mem);
+	free(graphics_context->draws);
+
+	destroy_buffer(device, graphics_context->instance_buffer);
+	free_memory(device, graphics_context->instance_mem);
+	destroy_buffer(device, graphics_context->visible_instance_buffer);
+	free_memory(device, graphics_context->visible_instance_mem);
+	destroy_gpu_culling(graphics_context);
+	destroy_draw_batches(graphics_context, &scene_draw_batches);
+	destroy_culling_system(graphics_context);
+	destroy_occlusion_culler(graphics_context->occlusion_culler);
+	destroy_job_pool(graphics_context->job_pool);
+	destroy_occlusion_queries(graphics_context, graphics_context->occlusion_queries);
+	free_culling_bounds(&scene_instance_bounds);
+	free(scene_visible_instances);
+	free(scene_lod_scratch);
+	free(scene_meshlets);
+	free(scene_meshlet_ranges);
+	destroy_scene_graph(&scene_graph);
 
 	destroy_buffer(device, graphics_context->uniform_buffer_vs);
 	free_memory(device, graphics_context->uniform_memory_vs);
@@ -1511,6 +2523,13 @@ failed:
 		vkFreeMemory(device, graphics_context->depth_stencil_mem, nullptr);
 	}
 
+	if (graphics_context->msaa_color_view)
+	{
+		vkDestroyImageView(device, graphics_context->msaa_color_view, nullptr);
+		vkDestroyImage(device, graphics_context->msaa_color_image, nullptr);
+		vkFreeMemory(device, graphics_context->msaa_color_mem, nullptr);
+	}
+
 	if (graphics_context->framebuffers)
 	{
 		for (uint32_t i = 0; i < graphics_context->image_num; i++)
@@ -1518,13 +2537,14 @@ failed:
 			vkDestroyFramebuffer(device, graphics_context->framebuffers[i], nullptr);
 		}
 	}
+	// Joins the pipeline compiler threads, which still reference the render pass
+	destroy_graphics_pipeline(graphics_context);
+
 	if (graphics_context->render_pass)
 	{
 		vkDestroyRenderPass(device, graphics_context->render_pass, nullptr);
 	}
 
-	destroy_graphics_pipeline(graphics_context);
-
 	if (acquired_image_ready_sema)
 	{
 		vkDestroySemaphore(device, acquired_image_ready_sema, nullptr);
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "mapped_file.h"
+#include <windows.h>
+
+int map_file(const char* file_name, struct MappedFile* mapped_file)
+{
+	LARGE_INTEGER file_size;
+
+	memset(mapped_file, 0, sizeof(*mapped_file));
+
+	// Loaders walk the file front to back
+	mapped_file->file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mapped_file->file == INVALID_HANDLE_VALUE)
+	{
+		printf("cannot open file %s\n", file_name);
+		mapped_file->file = NULL;
+		return -1;
+	}
+
+	if (!GetFileSizeEx(mapped_file->file, &file_size) || file_size.QuadPart <= 0 || (uint64_t)file_size.QuadPart > SIZE_MAX)
+	{
+		printf("cannot map empty or oversized file %s\n", file_name);
+		unmap_file(mapped_file);
+		return -1;
+	}
+	mapped_file->size = (size_t)file_size.QuadPart;
+
+	mapped_file->mapping = CreateFileMappingA(mapped_file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapped_file->mapping)
+	{
+		mapped_file->data = MapViewOfFile(mapped_file->mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (!mapped_file->data)
+	{
+		printf("cannot map file %s\n", file_name);
+		unmap_file(mapped_file);
+		return -1;
+	}
+	return 0;
+}
+
+void unmap_file(struct MappedFile* mapped_file)
+{
+	if (mapped_file->data)
+		UnmapViewOfFile(mapped_file->data);
+	if (mapped_file->mapping)
+		CloseHandle(mapped_file->mapping);
+	if (mapped_file->file)
+		CloseHandle(mapped_file->file);
+	memset(mapped_file, 0, sizeof(*mapped_file));
+}
\ No newline at end of file
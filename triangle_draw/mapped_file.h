@@ -0,0 +1,14 @@
+#pragma once
+#include <stddef.h>
+
+// Read only view of a whole file, pages are brought in by the OS as they are touched
+struct MappedFile
+{
+	const void* data;
+	size_t size;
+	void* file;
+	void* mapping;
+};
+
+extern int map_file(const char* file_name, struct MappedFile* mapped_file);
+extern void unmap_file(struct MappedFile* mapped_file);
\ No newline at end of file
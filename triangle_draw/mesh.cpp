@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <sys/stat.h>
+#include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimize.h"
+#include "mesh_lod.h"
+#include "mesh_meshlet.h"
+#include "mapped_file.h"
+
+static int has_extension(const char* file_name, const char* extension)
+{
+	size_t name_length = strlen(file_name);
+	size_t extension_length = strlen(extension);
+
+	if (name_length < extension_length)
+		return 0;
+
+	for (size_t i = 0; i < extension_length; i++)
+	{
+		char c = file_name[name_length - extension_length + i];
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		if (c != extension[i])
+			return 0;
+	}
+	return 1;
+}
+
+int alloc_mesh(struct Mesh* mesh, uint32_t vertex_count, uint32_t index_count)
+{
+	memset(mesh, 0, sizeof(*mesh));
+	mesh->vertices = (struct Vertex*)malloc((size_t)vertex_count * sizeof(struct Vertex));
+	mesh->indices = (uint32_t*)malloc((size_t)index_count * sizeof(uint32_t));
+	if (!mesh->vertices || !mesh->indices)
+	{
+		printf("cannot allocate mesh with %u vertices and %u indices\n", vertex_count, index_count);
+		free_mesh(mesh);
+		return -1;
+	}
+	mesh->vertex_count = vertex_count;
+	mesh->index_count = index_count;
+	mesh->lods[0].index_count = index_count;
+	mesh->lod_count = 1;
+	return 0;
+}
+
+void free_mesh(struct Mesh* mesh)
+{
+	if (mesh->mapped_file)
+	{
+		unmap_file(mesh->mapped_file);
+		free(mesh->mapped_file);
+		mesh->mapped_file = NULL;
+	}
+	else
+	{
+		free(mesh->vertices);
+		free(mesh->indices);
+		free(mesh->meshlets);
+	}
+	mesh->vertices = NULL;
+	mesh->indices = NULL;
+	mesh->meshlets = NULL;
+}
+
+void compute_mesh_bounds(struct Mesh* mesh)
+{
+	if (!mesh->vertex_count)
+	{
+		mesh->bounds_min = glm::vec3(0.0f);
+		mesh->bounds_max = glm::vec3(0.0f);
+		mesh->sphere_center = glm::vec3(0.0f);
+		mesh->sphere_radius = 0.0f;
+		return;
+	}
+
+	mesh->bounds_min = mesh->vertices[0].position;
+	mesh->bounds_max = mesh->vertices[0].position;
+	for (uint32_t i = 1; i < mesh->vertex_count; i++)
+	{
+		mesh->bounds_min = glm::min(mesh->bounds_min, mesh->vertices[i].position);
+		mesh->bounds_max = glm::max(mesh->bounds_max, mesh->vertices[i].position);
+	}
+
+	// Centered on the box, not minimal but one pass
+	mesh->sphere_center = (mesh->bounds_min + mesh->bounds_max) * 0.5f;
+	mesh->sphere_radius = 0.0f;
+	for (uint32_t i = 0; i < mesh->vertex_count; i++)
+	{
+		mesh->sphere_radius = glm::max(mesh->sphere_radius, glm::length(mesh->vertices[i].position - mesh->sphere_center));
+	}
+}
+
+glm::mat4 get_mesh_fit_transform(const struct Mesh* mesh)
+{
+	glm::vec3 extent = mesh->bounds_max - mesh->bounds_min;
+	glm::vec3 center = (mesh->bounds_min + mesh->bounds_max) * 0.5f;
+	float largest = glm::max(extent.x, glm::max(extent.y, extent.z));
+	float scale = largest > 0.0f ? 1.0f / largest : 1.0f;
+
+	return glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(scale)), -center);
+}
+
+static void report_mesh_load(const char* file_name, const struct Mesh* mesh, size_t file_size, std::chrono::steady_clock::time_point start)
+{
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("loaded %s: %u vertices, %u triangles, %.1f MB in %.1f ms (%.1f MB/s)\n", file_name,
+		mesh->vertex_count, mesh->index_count / 3, file_size / (1024.0 * 1024.0), seconds * 1000.0,
+		seconds > 0.0 ? file_size / (1024.0 * 1024.0) / seconds : 0.0);
+}
+
+void get_mesh_cache_name(const char* file_name, char* cache_name, size_t size)
+{
+	if (has_extension(file_name, MESH_CACHE_EXTENSION))
+		snprintf(cache_name, size, "%s", file_name);
+	else
+		snprintf(cache_name, size, "%s%s", file_name, MESH_CACHE_EXTENSION);
+}
+
+int load_mesh(const char* file_name, struct Mesh* mesh)
+{
+	struct MappedFile file;
+	struct _stat64 source_stat;
+	struct _stat64 cache_stat;
+	char cache_name[MAX_MESH_PATH];
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int ret;
+
+	memset(mesh, 0, sizeof(*mesh));
+	if (has_extension(file_name, MESH_CACHE_EXTENSION))
+	{
+		ret = map_mesh_cache(file_name, mesh, 0, 0);
+		if (!ret)
+			report_mesh_load(file_name, mesh, mesh->mapped_file->size, start);
+		return ret;
+	}
+
+	if (!has_extension(file_name, ".obj") && !has_extension(file_name, ".glb"))
+	{
+		printf("unsupported mesh file %s, expected .obj, .glb or %s\n", file_name, MESH_CACHE_EXTENSION);
+		return -1;
+	}
+
+	if (_stat64(file_name, &source_stat))
+	{
+		printf("cannot open file %s\n", file_name);
+		return -1;
+	}
+
+	// Pages of the cache are only read when the upload touches them, the report covers mapping and validation
+	get_mesh_cache_name(file_name, cache_name, sizeof(cache_name));
+	if (!_stat64(cache_name, &cache_stat) && !map_mesh_cache(cache_name, mesh, source_stat.st_size, source_stat.st_mtime))
+	{
+		report_mesh_load(cache_name, mesh, mesh->mapped_file->size, start);
+		return 0;
+	}
+
+	if (map_file(file_name, &file))
+		return -1;
+
+	ret = has_extension(file_name, ".obj") ? load_obj_mesh(&file, mesh) : load_glb_mesh(&file, mesh);
+	if (!ret)
+	{
+		compute_mesh_bounds(mesh);
+		report_mesh_load(file_name, mesh, file.size, start);
+		// Done once per import, the cache stores the optimized order, the LODs and the meshlets
+		optimize_mesh(mesh, MESH_OPTIMIZATION);
+		build_mesh_lods(mesh, MESH_LOD_COUNT);
+		build_mesh_meshlets(mesh);
+		write_mesh_cache(cache_name, mesh, source_stat.st_size, source_stat.st_mtime);
+	}
+	else
+	{
+		printf("failed to load mesh %s\n", file_name);
+		free_mesh(mesh);
+	}
+
+	unmap_file(&file);
+	return ret;
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+#include "common.h"
+
+// Longest mesh or mesh cache file name
+#define MAX_MESH_PATH 512
+
+struct MappedFile;
+
+// Index range and error of one level of detail, LOD 0 is the full mesh
+struct MeshLod
+{
+	uint32_t first_index;
+	uint32_t index_count;
+	// Simplification error relative to the bounding sphere radius
+	float error;
+};
+
+// Cluster of consecutive LOD 0 triangles, culled on its own when a single instance is drawn
+struct Meshlet
+{
+	uint32_t first_index;
+	uint32_t index_count;
+	// Bounding sphere of the meshlet vertices
+	glm::vec3 center;
+	float radius;
+	// All triangles face away from cameras in the cone around -cone_axis from cone_apex, where
+	// dot(normalize(cone_apex - camera), cone_axis) >= cone_cutoff. A cutoff of 1 never culls.
+	glm::vec3 cone_apex;
+	glm::vec3 cone_axis;
+	float cone_cutoff;
+};
+
+// Packed vertex and index arrays of a whole scene, ready to be copied into vertex and index buffers
+struct Mesh
+{
+	struct Vertex* vertices;
+	uint32_t vertex_count;
+	uint32_t* indices;
+	uint32_t index_count;
+	// Levels of detail sharing the vertices, their index ranges follow each other in indices
+	struct MeshLod lods[MAX_MESH_LODS];
+	uint32_t lod_count;
+	// Clusters of LOD 0 in index order, none for meshes too small to be split
+	struct Meshlet* meshlets;
+	uint32_t meshlet_count;
+	// Axis aligned bounds and bounding sphere of the vertex positions
+	glm::vec3 bounds_min;
+	glm::vec3 bounds_max;
+	glm::vec3 sphere_center;
+	float sphere_radius;
+	// Set when vertices, indices and meshlets point into a mapped mesh cache instead of owned arrays
+	struct MappedFile* mapped_file;
+};
+
+// Loads a Wavefront .obj or binary glTF .glb file, picked by extension. Reports load throughput.
+// Imports are written to a mesh cache next to the file, which is mapped instead while the file is unchanged.
+// A .meshcache file can be loaded directly.
+extern int load_mesh(const char* file_name, struct Mesh* mesh);
+// Name of the mesh cache a mesh file is imported to, a .meshcache file is its own cache
+extern void get_mesh_cache_name(const char* file_name, char* cache_name, size_t size);
+extern int load_obj_mesh(const struct MappedFile* file, struct Mesh* mesh);
+extern int load_glb_mesh(const struct MappedFile* file, struct Mesh* mesh);
+
+// The mesh starts out with one LOD covering all indices
+extern int alloc_mesh(struct Mesh* mesh, uint32_t vertex_count, uint32_t index_count);
+// Releases the vertex, index and meshlet arrays or the cache mapping, counts and bounds stay valid
+extern void free_mesh(struct Mesh* mesh);
+extern void compute_mesh_bounds(struct Mesh* mesh);
+// Model transform fitting the mesh bounds into a unit cube around the origin
+extern glm::mat4 get_mesh_fit_transform(const struct Mesh* mesh);
\ No newline at end of file
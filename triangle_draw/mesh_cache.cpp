@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_meshlet.h"
+#include "mapped_file.h"
+
+static inline uint64_t align_offset(uint64_t offset)
+{
+	return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(uint64_t)(MESH_CACHE_ALIGNMENT - 1);
+}
+
+static int write_padding(FILE* fp, uint64_t offset)
+{
+	static const uint8_t zeros[MESH_CACHE_ALIGNMENT] = { 0 };
+	size_t padding = (size_t)(align_offset(offset) - offset);
+
+	return padding && fwrite(zeros, 1, padding, fp) != padding ? -1 : 0;
+}
+
+int write_mesh_cache(const char* file_name, const struct Mesh* mesh, uint64_t source_size, int64_t source_time)
+{
+	struct MeshCacheHeader header;
+	uint64_t vertex_size = (uint64_t)mesh->vertex_count * sizeof(struct Vertex);
+	uint64_t index_size = (uint64_t)mesh->index_count * sizeof(uint32_t);
+	uint64_t meshlet_size = (uint64_t)mesh->meshlet_count * sizeof(struct Meshlet);
+	uint32_t magic = MESH_CACHE_MAGIC;
+	FILE* fp = NULL;
+	int ret = 0;
+
+	memset(&header, 0, sizeof(header));
+	header.version = MESH_CACHE_VERSION;
+	header.vertex_stride = sizeof(struct Vertex);
+	header.index_stride = sizeof(uint32_t);
+	header.meshlet_stride = sizeof(struct Meshlet);
+	header.optimization = MESH_OPTIMIZATION;
+	header.lod_setting = MESH_LOD_COUNT;
+	header.meshlet_setting = MESHLET_MAX_VERTICES << 16 | MESHLET_MAX_TRIANGLES;
+	header.vertex_count = mesh->vertex_count;
+	header.index_count = mesh->index_count;
+	header.meshlet_count = mesh->meshlet_count;
+	header.vertex_offset = align_offset(sizeof(header));
+	header.index_offset = align_offset(header.vertex_offset + vertex_size);
+	header.meshlet_offset = align_offset(header.index_offset + index_size);
+	header.source_size = source_size;
+	header.source_time = source_time;
+	for (int i = 0; i < 3; i++)
+	{
+		header.bounds_min[i] = mesh->bounds_min[i];
+		header.bounds_max[i] = mesh->bounds_max[i];
+		header.sphere_center[i] = mesh->sphere_center[i];
+	}
+	header.sphere_radius = mesh->sphere_radius;
+	header.lod_count = mesh->lod_count;
+	for (uint32_t i = 0; i < mesh->lod_count; i++)
+	{
+		header.lod_first_index[i] = mesh->lods[i].first_index;
+		header.lod_index_count[i] = mesh->lods[i].index_count;
+		header.lod_error[i] = mesh->lods[i].error;
+	}
+
+	if (fopen_s(&fp, file_name, "wb") || !fp)
+	{
+		printf("cannot open file %s\n", file_name);
+		return -1;
+	}
+
+	// The magic is written last, an interrupted write leaves a file that is rejected on load
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 || write_padding(fp, sizeof(header)) ||
+		fwrite(mesh->vertices, 1, (size_t)vertex_size, fp) != vertex_size || write_padding(fp, header.vertex_offset + vertex_size) ||
+		fwrite(mesh->indices, 1, (size_t)index_size, fp) != index_size || write_padding(fp, header.index_offset + index_size) ||
+		fwrite(mesh->meshlets, 1, (size_t)meshlet_size, fp) != meshlet_size ||
+		fseek(fp, 0, SEEK_SET) || fwrite(&magic, sizeof(magic), 1, fp) != 1 || fflush(fp))
+	{
+		printf("failed to write mesh cache %s\n", file_name);
+		ret = -1;
+	}
+	fclose(fp);
+
+	if (!ret)
+	{
+		printf("saved mesh cache %s (%.1f MB)\n", file_name, (header.meshlet_offset + meshlet_size) / (1024.0 * 1024.0));
+	}
+	return ret;
+}
+
+int map_mesh_cache(const char* file_name, struct Mesh* mesh, uint64_t source_size, int64_t source_time)
+{
+	struct MappedFile* file = (struct MappedFile*)malloc(sizeof(struct MappedFile));
+	struct MeshCacheHeader header;
+
+	memset(mesh, 0, sizeof(*mesh));
+	if (!file || map_file(file_name, file))
+	{
+		free(file);
+		return -1;
+	}
+
+	if (file->size < sizeof(header))
+		goto invalid;
+	memcpy(&header, file->data, sizeof(header));
+
+	if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION ||
+		header.vertex_stride != sizeof(struct Vertex) || header.index_stride != sizeof(uint32_t) ||
+		header.meshlet_stride != sizeof(struct Meshlet))
+		goto invalid;
+
+	if (source_size && (header.source_size != source_size || header.source_time != source_time ||
+		header.optimization != MESH_OPTIMIZATION || header.lod_setting != MESH_LOD_COUNT ||
+		header.meshlet_setting != (MESHLET_MAX_VERTICES << 16 | MESHLET_MAX_TRIANGLES)))
+	{
+		printf("mesh cache %s is out of date\n", file_name);
+		unmap_file(file);
+		free(file);
+		return -1;
+	}
+
+	if (header.vertex_offset < sizeof(header) || header.vertex_offset % MESH_CACHE_ALIGNMENT || header.index_offset % MESH_CACHE_ALIGNMENT ||
+		header.vertex_offset + (uint64_t)header.vertex_count * sizeof(struct Vertex) > header.index_offset ||
+		header.meshlet_offset % MESH_CACHE_ALIGNMENT ||
+		header.index_offset + (uint64_t)header.index_count * sizeof(uint32_t) > header.meshlet_offset ||
+		header.meshlet_offset + (uint64_t)header.meshlet_count * sizeof(struct Meshlet) > file->size ||
+		!header.lod_count || header.lod_count > MAX_MESH_LODS)
+		goto invalid;
+
+	for (uint32_t i = 0; i < header.lod_count; i++)
+	{
+		if ((uint64_t)header.lod_first_index[i] + header.lod_index_count[i] > header.index_count)
+			goto invalid;
+		mesh->lods[i].first_index = header.lod_first_index[i];
+		mesh->lods[i].index_count = header.lod_index_count[i];
+		mesh->lods[i].error = header.lod_error[i];
+	}
+	mesh->lod_count = header.lod_count;
+
+	for (uint32_t i = 0; i < header.meshlet_count; i++)
+	{
+		const struct Meshlet* meshlet = (const struct Meshlet*)((const uint8_t*)file->data + header.meshlet_offset) + i;
+
+		if ((uint64_t)meshlet->first_index + meshlet->index_count > (uint64_t)mesh->lods[0].first_index + mesh->lods[0].index_count)
+			goto invalid;
+	}
+
+	// Indices go straight into the vertex array on the CPU too, one pass is cheap next to the import it replaces
+	for (uint32_t i = 0; i < header.index_count; i++)
+	{
+		if (((const uint32_t*)((const uint8_t*)file->data + header.index_offset))[i] >= header.vertex_count)
+			goto invalid;
+	}
+
+	// No copy, the upload reads straight from the mapped pages
+	mesh->vertices = (struct Vertex*)((const uint8_t*)file->data + header.vertex_offset);
+	mesh->vertex_count = header.vertex_count;
+	mesh->indices = (uint32_t*)((const uint8_t*)file->data + header.index_offset);
+	mesh->index_count = header.index_count;
+	mesh->meshlets = (struct Meshlet*)((const uint8_t*)file->data + header.meshlet_offset);
+	mesh->meshlet_count = header.meshlet_count;
+	mesh->bounds_min = glm::vec3(header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]);
+	mesh->bounds_max = glm::vec3(header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]);
+	mesh->sphere_center = glm::vec3(header.sphere_center[0], header.sphere_center[1], header.sphere_center[2]);
+	mesh->sphere_radius = header.sphere_radius;
+	mesh->mapped_file = file;
+	return 0;
+
+invalid:
+	printf("mesh cache %s is invalid\n", file_name);
+	unmap_file(file);
+	free(file);
+	return -1;
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+#include "common.h"
+
+// Written next to an imported mesh file, e.g. model.obj.meshcache
+#define MESH_CACHE_EXTENSION ".meshcache"
+#define MESH_CACHE_MAGIC 0x4348534d
+#define MESH_CACHE_VERSION 4
+// Blob alignment inside the file. Mapped views start page aligned, so the blobs stay aligned in memory.
+#define MESH_CACHE_ALIGNMENT 256
+
+struct Mesh;
+
+// Header at the start of a mesh cache file, followed by the aligned vertex, index and meshlet blobs
+struct MeshCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertex_stride;
+	uint32_t index_stride;
+	uint32_t meshlet_stride;
+	// MESH_OPTIMIZATION the import was optimized with, a different setting invalidates the cache
+	uint32_t optimization;
+	// MESH_LOD_COUNT the LODs were generated with, a different setting invalidates the cache
+	uint32_t lod_setting;
+	// MESHLET_MAX_VERTICES << 16 | MESHLET_MAX_TRIANGLES the meshlets were built with
+	uint32_t meshlet_setting;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	uint32_t meshlet_count;
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	uint64_t meshlet_offset;
+	// Size and modification time of the imported file, a changed source invalidates the cache
+	uint64_t source_size;
+	int64_t source_time;
+	float bounds_min[3];
+	float bounds_max[3];
+	float sphere_center[3];
+	float sphere_radius;
+	// LOD index ranges inside the index blob
+	uint32_t lod_count;
+	uint32_t lod_first_index[MAX_MESH_LODS];
+	uint32_t lod_index_count[MAX_MESH_LODS];
+	float lod_error[MAX_MESH_LODS];
+};
+
+extern int write_mesh_cache(const char* file_name, const struct Mesh* mesh, uint64_t source_size, int64_t source_time);
+// Maps a mesh cache, the mesh vertices, indices and meshlets then point into the mapping until free_mesh.
+// A source_size of 0 accepts the cache without checking it against its source.
+extern int map_mesh_cache(const char* file_name, struct Mesh* mesh, uint64_t source_size, int64_t source_time);
\ No newline at end of file
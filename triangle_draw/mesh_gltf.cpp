@@ -0,0 +1,545 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mesh.h"
+#include "mapped_file.h"
+
+// Binary glTF 2.0: a 12 byte header followed by a JSON chunk and a BIN chunk.
+// Every triangle primitive of every mesh is appended to one Mesh, node transforms are not applied.
+#define GLB_MAGIC 0x46546c67
+#define GLB_CHUNK_JSON 0x4e4f534a
+#define GLB_CHUNK_BIN 0x004e4942
+#define GLTF_MODE_TRIANGLES 4
+#define JSON_MAX_DEPTH 64
+
+enum GltfComponentType
+{
+	GLTF_BYTE = 5120,
+	GLTF_UNSIGNED_BYTE = 5121,
+	GLTF_SHORT = 5122,
+	GLTF_UNSIGNED_SHORT = 5123,
+	GLTF_UNSIGNED_INT = 5125,
+	GLTF_FLOAT = 5126,
+};
+
+enum JsonType
+{
+	JSON_OBJECT,
+	JSON_ARRAY,
+	JSON_STRING,
+	JSON_PRIMITIVE,
+};
+
+// Tokens are stored in document order, size counts direct children (keys and values both count for objects)
+struct JsonToken
+{
+	uint32_t type;
+	uint32_t start;
+	uint32_t end;
+	uint32_t size;
+};
+
+struct JsonDocument
+{
+	const char* json;
+	uint32_t length;
+	uint32_t pos;
+	struct JsonToken* tokens;
+	uint32_t token_count;
+	uint32_t token_capacity;
+};
+
+struct GltfAccessor
+{
+	const uint8_t* data;
+	uint32_t count;
+	uint32_t component_type;
+	uint32_t components;
+	uint32_t stride;
+	uint32_t normalized;
+};
+
+static int32_t json_add_token(struct JsonDocument* doc, uint32_t type, uint32_t start)
+{
+	if (doc->token_count == doc->token_capacity)
+	{
+		uint32_t capacity = doc->token_capacity ? doc->token_capacity * 2 : 1024;
+		struct JsonToken* tokens = (struct JsonToken*)realloc(doc->tokens, capacity * sizeof(struct JsonToken));
+		if (!tokens)
+			return -1;
+		doc->tokens = tokens;
+		doc->token_capacity = capacity;
+	}
+
+	doc->tokens[doc->token_count].type = type;
+	doc->tokens[doc->token_count].start = start;
+	doc->tokens[doc->token_count].end = start;
+	doc->tokens[doc->token_count].size = 0;
+	return (int32_t)doc->token_count++;
+}
+
+static void json_skip_whitespace(struct JsonDocument* doc)
+{
+	while (doc->pos < doc->length && (doc->json[doc->pos] == ' ' || doc->json[doc->pos] == '\t' ||
+		doc->json[doc->pos] == '\n' || doc->json[doc->pos] == '\r'))
+	{
+		doc->pos++;
+	}
+}
+
+static int json_parse_string(struct JsonDocument* doc)
+{
+	int32_t token;
+
+	// Escapes are skipped, not decoded, glTF keys and enums never need them
+	doc->pos++;
+	token = json_add_token(doc, JSON_STRING, doc->pos);
+	if (token < 0)
+		return -1;
+	while (doc->pos < doc->length && doc->json[doc->pos] != '"')
+	{
+		doc->pos += doc->json[doc->pos] == '\\' ? 2 : 1;
+	}
+	if (doc->pos >= doc->length)
+		return -1;
+
+	doc->tokens[token].end = doc->pos++;
+	return 0;
+}
+
+static int json_parse_value(struct JsonDocument* doc, uint32_t depth)
+{
+	int32_t token;
+	char c;
+
+	json_skip_whitespace(doc);
+	if (doc->pos >= doc->length || depth > JSON_MAX_DEPTH)
+		return -1;
+
+	c = doc->json[doc->pos];
+	if (c == '"')
+		return json_parse_string(doc);
+
+	if (c == '{' || c == '[')
+	{
+		char close = c == '{' ? '}' : ']';
+
+		token = json_add_token(doc, c == '{' ? JSON_OBJECT : JSON_ARRAY, doc->pos);
+		if (token < 0)
+			return -1;
+		doc->pos++;
+
+		json_skip_whitespace(doc);
+		while (doc->pos < doc->length && doc->json[doc->pos] != close)
+		{
+			if (c == '{')
+			{
+				if (doc->json[doc->pos] != '"' || json_parse_string(doc))
+					return -1;
+				json_skip_whitespace(doc);
+				if (doc->pos >= doc->length || doc->json[doc->pos] != ':')
+					return -1;
+				doc->pos++;
+				doc->tokens[token].size++;
+			}
+			if (json_parse_value(doc, depth + 1))
+				return -1;
+			doc->tokens[token].size++;
+
+			json_skip_whitespace(doc);
+			if (doc->pos < doc->length && doc->json[doc->pos] == ',')
+			{
+				doc->pos++;
+				json_skip_whitespace(doc);
+			}
+		}
+		if (doc->pos >= doc->length)
+			return -1;
+
+		doc->tokens[token].end = ++doc->pos;
+		return 0;
+	}
+
+	// Numbers, true, false and null
+	token = json_add_token(doc, JSON_PRIMITIVE, doc->pos);
+	if (token < 0)
+		return -1;
+	while (doc->pos < doc->length && !strchr(",}] \t\r\n", doc->json[doc->pos]))
+	{
+		doc->pos++;
+	}
+	doc->tokens[token].end = doc->pos;
+	return doc->tokens[token].end > doc->tokens[token].start ? 0 : -1;
+}
+
+// Returns the index of the token after the subtree at index
+static uint32_t json_skip(const struct JsonDocument* doc, uint32_t index)
+{
+	uint32_t pending = 1;
+
+	while (pending && index < doc->token_count)
+	{
+		pending += doc->tokens[index].size;
+		pending--;
+		index++;
+	}
+	return index;
+}
+
+static int json_equals(const struct JsonDocument* doc, uint32_t index, const char* string)
+{
+	const struct JsonToken* token = &doc->tokens[index];
+	size_t length = strlen(string);
+
+	return token->type == JSON_STRING && token->end - token->start == length &&
+		!memcmp(doc->json + token->start, string, length);
+}
+
+// Value of key in the object at index, -1 when absent
+static int32_t json_object_get(const struct JsonDocument* doc, int32_t index, const char* key)
+{
+	uint32_t child;
+
+	if (index < 0 || doc->tokens[index].type != JSON_OBJECT)
+		return -1;
+
+	child = index + 1;
+	for (uint32_t i = 0; i < doc->tokens[index].size / 2; i++)
+	{
+		if (json_equals(doc, child, key))
+			return (int32_t)child + 1;
+		child = json_skip(doc, child + 1);
+	}
+	return -1;
+}
+
+static int32_t json_array_get(const struct JsonDocument* doc, int32_t index, uint32_t element)
+{
+	uint32_t child;
+
+	if (index < 0 || doc->tokens[index].type != JSON_ARRAY || element >= doc->tokens[index].size)
+		return -1;
+
+	child = index + 1;
+	for (uint32_t i = 0; i < element; i++)
+	{
+		child = json_skip(doc, child);
+	}
+	return (int32_t)child;
+}
+
+static int64_t json_to_int(const struct JsonDocument* doc, int32_t index, int64_t default_value)
+{
+	const struct JsonToken* token;
+	int64_t value = 0;
+
+	if (index < 0 || doc->tokens[index].type != JSON_PRIMITIVE)
+		return default_value;
+
+	token = &doc->tokens[index];
+	for (uint32_t i = token->start; i < token->end; i++)
+	{
+		if (doc->json[i] < '0' || doc->json[i] > '9' || value > UINT32_MAX)
+			return default_value;
+		value = value * 10 + (doc->json[i] - '0');
+	}
+	return value;
+}
+
+static uint32_t get_component_size(uint32_t component_type)
+{
+	switch (component_type)
+	{
+	case GLTF_BYTE:
+	case GLTF_UNSIGNED_BYTE:
+		return 1;
+	case GLTF_SHORT:
+	case GLTF_UNSIGNED_SHORT:
+		return 2;
+	case GLTF_UNSIGNED_INT:
+	case GLTF_FLOAT:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+static int get_gltf_accessor(const struct JsonDocument* doc, int32_t accessor_index, const uint8_t* bin, uint32_t bin_size,
+	struct GltfAccessor* accessor)
+{
+	int32_t root = 0;
+	int32_t accessor_token = json_array_get(doc, json_object_get(doc, root, "accessors"), (uint32_t)accessor_index);
+	int32_t view_token;
+	int32_t type_token;
+	uint64_t accessor_offset, view_offset, view_length, element_size;
+	uint32_t component_size;
+
+	if (accessor_index < 0 || accessor_token < 0)
+		return -1;
+
+	// Sparse accessors and accessors without a buffer view are not supported
+	view_token = json_array_get(doc, json_object_get(doc, root, "bufferViews"),
+		(uint32_t)json_to_int(doc, json_object_get(doc, accessor_token, "bufferView"), UINT32_MAX));
+	if (view_token < 0 || json_to_int(doc, json_object_get(doc, view_token, "buffer"), 0) != 0)
+	{
+		printf("gltf accessor %d has no buffer view in the GLB buffer\n", accessor_index);
+		return -1;
+	}
+
+	memset(accessor, 0, sizeof(*accessor));
+	accessor->count = (uint32_t)json_to_int(doc, json_object_get(doc, accessor_token, "count"), 0);
+	accessor->component_type = (uint32_t)json_to_int(doc, json_object_get(doc, accessor_token, "componentType"), 0);
+	accessor->normalized = json_object_get(doc, accessor_token, "normalized") >= 0 &&
+		doc->json[doc->tokens[json_object_get(doc, accessor_token, "normalized")].start] == 't';
+
+	type_token = json_object_get(doc, accessor_token, "type");
+	if (type_token >= 0 && json_equals(doc, type_token, "SCALAR"))
+		accessor->components = 1;
+	else if (type_token >= 0 && json_equals(doc, type_token, "VEC2"))
+		accessor->components = 2;
+	else if (type_token >= 0 && json_equals(doc, type_token, "VEC3"))
+		accessor->components = 3;
+	else if (type_token >= 0 && json_equals(doc, type_token, "VEC4"))
+		accessor->components = 4;
+
+	component_size = get_component_size(accessor->component_type);
+	if (!component_size || !accessor->components)
+	{
+		printf("gltf accessor %d has an unsupported type\n", accessor_index);
+		return -1;
+	}
+	element_size = (uint64_t)component_size * accessor->components;
+
+	accessor_offset = json_to_int(doc, json_object_get(doc, accessor_token, "byteOffset"), 0);
+	view_offset = json_to_int(doc, json_object_get(doc, view_token, "byteOffset"), 0);
+	view_length = json_to_int(doc, json_object_get(doc, view_token, "byteLength"), 0);
+	accessor->stride = (uint32_t)json_to_int(doc, json_object_get(doc, view_token, "byteStride"), element_size);
+
+	if (view_offset + view_length > bin_size || (accessor->count &&
+		accessor_offset + (uint64_t)accessor->stride * (accessor->count - 1) + element_size > view_length))
+	{
+		printf("gltf accessor %d is out of the GLB buffer bounds\n", accessor_index);
+		return -1;
+	}
+
+	accessor->data = bin + view_offset + accessor_offset;
+	return 0;
+}
+
+static float read_gltf_component(const struct GltfAccessor* accessor, uint32_t element, uint32_t component)
+{
+	const uint8_t* p = accessor->data + (size_t)element * accessor->stride + component * get_component_size(accessor->component_type);
+	float f;
+	uint16_t u16;
+	int16_t s16;
+	uint32_t u32;
+
+	switch (accessor->component_type)
+	{
+	case GLTF_FLOAT:
+		memcpy(&f, p, sizeof(f));
+		return f;
+	case GLTF_UNSIGNED_BYTE:
+		return accessor->normalized ? p[0] / 255.0f : p[0];
+	case GLTF_BYTE:
+		return accessor->normalized ? glm::max((int8_t)p[0] / 127.0f, -1.0f) : (int8_t)p[0];
+	case GLTF_UNSIGNED_SHORT:
+		memcpy(&u16, p, sizeof(u16));
+		return accessor->normalized ? u16 / 65535.0f : u16;
+	case GLTF_SHORT:
+		memcpy(&s16, p, sizeof(s16));
+		return accessor->normalized ? glm::max(s16 / 32767.0f, -1.0f) : s16;
+	case GLTF_UNSIGNED_INT:
+		memcpy(&u32, p, sizeof(u32));
+		return (float)u32;
+	default:
+		return 0.0f;
+	}
+}
+
+static uint32_t read_gltf_index(const struct GltfAccessor* accessor, uint32_t element)
+{
+	const uint8_t* p = accessor->data + (size_t)element * accessor->stride;
+	uint16_t u16;
+	uint32_t u32;
+
+	switch (accessor->component_type)
+	{
+	case GLTF_UNSIGNED_BYTE:
+		return p[0];
+	case GLTF_UNSIGNED_SHORT:
+		memcpy(&u16, p, sizeof(u16));
+		return u16;
+	// Any other type is rejected when the accessor is read
+	default:
+		memcpy(&u32, p, sizeof(u32));
+		return u32;
+	}
+}
+
+// Walks every triangle primitive. Counts vertices and indices when mesh is NULL, fills mesh otherwise.
+static int read_gltf_primitives(const struct JsonDocument* doc, const uint8_t* bin, uint32_t bin_size,
+	struct Mesh* mesh, uint64_t* vertex_count, uint64_t* index_count)
+{
+	int32_t meshes = json_object_get(doc, 0, "meshes");
+	uint32_t mesh_count = meshes >= 0 ? doc->tokens[meshes].size : 0;
+
+	*vertex_count = 0;
+	*index_count = 0;
+	for (uint32_t m = 0; m < mesh_count; m++)
+	{
+		int32_t primitives = json_object_get(doc, json_array_get(doc, meshes, m), "primitives");
+		uint32_t primitive_count = primitives >= 0 ? doc->tokens[primitives].size : 0;
+
+		for (uint32_t p = 0; p < primitive_count; p++)
+		{
+			int32_t primitive = json_array_get(doc, primitives, p);
+			int32_t attributes = json_object_get(doc, primitive, "attributes");
+			int32_t indices = json_object_get(doc, primitive, "indices");
+			int32_t colors = json_object_get(doc, attributes, "COLOR_0");
+			struct GltfAccessor position_accessor, color_accessor, index_accessor;
+			uint32_t base_vertex = (uint32_t)*vertex_count;
+			uint32_t primitive_index_count;
+
+			if (json_to_int(doc, json_object_get(doc, primitive, "mode"), GLTF_MODE_TRIANGLES) != GLTF_MODE_TRIANGLES)
+			{
+				printf("skipping gltf mesh %u primitive %u, only triangle lists are supported\n", m, p);
+				continue;
+			}
+
+			if (get_gltf_accessor(doc, (int32_t)json_to_int(doc, json_object_get(doc, attributes, "POSITION"), -1), bin, bin_size, &position_accessor))
+				return -1;
+			if (position_accessor.component_type != GLTF_FLOAT || position_accessor.components != 3)
+			{
+				printf("gltf positions must be float VEC3\n");
+				return -1;
+			}
+			if (colors >= 0 && get_gltf_accessor(doc, (int32_t)json_to_int(doc, colors, -1), bin, bin_size, &color_accessor))
+				return -1;
+			if (colors >= 0 && color_accessor.components != 3 && color_accessor.components != 4)
+			{
+				printf("gltf colors must be VEC3 or VEC4\n");
+				return -1;
+			}
+			if (indices >= 0 && get_gltf_accessor(doc, (int32_t)json_to_int(doc, indices, -1), bin, bin_size, &index_accessor))
+				return -1;
+			if (indices >= 0 && (index_accessor.components != 1 || (index_accessor.component_type != GLTF_UNSIGNED_BYTE &&
+				index_accessor.component_type != GLTF_UNSIGNED_SHORT && index_accessor.component_type != GLTF_UNSIGNED_INT)))
+			{
+				printf("gltf indices must be unsigned byte, short or int SCALAR\n");
+				return -1;
+			}
+
+			primitive_index_count = indices >= 0 ? index_accessor.count : position_accessor.count;
+			// Primitives are appended back to back, a partial triangle would shift every later one
+			if (primitive_index_count % 3)
+			{
+				printf("gltf mesh %u primitive %u has %u indices, not whole triangles\n", m, p, primitive_index_count);
+				return -1;
+			}
+			if (mesh)
+			{
+				for (uint32_t i = 0; i < position_accessor.count; i++)
+				{
+					struct Vertex* v = &mesh->vertices[base_vertex + i];
+
+					v->position = glm::vec3(read_gltf_component(&position_accessor, i, 0),
+						read_gltf_component(&position_accessor, i, 1), read_gltf_component(&position_accessor, i, 2));
+					v->color = colors >= 0 && color_accessor.count == position_accessor.count ?
+						glm::vec3(read_gltf_component(&color_accessor, i, 0), read_gltf_component(&color_accessor, i, 1),
+							read_gltf_component(&color_accessor, i, 2)) : glm::vec3(1.0f, 1.0f, 1.0f);
+				}
+
+				for (uint32_t i = 0; i < primitive_index_count; i++)
+				{
+					uint32_t index = indices >= 0 ? read_gltf_index(&index_accessor, i) : i;
+					if (index >= position_accessor.count)
+					{
+						printf("gltf mesh %u primitive %u references missing vertex %u\n", m, p, index);
+						return -1;
+					}
+					mesh->indices[*index_count + i] = base_vertex + index;
+				}
+			}
+
+			*vertex_count += position_accessor.count;
+			*index_count += primitive_index_count;
+			if (*vertex_count > UINT32_MAX || *index_count > UINT32_MAX)
+			{
+				printf("gltf scene is too large\n");
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+int load_glb_mesh(const struct MappedFile* file, struct Mesh* mesh)
+{
+	const uint8_t* data = (const uint8_t*)file->data;
+	uint32_t header[3];
+	uint32_t chunk[2];
+	const uint8_t* bin = NULL;
+	uint32_t bin_size = 0;
+	struct JsonDocument doc;
+	uint64_t vertex_count, index_count;
+	size_t offset;
+	int ret = -1;
+
+	memset(&doc, 0, sizeof(doc));
+	if (file->size < sizeof(header) + sizeof(chunk))
+		return -1;
+
+	memcpy(header, data, sizeof(header));
+	// The length covers the header and at least the JSON chunk header
+	if (header[0] != GLB_MAGIC || header[1] != 2 || header[2] > file->size || header[2] < sizeof(header) + sizeof(chunk))
+	{
+		printf("not a glTF 2.0 binary file\n");
+		return -1;
+	}
+
+	memcpy(chunk, data + sizeof(header), sizeof(chunk));
+	offset = sizeof(header) + sizeof(chunk);
+	if (chunk[1] != GLB_CHUNK_JSON || chunk[0] > header[2] - offset)
+	{
+		printf("glTF binary file has no JSON chunk\n");
+		return -1;
+	}
+	doc.json = (const char*)data + offset;
+	doc.length = chunk[0];
+	offset += chunk[0];
+
+	// The BIN chunk is optional, glTF only requires it when accessors use it
+	if (offset <= header[2] && header[2] - offset >= sizeof(chunk))
+	{
+		memcpy(chunk, data + offset, sizeof(chunk));
+		offset += sizeof(chunk);
+		if (chunk[1] == GLB_CHUNK_BIN && chunk[0] <= header[2] - offset)
+		{
+			bin = data + offset;
+			bin_size = chunk[0];
+		}
+	}
+
+	if (json_parse_value(&doc, 0) || doc.tokens[0].type != JSON_OBJECT)
+	{
+		printf("glTF JSON chunk is malformed\n");
+		goto done;
+	}
+
+	if (read_gltf_primitives(&doc, bin, bin_size, NULL, &vertex_count, &index_count))
+		goto done;
+	if (!index_count)
+	{
+		printf("glTF file has no triangles\n");
+		goto done;
+	}
+
+	if (alloc_mesh(mesh, (uint32_t)vertex_count, (uint32_t)index_count))
+		goto done;
+	ret = read_gltf_primitives(&doc, bin, bin_size, mesh, &vertex_count, &index_count);
+
+done:
+	free(doc.tokens);
+	return ret;
+}
\ No newline at end of file
@@ -0,0 +1,487 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include "mesh.h"
+#include "mesh_lod.h"
+#include "mesh_optimize.h"
+
+// Border planes count this much more than surface planes, so open edges keep their shape
+#define BORDER_QUADRIC_WEIGHT 10.0f
+// Collapses rotating a triangle normal by more than about 75 degrees are rejected
+#define MIN_COLLAPSE_NORMAL_COS 0.25f
+
+enum VertexKind
+{
+	// Interior vertex, collapses onto any neighbor
+	VERTEX_MANIFOLD,
+	// On one open border, collapses along it
+	VERTEX_BORDER,
+	// Seam, non-manifold or border corner, never moves
+	VERTEX_LOCKED,
+};
+
+// Symmetric 4x4 error quadric, p^T A p + 2 b.p + c summed over planes, with the total plane weight
+struct Quadric
+{
+	float a00, a11, a22, a01, a02, a12;
+	float b0, b1, b2;
+	float c;
+	float weight;
+};
+
+struct Collapse
+{
+	float cost;
+	uint32_t vertex;
+	uint32_t target;
+};
+
+// Directed edges between position ids, open addressing
+struct EdgeTable
+{
+	uint64_t* keys;
+	uint32_t capacity;
+};
+
+static inline uint32_t hash_uint64(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	return (uint32_t)key;
+}
+
+static void add_plane_quadric(struct Quadric* q, glm::vec3 normal, float distance, float weight)
+{
+	q->a00 += weight * normal.x * normal.x;
+	q->a11 += weight * normal.y * normal.y;
+	q->a22 += weight * normal.z * normal.z;
+	q->a01 += weight * normal.x * normal.y;
+	q->a02 += weight * normal.x * normal.z;
+	q->a12 += weight * normal.y * normal.z;
+	q->b0 += weight * normal.x * distance;
+	q->b1 += weight * normal.y * distance;
+	q->b2 += weight * normal.z * distance;
+	q->c += weight * distance * distance;
+	q->weight += weight;
+}
+
+static void add_quadric(struct Quadric* q, const struct Quadric* other)
+{
+	q->a00 += other->a00;
+	q->a11 += other->a11;
+	q->a22 += other->a22;
+	q->a01 += other->a01;
+	q->a02 += other->a02;
+	q->a12 += other->a12;
+	q->b0 += other->b0;
+	q->b1 += other->b1;
+	q->b2 += other->b2;
+	q->c += other->c;
+	q->weight += other->weight;
+}
+
+// Weighted mean squared distance of p to the planes of q
+static float quadric_error(const struct Quadric* q, glm::vec3 p)
+{
+	float error = q->a00 * p.x * p.x + q->a11 * p.y * p.y + q->a22 * p.z * p.z +
+		2.0f * (q->a01 * p.x * p.y + q->a02 * p.x * p.z + q->a12 * p.y * p.z) +
+		2.0f * (q->b0 * p.x + q->b1 * p.y + q->b2 * p.z) + q->c;
+
+	return q->weight > 0.0f ? fabsf(error) / q->weight : 0.0f;
+}
+
+static int compare_collapses(const void* a, const void* b)
+{
+	float cost_a = ((const struct Collapse*)a)->cost;
+	float cost_b = ((const struct Collapse*)b)->cost;
+
+	return cost_a < cost_b ? -1 : cost_a > cost_b;
+}
+
+static uint64_t* edge_table_find(struct EdgeTable* table, uint64_t key)
+{
+	uint32_t i = hash_uint64(key) & (table->capacity - 1);
+
+	while (table->keys[i] != UINT64_MAX && table->keys[i] != key)
+		i = (i + 1) & (table->capacity - 1);
+	return &table->keys[i];
+}
+
+static int edge_exists(struct EdgeTable* table, uint32_t a, uint32_t b)
+{
+	uint64_t key = (uint64_t)a << 32 | b;
+	return *edge_table_find(table, key) == key;
+}
+
+// Vertices sharing a position get one position id, so seams are found and quadrics are shared across them
+static uint32_t build_position_ids(const glm::vec3* positions, uint32_t vertex_count, uint32_t* position_ids)
+{
+	uint32_t capacity = 16;
+	uint32_t* table;
+	uint32_t count = 0;
+
+	while (capacity < vertex_count * 2)
+		capacity *= 2;
+	table = (uint32_t*)malloc((size_t)capacity * sizeof(uint32_t));
+	if (!table)
+		return 0;
+	memset(table, 0xff, (size_t)capacity * sizeof(uint32_t));
+
+	for (uint32_t v = 0; v < vertex_count; v++)
+	{
+		uint32_t bits[3];
+		uint32_t i;
+
+		memcpy(bits, &positions[v], sizeof(bits));
+		i = hash_uint64(((uint64_t)bits[0] << 32 | bits[1]) ^ ((uint64_t)bits[2] * 0x9e3779b97f4a7c15ull)) & (capacity - 1);
+		while (table[i] != UINT32_MAX && memcmp(&positions[table[i]], &positions[v], sizeof(glm::vec3)))
+			i = (i + 1) & (capacity - 1);
+
+		if (table[i] == UINT32_MAX)
+		{
+			table[i] = v;
+			position_ids[v] = count++;
+		}
+		else
+		{
+			position_ids[v] = position_ids[table[i]];
+		}
+	}
+	free(table);
+	return count;
+}
+
+// Classifies every position from the current triangles: open edges only have one direction
+static void classify_vertices(struct EdgeTable* edges, const uint32_t* indices, uint32_t index_count, const uint32_t* position_ids,
+	const uint32_t* wedge_counts, uint32_t position_count, uint8_t* open_out, uint8_t* open_in, uint8_t* kinds)
+{
+	memset(edges->keys, 0xff, (size_t)edges->capacity * sizeof(uint64_t));
+	memset(open_out, 0, position_count);
+	memset(open_in, 0, position_count);
+	memset(kinds, VERTEX_MANIFOLD, position_count);
+
+	for (uint32_t i = 0; i < index_count; i++)
+	{
+		uint32_t a = position_ids[indices[i]];
+		uint32_t b = position_ids[indices[i - i % 3 + (i + 1) % 3]];
+		uint64_t key = (uint64_t)a << 32 | b;
+		uint64_t* slot = edge_table_find(edges, key);
+
+		// The same directed edge twice is non-manifold
+		if (*slot == key)
+		{
+			kinds[a] = VERTEX_LOCKED;
+			kinds[b] = VERTEX_LOCKED;
+		}
+		*slot = key;
+	}
+
+	for (uint32_t i = 0; i < index_count; i++)
+	{
+		uint32_t a = position_ids[indices[i]];
+		uint32_t b = position_ids[indices[i - i % 3 + (i + 1) % 3]];
+
+		if (!edge_exists(edges, b, a))
+		{
+			open_out[a] = open_out[a] < 255 ? open_out[a] + 1 : 255;
+			open_in[b] = open_in[b] < 255 ? open_in[b] + 1 : 255;
+		}
+	}
+
+	for (uint32_t p = 0; p < position_count; p++)
+	{
+		if (wedge_counts[p] > 1 || open_out[p] != open_in[p] || open_out[p] > 1)
+			kinds[p] = VERTEX_LOCKED;
+		else if (open_out[p] == 1 && kinds[p] != VERTEX_LOCKED)
+			kinds[p] = VERTEX_BORDER;
+	}
+}
+
+// Moving vertex onto target must not flip the triangles around vertex that survive
+static int collapse_flips(const glm::vec3* positions, const uint32_t* indices, const uint32_t* triangle_offsets,
+	const uint32_t* triangles, uint32_t vertex, uint32_t target)
+{
+	for (uint32_t k = triangle_offsets[vertex]; k < triangle_offsets[vertex + 1]; k++)
+	{
+		const uint32_t* triangle = &indices[triangles[k] * 3];
+		glm::vec3 corners[3];
+		glm::vec3 normal, moved_normal;
+
+		if (triangle[0] == target || triangle[1] == target || triangle[2] == target)
+			continue;
+
+		for (uint32_t c = 0; c < 3; c++)
+			corners[c] = positions[triangle[c]];
+		normal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+		for (uint32_t c = 0; c < 3; c++)
+			corners[c] = triangle[c] == vertex ? positions[target] : corners[c];
+		moved_normal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+
+		if (glm::dot(normal, moved_normal) < MIN_COLLAPSE_NORMAL_COS * glm::length(normal) * glm::length(moved_normal))
+			return 1;
+	}
+	return 0;
+}
+
+uint32_t simplify_mesh(const struct Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+	uint32_t target_index_count, float* error, uint32_t* destination)
+{
+	glm::vec3* positions = (glm::vec3*)malloc((size_t)vertex_count * sizeof(glm::vec3));
+	uint32_t* position_ids = (uint32_t*)malloc((size_t)vertex_count * sizeof(uint32_t));
+	uint32_t* wedge_counts = (uint32_t*)calloc(vertex_count, sizeof(uint32_t));
+	struct Quadric* quadrics = (struct Quadric*)calloc(vertex_count, sizeof(struct Quadric));
+	uint8_t* open_out = (uint8_t*)malloc(vertex_count);
+	uint8_t* open_in = (uint8_t*)malloc(vertex_count);
+	uint8_t* kinds = (uint8_t*)malloc(vertex_count);
+	uint8_t* locked = (uint8_t*)malloc(vertex_count);
+	uint32_t* triangle_offsets = (uint32_t*)malloc(((size_t)vertex_count + 1) * sizeof(uint32_t));
+	uint32_t* triangles = (uint32_t*)malloc((size_t)index_count * sizeof(uint32_t));
+	uint32_t* collapse_remap = (uint32_t*)malloc((size_t)vertex_count * sizeof(uint32_t));
+	struct Collapse* collapses = (struct Collapse*)malloc((size_t)index_count * sizeof(struct Collapse));
+	struct EdgeTable edges = { NULL, 16 };
+	glm::vec3 bounds_min, bounds_max, center;
+	float extent, scale, max_error = 0.0f;
+	uint32_t position_count;
+
+	index_count -= index_count % 3;
+	memcpy(destination, indices, (size_t)index_count * sizeof(uint32_t));
+	*error = 0.0f;
+
+	while (edges.capacity < index_count * 2)
+		edges.capacity *= 2;
+	edges.keys = (uint64_t*)malloc((size_t)edges.capacity * sizeof(uint64_t));
+
+	if (!positions || !position_ids || !wedge_counts || !quadrics || !open_out || !open_in || !kinds || !locked ||
+		!triangle_offsets || !triangles || !collapse_remap || !collapses || !edges.keys || !vertex_count)
+	{
+		goto done;
+	}
+
+	// Errors are computed in a unit sized box, so float quadrics keep their precision on any mesh scale
+	bounds_min = bounds_max = vertices[0].position;
+	for (uint32_t v = 1; v < vertex_count; v++)
+	{
+		bounds_min = glm::min(bounds_min, vertices[v].position);
+		bounds_max = glm::max(bounds_max, vertices[v].position);
+	}
+	center = (bounds_min + bounds_max) * 0.5f;
+	extent = glm::max(bounds_max.x - bounds_min.x, glm::max(bounds_max.y - bounds_min.y, bounds_max.z - bounds_min.z));
+	scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+	for (uint32_t v = 0; v < vertex_count; v++)
+		positions[v] = (vertices[v].position - center) * scale;
+
+	position_count = build_position_ids(positions, vertex_count, position_ids);
+	if (!position_count)
+		goto done;
+	for (uint32_t v = 0; v < vertex_count; v++)
+		wedge_counts[position_ids[v]]++;
+
+	// Area weighted triangle planes
+	for (uint32_t i = 0; i < index_count; i += 3)
+	{
+		glm::vec3 p0 = positions[destination[i]], p1 = positions[destination[i + 1]], p2 = positions[destination[i + 2]];
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float area = glm::length(normal);
+
+		if (area <= 0.0f)
+			continue;
+		normal = normal / area;
+		for (uint32_t c = 0; c < 3; c++)
+			add_plane_quadric(&quadrics[position_ids[destination[i + c]]], normal, -glm::dot(normal, p0), area * 0.5f);
+	}
+
+	// Planes through open edges, perpendicular to their triangle
+	classify_vertices(&edges, destination, index_count, position_ids, wedge_counts, position_count, open_out, open_in, kinds);
+	for (uint32_t i = 0; i < index_count; i++)
+	{
+		uint32_t a = destination[i];
+		uint32_t b = destination[i - i % 3 + (i + 1) % 3];
+		uint32_t c = destination[i - i % 3 + (i + 2) % 3];
+		glm::vec3 edge = positions[b] - positions[a];
+		glm::vec3 normal = glm::cross(edge, glm::cross(edge, positions[c] - positions[a]));
+		float length = glm::length(edge);
+
+		if (edge_exists(&edges, position_ids[b], position_ids[a]) || length <= 0.0f || glm::length(normal) <= 0.0f)
+			continue;
+		normal = glm::normalize(normal);
+		add_plane_quadric(&quadrics[position_ids[a]], normal, -glm::dot(normal, positions[a]), length * BORDER_QUADRIC_WEIGHT);
+		add_plane_quadric(&quadrics[position_ids[b]], normal, -glm::dot(normal, positions[a]), length * BORDER_QUADRIC_WEIGHT);
+	}
+
+	// Passes of independent collapses, cheapest first, until the target is reached or nothing collapses
+	while (index_count > target_index_count)
+	{
+		uint32_t collapse_count = 0;
+		uint32_t collapse_goal = (index_count - target_index_count) / 6 + 1;
+		uint32_t collapsed = 0;
+		uint32_t write = 0;
+
+		classify_vertices(&edges, destination, index_count, position_ids, wedge_counts, position_count, open_out, open_in, kinds);
+
+		// Triangles around each vertex
+		memset(triangle_offsets, 0, ((size_t)vertex_count + 1) * sizeof(uint32_t));
+		for (uint32_t i = 0; i < index_count; i++)
+			triangle_offsets[destination[i] + 1]++;
+		for (uint32_t v = 0; v < vertex_count; v++)
+			triangle_offsets[v + 1] += triangle_offsets[v];
+		for (uint32_t i = 0; i < index_count; i++)
+			triangles[triangle_offsets[destination[i]]++] = i / 3;
+		for (uint32_t v = vertex_count; v > 0; v--)
+			triangle_offsets[v] = triangle_offsets[v - 1];
+		triangle_offsets[0] = 0;
+
+		for (uint32_t i = 0; i < index_count; i++)
+		{
+			uint32_t ends[2] = { destination[i], destination[i - i % 3 + (i + 1) % 3] };
+			struct Collapse best = { INFINITY, 0, 0 };
+
+			for (uint32_t d = 0; d < 2; d++)
+			{
+				uint32_t vertex = ends[d], target = ends[1 - d];
+				uint32_t pv = position_ids[vertex], pt = position_ids[target];
+				struct Quadric merged;
+				float cost;
+
+				if (pv == pt || kinds[pv] == VERTEX_LOCKED)
+					continue;
+				if (kinds[pv] == VERTEX_BORDER && edge_exists(&edges, pv, pt) == edge_exists(&edges, pt, pv))
+					continue;
+
+				merged = quadrics[pv];
+				add_quadric(&merged, &quadrics[pt]);
+				cost = quadric_error(&merged, positions[target]);
+				if (cost < best.cost)
+				{
+					best.cost = cost;
+					best.vertex = vertex;
+					best.target = target;
+				}
+			}
+			if (best.cost < INFINITY)
+				collapses[collapse_count++] = best;
+		}
+		if (!collapse_count)
+			break;
+
+		qsort(collapses, collapse_count, sizeof(struct Collapse), compare_collapses);
+		memset(locked, 0, vertex_count);
+		for (uint32_t v = 0; v < vertex_count; v++)
+			collapse_remap[v] = v;
+
+		for (uint32_t c = 0; c < collapse_count && collapsed < collapse_goal; c++)
+		{
+			uint32_t vertex = collapses[c].vertex, target = collapses[c].target;
+
+			if (locked[vertex] || locked[target] ||
+				collapse_flips(positions, destination, triangle_offsets, triangles, vertex, target))
+				continue;
+
+			collapse_remap[vertex] = target;
+			add_quadric(&quadrics[position_ids[target]], &quadrics[position_ids[vertex]]);
+			max_error = glm::max(max_error, collapses[c].cost);
+			collapsed++;
+
+			// The triangles around vertex change, so their corners sit out the rest of the pass
+			for (uint32_t k = triangle_offsets[vertex]; k < triangle_offsets[vertex + 1]; k++)
+			{
+				for (uint32_t corner = 0; corner < 3; corner++)
+					locked[destination[triangles[k] * 3 + corner]] = 1;
+			}
+		}
+		if (!collapsed)
+			break;
+
+		// Collapsed triangles degenerate and are dropped
+		for (uint32_t i = 0; i < index_count; i += 3)
+		{
+			uint32_t a = collapse_remap[destination[i]];
+			uint32_t b = collapse_remap[destination[i + 1]];
+			uint32_t c = collapse_remap[destination[i + 2]];
+
+			if (a == b || b == c || a == c)
+				continue;
+			destination[write++] = a;
+			destination[write++] = b;
+			destination[write++] = c;
+		}
+		index_count = write;
+	}
+
+	*error = sqrtf(max_error) / scale;
+
+done:
+	free(positions);
+	free(position_ids);
+	free(wedge_counts);
+	free(quadrics);
+	free(open_out);
+	free(open_in);
+	free(kinds);
+	free(locked);
+	free(triangle_offsets);
+	free(triangles);
+	free(collapse_remap);
+	free(collapses);
+	free(edges.keys);
+	return index_count;
+}
+
+int build_mesh_lods(struct Mesh* mesh, uint32_t lod_count)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	uint32_t base_index_count = mesh->lods[0].index_count;
+	uint32_t* indices;
+	uint32_t* simplified;
+
+	lod_count = lod_count < MAX_MESH_LODS ? lod_count : MAX_MESH_LODS;
+	if (lod_count <= 1 || mesh->mapped_file || mesh->lod_count != 1 || base_index_count / 3 < MIN_MESH_LOD_TRIANGLES * 2)
+		return 0;
+
+	// The LOD sizes halve, so all of them fit into another LOD 0
+	indices = (uint32_t*)realloc(mesh->indices, (size_t)base_index_count * 2 * sizeof(uint32_t));
+	simplified = (uint32_t*)malloc((size_t)base_index_count * sizeof(uint32_t));
+	mesh->indices = indices ? indices : mesh->indices;
+	if (!indices || !simplified)
+	{
+		printf("cannot allocate mesh LOD indices\n");
+		free(simplified);
+		return -1;
+	}
+
+	// Every LOD starts from LOD 0, so its error is measured against the full mesh
+	while (mesh->lod_count < lod_count)
+	{
+		const struct MeshLod* previous = &mesh->lods[mesh->lod_count - 1];
+		struct MeshLod* lod = &mesh->lods[mesh->lod_count];
+		uint32_t target = (uint32_t)(previous->index_count / 3 * MESH_LOD_REDUCTION) * 3;
+		float error;
+
+		if (target / 3 < MIN_MESH_LOD_TRIANGLES || mesh->index_count + previous->index_count > base_index_count * 2)
+			break;
+
+		lod->first_index = mesh->index_count;
+		lod->index_count = simplify_mesh(mesh->vertices, mesh->vertex_count, mesh->indices, base_index_count, target, &error, simplified);
+		// Simplification stalled on locked vertices, a barely smaller LOD is not worth a draw
+		if (!lod->index_count || lod->index_count > previous->index_count - previous->index_count / 8)
+			break;
+		memcpy(mesh->indices + lod->first_index, simplified, (size_t)lod->index_count * sizeof(uint32_t));
+
+		optimize_vertex_cache(mesh->indices + lod->first_index, lod->index_count, mesh->vertex_count);
+		lod->error = glm::max(previous->error, mesh->sphere_radius > 0.0f ? error / mesh->sphere_radius : 0.0f);
+		mesh->index_count += lod->index_count;
+		mesh->lod_count++;
+	}
+
+	free(simplified);
+	indices = (uint32_t*)realloc(mesh->indices, (size_t)mesh->index_count * sizeof(uint32_t));
+	mesh->indices = indices ? indices : mesh->indices;
+
+	printf("mesh LODs:");
+	for (uint32_t i = 0; i < mesh->lod_count; i++)
+		printf(" %u (%.4f)", mesh->lods[i].index_count / 3, mesh->lods[i].error);
+	printf(" triangles in %.1f ms\n", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#pragma once
+#include "common.h"
+
+// Each LOD targets this fraction of the triangles of the previous one
+#define MESH_LOD_REDUCTION 0.5f
+// No LODs are generated below this many triangles
+#define MIN_MESH_LOD_TRIANGLES 64
+
+struct Mesh;
+
+// Quadric error metric edge collapse. Vertices only collapse onto their neighbors, so the result indexes the
+// original vertices and shares their buffer. Seams between vertices with equal positions stay locked, open borders
+// only collapse along themselves. Writes at most index_count indices to destination and returns their count,
+// error receives the largest collapse error in position units.
+extern uint32_t simplify_mesh(const struct Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+	uint32_t target_index_count, float* error, uint32_t* destination);
+// Appends up to lod_count - 1 simplified LODs of LOD 0 to an owned mesh, each optimized for the vertex cache
+extern int build_mesh_lods(struct Mesh* mesh, uint32_t lod_count);
\ No newline at end of file
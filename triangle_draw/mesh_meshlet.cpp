@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include "mesh.h"
+#include "mesh_meshlet.h"
+
+// Bounding sphere around the box of the meshlet vertices and the cone of its triangle normals
+static void compute_meshlet_bounds(const struct Vertex* vertices, const uint32_t* indices, struct Meshlet* meshlet)
+{
+	glm::vec3 bounds_min = vertices[indices[meshlet->first_index]].position;
+	glm::vec3 bounds_max = bounds_min;
+	glm::vec3 axis = glm::vec3(0.0f);
+	float min_cos = 1.0f;
+	float max_t = 0.0f;
+	float axis_length;
+
+	for (uint32_t i = meshlet->first_index; i < meshlet->first_index + meshlet->index_count; i++)
+	{
+		bounds_min = glm::min(bounds_min, vertices[indices[i]].position);
+		bounds_max = glm::max(bounds_max, vertices[indices[i]].position);
+	}
+	meshlet->center = (bounds_min + bounds_max) * 0.5f;
+	meshlet->radius = 0.0f;
+	for (uint32_t i = meshlet->first_index; i < meshlet->first_index + meshlet->index_count; i++)
+	{
+		meshlet->radius = glm::max(meshlet->radius, glm::length(vertices[indices[i]].position - meshlet->center));
+	}
+
+	for (uint32_t i = meshlet->first_index; i < meshlet->first_index + meshlet->index_count; i += 3)
+	{
+		glm::vec3 p0 = vertices[indices[i]].position;
+		glm::vec3 normal = glm::cross(vertices[indices[i + 1]].position - p0, vertices[indices[i + 2]].position - p0);
+		float length = glm::length(normal);
+
+		if (length > 0.0f)
+			axis = axis + normal / length;
+	}
+
+	// Without a cone the meshlet is only frustum culled
+	meshlet->cone_apex = meshlet->center;
+	meshlet->cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+	meshlet->cone_cutoff = 1.0f;
+	axis_length = glm::length(axis);
+	if (axis_length <= 0.0f)
+		return;
+	axis = axis / axis_length;
+
+	for (uint32_t i = meshlet->first_index; i < meshlet->first_index + meshlet->index_count; i += 3)
+	{
+		glm::vec3 p0 = vertices[indices[i]].position;
+		glm::vec3 normal = glm::cross(vertices[indices[i + 1]].position - p0, vertices[indices[i + 2]].position - p0);
+		float length = glm::length(normal);
+
+		if (length > 0.0f)
+			min_cos = glm::min(min_cos, glm::dot(normal / length, axis));
+	}
+	if (min_cos <= MIN_MESHLET_CONE_COS)
+		return;
+
+	// The apex is moved back along the axis until it lies behind every triangle plane, a camera inside the
+	// backward cone from there then sees the back of all triangles
+	for (uint32_t i = meshlet->first_index; i < meshlet->first_index + meshlet->index_count; i += 3)
+	{
+		glm::vec3 p0 = vertices[indices[i]].position;
+		glm::vec3 normal = glm::cross(vertices[indices[i + 1]].position - p0, vertices[indices[i + 2]].position - p0);
+		float length = glm::length(normal);
+
+		if (length > 0.0f)
+		{
+			normal = normal / length;
+			max_t = glm::max(max_t, glm::dot(meshlet->center - p0, normal) / glm::dot(axis, normal));
+		}
+	}
+	meshlet->cone_apex = meshlet->center - axis * max_t;
+	meshlet->cone_axis = axis;
+	meshlet->cone_cutoff = sqrtf(1.0f - min_cos * min_cos);
+}
+
+int build_mesh_meshlets(struct Mesh* mesh)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	uint32_t end = mesh->lods[0].first_index + mesh->lods[0].index_count;
+	uint32_t triangle_count = mesh->lods[0].index_count / 3;
+	// Meshlet each vertex was last added to, so the unique vertex count is kept without a set
+	uint32_t* vertex_meshlet = (uint32_t*)malloc((size_t)mesh->vertex_count * sizeof(uint32_t));
+	struct Meshlet* meshlets = (struct Meshlet*)malloc(((size_t)triangle_count + 1) * sizeof(struct Meshlet));
+	uint32_t meshlet_count = 0;
+	uint32_t meshlet_vertices = 0;
+
+	if (mesh->mapped_file || mesh->meshlets || !triangle_count)
+	{
+		free(vertex_meshlet);
+		free(meshlets);
+		return 0;
+	}
+
+	if (!vertex_meshlet || !meshlets)
+	{
+		printf("cannot allocate meshlets\n");
+		free(vertex_meshlet);
+		free(meshlets);
+		return -1;
+	}
+	memset(vertex_meshlet, 0xff, (size_t)mesh->vertex_count * sizeof(uint32_t));
+
+	meshlets[0].first_index = mesh->lods[0].first_index;
+	meshlets[0].index_count = 0;
+	for (uint32_t i = mesh->lods[0].first_index; i + 2 < end; i += 3)
+	{
+		struct Meshlet* meshlet = &meshlets[meshlet_count];
+		uint32_t new_vertices = 0;
+
+		for (uint32_t k = 0; k < 3; k++)
+			new_vertices += vertex_meshlet[mesh->indices[i + k]] != meshlet_count;
+
+		if (meshlet_vertices + new_vertices > MESHLET_MAX_VERTICES || meshlet->index_count / 3 >= MESHLET_MAX_TRIANGLES)
+		{
+			meshlet_count++;
+			meshlet = &meshlets[meshlet_count];
+			meshlet->first_index = i;
+			meshlet->index_count = 0;
+			meshlet_vertices = 0;
+		}
+
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			if (vertex_meshlet[mesh->indices[i + k]] != meshlet_count)
+			{
+				vertex_meshlet[mesh->indices[i + k]] = meshlet_count;
+				meshlet_vertices++;
+			}
+		}
+		meshlet->index_count += 3;
+	}
+	meshlet_count++;
+	free(vertex_meshlet);
+
+	for (uint32_t m = 0; m < meshlet_count; m++)
+	{
+		compute_meshlet_bounds(mesh->vertices, mesh->indices, &meshlets[m]);
+	}
+
+	mesh->meshlets = (struct Meshlet*)realloc(meshlets, (size_t)meshlet_count * sizeof(struct Meshlet));
+	mesh->meshlets = mesh->meshlets ? mesh->meshlets : meshlets;
+	mesh->meshlet_count = meshlet_count;
+
+	printf("%u meshlets, %.1f triangles on average, in %.1f ms\n", meshlet_count, (double)triangle_count / meshlet_count,
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#pragma once
+#include "common.h"
+
+// Meshlet size limits, the usual mesh shader sizes so the clusters stay small enough to cull finely
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+// Clusters whose triangle normals spread wider than this cosine around the cone axis are never cone culled
+#define MIN_MESHLET_CONE_COS 0.1f
+
+struct Mesh;
+
+// Splits LOD 0 of an owned mesh into meshlets of consecutive triangles. The triangle order is kept, so each meshlet
+// is one index range and the vertex cache order of the import stays intact.
+extern int build_mesh_meshlets(struct Mesh* mesh);
\ No newline at end of file
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mesh.h"
+#include "mapped_file.h"
+
+// Only positions, optional "v x y z r g b" vertex colors and faces are read. Faces are fan triangulated and index
+// the position list directly, so vertices are never duplicated and the arrays are sized by a counting pass.
+
+static inline int is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skip_blanks(const char* p, const char* end)
+{
+	while (p < end && is_blank(*p))
+		p++;
+	return p;
+}
+
+static inline const char* next_line(const char* p, const char* end)
+{
+	const char* newline = (const char*)memchr(p, '\n', end - p);
+	return newline ? newline + 1 : end;
+}
+
+// The mapped file is not NUL terminated, so strtof cannot be used. Returns NULL when no number is found.
+static const char* parse_float(const char* p, const char* end, float* value)
+{
+	double result = 0.0;
+	double sign = 1.0;
+	int digits = 0;
+
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		sign = *p == '-' ? -1.0 : 1.0;
+		p++;
+	}
+	for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+		result = result * 10.0 + (*p - '0');
+
+	if (p < end && *p == '.')
+	{
+		double factor = 0.1;
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++, factor *= 0.1)
+			result += (*p - '0') * factor;
+	}
+	if (!digits)
+		return NULL;
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		int exponent = 0;
+		int exponent_sign = 1;
+
+		p++;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			exponent_sign = *p == '-' ? -1 : 1;
+			p++;
+		}
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+		{
+			if (exponent < 1000)
+				exponent = exponent * 10 + (*p - '0');
+		}
+		result *= pow(10.0, exponent_sign * exponent);
+	}
+
+	*value = (float)(sign * result);
+	return p;
+}
+
+static const char* parse_int(const char* p, const char* end, int64_t* value)
+{
+	int64_t result = 0;
+	int negative = 0;
+	int digits = 0;
+
+	if (p < end && *p == '-')
+	{
+		negative = 1;
+		p++;
+	}
+	for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+	{
+		if (result < INT32_MAX)
+			result = result * 10 + (*p - '0');
+	}
+	if (!digits)
+		return NULL;
+
+	*value = negative ? -result : result;
+	return p;
+}
+
+// Skips a face vertex "p/t/n", returns the first character after it
+static inline const char* skip_token(const char* p, const char* end)
+{
+	while (p < end && !is_blank(*p) && *p != '\n')
+		p++;
+	return p;
+}
+
+int load_obj_mesh(const struct MappedFile* file, struct Mesh* mesh)
+{
+	const char* begin = (const char*)file->data;
+	const char* end = begin + file->size;
+	uint64_t position_count = 0;
+	uint64_t index_count = 0;
+	uint32_t vertex = 0;
+	uint32_t index = 0;
+	const char* p;
+
+	// Counting pass
+	for (p = begin; p < end; p = next_line(p, end))
+	{
+		p = skip_blanks(p, end);
+		if (end - p < 2 || !is_blank(p[1]))
+			continue;
+
+		if (p[0] == 'v')
+		{
+			position_count++;
+		}
+		else if (p[0] == 'f')
+		{
+			uint32_t corners = 0;
+			for (p = skip_blanks(p + 1, end); p < end && *p != '\n'; p = skip_blanks(p, end))
+			{
+				p = skip_token(p, end);
+				corners++;
+			}
+			if (corners >= 3)
+				index_count += (corners - 2) * 3;
+		}
+	}
+
+	if (!position_count || !index_count || position_count > UINT32_MAX || index_count > UINT32_MAX)
+	{
+		printf("obj file has %llu positions and %llu indices, nothing to draw\n",
+			(unsigned long long)position_count, (unsigned long long)index_count);
+		return -1;
+	}
+
+	if (alloc_mesh(mesh, (uint32_t)position_count, (uint32_t)index_count))
+		return -1;
+
+	// Parsing pass
+	for (p = begin; p < end; p = next_line(p, end))
+	{
+		p = skip_blanks(p, end);
+		if (end - p < 2 || !is_blank(p[1]))
+			continue;
+
+		if (p[0] == 'v')
+		{
+			struct Vertex* v = &mesh->vertices[vertex++];
+			float rgb[3] = { 1.0f, 1.0f, 1.0f };
+			const char* q;
+
+			p = skip_blanks(p + 1, end);
+			if (!(p = parse_float(p, end, &v->position.x)) ||
+				!(p = parse_float(skip_blanks(p, end), end, &v->position.y)) ||
+				!(p = parse_float(skip_blanks(p, end), end, &v->position.z)))
+			{
+				printf("obj vertex %u is malformed\n", vertex);
+				return -1;
+			}
+
+			// Optional color after the position, w coordinates are not supported
+			q = parse_float(skip_blanks(p, end), end, &rgb[0]);
+			if (q && (q = parse_float(skip_blanks(q, end), end, &rgb[1])) && (q = parse_float(skip_blanks(q, end), end, &rgb[2])))
+			{
+				v->color = glm::vec3(rgb[0], rgb[1], rgb[2]);
+			}
+			else
+			{
+				v->color = glm::vec3(1.0f, 1.0f, 1.0f);
+			}
+		}
+		else if (p[0] == 'f')
+		{
+			uint32_t corners = 0;
+			uint32_t first = 0;
+			uint32_t previous = 0;
+
+			for (p = skip_blanks(p + 1, end); p < end && *p != '\n'; p = skip_blanks(skip_token(p, end), end))
+			{
+				int64_t position;
+
+				if (!parse_int(p, end, &position))
+				{
+					printf("obj face near vertex %u is malformed\n", vertex);
+					return -1;
+				}
+
+				// Negative indices count back from the last position read so far
+				position = position < 0 ? (int64_t)vertex + position : position - 1;
+				if (position < 0 || position >= (int64_t)mesh->vertex_count)
+				{
+					printf("obj face references missing vertex %lld\n", (long long)position + 1);
+					return -1;
+				}
+
+				if (corners == 0)
+				{
+					first = (uint32_t)position;
+				}
+				else if (corners >= 2)
+				{
+					mesh->indices[index++] = first;
+					mesh->indices[index++] = previous;
+					mesh->indices[index++] = (uint32_t)position;
+				}
+				previous = (uint32_t)position;
+				corners++;
+			}
+		}
+	}
+
+	return 0;
+}
\ No newline at end of file
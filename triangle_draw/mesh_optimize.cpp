@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "mesh.h"
+#include "mesh_optimize.h"
+
+struct OverdrawCluster
+{
+	float sort_key;
+	uint32_t start;
+	uint32_t count;
+};
+
+void analyze_vertex_cache(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size,
+	struct VertexCacheStats* stats)
+{
+	// A vertex is still cached while fewer than cache_size misses happened since it was loaded
+	uint32_t* load_time = (uint32_t*)calloc(vertex_count, sizeof(uint32_t));
+	uint32_t time = cache_size + 1;
+	uint32_t misses = 0;
+	uint32_t referenced = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	if (!load_time || !index_count)
+	{
+		free(load_time);
+		return;
+	}
+
+	for (uint32_t i = 0; i < index_count; i++)
+	{
+		uint32_t v = indices[i];
+
+		if (!load_time[v])
+			referenced++;
+		if (time - load_time[v] > cache_size)
+		{
+			load_time[v] = time++;
+			misses++;
+		}
+	}
+
+	stats->acmr = (float)misses / (index_count / 3);
+	stats->atvr = (float)misses / referenced;
+	free(load_time);
+}
+
+// Tipsify, Sander et al. "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw".
+// Fans around the most recently cached vertex that stays cached, restarts from the dead-end stack or the next
+// vertex with triangles left. Each restart is recorded as a cluster start for the overdraw pass.
+static int tipsify(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size,
+	uint32_t* destination, uint32_t* cluster_starts, uint32_t* cluster_count)
+{
+	uint32_t triangle_count = index_count / 3;
+	uint32_t* live = (uint32_t*)calloc(vertex_count, sizeof(uint32_t));
+	uint32_t* offsets = (uint32_t*)calloc((size_t)vertex_count + 1, sizeof(uint32_t));
+	uint32_t* adjacency = (uint32_t*)malloc((size_t)index_count * sizeof(uint32_t));
+	uint32_t* cache_time = (uint32_t*)calloc(vertex_count, sizeof(uint32_t));
+	uint32_t* dead_end = (uint32_t*)malloc((size_t)index_count * sizeof(uint32_t));
+	uint8_t* emitted = (uint8_t*)calloc(triangle_count, sizeof(uint8_t));
+	uint32_t time = cache_size + 1;
+	uint32_t dead_end_top = 0;
+	uint32_t cursor = 0;
+	uint32_t output = 0;
+	int64_t fanning = -1;
+	int ret = -1;
+
+	*cluster_count = 0;
+	if (!live || !offsets || !adjacency || !cache_time || !dead_end || !emitted)
+		goto done;
+
+	// Triangles using each vertex, offsets[v] ends up as the start of its list
+	for (uint32_t i = 0; i < index_count; i++)
+		live[indices[i]]++;
+	for (uint32_t v = 0; v < vertex_count; v++)
+		offsets[v + 1] = offsets[v] + live[v];
+	for (uint32_t i = 0; i < index_count; i++)
+		adjacency[offsets[indices[i]]++] = i / 3;
+	for (uint32_t v = 0; v < vertex_count; v++)
+		offsets[v] -= live[v];
+
+	for (;;)
+	{
+		uint32_t candidates_begin = dead_end_top;
+		int best_priority = -1;
+
+		if (fanning < 0)
+		{
+			// Cold restart, nothing useful is cached
+			while (dead_end_top && fanning < 0)
+			{
+				uint32_t v = dead_end[--dead_end_top];
+				if (live[v])
+					fanning = v;
+			}
+			while (fanning < 0 && cursor < vertex_count)
+			{
+				if (live[cursor])
+					fanning = cursor;
+				cursor++;
+			}
+			if (fanning < 0)
+				break;
+
+			cluster_starts[(*cluster_count)++] = output;
+			candidates_begin = dead_end_top;
+		}
+
+		for (uint32_t a = offsets[fanning]; a < offsets[fanning + 1]; a++)
+		{
+			uint32_t triangle = adjacency[a];
+			if (emitted[triangle])
+				continue;
+
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t v = indices[triangle * 3 + k];
+
+				destination[output++] = v;
+				dead_end[dead_end_top++] = v;
+				live[v]--;
+				if (time - cache_time[v] > cache_size)
+					cache_time[v] = time++;
+			}
+			emitted[triangle] = 1;
+		}
+
+		// Next fan: the candidate that stays in the cache the longest while its remaining triangles are emitted
+		fanning = -1;
+		for (uint32_t c = candidates_begin; c < dead_end_top; c++)
+		{
+			uint32_t v = dead_end[c];
+			int priority = 0;
+
+			if (!live[v])
+				continue;
+			if (time - cache_time[v] + 2 * live[v] <= cache_size)
+				priority = time - cache_time[v];
+			if (priority > best_priority)
+			{
+				best_priority = priority;
+				fanning = v;
+			}
+		}
+	}
+	ret = output == triangle_count * 3 ? 0 : -1;
+
+done:
+	free(live);
+	free(offsets);
+	free(adjacency);
+	free(cache_time);
+	free(dead_end);
+	free(emitted);
+	return ret;
+}
+
+static int compare_overdraw_clusters(const void* a, const void* b)
+{
+	float ka = ((const struct OverdrawCluster*)a)->sort_key;
+	float kb = ((const struct OverdrawCluster*)b)->sort_key;
+	return ka < kb ? 1 : ka > kb ? -1 : 0;
+}
+
+// Clusters facing away from the mesh center are likely in front of the rest, drawing them first lets the
+// depth test reject more of what follows. Cluster starts are cache restarts, so reordering keeps the ACMR.
+static int sort_overdraw_clusters(const struct Vertex* vertices, uint32_t* indices, uint32_t index_count,
+	const uint32_t* cluster_starts, uint32_t cluster_count)
+{
+	struct OverdrawCluster* clusters = (struct OverdrawCluster*)malloc(cluster_count * sizeof(struct OverdrawCluster));
+	uint32_t* sorted = (uint32_t*)malloc((size_t)index_count * sizeof(uint32_t));
+	glm::vec3 mesh_center = glm::vec3(0.0f);
+	uint32_t output = 0;
+
+	if (!clusters || !sorted)
+	{
+		free(clusters);
+		free(sorted);
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < index_count; i++)
+		mesh_center = mesh_center + vertices[indices[i]].position;
+	mesh_center = mesh_center / (float)index_count;
+
+	for (uint32_t c = 0; c < cluster_count; c++)
+	{
+		glm::vec3 center = glm::vec3(0.0f);
+		glm::vec3 normal = glm::vec3(0.0f);
+		float normal_length;
+
+		clusters[c].start = cluster_starts[c];
+		clusters[c].count = (c + 1 < cluster_count ? cluster_starts[c + 1] : index_count) - cluster_starts[c];
+
+		for (uint32_t i = clusters[c].start; i < clusters[c].start + clusters[c].count; i += 3)
+		{
+			glm::vec3 p0 = vertices[indices[i]].position;
+			glm::vec3 p1 = vertices[indices[i + 1]].position;
+			glm::vec3 p2 = vertices[indices[i + 2]].position;
+
+			center = center + p0 + p1 + p2;
+			// Area weighted
+			normal = normal + glm::cross(p1 - p0, p2 - p0);
+		}
+		center = center / (float)clusters[c].count;
+		normal_length = glm::length(normal);
+		clusters[c].sort_key = normal_length > 0.0f ? glm::dot(center - mesh_center, normal / normal_length) : 0.0f;
+	}
+
+	qsort(clusters, cluster_count, sizeof(struct OverdrawCluster), compare_overdraw_clusters);
+	for (uint32_t c = 0; c < cluster_count; c++)
+	{
+		memcpy(sorted + output, indices + clusters[c].start, clusters[c].count * sizeof(uint32_t));
+		output += clusters[c].count;
+	}
+	memcpy(indices, sorted, (size_t)index_count * sizeof(uint32_t));
+
+	free(clusters);
+	free(sorted);
+	return 0;
+}
+
+// Renumbers vertices in the order the index buffer first uses them, unreferenced vertices are dropped
+static int optimize_vertex_fetch(struct Mesh* mesh)
+{
+	uint32_t* remap = (uint32_t*)malloc((size_t)mesh->vertex_count * sizeof(uint32_t));
+	struct Vertex* vertices = (struct Vertex*)malloc((size_t)mesh->vertex_count * sizeof(struct Vertex));
+	uint32_t next = 0;
+
+	if (!remap || !vertices)
+	{
+		free(remap);
+		free(vertices);
+		return -1;
+	}
+
+	memset(remap, 0xff, (size_t)mesh->vertex_count * sizeof(uint32_t));
+	for (uint32_t i = 0; i < mesh->index_count; i++)
+	{
+		uint32_t v = mesh->indices[i];
+
+		if (remap[v] == UINT32_MAX)
+		{
+			vertices[next] = mesh->vertices[v];
+			remap[v] = next++;
+		}
+		mesh->indices[i] = remap[v];
+	}
+
+	free(mesh->vertices);
+	free(remap);
+	mesh->vertices = vertices;
+	mesh->vertex_count = next;
+	return 0;
+}
+
+int optimize_vertex_cache(uint32_t* indices, uint32_t index_count, uint32_t vertex_count)
+{
+	uint32_t* reordered = (uint32_t*)malloc((size_t)index_count * sizeof(uint32_t));
+	uint32_t* cluster_starts = (uint32_t*)malloc((size_t)(index_count / 3 + 1) * sizeof(uint32_t));
+	uint32_t cluster_count = 0;
+	int ret = -1;
+
+	if (reordered && cluster_starts &&
+		!tipsify(indices, index_count - index_count % 3, vertex_count, VERTEX_CACHE_SIZE, reordered, cluster_starts, &cluster_count))
+	{
+		memcpy(indices, reordered, (size_t)(index_count - index_count % 3) * sizeof(uint32_t));
+		ret = 0;
+	}
+	free(reordered);
+	free(cluster_starts);
+	return ret;
+}
+
+int optimize_mesh(struct Mesh* mesh, uint32_t optimization)
+{
+	struct VertexCacheStats before, after;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	uint32_t* cluster_starts = NULL;
+	uint32_t* reordered = NULL;
+	uint32_t cluster_count = 0;
+	int ret = 0;
+
+	if (!optimization || mesh->mapped_file || mesh->index_count < 3)
+		return 0;
+
+	analyze_vertex_cache(mesh->indices, mesh->index_count, mesh->vertex_count, VERTEX_CACHE_SIZE, &before);
+
+	if (optimization & MESH_OPTIMIZE_VERTEX_CACHE)
+	{
+		// Any trailing partial triangle is dropped first, tipsify only takes whole triangles
+		mesh->index_count -= mesh->index_count % 3;
+		mesh->lods[0].index_count = mesh->index_count;
+		reordered = (uint32_t*)malloc((size_t)mesh->index_count * sizeof(uint32_t));
+		cluster_starts = (uint32_t*)malloc((size_t)(mesh->index_count / 3) * sizeof(uint32_t));
+		if (!reordered || !cluster_starts ||
+			tipsify(mesh->indices, mesh->index_count, mesh->vertex_count, VERTEX_CACHE_SIZE, reordered, cluster_starts, &cluster_count))
+		{
+			printf("vertex cache optimization failed\n");
+			ret = -1;
+			goto done;
+		}
+		memcpy(mesh->indices, reordered, (size_t)mesh->index_count * sizeof(uint32_t));
+
+		if ((optimization & MESH_OPTIMIZE_OVERDRAW) &&
+			sort_overdraw_clusters(mesh->vertices, mesh->indices, mesh->index_count, cluster_starts, cluster_count))
+		{
+			printf("overdraw optimization failed\n");
+		}
+	}
+
+	if ((optimization & MESH_OPTIMIZE_VERTEX_FETCH) && optimize_vertex_fetch(mesh))
+	{
+		printf("vertex fetch optimization failed\n");
+		ret = -1;
+		goto done;
+	}
+
+	analyze_vertex_cache(mesh->indices, mesh->index_count, mesh->vertex_count, VERTEX_CACHE_SIZE, &after);
+	printf("mesh optimization: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (cache size %u, %u clusters) in %.1f ms\n",
+		before.acmr, after.acmr, before.atvr, after.atvr, VERTEX_CACHE_SIZE, cluster_count,
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+done:
+	free(reordered);
+	free(cluster_starts);
+	return ret;
+}
\ No newline at end of file
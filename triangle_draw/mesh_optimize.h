@@ -0,0 +1,22 @@
+#pragma once
+#include "common.h"
+
+// FIFO post-transform cache size the optimizer targets and statistics are simulated with
+#define VERTEX_CACHE_SIZE 16
+
+struct Mesh;
+
+struct VertexCacheStats
+{
+	// Average cache miss ratio: transformed vertices per triangle, 0.5 is the best a closed mesh can do
+	float acmr;
+	// Average transformed vertex ratio: transformed vertices per referenced vertex, 1.0 is optimal
+	float atvr;
+};
+
+extern void analyze_vertex_cache(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size,
+	struct VertexCacheStats* stats);
+// Reorders the triangles of an index range for the vertex cache, without touching the vertices
+extern int optimize_vertex_cache(uint32_t* indices, uint32_t index_count, uint32_t vertex_count);
+// Applies the enum MeshOptimization stages in optimization to an owned (not mapped) mesh and reports ACMR/ATVR
+extern int optimize_mesh(struct Mesh* mesh, uint32_t optimization);
\ No newline at end of file
@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <atomic>
+#include <intrin.h>
+#include <immintrin.h>
+#include "occlusion.h"
+#include "culling.h"
+#include "job_pool.h"
+
+#define OCCLUSION_TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE_SIZE)
+#define OCCLUSION_TILES_Y (OCCLUSION_HEIGHT / OCCLUSION_TILE_SIZE)
+#define OCCLUSION_TILE_COUNT (OCCLUSION_TILES_X * OCCLUSION_TILES_Y)
+// Below this many triangles the render thread rasterizes alone
+#define MIN_PARALLEL_OCCLUDER_TRIANGLES 256
+
+// Screen space triangle. Edge functions a * x + b * y + c are >= 0 inside, depth is the 1 / w plane.
+struct OcclusionTriangle
+{
+	float edge_a[3];
+	float edge_b[3];
+	float edge_c[3];
+	float depth_a, depth_b, depth_c;
+	int32_t min_x, min_y, max_x, max_y;
+};
+
+struct OcclusionCuller
+{
+	struct JobPool* pool;
+	std::atomic<uint32_t> next_tile;
+
+	// Occluder mesh, compacted to the used vertices
+	glm::vec3* positions;
+	uint32_t vertex_count;
+	uint32_t* indices;
+	uint32_t index_count;
+	// x, y in pixels and 1 / w of the occluder vertices under one transform, w 0 behind the near limit
+	glm::vec4* screen_positions;
+
+	struct OcclusionTriangle* triangles;
+	uint32_t triangle_count;
+	uint32_t triangle_capacity;
+	// Triangles overlapping tile t are bins[bin_starts[t]..bin_starts[t + 1]]
+	uint32_t* bins;
+	uint32_t bin_capacity;
+	uint32_t bin_starts[OCCLUSION_TILE_COUNT + 1];
+
+	// Pyramid levels in one 16 byte aligned allocation
+	float* levels[OCCLUSION_LEVELS];
+	glm::mat4 view_projection;
+};
+
+// Pixel centers of 4 neighboring pixels are tested at once, depth is kept as the maximum 1 / w, the nearest occluder.
+// Tiles are 4 pixel aligned, so the blocks never leave the tile of the thread writing them.
+static void rasterize_tile(struct OcclusionCuller* culler, uint32_t tile)
+{
+	int32_t tile_x = (int32_t)(tile % OCCLUSION_TILES_X) * OCCLUSION_TILE_SIZE;
+	int32_t tile_y = (int32_t)(tile / OCCLUSION_TILES_X) * OCCLUSION_TILE_SIZE;
+	__m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	__m128 zero = _mm_setzero_ps();
+
+	for (uint32_t b = culler->bin_starts[tile]; b < culler->bin_starts[tile + 1]; b++)
+	{
+		const struct OcclusionTriangle* triangle = &culler->triangles[culler->bins[b]];
+		int32_t x0 = (triangle->min_x > tile_x ? triangle->min_x : tile_x) & ~3;
+		int32_t x1 = triangle->max_x < tile_x + OCCLUSION_TILE_SIZE - 1 ? triangle->max_x : tile_x + OCCLUSION_TILE_SIZE - 1;
+		int32_t y0 = triangle->min_y > tile_y ? triangle->min_y : tile_y;
+		int32_t y1 = triangle->max_y < tile_y + OCCLUSION_TILE_SIZE - 1 ? triangle->max_y : tile_y + OCCLUSION_TILE_SIZE - 1;
+		__m128 a0 = _mm_set1_ps(triangle->edge_a[0]);
+		__m128 a1 = _mm_set1_ps(triangle->edge_a[1]);
+		__m128 a2 = _mm_set1_ps(triangle->edge_a[2]);
+		__m128 depth_a = _mm_set1_ps(triangle->depth_a);
+
+		for (int32_t y = y0; y <= y1; y++)
+		{
+			float center_y = y + 0.5f;
+			__m128 row0 = _mm_set1_ps(triangle->edge_b[0] * center_y + triangle->edge_c[0]);
+			__m128 row1 = _mm_set1_ps(triangle->edge_b[1] * center_y + triangle->edge_c[1]);
+			__m128 row2 = _mm_set1_ps(triangle->edge_b[2] * center_y + triangle->edge_c[2]);
+			__m128 depth_row = _mm_set1_ps(triangle->depth_b * center_y + triangle->depth_c);
+			float* depth = culler->levels[0] + y * OCCLUSION_WIDTH;
+
+			for (int32_t x = x0; x <= x1; x += 4)
+			{
+				__m128 center_x = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+				__m128 inside = _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(center_x, a0), row0), zero),
+					_mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(center_x, a1), row1), zero),
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(center_x, a2), row2), zero)));
+				__m128 triangle_depth = _mm_and_ps(inside, _mm_add_ps(_mm_mul_ps(center_x, depth_a), depth_row));
+
+				_mm_store_ps(depth + x, _mm_max_ps(_mm_load_ps(depth + x), triangle_depth));
+			}
+		}
+	}
+}
+
+// Takes tiles until none are left
+static void run_occlusion_tiles(void* data)
+{
+	struct OcclusionCuller* culler = (struct OcclusionCuller*)data;
+	uint32_t tile;
+
+	while ((tile = culler->next_tile.fetch_add(1)) < OCCLUSION_TILE_COUNT)
+	{
+		rasterize_tile(culler, tile);
+	}
+}
+
+struct OcclusionCuller* create_occlusion_culler(struct JobPool* pool)
+{
+	struct OcclusionCuller* culler = new struct OcclusionCuller();
+	size_t level_size = 0;
+
+	for (uint32_t level = 0; level < OCCLUSION_LEVELS; level++)
+		level_size += (size_t)(OCCLUSION_WIDTH >> level) * (OCCLUSION_HEIGHT >> level);
+	culler->levels[0] = (float*)_aligned_malloc(level_size * sizeof(float), 16);
+	if (!culler->levels[0])
+	{
+		printf("cannot allocate occlusion depth buffer\n");
+		delete culler;
+		return NULL;
+	}
+	memset(culler->levels[0], 0, level_size * sizeof(float));
+	for (uint32_t level = 1; level < OCCLUSION_LEVELS; level++)
+		culler->levels[level] = culler->levels[level - 1] + (OCCLUSION_WIDTH >> (level - 1)) * (OCCLUSION_HEIGHT >> (level - 1));
+
+	culler->next_tile = 0;
+	culler->view_projection = glm::mat4(1.0f);
+	// The render thread rasterizes too
+	culler->pool = pool;
+
+	printf("occlusion culling at %ux%u on %u threads\n", OCCLUSION_WIDTH, OCCLUSION_HEIGHT, get_job_worker_count(culler->pool) + 1);
+	return culler;
+}
+
+void destroy_occlusion_culler(struct OcclusionCuller* culler)
+{
+	if (!culler)
+		return;
+
+	free(culler->positions);
+	free(culler->indices);
+	free(culler->screen_positions);
+	free(culler->triangles);
+	free(culler->bins);
+	_aligned_free(culler->levels[0]);
+	delete culler;
+}
+
+int set_occluder_mesh(struct OcclusionCuller* culler, const struct Vertex* vertices, uint32_t vertex_count,
+	const uint32_t* indices, uint32_t index_count)
+{
+	uint32_t* remap = (uint32_t*)malloc((size_t)vertex_count * sizeof(uint32_t));
+	uint32_t used = 0;
+
+	free(culler->positions);
+	free(culler->indices);
+	free(culler->screen_positions);
+	culler->positions = (glm::vec3*)malloc((size_t)(index_count ? index_count : 1) * sizeof(glm::vec3));
+	culler->indices = (uint32_t*)malloc((size_t)(index_count ? index_count : 1) * sizeof(uint32_t));
+	culler->screen_positions = (glm::vec4*)malloc((size_t)(index_count ? index_count : 1) * sizeof(glm::vec4));
+	culler->vertex_count = 0;
+	culler->index_count = 0;
+	if (!remap || !culler->positions || !culler->indices || !culler->screen_positions)
+	{
+		printf("cannot allocate occluder mesh with %u indices\n", index_count);
+		free(remap);
+		return -1;
+	}
+
+	memset(remap, 0xff, (size_t)vertex_count * sizeof(uint32_t));
+	for (uint32_t i = 0; i < index_count; i++)
+	{
+		if (remap[indices[i]] == UINT32_MAX)
+		{
+			remap[indices[i]] = used;
+			culler->positions[used++] = vertices[indices[i]].position;
+		}
+		culler->indices[i] = remap[indices[i]];
+	}
+	culler->vertex_count = used;
+	culler->index_count = index_count - index_count % 3;
+	free(remap);
+	return 0;
+}
+
+// Drops triangles behind the near limit, degenerate or off screen
+static VkBool32 setup_triangle(glm::vec4 v0, glm::vec4 v1, glm::vec4 v2, struct OcclusionTriangle* triangle)
+{
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+	float sign = area > 0.0f ? 1.0f : -1.0f;
+	const glm::vec4* v[3] = { &v0, &v1, &v2 };
+
+	if (v0.w == 0.0f || v1.w == 0.0f || v2.w == 0.0f || fabsf(area) < 1e-8f)
+		return VK_FALSE;
+
+	triangle->min_x = (int32_t)floorf(glm::min(v0.x, glm::min(v1.x, v2.x)));
+	triangle->max_x = (int32_t)ceilf(glm::max(v0.x, glm::max(v1.x, v2.x)));
+	triangle->min_y = (int32_t)floorf(glm::min(v0.y, glm::min(v1.y, v2.y)));
+	triangle->max_y = (int32_t)ceilf(glm::max(v0.y, glm::max(v1.y, v2.y)));
+	triangle->min_x = triangle->min_x > 0 ? triangle->min_x : 0;
+	triangle->min_y = triangle->min_y > 0 ? triangle->min_y : 0;
+	triangle->max_x = triangle->max_x < OCCLUSION_WIDTH - 1 ? triangle->max_x : OCCLUSION_WIDTH - 1;
+	triangle->max_y = triangle->max_y < OCCLUSION_HEIGHT - 1 ? triangle->max_y : OCCLUSION_HEIGHT - 1;
+	if (triangle->min_x > triangle->max_x || triangle->min_y > triangle->max_y)
+		return VK_FALSE;
+
+	// Edge i runs from vertex i to the next one, flipped for clockwise triangles so inside stays positive
+	for (int i = 0; i < 3; i++)
+	{
+		const glm::vec4* a = v[i];
+		const glm::vec4* b = v[(i + 1) % 3];
+
+		triangle->edge_a[i] = (a->y - b->y) * sign;
+		triangle->edge_b[i] = (b->x - a->x) * sign;
+		triangle->edge_c[i] = (a->x * b->y - b->x * a->y) * sign;
+	}
+
+	// 1 / w is linear in screen space
+	triangle->depth_a = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+	triangle->depth_b = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+	triangle->depth_c = v0.z - triangle->depth_a * v0.x - triangle->depth_b * v0.y;
+	return VK_TRUE;
+}
+
+// Transforms and sets up the occluder triangles of every transform
+static int setup_occluder_triangles(struct OcclusionCuller* culler, const glm::mat4& view_projection, const glm::mat4* transforms,
+	uint32_t transform_count)
+{
+	uint64_t capacity = (uint64_t)culler->index_count / 3 * transform_count;
+
+	if (capacity > culler->triangle_capacity)
+	{
+		struct OcclusionTriangle* triangles = (struct OcclusionTriangle*)realloc(culler->triangles,
+			(size_t)capacity * sizeof(struct OcclusionTriangle));
+		if (!triangles || capacity > UINT32_MAX)
+		{
+			printf("cannot allocate %llu occluder triangles\n", (unsigned long long)capacity);
+			return -1;
+		}
+		culler->triangles = triangles;
+		culler->triangle_capacity = (uint32_t)capacity;
+	}
+
+	culler->triangle_count = 0;
+	for (uint32_t t = 0; t < transform_count; t++)
+	{
+		glm::mat4 transform = view_projection * transforms[t];
+
+		for (uint32_t i = 0; i < culler->vertex_count; i++)
+		{
+			glm::vec4 clip = transform * glm::vec4(culler->positions[i], 1.0f);
+			float inverse_w = 1.0f / clip.w;
+
+			culler->screen_positions[i] = clip.w < OCCLUSION_NEAR_W ? glm::vec4(0.0f) :
+				glm::vec4((clip.x * inverse_w * 0.5f + 0.5f) * OCCLUSION_WIDTH, (clip.y * inverse_w * 0.5f + 0.5f) * OCCLUSION_HEIGHT,
+					inverse_w, 1.0f);
+		}
+		for (uint32_t i = 0; i < culler->index_count; i += 3)
+		{
+			culler->triangle_count += setup_triangle(culler->screen_positions[culler->indices[i]],
+				culler->screen_positions[culler->indices[i + 1]], culler->screen_positions[culler->indices[i + 2]],
+				&culler->triangles[culler->triangle_count]);
+		}
+	}
+	return 0;
+}
+
+// Counting pass over the tile rectangles of the triangles, then the fill
+static int bin_occluder_triangles(struct OcclusionCuller* culler)
+{
+	uint32_t offsets[OCCLUSION_TILE_COUNT];
+	uint32_t total = 0;
+
+	memset(offsets, 0, sizeof(offsets));
+	for (uint32_t i = 0; i < culler->triangle_count; i++)
+	{
+		const struct OcclusionTriangle* triangle = &culler->triangles[i];
+
+		for (int32_t y = triangle->min_y / OCCLUSION_TILE_SIZE; y <= triangle->max_y / OCCLUSION_TILE_SIZE; y++)
+			for (int32_t x = triangle->min_x / OCCLUSION_TILE_SIZE; x <= triangle->max_x / OCCLUSION_TILE_SIZE; x++)
+				offsets[y * OCCLUSION_TILES_X + x]++;
+	}
+	for (uint32_t tile = 0; tile < OCCLUSION_TILE_COUNT; tile++)
+	{
+		culler->bin_starts[tile] = total;
+		total += offsets[tile];
+		offsets[tile] = culler->bin_starts[tile];
+	}
+	culler->bin_starts[OCCLUSION_TILE_COUNT] = total;
+
+	if (total > culler->bin_capacity)
+	{
+		uint32_t* bins = (uint32_t*)realloc(culler->bins, (size_t)total * sizeof(uint32_t));
+		if (!bins)
+		{
+			printf("cannot allocate %u occluder bin entries\n", total);
+			return -1;
+		}
+		culler->bins = bins;
+		culler->bin_capacity = total;
+	}
+
+	for (uint32_t i = 0; i < culler->triangle_count; i++)
+	{
+		const struct OcclusionTriangle* triangle = &culler->triangles[i];
+
+		for (int32_t y = triangle->min_y / OCCLUSION_TILE_SIZE; y <= triangle->max_y / OCCLUSION_TILE_SIZE; y++)
+			for (int32_t x = triangle->min_x / OCCLUSION_TILE_SIZE; x <= triangle->max_x / OCCLUSION_TILE_SIZE; x++)
+				culler->bins[offsets[y * OCCLUSION_TILES_X + x]++] = i;
+	}
+	return 0;
+}
+
+// Each texel keeps the farthest occluder, the minimum 1 / w, of the 2x2 texels below it
+static void build_occlusion_pyramid(struct OcclusionCuller* culler)
+{
+	for (uint32_t level = 1; level < OCCLUSION_LEVELS; level++)
+	{
+		uint32_t source_width = OCCLUSION_WIDTH >> (level - 1);
+		uint32_t width = OCCLUSION_WIDTH >> level;
+		uint32_t height = OCCLUSION_HEIGHT >> level;
+
+		for (uint32_t y = 0; y < height; y++)
+		{
+			const float* row0 = culler->levels[level - 1] + y * 2 * source_width;
+			const float* row1 = row0 + source_width;
+			float* destination = culler->levels[level] + y * width;
+			uint32_t x = 0;
+
+			for (; x + 4 <= width; x += 4)
+			{
+				__m128 low = _mm_min_ps(_mm_load_ps(row0 + x * 2), _mm_load_ps(row1 + x * 2));
+				__m128 high = _mm_min_ps(_mm_load_ps(row0 + x * 2 + 4), _mm_load_ps(row1 + x * 2 + 4));
+
+				_mm_store_ps(destination + x, _mm_min_ps(_mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)),
+					_mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1))));
+			}
+			for (; x < width; x++)
+			{
+				destination[x] = glm::min(glm::min(row0[x * 2], row0[x * 2 + 1]), glm::min(row1[x * 2], row1[x * 2 + 1]));
+			}
+		}
+	}
+}
+
+void render_occluders(struct OcclusionCuller* culler, const glm::mat4& view_projection, const glm::mat4* transforms,
+	uint32_t transform_count)
+{
+	culler->view_projection = view_projection;
+	memset(culler->levels[0], 0, (size_t)OCCLUSION_WIDTH * OCCLUSION_HEIGHT * sizeof(float));
+
+	// Nothing drawn occludes nothing
+	if (setup_occluder_triangles(culler, view_projection, transforms, transform_count) || bin_occluder_triangles(culler))
+		culler->triangle_count = 0;
+	if (!culler->triangle_count)
+		memset(culler->bin_starts, 0, sizeof(culler->bin_starts));
+
+	culler->next_tile = 0;
+	if (culler->triangle_count >= MIN_PARALLEL_OCCLUDER_TRIANGLES)
+		run_job(culler->pool, run_occlusion_tiles, culler);
+	else
+		run_occlusion_tiles(culler);
+
+	build_occlusion_pyramid(culler);
+}
+
+// The screen rectangle comes from the corners of the box around the sphere, the depth from its nearest point.
+// Anything reaching behind the near limit counts as visible.
+static VkBool32 is_sphere_occluded(const struct OcclusionCuller* culler, glm::vec3 center, float radius, float w_scale)
+{
+	const glm::mat4& view_projection = culler->view_projection;
+	glm::vec4 clip_center = view_projection * glm::vec4(center, 1.0f);
+	float nearest_w = clip_center.w - radius * w_scale;
+	float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+	float depth;
+	int32_t x0, y0, x1, y1;
+	uint32_t level = 0;
+
+	if (nearest_w < OCCLUSION_NEAR_W)
+		return VK_FALSE;
+
+	for (uint32_t corner = 0; corner < 8; corner++)
+	{
+		glm::vec4 clip = clip_center + view_projection[0] * (corner & 1 ? radius : -radius) +
+			view_projection[1] * (corner & 2 ? radius : -radius) + view_projection[2] * (corner & 4 ? radius : -radius);
+		float x, y;
+
+		if (clip.w < OCCLUSION_NEAR_W)
+			return VK_FALSE;
+		x = (clip.x / clip.w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+		y = (clip.y / clip.w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+		min_x = glm::min(min_x, x);
+		min_y = glm::min(min_y, y);
+		max_x = glm::max(max_x, x);
+		max_y = glm::max(max_y, y);
+	}
+
+	// Parts off screen hide behind nothing but are not seen either
+	x0 = (int32_t)glm::max(floorf(min_x), 0.0f);
+	y0 = (int32_t)glm::max(floorf(min_y), 0.0f);
+	x1 = (int32_t)glm::min(floorf(max_x), (float)(OCCLUSION_WIDTH - 1));
+	y1 = (int32_t)glm::min(floorf(max_y), (float)(OCCLUSION_HEIGHT - 1));
+	if (x0 > x1 || y0 > y1)
+		return VK_FALSE;
+
+	// The level where the rectangle covers at most 2x2 texels
+	while (level + 1 < OCCLUSION_LEVELS && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+		level++;
+
+	depth = 1.0f / nearest_w;
+	for (int32_t y = y0 >> level; y <= y1 >> level; y++)
+	{
+		for (int32_t x = x0 >> level; x <= x1 >> level; x++)
+		{
+			if (culler->levels[level][y * (OCCLUSION_WIDTH >> level) + x] <= depth)
+				return VK_FALSE;
+		}
+	}
+	return VK_TRUE;
+}
+
+uint32_t cull_occluded(const struct OcclusionCuller* culler, const struct CullingBounds* bounds, uint32_t* visible,
+	uint32_t visible_count)
+{
+	const glm::mat4& view_projection = culler->view_projection;
+	// Clip w grows by this much per unit of distance
+	float w_scale = glm::length(glm::vec3(view_projection[0][3], view_projection[1][3], view_projection[2][3]));
+	uint32_t count = 0;
+
+	if (!culler->triangle_count)
+		return visible_count;
+
+	for (uint32_t i = 0; i < visible_count; i++)
+	{
+		uint32_t index = visible[i];
+
+		if (!is_sphere_occluded(culler, glm::vec3(bounds->center_x[index], bounds->center_y[index], bounds->center_z[index]),
+			bounds->radius[index], w_scale))
+			visible[count++] = index;
+	}
+	return count;
+}
+
+const float* get_occlusion_level(const struct OcclusionCuller* culler, uint32_t level, uint32_t* width, uint32_t* height)
+{
+	*width = OCCLUSION_WIDTH >> level;
+	*height = OCCLUSION_HEIGHT >> level;
+	return culler->levels[level];
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+#include "common.h"
+
+// Occlusion depth buffer size, multiples of OCCLUSION_TILE_SIZE. Pixels need not be square, the test uses the same mapping.
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+// Tiles are rasterized independently by the occlusion threads
+#define OCCLUSION_TILE_SIZE 32
+// Hierarchical Z levels, level 0 is the full buffer and every level halves both sides
+#define OCCLUSION_LEVELS 8
+// Occluder triangles with a vertex closer than this clip w are dropped instead of clipped, which only occludes less
+#define OCCLUSION_NEAR_W 1e-3f
+
+struct Vertex;
+struct CullingBounds;
+struct OcclusionCuller;
+struct JobPool;
+
+// Tiles are rasterized on the threads of pool, which the culler does not own. NULL on failure.
+// Needs no device, so it runs on machines without a GPU.
+extern struct OcclusionCuller* create_occlusion_culler(struct JobPool* pool);
+extern void destroy_occlusion_culler(struct OcclusionCuller* culler);
+// Copies the occluder geometry, only the vertices the indices use are kept
+extern int set_occluder_mesh(struct OcclusionCuller* culler, const struct Vertex* vertices, uint32_t vertex_count,
+	const uint32_t* indices, uint32_t index_count);
+// Clears the depth buffer, rasterizes the occluder mesh with every transform and builds the hierarchical Z pyramid
+extern void render_occluders(struct OcclusionCuller* culler, const glm::mat4& view_projection, const glm::mat4* transforms,
+	uint32_t transform_count);
+// Drops the spheres behind the occluders from visible, keeping the order of the rest. Returns the remaining count.
+extern uint32_t cull_occluded(const struct OcclusionCuller* culler, const struct CullingBounds* bounds, uint32_t* visible,
+	uint32_t visible_count);
+// One level of the pyramid: 1 / w of the farthest occluder under each texel, 0 where nothing was drawn
+extern const float* get_occlusion_level(const struct OcclusionCuller* culler, uint32_t level, uint32_t* width, uint32_t* height);
\ No newline at end of file
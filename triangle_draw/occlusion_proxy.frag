@@ -0,0 +1,6 @@
+#version 450
+
+// Occlusion proxies only count depth tested samples, the color write mask is 0
+void main()
+{
+}
@@ -0,0 +1,47 @@
+#version 450
+
+// Bounding box of a visible instance, drawn around an occlusion query. Declares the bindings and push constant size
+// of triangle.vert, so the scene descriptor set and pipeline layout are used as they are.
+
+layout (binding = 0) uniform UBO
+{
+	mat4 projection;
+	mat4 model;
+	vec4 viewPos;
+} ubo;
+
+layout(std430, binding = 2) readonly buffer Instances
+{
+	mat4 transforms[];
+} instances;
+
+// gl_InstanceIndex is the query index, which is the position in this list
+layout(std430, binding = 3) readonly buffer VisibleInstances
+{
+	uint indices[];
+} visible_instances;
+
+// Object space box, in place of the dequantization constants of the scene
+layout(push_constant) uniform Box
+{
+	vec4 box_min;
+	vec4 box_max;
+} box;
+
+// Corners of the 12 triangles, bit 0 selects max x, bit 1 max y and bit 2 max z
+const int box_corners[36] = int[](
+	0, 4, 6, 0, 6, 2,
+	1, 3, 7, 1, 7, 5,
+	0, 1, 5, 0, 5, 4,
+	2, 6, 7, 2, 7, 3,
+	0, 2, 3, 0, 3, 1,
+	4, 5, 7, 4, 7, 6
+);
+
+void main()
+{
+	int corner = box_corners[gl_VertexIndex];
+	vec3 position = mix(box.box_min.xyz, box.box_max.xyz, vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1));
+
+	gl_Position = ubo.projection * ubo.model * instances.transforms[visible_instances.indices[gl_InstanceIndex]] * vec4(position, 1.0);
+}
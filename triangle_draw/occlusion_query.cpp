@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "occlusion_query.h"
+#include "culling.h"
+#include "mesh.h"
+#include "index_format.h"
+#include "buffer.h"
+#include "memory.h"
+#include "pipeline.h"
+#include "pipeline_manager.h"
+
+// Visible list entries drawn without a predicate, and ones the read back results skip
+#define OCCLUSION_QUERY_NONE 0xffffffffu
+#define OCCLUSION_QUERY_OCCLUDED 0xfffffffeu
+
+struct OcclusionQueries
+{
+	VkQueryPool query_pool;
+	// One uint32_t sample count per query of the last frame, the predicate of conditional draws
+	VkBuffer predicate_buffer;
+	VkDeviceMemory predicate_mem;
+	// Proxy pipeline, requested every frame until it is compiled. Queries are issued once it is ready.
+	struct PipelineKey proxy_key;
+	VkPipeline proxy_pipeline;
+	// Object space bounding box pushed to the proxy shader, xyz of min then max
+	glm::vec4 box[2];
+	// Radius of the sphere around the mesh bounding sphere center that contains the box, relative to the
+	// bounding sphere radius
+	float box_radius_scale;
+	// Query each instance was tested with in the last frame, OCCLUSION_QUERY_NONE when it was not
+	uint32_t* instance_queries;
+	// Instances by query, query_count of them are tested this frame
+	uint32_t* queried_instances;
+	uint32_t query_count;
+	// Predicate query of each visible list entry this frame, or one of the OCCLUSION_QUERY_ values
+	uint32_t* predicates;
+	// Read back sample counts, only without conditional rendering
+	uint32_t* results;
+};
+
+struct OcclusionQueries* create_occlusion_queries(struct GraphicsContext* graphics_context, const struct Mesh* mesh)
+{
+	struct OcclusionQueries* queries = (struct OcclusionQueries*)calloc(1, sizeof(struct OcclusionQueries));
+	uint32_t instance_count = graphics_context->instance_count;
+	VkQueryPoolCreateInfo query_pool_create_info{ };
+	glm::vec3 box_center = (mesh->bounds_min + mesh->bounds_max) * 0.5f;
+	glm::vec3 box_extent = (mesh->bounds_max - mesh->bounds_min) * 0.5f;
+
+	if (!queries)
+	{
+		printf("cannot allocate occlusion queries\n");
+		return NULL;
+	}
+	queries->instance_queries = (uint32_t*)malloc((size_t)instance_count * sizeof(uint32_t));
+	queries->queried_instances = (uint32_t*)malloc((size_t)instance_count * sizeof(uint32_t));
+	queries->predicates = (uint32_t*)malloc((size_t)instance_count * sizeof(uint32_t));
+	queries->results = (uint32_t*)malloc((size_t)instance_count * sizeof(uint32_t));
+	if (!queries->instance_queries || !queries->queried_instances || !queries->predicates || !queries->results)
+	{
+		printf("cannot allocate occlusion queries for %u instances\n", instance_count);
+		destroy_occlusion_queries(graphics_context, queries);
+		return NULL;
+	}
+	memset(queries->instance_queries, 0xff, (size_t)instance_count * sizeof(uint32_t));
+
+	query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	query_pool_create_info.queryType = VK_QUERY_TYPE_OCCLUSION;
+	query_pool_create_info.queryCount = instance_count;
+	if (vkCreateQueryPool(graphics_context->device, &query_pool_create_info, NULL, &queries->query_pool) != VK_SUCCESS)
+	{
+		printf("cannot create %u occlusion queries\n", instance_count);
+		destroy_occlusion_queries(graphics_context, queries);
+		return NULL;
+	}
+
+	// Written by the GPU only, never read before a query of the last frame was copied to it
+	if (graphics_context->conditional_rendering)
+	{
+		VkDeviceSize predicate_size = (VkDeviceSize)instance_count * sizeof(uint32_t);
+
+		queries->predicate_buffer = create_buffer(graphics_context->device, predicate_size,
+			VK_BUFFER_USAGE_CONDITIONAL_RENDERING_BIT_EXT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+		queries->predicate_mem = alloc_bind_bufer_memory(graphics_context, queries->predicate_buffer, predicate_size,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	}
+
+	box_extent = box_extent + glm::vec3(glm::length(box_extent) * OCCLUSION_PROXY_PADDING);
+	queries->box[0] = glm::vec4(box_center - box_extent, 1.0f);
+	queries->box[1] = glm::vec4(box_center + box_extent, 1.0f);
+	queries->box_radius_scale = (glm::length(box_center - mesh->sphere_center) + glm::length(box_extent)) /
+		glm::max(mesh->sphere_radius, 1e-6f);
+
+	// Depth tested without writes, both sides count so a box the camera looks into from behind still passes.
+	// The shaders declare the bindings and push constant size of the scene shaders and share their layout.
+	init_pipeline_key(graphics_context, &queries->proxy_key);
+	strncpy_s(queries->proxy_key.vertex_shader, sizeof(queries->proxy_key.vertex_shader), OCCLUSION_PROXY_VERTEX_SHADER, _TRUNCATE);
+	strncpy_s(queries->proxy_key.fragment_shader, sizeof(queries->proxy_key.fragment_shader), OCCLUSION_PROXY_FRAGMENT_SHADER, _TRUNCATE);
+	queries->proxy_key.vertex_binding_count = 0;
+	memset(queries->proxy_key.vertex_bindings, 0, sizeof(queries->proxy_key.vertex_bindings));
+	queries->proxy_key.vertex_attribute_count = 0;
+	memset(queries->proxy_key.vertex_attributes, 0, sizeof(queries->proxy_key.vertex_attributes));
+	queries->proxy_key.cull_mode = VK_CULL_MODE_NONE;
+	queries->proxy_key.depth_write = VK_FALSE;
+	queries->proxy_key.color_write_mask = 0;
+	return queries;
+}
+
+void destroy_occlusion_queries(struct GraphicsContext* graphics_context, struct OcclusionQueries* queries)
+{
+	if (!queries)
+		return;
+
+	if (queries->query_pool != VK_NULL_HANDLE)
+		vkDestroyQueryPool(graphics_context->device, queries->query_pool, NULL);
+	destroy_buffer(graphics_context->device, queries->predicate_buffer);
+	free_memory(graphics_context->device, queries->predicate_mem);
+	free(queries->instance_queries);
+	free(queries->queried_instances);
+	free(queries->predicates);
+	free(queries->results);
+	free(queries);
+}
+
+uint32_t update_occlusion_queries(struct GraphicsContext* graphics_context, struct OcclusionQueries* queries,
+	const struct CullingBounds* bounds, const uint32_t* visible, uint32_t visible_count, glm::vec3 camera_position)
+{
+	uint32_t occluded = 0;
+
+	// The device is idle, so every query issued in the last frame is available. Ones that are not keep the
+	// prefilled count and draw.
+	if (!graphics_context->conditional_rendering && queries->query_count)
+	{
+		for (uint32_t i = 0; i < queries->query_count; i++)
+			queries->results[i] = 1;
+		vkGetQueryPoolResults(graphics_context->device, queries->query_pool, 0, queries->query_count,
+			queries->query_count * sizeof(uint32_t), queries->results, sizeof(uint32_t), 0);
+	}
+
+	for (uint32_t i = 0; i < visible_count; i++)
+	{
+		uint32_t instance = visible[i];
+		uint32_t query = queries->instance_queries[instance];
+		glm::vec3 center = glm::vec3(bounds->center_x[instance], bounds->center_y[instance], bounds->center_z[instance]);
+		float box_radius = bounds->radius[instance] * queries->box_radius_scale + OCCLUSION_PROXY_CLEARANCE;
+		glm::vec3 offset = center - camera_position;
+
+		// Instances that just became visible have no result, ones around the camera one that cannot be trusted
+		if (query == OCCLUSION_QUERY_NONE || glm::dot(offset, offset) <= box_radius * box_radius)
+		{
+			queries->predicates[i] = OCCLUSION_QUERY_NONE;
+		}
+		else if (!graphics_context->conditional_rendering)
+		{
+			queries->predicates[i] = queries->results[query] ? OCCLUSION_QUERY_NONE : OCCLUSION_QUERY_OCCLUDED;
+			occluded += queries->results[query] ? 0 : 1;
+		}
+		else
+		{
+			queries->predicates[i] = query;
+		}
+	}
+
+	for (uint32_t i = 0; i < queries->query_count; i++)
+	{
+		queries->instance_queries[queries->queried_instances[i]] = OCCLUSION_QUERY_NONE;
+	}
+	// Nothing is tested while the proxy pipeline compiles, every instance then draws in the next frame
+	queries->proxy_pipeline = get_pipeline_async(graphics_context, &queries->proxy_key, VK_NULL_HANDLE);
+	queries->query_count = queries->proxy_pipeline != VK_NULL_HANDLE ? visible_count : 0;
+	for (uint32_t i = 0; i < queries->query_count; i++)
+	{
+		queries->instance_queries[visible[i]] = i;
+		queries->queried_instances[i] = visible[i];
+	}
+	return occluded;
+}
+
+void record_occlusion_query_reset(struct GraphicsContext* graphics_context, const struct OcclusionQueries* queries,
+	VkCommandBuffer cmd)
+{
+	// Orders the copy of the last frame before both the predicate reads and the reset
+	if (graphics_context->conditional_rendering)
+	{
+		VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_CONDITIONAL_RENDERING_READ_BIT_EXT;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_CONDITIONAL_RENDERING_BIT_EXT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+	}
+	if (queries->query_count)
+		vkCmdResetQueryPool(cmd, queries->query_pool, 0, queries->query_count);
+}
+
+// Instances [first, first + count) of the visible list, all of one LOD
+static uint64_t draw_visible_range(struct GraphicsContext* graphics_context, VkCommandBuffer cmd, uint32_t lod, uint32_t first,
+	uint32_t count)
+{
+	uint64_t triangles = 0;
+
+	for (uint32_t d = 0; d < graphics_context->draw_count; d++)
+	{
+		const struct MeshDraw* draw = &graphics_context->draws[d];
+
+		if (draw->lod != lod)
+			continue;
+		vkCmdDrawIndexed(cmd, draw->index_count, count, draw->first_index + graphics_context->lod_index_offsets[lod],
+			draw->vertex_offset, first);
+		triangles += (uint64_t)(draw->index_count / 3) * count;
+	}
+	return triangles;
+}
+
+uint64_t draw_occlusion_tested(struct GraphicsContext* graphics_context, const struct OcclusionQueries* queries,
+	VkCommandBuffer cmd, const uint32_t* lod_instances)
+{
+	VkConditionalRenderingBeginInfoEXT conditional_rendering_begin_info = { VK_STRUCTURE_TYPE_CONDITIONAL_RENDERING_BEGIN_INFO_EXT };
+	uint64_t triangles = 0;
+	uint32_t lod_end = 0;
+
+	conditional_rendering_begin_info.buffer = queries->predicate_buffer;
+	for (uint32_t lod = 0; lod < graphics_context->lod_count; lod++)
+	{
+		uint32_t lod_first = lod_end;
+		// Start of the run of unconditional draws, drawn as one instanced draw
+		uint32_t run = lod_first;
+
+		lod_end += lod_instances[lod];
+		for (uint32_t i = lod_first; i < lod_end; i++)
+		{
+			uint32_t predicate = queries->predicates[i];
+
+			if (predicate == OCCLUSION_QUERY_NONE)
+				continue;
+			if (run < i)
+				triangles += draw_visible_range(graphics_context, cmd, lod, run, i - run);
+			run = i + 1;
+			if (predicate == OCCLUSION_QUERY_OCCLUDED)
+				continue;
+
+			conditional_rendering_begin_info.offset = (VkDeviceSize)predicate * sizeof(uint32_t);
+			graphics_context->pfn_vkCmdBeginConditionalRenderingEXT(cmd, &conditional_rendering_begin_info);
+			triangles += draw_visible_range(graphics_context, cmd, lod, i, 1);
+			graphics_context->pfn_vkCmdEndConditionalRenderingEXT(cmd);
+		}
+		if (run < lod_end)
+			triangles += draw_visible_range(graphics_context, cmd, lod, run, lod_end - run);
+	}
+	return triangles;
+}
+
+void draw_occlusion_proxies(struct GraphicsContext* graphics_context, const struct OcclusionQueries* queries,
+	VkCommandBuffer cmd)
+{
+	if (!queries->query_count)
+		return;
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, queries->proxy_pipeline);
+	set_pipeline_dynamic_state(graphics_context, cmd, &queries->proxy_key);
+	vkCmdPushConstants(cmd, graphics_context->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(queries->box), queries->box);
+	// gl_InstanceIndex picks the instance from the visible list, like in the scene draws
+	for (uint32_t i = 0; i < queries->query_count; i++)
+	{
+		vkCmdBeginQuery(cmd, queries->query_pool, i, 0);
+		vkCmdDraw(cmd, OCCLUSION_PROXY_VERTEX_COUNT, 1, 0, i);
+		vkCmdEndQuery(cmd, queries->query_pool, i);
+	}
+}
+
+void record_occlusion_query_copy(struct GraphicsContext* graphics_context, const struct OcclusionQueries* queries,
+	VkCommandBuffer cmd)
+{
+	if (!graphics_context->conditional_rendering || !queries->query_count)
+		return;
+
+	// The predicates of this frame are read before they are overwritten
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_CONDITIONAL_RENDERING_BIT_EXT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 0, NULL);
+	vkCmdCopyQueryPoolResults(cmd, queries->query_pool, 0, queries->query_count, queries->predicate_buffer, 0, sizeof(uint32_t),
+		VK_QUERY_RESULT_WAIT_BIT);
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+#include "common.h"
+
+#define OCCLUSION_PROXY_VERTEX_SHADER "occlusion_proxy.vert"
+#define OCCLUSION_PROXY_FRAGMENT_SHADER "occlusion_proxy.frag"
+// Triangle list of the proxy box, generated from gl_VertexIndex
+#define OCCLUSION_PROXY_VERTEX_COUNT 36
+// Proxy boxes grow by this fraction of their half diagonal, so mesh faces lying on the box cannot hide it
+#define OCCLUSION_PROXY_PADDING 0.01f
+// Instances whose proxy box comes closer than this to the camera are drawn untested, the near plane would clip the box
+#define OCCLUSION_PROXY_CLEARANCE 0.01f
+
+struct Mesh;
+struct CullingBounds;
+struct OcclusionQueries;
+
+// Creates the query pool with one query per instance and, with VK_EXT_conditional_rendering, the predicate buffer the
+// results are copied into. Proxies are the bounding box of mesh. NULL on failure.
+extern struct OcclusionQueries* create_occlusion_queries(struct GraphicsContext* graphics_context, const struct Mesh* mesh);
+extern void destroy_occlusion_queries(struct GraphicsContext* graphics_context, struct OcclusionQueries* queries);
+// Once per frame after culling: decides how each entry of the visible list is drawn from the queries of the last frame,
+// then assigns query i to visible[i]. Without conditional rendering the last results are read back here.
+// Returns the instances skipped as occluded, 0 when the draws are predicated on the GPU.
+extern uint32_t update_occlusion_queries(struct GraphicsContext* graphics_context, struct OcclusionQueries* queries,
+	const struct CullingBounds* bounds, const uint32_t* visible, uint32_t visible_count, glm::vec3 camera_position);
+// Outside of the render pass, before it: makes the last results visible to conditional rendering and resets the queries
+extern void record_occlusion_query_reset(struct GraphicsContext* graphics_context, const struct OcclusionQueries* queries,
+	VkCommandBuffer cmd);
+// Inside the render pass with the scene pipeline and buffers bound: draws the visible list, sorted by LOD with
+// lod_instances per LOD, skipping or predicating the instances occluded in the last frame. Returns the triangles drawn.
+extern uint64_t draw_occlusion_tested(struct GraphicsContext* graphics_context, const struct OcclusionQueries* queries,
+	VkCommandBuffer cmd, const uint32_t* lod_instances);
+// Inside the render pass after the scene: one query around the proxy of every visible instance
+extern void draw_occlusion_proxies(struct GraphicsContext* graphics_context, const struct OcclusionQueries* queries,
+	VkCommandBuffer cmd);
+// After the render pass: copies the results into the predicate buffer the next frame draws with
+extern void record_occlusion_query_copy(struct GraphicsContext* graphics_context, const struct OcclusionQueries* queries,
+	VkCommandBuffer cmd);
\ No newline at end of file
@@ -1,131 +1,552 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <chrono>
 
 #include "common.h"
 #include "pipeline.h"
 #include "shader.h"
+#include "descriptor.h"
+#include "reflection.h"
+#include "pipeline_cache.h"
+#include "pipeline_manager.h"
+#include "vertex_format.h"
 
-VkResult setup_graphics_pipeline(struct GraphicsContext* graphics_context)
+// Vertex attributes are taken tightly packed in location order from binding 0,
+// which is how struct Vertex lays them out.
+static uint32_t build_vertex_input(const struct ShaderReflection* vertex_reflection,
+	VkVertexInputBindingDescription* binding, VkVertexInputAttributeDescription* attributes)
 {
-	VkResult res = VK_SUCCESS;
+	uint32_t stride = 0;
 
-	VkPipelineInputAssemblyStateCreateInfo input_assembly_state = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
-	VkPipelineRasterizationStateCreateInfo rasterization_state = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
-	VkPipelineColorBlendAttachmentState blend_attachment_state = {0};
-	VkPipelineColorBlendStateCreateInfo color_blend_state = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
-	// Note: Using reversed depth-buffer for increased precision, so Greater depth values are kept
-	VkPipelineDepthStencilStateCreateInfo depth_stencil_state = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
-	VkPipelineViewportStateCreateInfo viewport_state = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
-	VkPipelineMultisampleStateCreateInfo multisample_state = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
-	VkDynamicState dynamic_state_enables[] = {
-		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_SCISSOR };
-	VkPipelineDynamicStateCreateInfo dynamic_state = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
-	// Load shaders
+	for (uint32_t i = 0; i < vertex_reflection->input_count; i++)
+	{
+		attributes[i].location = vertex_reflection->inputs[i].location;
+		attributes[i].binding = 0;
+		attributes[i].format = vertex_reflection->inputs[i].format;
+		attributes[i].offset = stride;
+		stride += vertex_reflection->inputs[i].size;
+	}
+
+	if (stride != sizeof(struct Vertex))
+	{
+		printf("vertex shader inputs (%u bytes) do not match struct Vertex (%zu bytes)\n", stride, sizeof(struct Vertex));
+	}
+
+	binding->binding = 0;
+	binding->stride = stride;
+	binding->inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	return vertex_reflection->input_count;
+}
+
+// Viewport and scissor plus everything extended dynamic state 1, 2 and 3 can take over
+#define MAX_PIPELINE_DYNAMIC_STATES 13
+
+// Per pipeline create info storage, kept alive until vkCreateGraphicsPipelines returns
+struct PipelineState
+{
 	VkPipelineShaderStageCreateInfo shader_stages[2];
+	VkVertexInputBindingDescription vertex_input_bindings[MAX_PIPELINE_VERTEX_BINDINGS];
+	VkVertexInputAttributeDescription vertex_input_attributes[MAX_REFLECTED_INPUTS];
+	VkPipelineVertexInputStateCreateInfo vertex_input_state;
+	VkPipelineInputAssemblyStateCreateInfo input_assembly_state;
+	VkPipelineRasterizationStateCreateInfo rasterization_state;
+	VkPipelineColorBlendAttachmentState blend_attachment_state;
+	VkPipelineColorBlendStateCreateInfo color_blend_state;
+	VkPipelineDepthStencilStateCreateInfo depth_stencil_state;
+	VkPipelineViewportStateCreateInfo viewport_state;
+	VkPipelineMultisampleStateCreateInfo multisample_state;
+	VkDynamicState dynamic_state_enables[MAX_PIPELINE_DYNAMIC_STATES];
+	VkPipelineDynamicStateCreateInfo dynamic_state;
+	VkPipelineRenderingCreateInfoKHR rendering_info;
+	VkGraphicsPipelineLibraryCreateInfoEXT library_info;
+	VkPipelineCreationFeedbackCreateInfoEXT creation_feedback_info;
+	VkPipelineCreationFeedbackEXT pipeline_feedback;
+	VkPipelineCreationFeedbackEXT stage_feedbacks[2];
+};
 
-	// Vertex bindings and attributes
-	VkVertexInputBindingDescription vertex_input_bindings[] = {
-		{
-		   0, //binding
-	       sizeof(struct Vertex), // stride
-	       VK_VERTEX_INPUT_RATE_VERTEX, //inputRate
-		},
-	};
+void init_pipeline_key(struct GraphicsContext* graphics_context, struct PipelineKey* key)
+{
+	memset(key, 0, sizeof(*key));
 
-	VkVertexInputAttributeDescription vertex_input_attributes[] = {
-		{
-		  .location = 0, // location
-	      .binding = 0, // binding
-	      .format = VK_FORMAT_R32G32B32_SFLOAT,//format
-	      .offset = offsetof(Vertex, position), // offset
-		},// position
-		{
-		 .location = 1, 
-		 .binding = 0, 
-		 .format = VK_FORMAT_R32G32B32_SFLOAT, 
-		 .offset = offsetof(Vertex, color)
-		}// color
+	strncpy_s(key->vertex_shader, sizeof(key->vertex_shader), "triangle.vert", _TRUNCATE);
+	strncpy_s(key->fragment_shader, sizeof(key->fragment_shader), "triangle.frag", _TRUNCATE);
 
-	};
+	key->vertex_binding_count = 1;
+	key->vertex_attribute_count = get_vertex_input(graphics_context->vertex_format, &key->vertex_bindings[0], key->vertex_attributes);
 
-	VkPipelineVertexInputStateCreateInfo vertex_input_state = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+	key->topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	key->polygon_mode = VK_POLYGON_MODE_FILL;
+	key->cull_mode = VK_CULL_MODE_FRONT_BIT;
+	key->front_face = VK_FRONT_FACE_CLOCKWISE;
 
-	VkGraphicsPipelineCreateInfo pipeline_create_info = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	// Note: Using reversed depth-buffer for increased precision, so Greater depth values are kept
+	key->depth_test = VK_TRUE;
+	key->depth_write = VK_TRUE;
+	key->depth_compare = VK_COMPARE_OP_GREATER;
+
+	key->blend_enable = VK_FALSE;
+	key->src_color_blend_factor = VK_BLEND_FACTOR_ONE;
+	key->dst_color_blend_factor = VK_BLEND_FACTOR_ZERO;
+	key->color_blend_op = VK_BLEND_OP_ADD;
+	key->src_alpha_blend_factor = VK_BLEND_FACTOR_ONE;
+	key->dst_alpha_blend_factor = VK_BLEND_FACTOR_ZERO;
+	key->alpha_blend_op = VK_BLEND_OP_ADD;
+	key->color_write_mask = 0xf;
+
+	key->color_format = graphics_context->surface_format.format;
+	key->depth_format = graphics_context->depth_format;
+	key->samples = graphics_context->sample_count;
+}
+
+// Topologies of the same class can be switched at record time without dynamicPrimitiveTopologyUnrestricted
+static VkPrimitiveTopology get_topology_class(VkPrimitiveTopology topology)
+{
+	switch (topology)
+	{
+	case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+	case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+	case VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY:
+	case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY:
+		return VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+	case VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST:
+	case VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP:
+	case VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN:
+	case VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST_WITH_ADJACENCY:
+	case VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP_WITH_ADJACENCY:
+		return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	default:
+		return topology;
+	}
+}
+
+const struct PipelineKey* normalize_pipeline_key(struct GraphicsContext* graphics_context, const struct PipelineKey* key, struct PipelineKey* normalized)
+{
+	*normalized = *key;
+
+	if (graphics_context->extended_dynamic_state)
+	{
+		normalized->topology = get_topology_class(key->topology);
+		normalized->cull_mode = VK_CULL_MODE_NONE;
+		normalized->front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		normalized->depth_test = VK_FALSE;
+		normalized->depth_write = VK_FALSE;
+		normalized->depth_compare = VK_COMPARE_OP_NEVER;
+	}
+
+	if (graphics_context->extended_dynamic_state2)
+	{
+		normalized->primitive_restart = VK_FALSE;
+	}
+
+	if (graphics_context->extended_dynamic_state3)
+	{
+		normalized->polygon_mode = VK_POLYGON_MODE_FILL;
+		normalized->blend_enable = VK_FALSE;
+		normalized->src_color_blend_factor = VK_BLEND_FACTOR_ZERO;
+		normalized->dst_color_blend_factor = VK_BLEND_FACTOR_ZERO;
+		normalized->color_blend_op = VK_BLEND_OP_ADD;
+		normalized->src_alpha_blend_factor = VK_BLEND_FACTOR_ZERO;
+		normalized->dst_alpha_blend_factor = VK_BLEND_FACTOR_ZERO;
+		normalized->alpha_blend_op = VK_BLEND_OP_ADD;
+		normalized->color_write_mask = 0;
+	}
+	return normalized;
+}
+
+void set_pipeline_dynamic_state(struct GraphicsContext* graphics_context, VkCommandBuffer cmd, const struct PipelineKey* key)
+{
+	if (graphics_context->extended_dynamic_state)
+	{
+		graphics_context->pfn_vkCmdSetPrimitiveTopologyEXT(cmd, key->topology);
+		graphics_context->pfn_vkCmdSetCullModeEXT(cmd, key->cull_mode);
+		graphics_context->pfn_vkCmdSetFrontFaceEXT(cmd, key->front_face);
+		graphics_context->pfn_vkCmdSetDepthTestEnableEXT(cmd, key->depth_test);
+		graphics_context->pfn_vkCmdSetDepthWriteEnableEXT(cmd, key->depth_write);
+		graphics_context->pfn_vkCmdSetDepthCompareOpEXT(cmd, key->depth_compare);
+	}
+
+	if (graphics_context->extended_dynamic_state2)
+	{
+		graphics_context->pfn_vkCmdSetPrimitiveRestartEnableEXT(cmd, key->primitive_restart);
+	}
+
+	if (graphics_context->extended_dynamic_state3)
+	{
+		VkColorBlendEquationEXT blend_equation;
+
+		blend_equation.srcColorBlendFactor = key->src_color_blend_factor;
+		blend_equation.dstColorBlendFactor = key->dst_color_blend_factor;
+		blend_equation.colorBlendOp = key->color_blend_op;
+		blend_equation.srcAlphaBlendFactor = key->src_alpha_blend_factor;
+		blend_equation.dstAlphaBlendFactor = key->dst_alpha_blend_factor;
+		blend_equation.alphaBlendOp = key->alpha_blend_op;
+
+		graphics_context->pfn_vkCmdSetPolygonModeEXT(cmd, key->polygon_mode);
+		graphics_context->pfn_vkCmdSetColorBlendEnableEXT(cmd, 0, 1, &key->blend_enable);
+		graphics_context->pfn_vkCmdSetColorBlendEquationEXT(cmd, 0, 1, &blend_equation);
+		graphics_context->pfn_vkCmdSetColorWriteMaskEXT(cmd, 0, 1, &key->color_write_mask);
+	}
+}
+
+static void fill_dynamic_state(struct GraphicsContext* graphics_context, struct PipelineState* state)
+{
+	uint32_t count = 0;
+
+	state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_VIEWPORT;
+	state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_SCISSOR;
+
+	if (graphics_context->extended_dynamic_state)
+	{
+		state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT;
+		state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_CULL_MODE_EXT;
+		state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_FRONT_FACE_EXT;
+		state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT;
+		state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT;
+		state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT;
+	}
+
+	if (graphics_context->extended_dynamic_state2)
+	{
+		state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE_EXT;
+	}
+
+	if (graphics_context->extended_dynamic_state3)
+	{
+		state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_POLYGON_MODE_EXT;
+		state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT;
+		state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT;
+		state->dynamic_state_enables[count++] = VK_DYNAMIC_STATE_COLOR_WRITE_MASK_EXT;
+	}
+
+	state->dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	state->dynamic_state.dynamicStateCount = count;
+	state->dynamic_state.pDynamicStates = state->dynamic_state_enables;
+}
+
+static void fill_pipeline_state(struct GraphicsContext* graphics_context, const struct PipelineCreateDesc* desc,
+	struct PipelineState* state, VkGraphicsPipelineCreateInfo* pipeline_create_info)
+{
+	const struct PipelineKey* key = desc->key;
+
+	memset(state, 0, sizeof(*state));
+	state->input_assembly_state.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	state->rasterization_state.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	state->color_blend_state.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	state->depth_stencil_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	state->viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	state->multisample_state.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	state->vertex_input_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	state->rendering_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+	state->creation_feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+
+	state->input_assembly_state.topology = key->topology;
+	state->input_assembly_state.flags = 0;
+	state->input_assembly_state.primitiveRestartEnable = key->primitive_restart;
+
+	state->rasterization_state.polygonMode = key->polygon_mode;
+	state->rasterization_state.cullMode = key->cull_mode;
+	state->rasterization_state.frontFace = key->front_face;
+	state->rasterization_state.flags = 0;
+	state->rasterization_state.depthClampEnable = VK_FALSE;
+	state->rasterization_state.lineWidth = 1.0f;
 
-	input_assembly_state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	input_assembly_state.flags = 0;
-	input_assembly_state.primitiveRestartEnable = VK_FALSE;
+	state->blend_attachment_state.colorWriteMask = key->color_write_mask;
+	state->blend_attachment_state.blendEnable = key->blend_enable;
+	state->blend_attachment_state.srcColorBlendFactor = key->src_color_blend_factor;
+	state->blend_attachment_state.dstColorBlendFactor = key->dst_color_blend_factor;
+	state->blend_attachment_state.colorBlendOp = key->color_blend_op;
+	state->blend_attachment_state.srcAlphaBlendFactor = key->src_alpha_blend_factor;
+	state->blend_attachment_state.dstAlphaBlendFactor = key->dst_alpha_blend_factor;
+	state->blend_attachment_state.alphaBlendOp = key->alpha_blend_op;
 
-	rasterization_state.polygonMode = VK_POLYGON_MODE_FILL;
-	rasterization_state.cullMode = VK_CULL_MODE_FRONT_BIT;
-	rasterization_state.frontFace = VK_FRONT_FACE_CLOCKWISE;
-	rasterization_state.flags = 0;
-	rasterization_state.depthClampEnable = VK_FALSE;
-	rasterization_state.lineWidth = 1.0f;
+	state->color_blend_state.attachmentCount = 1;
+	state->color_blend_state.pAttachments = &state->blend_attachment_state;
 
-	blend_attachment_state.colorWriteMask = 0xf;
-	blend_attachment_state.blendEnable = VK_FALSE;
+	state->depth_stencil_state.depthTestEnable = key->depth_test;
+	state->depth_stencil_state.depthWriteEnable = key->depth_write;
+	state->depth_stencil_state.depthCompareOp = key->depth_compare;
+	state->depth_stencil_state.front = state->depth_stencil_state.back;
+	state->depth_stencil_state.back.compareOp = key->depth_compare;
 
-	color_blend_state.attachmentCount = 1;
-	color_blend_state.pAttachments = &blend_attachment_state;
+	state->viewport_state.viewportCount = 1;
+	state->viewport_state.scissorCount = 1;
+	state->viewport_state.flags = 0;
 
-	depth_stencil_state.depthTestEnable = VK_TRUE;
-	depth_stencil_state.depthWriteEnable = VK_TRUE;
-	depth_stencil_state.depthCompareOp = VK_COMPARE_OP_GREATER;
-	depth_stencil_state.front = depth_stencil_state.back;
-	depth_stencil_state.back.compareOp = VK_COMPARE_OP_GREATER;
+	state->multisample_state.rasterizationSamples = key->samples;
+	state->multisample_state.flags = 0;
 
-	viewport_state.viewportCount = 1;
-	viewport_state.scissorCount = 1;
-	viewport_state.flags = 0;
+	fill_dynamic_state(graphics_context, state);
 
-	multisample_state.rasterizationSamples = VK_SAMPLE_COUNT_8_BIT;
-	multisample_state.flags = 0;
+	state->shader_stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	state->shader_stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	state->shader_stages[0].module = desc->vertex_module;
+	state->shader_stages[0].pName = "main";
+	state->shader_stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	state->shader_stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	state->shader_stages[1].module = desc->fragment_module;
+	state->shader_stages[1].pName = "main";
 
-	dynamic_state.pDynamicStates = dynamic_state_enables;
-	dynamic_state.dynamicStateCount = sizeof(dynamic_state_enables)/sizeof(dynamic_state_enables[0]);
-	dynamic_state.flags = 0;
+	if (key->vertex_attribute_count)
+	{
+		state->vertex_input_state.vertexBindingDescriptionCount = key->vertex_binding_count;
+		state->vertex_input_state.pVertexBindingDescriptions = key->vertex_bindings;
+		state->vertex_input_state.vertexAttributeDescriptionCount = key->vertex_attribute_count;
+		state->vertex_input_state.pVertexAttributeDescriptions = key->vertex_attributes;
+	}
+	else
+	{
+		state->vertex_input_state.vertexBindingDescriptionCount = 1;
+		state->vertex_input_state.pVertexBindingDescriptions = state->vertex_input_bindings;
+		state->vertex_input_state.vertexAttributeDescriptionCount =
+			build_vertex_input(desc->vertex_reflection, &state->vertex_input_bindings[0], state->vertex_input_attributes);
+		state->vertex_input_state.pVertexAttributeDescriptions = state->vertex_input_attributes;
+	}
 
-	shader_stages[0] = load_shader(graphics_context, "triangle.vert", VK_SHADER_STAGE_VERTEX_BIT);
-	shader_stages[1] = load_shader(graphics_context, "triangle.frag", VK_SHADER_STAGE_FRAGMENT_BIT);
+	// Only one set of attachments exists, keys must describe it
+	if (key->color_format != graphics_context->surface_format.format || key->depth_format != graphics_context->depth_format ||
+		key->samples != graphics_context->sample_count)
+	{
+		printf("pipeline attachment formats or sample count do not match the render pass\n");
+	}
 
-	vertex_input_state.vertexBindingDescriptionCount = sizeof(vertex_input_bindings) / sizeof(vertex_input_bindings[0]);
-	vertex_input_state.pVertexBindingDescriptions = vertex_input_bindings;
-	vertex_input_state.vertexAttributeDescriptionCount = sizeof(vertex_input_attributes) / sizeof(vertex_input_attributes[0]);
-	vertex_input_state.pVertexAttributeDescriptions = vertex_input_attributes;
+	memset(pipeline_create_info, 0, sizeof(*pipeline_create_info));
+	pipeline_create_info->sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipeline_create_info->layout = desc->layout;
+	pipeline_create_info->renderPass = graphics_context->render_pass;
 
-	pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipeline_create_info.layout = graphics_context->pipeline_layout;
-	pipeline_create_info.renderPass = graphics_context->render_pass;
-	pipeline_create_info.flags = 0;
+	// Without a render pass the attachment formats are given directly
+	if (graphics_context->dynamic_rendering)
+	{
+		state->rendering_info.colorAttachmentCount = 1;
+		state->rendering_info.pColorAttachmentFormats = &key->color_format;
+		state->rendering_info.depthAttachmentFormat = key->depth_format;
+		state->rendering_info.stencilAttachmentFormat = depth_format_has_stencil(key->depth_format) ? key->depth_format : VK_FORMAT_UNDEFINED;
+		pipeline_create_info->renderPass = VK_NULL_HANDLE;
+		pipeline_create_info->pNext = &state->rendering_info;
+	}
+	pipeline_create_info->flags = 0;
+	pipeline_create_info->basePipelineIndex = -1;
+	pipeline_create_info->basePipelineHandle = VK_NULL_HANDLE;
+	pipeline_create_info->pVertexInputState = &state->vertex_input_state;
+	pipeline_create_info->pInputAssemblyState = &state->input_assembly_state;
+	pipeline_create_info->pRasterizationState = &state->rasterization_state;
+	pipeline_create_info->pColorBlendState = &state->color_blend_state;
+	pipeline_create_info->pMultisampleState = &state->multisample_state;
+	pipeline_create_info->pViewportState = &state->viewport_state;
+	pipeline_create_info->pDepthStencilState = &state->depth_stencil_state;
+	pipeline_create_info->pDynamicState = &state->dynamic_state;
+	pipeline_create_info->stageCount = sizeof(state->shader_stages) / sizeof(state->shader_stages[0]);
+	pipeline_create_info->pStages = state->shader_stages;
+
+	if (graphics_context->pipeline_creation_feedback)
+	{
+		state->creation_feedback_info.pPipelineCreationFeedback = &state->pipeline_feedback;
+		state->creation_feedback_info.pipelineStageCreationFeedbackCount = pipeline_create_info->stageCount;
+		state->creation_feedback_info.pPipelineStageCreationFeedbacks = state->stage_feedbacks;
+		state->creation_feedback_info.pNext = pipeline_create_info->pNext;
+		pipeline_create_info->pNext = &state->creation_feedback_info;
+	}
+}
+
+VkResult create_graphics_pipelines(struct GraphicsContext* graphics_context, const struct PipelineCreateDesc* descs, uint32_t count, VkPipeline* pipelines)
+{
+	VkResult res;
+	struct PipelineState* states = (struct PipelineState*)malloc(count * sizeof(struct PipelineState));
+	VkGraphicsPipelineCreateInfo* pipeline_create_infos = (VkGraphicsPipelineCreateInfo*)malloc(count * sizeof(VkGraphicsPipelineCreateInfo));
+
+	if (!states || !pipeline_create_infos)
+	{
+		free(states);
+		free(pipeline_create_infos);
+		return VK_ERROR_OUT_OF_HOST_MEMORY;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		fill_pipeline_state(graphics_context, &descs[i], &states[i], &pipeline_create_infos[i]);
+	}
+
+	res = vkCreateGraphicsPipelines(graphics_context->device, graphics_context->pipeline_cache, count, pipeline_create_infos, nullptr, pipelines);
+	if (res != VK_SUCCESS)
+	{
+		printf("vkCreateGraphicsPipelines failed: %s\n", vk_result_to_string(res));
+	}
+
+	if (graphics_context->pipeline_creation_feedback)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			record_pipeline_creation_feedback(&states[i].pipeline_feedback, states[i].stage_feedbacks, pipeline_create_infos[i].stageCount);
+		}
+	}
+
+	free(states);
+	free(pipeline_create_infos);
+	return res;
+}
+
+VkResult create_graphics_pipeline_library(struct GraphicsContext* graphics_context, const struct PipelineCreateDesc* desc,
+	VkGraphicsPipelineLibraryFlagsEXT part, VkPipeline* library)
+{
+	VkResult res;
+	VkGraphicsPipelineCreateInfo pipeline_create_info;
+	struct PipelineState* state = (struct PipelineState*)malloc(sizeof(struct PipelineState));
+
+	if (!state)
+		return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+	// The full state is filled in, the driver only reads what belongs to part
+	fill_pipeline_state(graphics_context, desc, state, &pipeline_create_info);
+	state->library_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+	state->library_info.flags = part;
+	state->library_info.pNext = pipeline_create_info.pNext;
+	pipeline_create_info.pNext = &state->library_info;
+	// Keep what the optimized link needs
+	pipeline_create_info.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+
+	pipeline_create_info.stageCount = 0;
+	pipeline_create_info.pStages = NULL;
+	if (part == VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT)
+	{
+		pipeline_create_info.stageCount = 1;
+		pipeline_create_info.pStages = &state->shader_stages[0];
+	}
+	else if (part == VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT)
+	{
+		pipeline_create_info.stageCount = 1;
+		pipeline_create_info.pStages = &state->shader_stages[1];
+	}
+	else
+	{
+		// Only the shader parts use descriptors
+		pipeline_create_info.layout = VK_NULL_HANDLE;
+	}
+	state->creation_feedback_info.pipelineStageCreationFeedbackCount = pipeline_create_info.stageCount;
+
+	*library = VK_NULL_HANDLE;
+	res = vkCreateGraphicsPipelines(graphics_context->device, graphics_context->pipeline_cache, 1, &pipeline_create_info, nullptr, library);
+	if (res != VK_SUCCESS)
+	{
+		printf("pipeline library creation failed: %s\n", vk_result_to_string(res));
+	}
+	else if (graphics_context->pipeline_creation_feedback)
+	{
+		record_pipeline_creation_feedback(&state->pipeline_feedback, state->stage_feedbacks, pipeline_create_info.stageCount);
+	}
+
+	free(state);
+	return res;
+}
+
+VkResult link_graphics_pipeline(struct GraphicsContext* graphics_context, const VkPipeline* libraries, uint32_t library_count,
+	VkPipelineLayout layout, VkBool32 optimize, VkPipeline* pipeline)
+{
+	VkResult res;
+	VkPipelineLibraryCreateInfoKHR library_info = { VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR };
+	VkGraphicsPipelineCreateInfo pipeline_create_info = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+
+	library_info.libraryCount = library_count;
+	library_info.pLibraries = libraries;
+
+	pipeline_create_info.pNext = &library_info;
+	pipeline_create_info.flags = optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+	pipeline_create_info.layout = layout;
 	pipeline_create_info.basePipelineIndex = -1;
 	pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
-	pipeline_create_info.pVertexInputState = &vertex_input_state;
-	pipeline_create_info.pInputAssemblyState = &input_assembly_state;
-	pipeline_create_info.pRasterizationState = &rasterization_state;
-	pipeline_create_info.pColorBlendState = &color_blend_state;
-	pipeline_create_info.pMultisampleState = &multisample_state;
-	pipeline_create_info.pViewportState = &viewport_state;
-	pipeline_create_info.pDepthStencilState = &depth_stencil_state;
-	pipeline_create_info.pDynamicState = &dynamic_state;
-	pipeline_create_info.stageCount = sizeof(shader_stages)/sizeof(shader_stages[0]);
-	pipeline_create_info.pStages = shader_stages;
-
-	VK_CHECK(vkCreateGraphicsPipelines(graphics_context->device, graphics_context->pipeline_cache, 1, &pipeline_create_info, nullptr, &graphics_context->graphics_pipeline));
-	//VK_CHECK(vkCreateGraphicsPipelines(graphics_context->device, VK_NULL_HANDLE, 1, &pipeline_create_info, nullptr, &graphics_context->graphics_pipeline));
-
-	// Pipeline is baked, we can delete the shader modules now.
-	vkDestroyShaderModule(graphics_context->device, shader_stages[0].module, nullptr);
-	vkDestroyShaderModule(graphics_context->device, shader_stages[1].module, nullptr);
 
+	*pipeline = VK_NULL_HANDLE;
+	res = vkCreateGraphicsPipelines(graphics_context->device, graphics_context->pipeline_cache, 1, &pipeline_create_info, nullptr, pipeline);
+	if (res != VK_SUCCESS)
+	{
+		printf("pipeline link failed: %s\n", vk_result_to_string(res));
+	}
+	return res;
+}
+
+VkResult setup_graphics_pipeline(struct GraphicsContext* graphics_context)
+{
+	struct PipelineKey key;
+	struct ShaderReflection shader_reflections[2];
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if (create_pipeline_manager(graphics_context))
+		return VK_ERROR_INITIALIZATION_FAILED;
+
+	init_pipeline_key(graphics_context, &key);
+
+	// Descriptor set and pipeline layouts come from what the shaders declare
+	if (get_pipeline_key_reflection(graphics_context, &key, shader_reflections) ||
+		setup_descriptor_set_layout(graphics_context, shader_reflections, sizeof(shader_reflections) / sizeof(shader_reflections[0])))
+	{
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	// Pipelines used by the last session compile on all compiler threads next to the fallback
+	warm_up_pipelines(graphics_context, PIPELINE_MANIFEST_FILE);
+
+	// Fallback drawn with while other pipelines compile in the background, so it is created up front
+	graphics_context->graphics_pipeline = get_pipeline(graphics_context, &key);
+	if (graphics_context->graphics_pipeline == VK_NULL_HANDLE)
+		return VK_ERROR_INITIALIZATION_FAILED;
+
+	// Known pipelines are ready before the first frame instead of showing up as hitches
+	wait_for_pipelines(graphics_context);
+	printf("pipelines ready after %.3f ms\n",
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+	return VK_SUCCESS;
+}
+
+VkResult setup_compute_pipeline(struct GraphicsContext* graphics_context, const char* shader_name,
+	VkPipeline* pipeline, VkPipelineLayout* pipeline_layout, VkDescriptorSetLayout* descriptor_set_layout)
+{
+	VkComputePipelineCreateInfo pipeline_create_info = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+	VkDescriptorSetLayout set_layouts[MAX_DESCRIPTOR_SETS] = { VK_NULL_HANDLE };
+	uint32_t set_layout_count = 0;
+	struct ShaderReflection reflection;
+	VkResult res;
+
+	pipeline_create_info.stage = load_shader(graphics_context, shader_name, VK_SHADER_STAGE_COMPUTE_BIT, &reflection);
+	if (pipeline_create_info.stage.module == VK_NULL_HANDLE)
+		return VK_ERROR_INITIALIZATION_FAILED;
+
+	*pipeline_layout = get_reflected_pipeline_layout(graphics_context, &reflection, 1, set_layouts, &set_layout_count);
+	// Descriptors are allocated for set 0 only
+	*descriptor_set_layout = set_layouts[0];
+	if (*pipeline_layout == VK_NULL_HANDLE || set_layout_count == 0)
+	{
+		printf("failed to build the pipeline layout of %s\n", shader_name);
+		vkDestroyShaderModule(graphics_context->device, pipeline_create_info.stage.module, nullptr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	pipeline_create_info.layout = *pipeline_layout;
+	res = vkCreateComputePipelines(graphics_context->device, graphics_context->pipeline_cache, 1, &pipeline_create_info, nullptr, pipeline);
+	vkDestroyShaderModule(graphics_context->device, pipeline_create_info.stage.module, nullptr);
+	if (res != VK_SUCCESS)
+	{
+		printf("compute pipeline %s failed: %s\n", shader_name, vk_result_to_string(res));
+	}
 	return res;
 }
 
 VkResult destroy_graphics_pipeline(struct GraphicsContext* graphics_context)
 {
-	vkDestroyPipeline(graphics_context->device,graphics_context->graphics_pipeline, nullptr);
-	vkDestroyPipelineLayout(graphics_context->device, graphics_context->pipeline_layout, nullptr);
+	save_pipeline_manifest(graphics_context, PIPELINE_MANIFEST_FILE);
+	// graphics_pipeline and the shader modules belong to the pipeline manager
+	destroy_pipeline_manager(graphics_context);
+	graphics_context->graphics_pipeline = VK_NULL_HANDLE;
+	if (graphics_context->culling_pipeline)
+	{
+		vkDestroyPipeline(graphics_context->device, graphics_context->culling_pipeline, nullptr);
+		graphics_context->culling_pipeline = VK_NULL_HANDLE;
+	}
+	// pipeline_layout and descriptor_set_layout are owned by the layout cache
+	destroy_layout_cache(graphics_context);
+	report_pipeline_creation_feedback();
+	// Keep what the driver compiled for the next run
+	save_pipeline_cache(graphics_context->device, graphics_context->pipeline_cache, PIPELINE_CACHE_FILE);
 	vkDestroyPipelineCache(graphics_context->device, graphics_context->pipeline_cache, nullptr);
 	return VK_SUCCESS;
 }
\ No newline at end of file
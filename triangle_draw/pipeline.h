@@ -1,4 +1,74 @@
 #pragma once
+#include "common.h"
+
+#define PIPELINE_SHADER_NAME_SIZE 64
+#define MAX_PIPELINE_VERTEX_BINDINGS 2
+#define MAX_PIPELINE_VERTEX_ATTRIBUTES 8
+
+struct ShaderReflection;
+
+// Full graphics pipeline state. Keys are hashed and compared bytewise,
+// so always start from init_pipeline_key before changing fields.
+struct PipelineKey
+{
+	char vertex_shader[PIPELINE_SHADER_NAME_SIZE];
+	char fragment_shader[PIPELINE_SHADER_NAME_SIZE];
+	// Vertex layout, taken from the vertex shader inputs when vertex_attribute_count is 0
+	uint32_t vertex_binding_count;
+	VkVertexInputBindingDescription vertex_bindings[MAX_PIPELINE_VERTEX_BINDINGS];
+	uint32_t vertex_attribute_count;
+	VkVertexInputAttributeDescription vertex_attributes[MAX_PIPELINE_VERTEX_ATTRIBUTES];
+	// Input assembly and rasterization
+	VkPrimitiveTopology topology;
+	VkBool32 primitive_restart;
+	VkPolygonMode polygon_mode;
+	VkCullModeFlags cull_mode;
+	VkFrontFace front_face;
+	// Depth
+	VkBool32 depth_test;
+	VkBool32 depth_write;
+	VkCompareOp depth_compare;
+	// Blend state of the single color attachment
+	VkBool32 blend_enable;
+	VkBlendFactor src_color_blend_factor;
+	VkBlendFactor dst_color_blend_factor;
+	VkBlendOp color_blend_op;
+	VkBlendFactor src_alpha_blend_factor;
+	VkBlendFactor dst_alpha_blend_factor;
+	VkBlendOp alpha_blend_op;
+	VkColorComponentFlags color_write_mask;
+	// Render pass compatibility
+	VkFormat color_format;
+	VkFormat depth_format;
+	VkSampleCountFlagBits samples;
+};
+
+// Everything resolved for one vkCreateGraphicsPipelines entry
+struct PipelineCreateDesc
+{
+	const struct PipelineKey* key;
+	VkShaderModule vertex_module;
+	VkShaderModule fragment_module;
+	const struct ShaderReflection* vertex_reflection;
+	VkPipelineLayout layout;
+};
+
+extern void init_pipeline_key(struct GraphicsContext* graphics_context, struct PipelineKey* key);
+// Resets the fields set at record time with extended dynamic state, so keys differing only in those share a pipeline.
+// Returns normalized.
+extern const struct PipelineKey* normalize_pipeline_key(struct GraphicsContext* graphics_context, const struct PipelineKey* key, struct PipelineKey* normalized);
+// Sets the dynamic part of key on cmd, after the pipeline created from the normalized key is bound
+extern void set_pipeline_dynamic_state(struct GraphicsContext* graphics_context, VkCommandBuffer cmd, const struct PipelineKey* key);
+extern VkResult create_graphics_pipelines(struct GraphicsContext* graphics_context, const struct PipelineCreateDesc* descs, uint32_t count, VkPipeline* pipelines);
+// Creates one VK_EXT_graphics_pipeline_library part of desc, with link time optimization info retained
+extern VkResult create_graphics_pipeline_library(struct GraphicsContext* graphics_context, const struct PipelineCreateDesc* desc,
+	VkGraphicsPipelineLibraryFlagsEXT part, VkPipeline* library);
+// Links pipeline library parts into a complete pipeline, optimize requests link time optimization
+extern VkResult link_graphics_pipeline(struct GraphicsContext* graphics_context, const VkPipeline* libraries, uint32_t library_count,
+	VkPipelineLayout layout, VkBool32 optimize, VkPipeline* pipeline);
 
 extern VkResult setup_graphics_pipeline(struct GraphicsContext* graphics_context);
+// Compute pipeline with the layout reflected from the shader, the layouts belong to the layout cache
+extern VkResult setup_compute_pipeline(struct GraphicsContext* graphics_context, const char* shader_name,
+	VkPipeline* pipeline, VkPipelineLayout* pipeline_layout, VkDescriptorSetLayout* descriptor_set_layout);
 extern VkResult destroy_graphics_pipeline(struct GraphicsContext* graphics_context);
\ No newline at end of file
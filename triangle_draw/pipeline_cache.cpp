@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include "pipeline_cache.h"
+#include <windows.h>
+
+// Updated from the pipeline compiler threads
+static struct
+{
+	std::atomic<uint32_t> pipelines;
+	std::atomic<uint32_t> pipelines_with_feedback;
+	std::atomic<uint32_t> pipeline_cache_hits;
+	std::atomic<uint32_t> stages;
+	std::atomic<uint32_t> stage_cache_hits;
+	std::atomic<uint64_t> creation_duration_ns;
+} feedback_stats;
+
+// Checks the VkPipelineCacheHeaderVersionOne at the start of the blob against the selected device
+static int validate_pipeline_cache_header(VkPhysicalDevice gpu_device, const void* data, size_t size)
+{
+	VkPipelineCacheHeaderVersionOne header;
+	VkPhysicalDeviceProperties properties;
+
+	if (size < sizeof(header))
+	{
+		printf("pipeline cache blob too small (%zu bytes)\n", size);
+		return -1;
+	}
+	memcpy(&header, data, sizeof(header));
+	vkGetPhysicalDeviceProperties(gpu_device, &properties);
+
+	if (header.headerSize < sizeof(header) || header.headerSize > size ||
+		header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+	{
+		printf("pipeline cache header is invalid\n");
+		return -1;
+	}
+
+	if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID ||
+		memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE))
+	{
+		printf("pipeline cache was written by another device or driver, discarding it\n");
+		return -1;
+	}
+	return 0;
+}
+
+VkPipelineCache load_pipeline_cache(VkPhysicalDevice gpu_device, VkDevice device, const char* file_name)
+{
+	VkPipelineCacheCreateInfo pipeline_cache_create_info = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+	VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+	void* data = NULL;
+	long data_size = 0;
+	FILE* fp = NULL;
+
+	if (!fopen_s(&fp, file_name, "rb") && fp)
+	{
+		fseek(fp, 0L, SEEK_END);
+		data_size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+
+		data = data_size > 0 ? malloc(data_size) : NULL;
+		if (data && fread(data, 1, data_size, fp) != (size_t)data_size)
+		{
+			free(data);
+			data = NULL;
+		}
+		fclose(fp);
+	}
+
+	if (data && !validate_pipeline_cache_header(gpu_device, data, data_size))
+	{
+		pipeline_cache_create_info.initialDataSize = data_size;
+		pipeline_cache_create_info.pInitialData = data;
+		printf("loaded pipeline cache %s (%ld bytes)\n", file_name, data_size);
+	}
+
+	// The driver may still reject the data, retry with an empty cache in that case
+	if (vkCreatePipelineCache(device, &pipeline_cache_create_info, nullptr, &pipeline_cache) != VK_SUCCESS)
+	{
+		pipeline_cache_create_info.initialDataSize = 0;
+		pipeline_cache_create_info.pInitialData = NULL;
+		VK_CHECK(vkCreatePipelineCache(device, &pipeline_cache_create_info, nullptr, &pipeline_cache));
+	}
+
+	if (data)
+		free(data);
+
+	return pipeline_cache;
+}
+
+int save_pipeline_cache(VkDevice device, VkPipelineCache pipeline_cache, const char* file_name)
+{
+	char temp_file_name[MAX_PATH];
+	size_t data_size = 0;
+	void* data;
+	FILE* fp = NULL;
+	int ret = 0;
+
+	if (pipeline_cache == VK_NULL_HANDLE)
+		return -1;
+
+	VK_CHECK(vkGetPipelineCacheData(device, pipeline_cache, &data_size, nullptr));
+	if (!data_size)
+		return 0;
+
+	data = malloc(data_size);
+	if (!data)
+		return -1;
+	VK_CHECK(vkGetPipelineCacheData(device, pipeline_cache, &data_size, data));
+
+	// Write next to the destination and rename over it, so a crash never leaves a truncated cache behind
+	snprintf(temp_file_name, sizeof(temp_file_name), "%s.tmp", file_name);
+	if (fopen_s(&fp, temp_file_name, "wb") || !fp)
+	{
+		printf("cannot open file %s\n", temp_file_name);
+		free(data);
+		return -1;
+	}
+
+	if (fwrite(data, 1, data_size, fp) != data_size || fflush(fp))
+	{
+		ret = -1;
+	}
+	fclose(fp);
+
+	if (!ret && !MoveFileExA(temp_file_name, file_name, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		ret = -1;
+	}
+
+	if (ret)
+	{
+		printf("failed to write pipeline cache %s\n", file_name);
+		DeleteFileA(temp_file_name);
+	}
+	else
+	{
+		printf("saved pipeline cache %s (%zu bytes)\n", file_name, data_size);
+	}
+
+	free(data);
+	return ret;
+}
+
+void record_pipeline_creation_feedback(const VkPipelineCreationFeedbackEXT* pipeline_feedback,
+	const VkPipelineCreationFeedbackEXT* stage_feedbacks, uint32_t stage_count)
+{
+	feedback_stats.pipelines++;
+	if (!(pipeline_feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT))
+		return;
+
+	feedback_stats.pipelines_with_feedback++;
+	feedback_stats.creation_duration_ns += pipeline_feedback->duration;
+	if (pipeline_feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT)
+	{
+		feedback_stats.pipeline_cache_hits++;
+	}
+
+	for (uint32_t i = 0; i < stage_count; i++)
+	{
+		if (!(stage_feedbacks[i].flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT))
+			continue;
+		feedback_stats.stages++;
+		if (stage_feedbacks[i].flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT)
+		{
+			feedback_stats.stage_cache_hits++;
+		}
+	}
+}
+
+void report_pipeline_creation_feedback(void)
+{
+	if (!feedback_stats.pipelines_with_feedback)
+		return;
+
+	printf("pipeline creation: %u pipelines, cache hits %u/%u (%.1f%%), stage cache hits %u/%u, total %.3f ms\n",
+		feedback_stats.pipelines.load(),
+		feedback_stats.pipeline_cache_hits.load(), feedback_stats.pipelines_with_feedback.load(),
+		100.0 * feedback_stats.pipeline_cache_hits / feedback_stats.pipelines_with_feedback,
+		feedback_stats.stage_cache_hits.load(), feedback_stats.stages.load(),
+		feedback_stats.creation_duration_ns / 1000000.0);
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "common.h"
+
+// Creates the pipeline cache, seeded from file_name when the blob there was written by the same device and driver
+extern VkPipelineCache load_pipeline_cache(VkPhysicalDevice gpu_device, VkDevice device, const char* file_name);
+// Writes the cache contents to file_name, replacing the previous file atomically
+extern int save_pipeline_cache(VkDevice device, VkPipelineCache pipeline_cache, const char* file_name);
+
+// VK_EXT_pipeline_creation_feedback statistics
+extern void record_pipeline_creation_feedback(const VkPipelineCreationFeedbackEXT* pipeline_feedback,
+	const VkPipelineCreationFeedbackEXT* stage_feedbacks, uint32_t stage_count);
+extern void report_pipeline_creation_feedback(void);
\ No newline at end of file
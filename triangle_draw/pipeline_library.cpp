@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include "common.h"
+#include "pipeline.h"
+#include "pipeline_library.h"
+
+static const VkGraphicsPipelineLibraryFlagsEXT library_parts[] = {
+	VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+	VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+	VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+	VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT };
+
+struct PipelineLibraryKey
+{
+	VkGraphicsPipelineLibraryFlagsEXT part;
+	VkShaderModule module;
+	VkPipelineLayout layout;
+	// Only the pipeline key fields the part depends on, the rest stays zero
+	struct PipelineKey state;
+};
+
+struct PipelineLibraryEntry
+{
+	uint64_t hash;
+	struct PipelineLibraryKey key;
+	VkPipeline library;
+};
+
+struct PipelineLibraryCache
+{
+	uint32_t count;
+	uint32_t created;
+	uint32_t reused;
+	struct PipelineLibraryEntry entries[PIPELINE_LIBRARY_CAPACITY];
+};
+
+// Pipeline compiler threads create and look up parts concurrently
+static std::mutex pipeline_library_mutex;
+
+static struct PipelineLibraryCache* get_pipeline_library_cache(struct GraphicsContext* graphics_context)
+{
+	if (!graphics_context->pipeline_library_cache)
+	{
+		graphics_context->pipeline_library_cache = (struct PipelineLibraryCache*)calloc(1, sizeof(struct PipelineLibraryCache));
+	}
+	return graphics_context->pipeline_library_cache;
+}
+
+static void init_library_key(const struct PipelineCreateDesc* desc, VkGraphicsPipelineLibraryFlagsEXT part, struct PipelineLibraryKey* library_key)
+{
+	const struct PipelineKey* key = desc->key;
+	struct PipelineKey* state = &library_key->state;
+
+	memset(library_key, 0, sizeof(*library_key));
+	library_key->part = part;
+
+	switch (part)
+	{
+	case VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT:
+		// Without explicit attributes the vertex input is derived from the vertex shader
+		if (!key->vertex_attribute_count)
+		{
+			memcpy(state->vertex_shader, key->vertex_shader, sizeof(state->vertex_shader));
+		}
+		state->vertex_binding_count = key->vertex_binding_count;
+		memcpy(state->vertex_bindings, key->vertex_bindings, sizeof(state->vertex_bindings));
+		state->vertex_attribute_count = key->vertex_attribute_count;
+		memcpy(state->vertex_attributes, key->vertex_attributes, sizeof(state->vertex_attributes));
+		state->topology = key->topology;
+		state->primitive_restart = key->primitive_restart;
+		break;
+	case VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT:
+		library_key->module = desc->vertex_module;
+		library_key->layout = desc->layout;
+		state->polygon_mode = key->polygon_mode;
+		state->cull_mode = key->cull_mode;
+		state->front_face = key->front_face;
+		break;
+	case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT:
+		library_key->module = desc->fragment_module;
+		library_key->layout = desc->layout;
+		state->depth_test = key->depth_test;
+		state->depth_write = key->depth_write;
+		state->depth_compare = key->depth_compare;
+		break;
+	case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT:
+		state->blend_enable = key->blend_enable;
+		state->src_color_blend_factor = key->src_color_blend_factor;
+		state->dst_color_blend_factor = key->dst_color_blend_factor;
+		state->color_blend_op = key->color_blend_op;
+		state->src_alpha_blend_factor = key->src_alpha_blend_factor;
+		state->dst_alpha_blend_factor = key->dst_alpha_blend_factor;
+		state->alpha_blend_op = key->alpha_blend_op;
+		state->color_write_mask = key->color_write_mask;
+		break;
+	}
+
+	// Every part is created against the same attachments
+	state->color_format = key->color_format;
+	state->depth_format = key->depth_format;
+	state->samples = key->samples;
+}
+
+// Returns the entry holding key, or the empty entry where it belongs. NULL when the table is full.
+static struct PipelineLibraryEntry* find_library_entry(struct PipelineLibraryCache* cache, uint64_t hash, const struct PipelineLibraryKey* key)
+{
+	uint32_t mask = PIPELINE_LIBRARY_CAPACITY - 1;
+
+	for (uint32_t i = 0; i < PIPELINE_LIBRARY_CAPACITY; i++)
+	{
+		struct PipelineLibraryEntry* entry = &cache->entries[(hash + i) & mask];
+
+		if (entry->library == VK_NULL_HANDLE)
+			return entry;
+		if (entry->hash == hash && !memcmp(&entry->key, key, sizeof(*key)))
+			return entry;
+	}
+	return NULL;
+}
+
+static VkPipeline get_pipeline_library(struct GraphicsContext* graphics_context, const struct PipelineCreateDesc* desc, VkGraphicsPipelineLibraryFlagsEXT part)
+{
+	struct PipelineLibraryKey library_key;
+	struct PipelineLibraryCache* cache;
+	struct PipelineLibraryEntry* entry;
+	VkPipeline library;
+	uint64_t hash;
+
+	init_library_key(desc, part, &library_key);
+	hash = hash_data(&library_key, sizeof(library_key));
+
+	{
+		std::lock_guard<std::mutex> lock(pipeline_library_mutex);
+		cache = get_pipeline_library_cache(graphics_context);
+		if (!cache)
+			return VK_NULL_HANDLE;
+
+		entry = find_library_entry(cache, hash, &library_key);
+		if (entry && entry->library != VK_NULL_HANDLE)
+		{
+			cache->reused++;
+			return entry->library;
+		}
+	}
+
+	// Created outside the lock, two threads racing for the same part only cost a duplicate compile
+	if (create_graphics_pipeline_library(graphics_context, desc, part, &library) != VK_SUCCESS)
+		return VK_NULL_HANDLE;
+
+	std::lock_guard<std::mutex> lock(pipeline_library_mutex);
+	entry = find_library_entry(cache, hash, &library_key);
+	if (!entry)
+	{
+		printf("pipeline library cache full (%u parts)\n", cache->count);
+		vkDestroyPipeline(graphics_context->device, library, nullptr);
+		return VK_NULL_HANDLE;
+	}
+	if (entry->library != VK_NULL_HANDLE)
+	{
+		vkDestroyPipeline(graphics_context->device, library, nullptr);
+		cache->reused++;
+		return entry->library;
+	}
+
+	entry->hash = hash;
+	entry->key = library_key;
+	entry->library = library;
+	cache->count++;
+	cache->created++;
+	return library;
+}
+
+VkPipeline link_pipeline_libraries(struct GraphicsContext* graphics_context, const struct PipelineCreateDesc* desc, VkBool32 optimize)
+{
+	VkPipeline libraries[sizeof(library_parts) / sizeof(library_parts[0])];
+	VkPipeline pipeline;
+
+	for (uint32_t i = 0; i < sizeof(library_parts) / sizeof(library_parts[0]); i++)
+	{
+		libraries[i] = get_pipeline_library(graphics_context, desc, library_parts[i]);
+		if (libraries[i] == VK_NULL_HANDLE)
+			return VK_NULL_HANDLE;
+	}
+
+	if (link_graphics_pipeline(graphics_context, libraries, sizeof(libraries) / sizeof(libraries[0]), desc->layout, optimize, &pipeline) != VK_SUCCESS)
+		return VK_NULL_HANDLE;
+
+	return pipeline;
+}
+
+void destroy_pipeline_library_cache(struct GraphicsContext* graphics_context)
+{
+	struct PipelineLibraryCache* cache = graphics_context->pipeline_library_cache;
+
+	if (!cache)
+		return;
+
+	printf("pipeline libraries: %u parts created, %u reused\n", cache->created, cache->reused);
+
+	// Linked pipelines do not depend on the libraries they were linked from
+	for (uint32_t i = 0; i < PIPELINE_LIBRARY_CAPACITY; i++)
+	{
+		if (cache->entries[i].library != VK_NULL_HANDLE)
+		{
+			vkDestroyPipeline(graphics_context->device, cache->entries[i].library, nullptr);
+		}
+	}
+
+	free(cache);
+	graphics_context->pipeline_library_cache = NULL;
+}
\ No newline at end of file
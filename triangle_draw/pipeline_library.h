@@ -0,0 +1,13 @@
+#pragma once
+#include "common.h"
+
+// Open addressing table size of the library part cache, must be a power of two
+#define PIPELINE_LIBRARY_CAPACITY 512
+
+struct PipelineCreateDesc;
+
+// Links desc from its vertex input, pre-rasterization, fragment shader and fragment output libraries,
+// creating the parts not cached yet. optimize requests a link time optimized link instead of a fast link.
+// VK_NULL_HANDLE on failure.
+extern VkPipeline link_pipeline_libraries(struct GraphicsContext* graphics_context, const struct PipelineCreateDesc* desc, VkBool32 optimize);
+extern void destroy_pipeline_library_cache(struct GraphicsContext* graphics_context);
\ No newline at end of file
@@ -0,0 +1,669 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+#include "pipeline.h"
+#include "pipeline_manager.h"
+#include "pipeline_library.h"
+#include "shader.h"
+#include "descriptor.h"
+#include "reflection.h"
+#include <windows.h>
+
+enum PipelineSlotState
+{
+	PIPELINE_SLOT_EMPTY,
+	// Key is published, pipeline queued or being compiled
+	PIPELINE_SLOT_PENDING,
+	PIPELINE_SLOT_READY,
+	PIPELINE_SLOT_FAILED,
+};
+
+// Key and hash are written under the manager lock before state is released as PENDING,
+// pipeline is written by a compiler thread before state becomes READY.
+// With pipeline libraries a link time optimized pipeline later replaces the fast linked one.
+struct PipelineSlot
+{
+	std::atomic<uint32_t> state;
+	uint64_t hash;
+	struct PipelineKey key;
+	std::atomic<VkPipeline> pipeline;
+	// Requested through get_pipeline or get_pipeline_async, only those are written to the manifest
+	std::atomic<uint32_t> used;
+	// Replaced fast linked pipeline, recorded command buffers may still use it until shutdown
+	VkPipeline fast_link_pipeline;
+};
+
+// Pipeline manifest file: header followed by key_count normalized PipelineKeys
+#define PIPELINE_MANIFEST_MAGIC 0x4d4c5050
+#define PIPELINE_MANIFEST_VERSION 1
+
+struct PipelineManifestHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t key_size;
+	uint32_t key_count;
+	// Extended dynamic state levels the keys were normalized for
+	uint32_t dynamic_state;
+};
+
+struct ShaderModuleEntry
+{
+	char name[PIPELINE_SHADER_NAME_SIZE];
+	VkShaderStageFlagBits stage;
+	VkShaderModule module;
+	struct ShaderReflection reflection;
+};
+
+struct PipelineManager
+{
+	struct GraphicsContext* graphics_context;
+
+	// Serializes slot insertion and the compile queue
+	std::mutex mutex;
+	std::condition_variable work_ready;
+	std::condition_variable work_done;
+	struct PipelineSlot slots[PIPELINE_TABLE_CAPACITY];
+	uint32_t pipeline_count;
+
+	// Every slot is queued at most once, so the ring never overflows
+	struct PipelineSlot* queue[PIPELINE_TABLE_CAPACITY];
+	uint32_t queue_head;
+	uint32_t queue_count;
+	// Slots taken off the queue and not published yet
+	uint32_t compiling;
+	// Fast linked slots waiting for their optimized link, served when queue is empty
+	struct PipelineSlot* optimize_queue[PIPELINE_TABLE_CAPACITY];
+	uint32_t optimize_head;
+	uint32_t optimize_count;
+	uint32_t optimized;
+
+	bool shutting_down;
+	uint32_t worker_count;
+	std::thread workers[MAX_PIPELINE_COMPILER_THREADS];
+
+	// Shader compilation is slow, keep it off the queue lock
+	std::mutex shader_mutex;
+	uint32_t shader_module_count;
+	struct ShaderModuleEntry shader_modules[MAX_PIPELINE_SHADER_MODULES];
+
+	std::atomic<uint32_t> generation;
+	std::atomic<uint32_t> lookups;
+	std::atomic<uint32_t> misses;
+};
+
+// Caller holds shader_mutex. Each shader file is compiled and reflected once.
+static struct ShaderModuleEntry* get_shader_module_entry(struct GraphicsContext* graphics_context, const char* name, VkShaderStageFlagBits stage)
+{
+	struct PipelineManager* manager = graphics_context->pipeline_manager;
+	struct ShaderModuleEntry* entry;
+
+	for (uint32_t i = 0; i < manager->shader_module_count; i++)
+	{
+		entry = &manager->shader_modules[i];
+		if (entry->stage == stage && !strcmp(entry->name, name))
+			return entry;
+	}
+
+	if (manager->shader_module_count == MAX_PIPELINE_SHADER_MODULES)
+	{
+		printf("too many shader modules, cannot load %s\n", name);
+		return NULL;
+	}
+
+	entry = &manager->shader_modules[manager->shader_module_count];
+	memset(&entry->reflection, 0, sizeof(entry->reflection));
+	entry->module = load_shader(graphics_context, name, stage, &entry->reflection).module;
+	if (entry->module == VK_NULL_HANDLE)
+	{
+		printf("cannot load shader %s\n", name);
+		return NULL;
+	}
+	strncpy_s(entry->name, sizeof(entry->name), name, _TRUNCATE);
+	entry->stage = stage;
+	manager->shader_module_count++;
+	return entry;
+}
+
+// Resolves shader modules and the pipeline layout of a queued slot
+static int prepare_pipeline_desc(struct GraphicsContext* graphics_context, struct PipelineSlot* slot, struct PipelineCreateDesc* desc)
+{
+	struct PipelineManager* manager = graphics_context->pipeline_manager;
+	struct ShaderModuleEntry* vertex_shader;
+	struct ShaderModuleEntry* fragment_shader;
+	struct ShaderReflection reflections[2];
+	VkDescriptorSetLayout set_layouts[MAX_DESCRIPTOR_SETS];
+	uint32_t set_layout_count;
+
+	{
+		std::lock_guard<std::mutex> lock(manager->shader_mutex);
+		vertex_shader = get_shader_module_entry(graphics_context, slot->key.vertex_shader, VK_SHADER_STAGE_VERTEX_BIT);
+		fragment_shader = get_shader_module_entry(graphics_context, slot->key.fragment_shader, VK_SHADER_STAGE_FRAGMENT_BIT);
+	}
+	if (!vertex_shader || !fragment_shader)
+		return -1;
+
+	reflections[0] = vertex_shader->reflection;
+	reflections[1] = fragment_shader->reflection;
+
+	desc->key = &slot->key;
+	desc->vertex_module = vertex_shader->module;
+	desc->fragment_module = fragment_shader->module;
+	desc->vertex_reflection = &vertex_shader->reflection;
+	desc->layout = get_reflected_pipeline_layout(graphics_context, reflections, 2, set_layouts, &set_layout_count);
+	return desc->layout == VK_NULL_HANDLE ? -1 : 0;
+}
+
+// Replaces the fast linked pipeline of slot with a link time optimized one
+static void optimize_linked_pipeline(struct PipelineManager* manager, struct PipelineSlot* slot)
+{
+	struct GraphicsContext* graphics_context = manager->graphics_context;
+	struct PipelineCreateDesc desc;
+	VkPipeline pipeline;
+
+	// The fast linked pipeline stays in use when this fails
+	if (prepare_pipeline_desc(graphics_context, slot, &desc))
+		return;
+	pipeline = link_pipeline_libraries(graphics_context, &desc, VK_TRUE);
+	if (pipeline == VK_NULL_HANDLE)
+		return;
+
+	std::lock_guard<std::mutex> lock(manager->mutex);
+	slot->fast_link_pipeline = slot->pipeline.load(std::memory_order_relaxed);
+	slot->pipeline.store(pipeline, std::memory_order_release);
+	manager->optimized++;
+	manager->generation.fetch_add(1, std::memory_order_release);
+}
+
+// Takes up to PIPELINE_COMPILE_BATCH_SIZE queued keys and creates them with a single vkCreateGraphicsPipelines call,
+// or fast links them from pipeline libraries. Optimized links run when nothing else is queued.
+static void pipeline_compiler_thread(struct PipelineManager* manager)
+{
+	struct GraphicsContext* graphics_context = manager->graphics_context;
+	struct PipelineSlot* batch[PIPELINE_COMPILE_BATCH_SIZE];
+	struct PipelineSlot* create_slots[PIPELINE_COMPILE_BATCH_SIZE];
+	struct PipelineCreateDesc descs[PIPELINE_COMPILE_BATCH_SIZE];
+	VkPipeline pipelines[PIPELINE_COMPILE_BATCH_SIZE];
+	struct PipelineSlot* optimize_slot;
+	uint32_t batch_limit;
+	uint32_t batch_count;
+	uint32_t create_count;
+	uint32_t optimize_queued;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(manager->mutex);
+			manager->work_ready.wait(lock, [manager] { return manager->shutting_down || manager->queue_count || manager->optimize_count; });
+			if (manager->shutting_down)
+				return;
+
+			// Spread a burst of keys over all compiler threads instead of filling one batch
+			batch_limit = (manager->queue_count + manager->worker_count - 1) / manager->worker_count;
+			if (batch_limit > PIPELINE_COMPILE_BATCH_SIZE)
+				batch_limit = PIPELINE_COMPILE_BATCH_SIZE;
+
+			batch_count = 0;
+			while (manager->queue_count && batch_count < batch_limit)
+			{
+				batch[batch_count++] = manager->queue[manager->queue_head];
+				manager->queue_head = (manager->queue_head + 1) % PIPELINE_TABLE_CAPACITY;
+				manager->queue_count--;
+			}
+			manager->compiling += batch_count;
+
+			optimize_slot = NULL;
+			if (!batch_count)
+			{
+				optimize_slot = manager->optimize_queue[manager->optimize_head];
+				manager->optimize_head = (manager->optimize_head + 1) % PIPELINE_TABLE_CAPACITY;
+				manager->optimize_count--;
+			}
+		}
+
+		if (optimize_slot)
+		{
+			optimize_linked_pipeline(manager, optimize_slot);
+			manager->work_done.notify_all();
+			continue;
+		}
+
+		create_count = 0;
+		for (uint32_t i = 0; i < batch_count; i++)
+		{
+			if (prepare_pipeline_desc(graphics_context, batch[i], &descs[create_count]))
+			{
+				batch[i]->state.store(PIPELINE_SLOT_FAILED, std::memory_order_release);
+				continue;
+			}
+			create_slots[create_count++] = batch[i];
+		}
+
+		if (create_count)
+		{
+			// On failure the driver still returns the pipelines it managed to create
+			memset(pipelines, 0, sizeof(pipelines));
+			if (graphics_context->graphics_pipeline_library)
+			{
+				for (uint32_t i = 0; i < create_count; i++)
+				{
+					pipelines[i] = link_pipeline_libraries(graphics_context, &descs[i], VK_FALSE);
+				}
+			}
+			else
+			{
+				create_graphics_pipelines(graphics_context, descs, create_count, pipelines);
+			}
+		}
+
+		optimize_queued = 0;
+		{
+			std::lock_guard<std::mutex> lock(manager->mutex);
+			for (uint32_t i = 0; i < create_count; i++)
+			{
+				create_slots[i]->pipeline.store(pipelines[i], std::memory_order_relaxed);
+				create_slots[i]->state.store(pipelines[i] != VK_NULL_HANDLE ? PIPELINE_SLOT_READY : PIPELINE_SLOT_FAILED, std::memory_order_release);
+
+				if (graphics_context->graphics_pipeline_library && pipelines[i] != VK_NULL_HANDLE)
+				{
+					manager->optimize_queue[(manager->optimize_head + manager->optimize_count) % PIPELINE_TABLE_CAPACITY] = create_slots[i];
+					manager->optimize_count++;
+					optimize_queued++;
+				}
+			}
+			manager->compiling -= batch_count;
+			manager->generation.fetch_add(1, std::memory_order_release);
+		}
+		manager->work_done.notify_all();
+		if (optimize_queued)
+		{
+			manager->work_ready.notify_all();
+		}
+	}
+}
+
+int create_pipeline_manager(struct GraphicsContext* graphics_context)
+{
+	struct PipelineManager* manager = new struct PipelineManager();
+	uint32_t hardware_threads = std::thread::hardware_concurrency();
+
+	manager->graphics_context = graphics_context;
+	for (uint32_t i = 0; i < PIPELINE_TABLE_CAPACITY; i++)
+	{
+		manager->slots[i].state.store(PIPELINE_SLOT_EMPTY, std::memory_order_relaxed);
+		manager->slots[i].pipeline.store(VK_NULL_HANDLE, std::memory_order_relaxed);
+		manager->slots[i].fast_link_pipeline = VK_NULL_HANDLE;
+		manager->slots[i].used.store(0, std::memory_order_relaxed);
+	}
+	manager->pipeline_count = 0;
+	manager->queue_head = 0;
+	manager->queue_count = 0;
+	manager->compiling = 0;
+	manager->optimize_head = 0;
+	manager->optimize_count = 0;
+	manager->optimized = 0;
+	manager->shutting_down = false;
+	manager->shader_module_count = 0;
+	manager->generation = 0;
+	manager->lookups = 0;
+	manager->misses = 0;
+
+	graphics_context->pipeline_manager = manager;
+
+	// Leave one core to the render thread
+	manager->worker_count = hardware_threads > 1 ? hardware_threads - 1 : 1;
+	if (manager->worker_count > MAX_PIPELINE_COMPILER_THREADS)
+		manager->worker_count = MAX_PIPELINE_COMPILER_THREADS;
+	for (uint32_t i = 0; i < manager->worker_count; i++)
+	{
+		manager->workers[i] = std::thread(pipeline_compiler_thread, manager);
+	}
+	return 0;
+}
+
+void destroy_pipeline_manager(struct GraphicsContext* graphics_context)
+{
+	struct PipelineManager* manager = graphics_context->pipeline_manager;
+
+	if (!manager)
+		return;
+
+	// Compiler threads finish the batch they are working on, keys and optimized links still queued are dropped
+	{
+		std::lock_guard<std::mutex> lock(manager->mutex);
+		manager->shutting_down = true;
+	}
+	manager->work_ready.notify_all();
+	for (uint32_t i = 0; i < manager->worker_count; i++)
+	{
+		manager->workers[i].join();
+	}
+
+	printf("pipeline manager: %u pipelines, %u lookups, %u compiled in the background\n",
+		manager->pipeline_count, manager->lookups.load(), manager->misses.load());
+	if (graphics_context->graphics_pipeline_library)
+	{
+		printf("pipeline manager: %u fast linked pipelines replaced by optimized links\n", manager->optimized);
+	}
+
+	for (uint32_t i = 0; i < PIPELINE_TABLE_CAPACITY; i++)
+	{
+		if (manager->slots[i].pipeline.load(std::memory_order_relaxed) != VK_NULL_HANDLE)
+		{
+			vkDestroyPipeline(graphics_context->device, manager->slots[i].pipeline.load(std::memory_order_relaxed), nullptr);
+		}
+		if (manager->slots[i].fast_link_pipeline != VK_NULL_HANDLE)
+		{
+			vkDestroyPipeline(graphics_context->device, manager->slots[i].fast_link_pipeline, nullptr);
+		}
+	}
+	destroy_pipeline_library_cache(graphics_context);
+
+	for (uint32_t i = 0; i < manager->shader_module_count; i++)
+	{
+		vkDestroyShaderModule(graphics_context->device, manager->shader_modules[i].module, nullptr);
+	}
+
+	delete manager;
+	graphics_context->pipeline_manager = NULL;
+}
+
+// Returns the slot holding key, or the empty slot where it belongs. NULL when the table is full.
+static struct PipelineSlot* find_pipeline_slot(struct PipelineManager* manager, const struct PipelineKey* key, uint64_t hash, uint32_t* state)
+{
+	uint32_t mask = PIPELINE_TABLE_CAPACITY - 1;
+
+	for (uint32_t i = 0; i < PIPELINE_TABLE_CAPACITY; i++)
+	{
+		struct PipelineSlot* slot = &manager->slots[(hash + i) & mask];
+
+		*state = slot->state.load(std::memory_order_acquire);
+		if (*state == PIPELINE_SLOT_EMPTY)
+			return slot;
+		if (slot->hash == hash && !memcmp(&slot->key, key, sizeof(*key)))
+			return slot;
+	}
+	return NULL;
+}
+
+// Caller holds the manager lock. Publishes key in an empty slot and queues it for compilation.
+static void queue_pipeline_slot(struct PipelineManager* manager, struct PipelineSlot* slot, const struct PipelineKey* key, uint64_t hash, uint32_t used)
+{
+	manager->misses.fetch_add(1, std::memory_order_relaxed);
+	slot->hash = hash;
+	slot->key = *key;
+	slot->pipeline.store(VK_NULL_HANDLE, std::memory_order_relaxed);
+	slot->fast_link_pipeline = VK_NULL_HANDLE;
+	slot->used.store(used, std::memory_order_relaxed);
+	slot->state.store(PIPELINE_SLOT_PENDING, std::memory_order_release);
+	manager->pipeline_count++;
+
+	manager->queue[(manager->queue_head + manager->queue_count) % PIPELINE_TABLE_CAPACITY] = slot;
+	manager->queue_count++;
+	manager->work_ready.notify_one();
+}
+
+// Returns the pipeline of a READY slot and marks it for the manifest
+static inline VkPipeline use_pipeline_slot(struct PipelineSlot* slot)
+{
+	slot->used.store(1, std::memory_order_relaxed);
+	return slot->pipeline.load(std::memory_order_acquire);
+}
+
+VkPipeline get_pipeline(struct GraphicsContext* graphics_context, const struct PipelineKey* requested_key)
+{
+	struct PipelineManager* manager = graphics_context->pipeline_manager;
+	struct PipelineKey normalized_key;
+	const struct PipelineKey* key = normalize_pipeline_key(graphics_context, requested_key, &normalized_key);
+	uint64_t hash = hash_data(key, sizeof(*key));
+	struct PipelineSlot* slot;
+	uint32_t state;
+
+	manager->lookups.fetch_add(1, std::memory_order_relaxed);
+
+	// Fast path, the common case once a pipeline has been created
+	slot = find_pipeline_slot(manager, key, hash, &state);
+	if (slot && state == PIPELINE_SLOT_READY)
+		return use_pipeline_slot(slot);
+	if (slot && state == PIPELINE_SLOT_FAILED)
+		return VK_NULL_HANDLE;
+
+	std::unique_lock<std::mutex> lock(manager->mutex);
+
+	// Another thread may have inserted the key while we waited
+	slot = find_pipeline_slot(manager, key, hash, &state);
+	if (!slot)
+	{
+		printf("pipeline table full (%u pipelines)\n", manager->pipeline_count);
+		return VK_NULL_HANDLE;
+	}
+	if (state == PIPELINE_SLOT_EMPTY)
+	{
+		queue_pipeline_slot(manager, slot, key, hash, 1);
+	}
+
+	manager->work_done.wait(lock, [slot] { return slot->state.load(std::memory_order_acquire) != PIPELINE_SLOT_PENDING; });
+	return slot->state.load(std::memory_order_acquire) == PIPELINE_SLOT_READY ? use_pipeline_slot(slot) : VK_NULL_HANDLE;
+}
+
+VkPipeline get_pipeline_async(struct GraphicsContext* graphics_context, const struct PipelineKey* requested_key, VkPipeline fallback)
+{
+	struct PipelineManager* manager = graphics_context->pipeline_manager;
+	struct PipelineKey normalized_key;
+	const struct PipelineKey* key = normalize_pipeline_key(graphics_context, requested_key, &normalized_key);
+	uint64_t hash = hash_data(key, sizeof(*key));
+	struct PipelineSlot* slot;
+	uint32_t state;
+
+	manager->lookups.fetch_add(1, std::memory_order_relaxed);
+
+	slot = find_pipeline_slot(manager, key, hash, &state);
+	if (slot && state == PIPELINE_SLOT_READY)
+		return use_pipeline_slot(slot);
+	if (slot && state != PIPELINE_SLOT_EMPTY)
+		return fallback;
+
+	std::lock_guard<std::mutex> lock(manager->mutex);
+
+	slot = find_pipeline_slot(manager, key, hash, &state);
+	if (!slot)
+	{
+		printf("pipeline table full (%u pipelines)\n", manager->pipeline_count);
+		return fallback;
+	}
+	if (state == PIPELINE_SLOT_READY)
+		return use_pipeline_slot(slot);
+	if (state == PIPELINE_SLOT_EMPTY)
+	{
+		queue_pipeline_slot(manager, slot, key, hash, 1);
+	}
+	return fallback;
+}
+
+uint32_t get_pipeline_generation(struct GraphicsContext* graphics_context)
+{
+	return graphics_context->pipeline_manager->generation.load(std::memory_order_acquire);
+}
+
+static uint32_t get_manifest_dynamic_state(struct GraphicsContext* graphics_context)
+{
+	return (graphics_context->extended_dynamic_state ? 1 : 0) |
+		(graphics_context->extended_dynamic_state2 ? 2 : 0) |
+		(graphics_context->extended_dynamic_state3 ? 4 : 0);
+}
+
+int save_pipeline_manifest(struct GraphicsContext* graphics_context, const char* file_name)
+{
+	struct PipelineManager* manager = graphics_context->pipeline_manager;
+	struct PipelineManifestHeader header;
+	struct PipelineKey* keys;
+	char temp_file_name[MAX_PATH];
+	FILE* fp = NULL;
+	int ret = 0;
+
+	keys = (struct PipelineKey*)malloc(PIPELINE_TABLE_CAPACITY * sizeof(struct PipelineKey));
+	if (!keys)
+		return -1;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = PIPELINE_MANIFEST_MAGIC;
+	header.version = PIPELINE_MANIFEST_VERSION;
+	header.key_size = sizeof(struct PipelineKey);
+	header.dynamic_state = get_manifest_dynamic_state(graphics_context);
+	{
+		std::lock_guard<std::mutex> lock(manager->mutex);
+		for (uint32_t i = 0; i < PIPELINE_TABLE_CAPACITY; i++)
+		{
+			struct PipelineSlot* slot = &manager->slots[i];
+
+			// Keys only warmed up but never requested this session are dropped
+			if (slot->state.load(std::memory_order_acquire) == PIPELINE_SLOT_READY && slot->used.load(std::memory_order_relaxed))
+			{
+				keys[header.key_count++] = slot->key;
+			}
+		}
+	}
+
+	// Like the pipeline cache, a crash while writing must not leave a truncated manifest to replay
+	snprintf(temp_file_name, sizeof(temp_file_name), "%s.tmp", file_name);
+	if (fopen_s(&fp, temp_file_name, "wb") || !fp)
+	{
+		printf("cannot open file %s\n", temp_file_name);
+		free(keys);
+		return -1;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+		fwrite(keys, sizeof(struct PipelineKey), header.key_count, fp) != header.key_count || fflush(fp))
+	{
+		ret = -1;
+	}
+	fclose(fp);
+
+	if (!ret && !MoveFileExA(temp_file_name, file_name, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		ret = -1;
+	}
+
+	if (ret)
+	{
+		printf("failed to write pipeline manifest %s\n", file_name);
+		DeleteFileA(temp_file_name);
+	}
+	else
+	{
+		printf("saved pipeline manifest %s (%u pipelines)\n", file_name, header.key_count);
+	}
+
+	free(keys);
+	return ret;
+}
+
+uint32_t warm_up_pipelines(struct GraphicsContext* graphics_context, const char* file_name)
+{
+	struct PipelineManager* manager = graphics_context->pipeline_manager;
+	struct PipelineManifestHeader header;
+	struct PipelineKey current_key;
+	struct PipelineKey* keys = NULL;
+	uint32_t queued = 0;
+	FILE* fp = NULL;
+
+	if (fopen_s(&fp, file_name, "rb") || !fp)
+		return 0;
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != PIPELINE_MANIFEST_MAGIC ||
+		header.version != PIPELINE_MANIFEST_VERSION || header.key_size != sizeof(struct PipelineKey) ||
+		header.key_count > PIPELINE_TABLE_CAPACITY)
+	{
+		printf("pipeline manifest %s is invalid, ignoring it\n", file_name);
+		fclose(fp);
+		return 0;
+	}
+
+	// Keys normalized for other dynamic state would create pipelines nothing asks for
+	if (header.dynamic_state != get_manifest_dynamic_state(graphics_context))
+	{
+		printf("pipeline manifest %s was written for other dynamic state support, ignoring it\n", file_name);
+		fclose(fp);
+		return 0;
+	}
+
+	if (!header.key_count)
+	{
+		fclose(fp);
+		return 0;
+	}
+
+	keys = (struct PipelineKey*)malloc(header.key_count * sizeof(struct PipelineKey));
+	if (!keys || fread(keys, sizeof(struct PipelineKey), header.key_count, fp) != header.key_count)
+	{
+		printf("pipeline manifest %s is truncated, ignoring it\n", file_name);
+		free(keys);
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+
+	init_pipeline_key(graphics_context, &current_key);
+	{
+		std::lock_guard<std::mutex> lock(manager->mutex);
+		for (uint32_t i = 0; i < header.key_count; i++)
+		{
+			const struct PipelineKey* key = &keys[i];
+			struct PipelineSlot* slot;
+			uint64_t hash;
+			uint32_t state;
+
+			// Attachments or vertex layout changed since the manifest was written, e.g. another MSAA sample count or VERTEX_FORMAT
+			if (key->color_format != graphics_context->surface_format.format || key->depth_format != graphics_context->depth_format ||
+				key->samples != graphics_context->sample_count || (key->vertex_attribute_count &&
+				memcmp(key->vertex_attributes, current_key.vertex_attributes, sizeof(key->vertex_attributes))))
+				continue;
+
+			hash = hash_data(key, sizeof(*key));
+			slot = find_pipeline_slot(manager, key, hash, &state);
+			if (slot && state == PIPELINE_SLOT_EMPTY)
+			{
+				queue_pipeline_slot(manager, slot, key, hash, 0);
+				queued++;
+			}
+		}
+	}
+
+	free(keys);
+	printf("warming up %u pipelines from %s\n", queued, file_name);
+	return queued;
+}
+
+void wait_for_pipelines(struct GraphicsContext* graphics_context)
+{
+	struct PipelineManager* manager = graphics_context->pipeline_manager;
+	std::unique_lock<std::mutex> lock(manager->mutex);
+
+	manager->work_done.wait(lock, [manager] { return !manager->queue_count && !manager->compiling; });
+}
+
+int get_pipeline_key_reflection(struct GraphicsContext* graphics_context, const struct PipelineKey* key, struct ShaderReflection* reflections)
+{
+	struct PipelineManager* manager = graphics_context->pipeline_manager;
+	struct ShaderModuleEntry* vertex_shader;
+	struct ShaderModuleEntry* fragment_shader;
+
+	std::lock_guard<std::mutex> lock(manager->shader_mutex);
+
+	vertex_shader = get_shader_module_entry(graphics_context, key->vertex_shader, VK_SHADER_STAGE_VERTEX_BIT);
+	fragment_shader = get_shader_module_entry(graphics_context, key->fragment_shader, VK_SHADER_STAGE_FRAGMENT_BIT);
+	if (!vertex_shader || !fragment_shader)
+		return -1;
+
+	reflections[0] = vertex_shader->reflection;
+	reflections[1] = fragment_shader->reflection;
+	return 0;
+}
\ No newline at end of file
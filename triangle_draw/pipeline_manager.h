@@ -0,0 +1,33 @@
+#pragma once
+#include "common.h"
+
+// Open addressing table size, must be a power of two
+#define PIPELINE_TABLE_CAPACITY 256
+#define MAX_PIPELINE_SHADER_MODULES 32
+// Background pipeline compilation
+#define MAX_PIPELINE_COMPILER_THREADS 4
+#define PIPELINE_COMPILE_BATCH_SIZE 8
+
+struct PipelineKey;
+struct ShaderReflection;
+
+extern int create_pipeline_manager(struct GraphicsContext* graphics_context);
+extern void destroy_pipeline_manager(struct GraphicsContext* graphics_context);
+
+// Returns the pipeline for key, waiting for it to be compiled on first use. Lookups of existing pipelines take no lock.
+// VK_NULL_HANDLE when the pipeline cannot be created.
+extern VkPipeline get_pipeline(struct GraphicsContext* graphics_context, const struct PipelineKey* key);
+// Never waits: returns the pipeline when ready, otherwise queues it for the compiler threads and returns fallback.
+// Pass VK_NULL_HANDLE as fallback to skip the draw until the pipeline is ready.
+extern VkPipeline get_pipeline_async(struct GraphicsContext* graphics_context, const struct PipelineKey* key, VkPipeline fallback);
+// Incremented each time a queued pipeline finishes compiling or is replaced by its optimized link,
+// command buffers recorded with a fallback should be re-recorded when it changes
+extern uint32_t get_pipeline_generation(struct GraphicsContext* graphics_context);
+// Writes the keys requested this session, so the next run can create them up front
+extern int save_pipeline_manifest(struct GraphicsContext* graphics_context, const char* file_name);
+// Queues the keys of a manifest written by save_pipeline_manifest for the compiler threads, returns how many were queued
+extern uint32_t warm_up_pipelines(struct GraphicsContext* graphics_context, const char* file_name);
+// Waits until every queued pipeline is created, optimized links still running are not waited for
+extern void wait_for_pipelines(struct GraphicsContext* graphics_context);
+// Loads the shaders named by key and returns their vertex and fragment reflections
+extern int get_pipeline_key_reflection(struct GraphicsContext* graphics_context, const struct PipelineKey* key, struct ShaderReflection* reflections);
\ No newline at end of file
@@ -0,0 +1,522 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reflection.h"
+
+// Subset of the SPIR-V enums used by the reflection (see spirv.h)
+enum
+{
+	SPV_MAGIC = 0x07230203,
+	SPV_HEADER_WORDS = 5,
+
+	SPV_OP_DECORATE = 71,
+	SPV_OP_MEMBER_DECORATE = 72,
+	SPV_OP_TYPE_BOOL = 20,
+	SPV_OP_TYPE_INT = 21,
+	SPV_OP_TYPE_FLOAT = 22,
+	SPV_OP_TYPE_VECTOR = 23,
+	SPV_OP_TYPE_MATRIX = 24,
+	SPV_OP_TYPE_IMAGE = 25,
+	SPV_OP_TYPE_SAMPLER = 26,
+	SPV_OP_TYPE_SAMPLED_IMAGE = 27,
+	SPV_OP_TYPE_ARRAY = 28,
+	SPV_OP_TYPE_RUNTIME_ARRAY = 29,
+	SPV_OP_TYPE_STRUCT = 30,
+	SPV_OP_TYPE_POINTER = 32,
+	SPV_OP_TYPE_FORWARD_POINTER = 39,
+	SPV_OP_CONSTANT = 43,
+	SPV_OP_VARIABLE = 59,
+	SPV_OP_TYPE_ACCELERATION_STRUCTURE = 5341,
+
+	SPV_DECORATION_BLOCK = 2,
+	SPV_DECORATION_BUFFER_BLOCK = 3,
+	SPV_DECORATION_ARRAY_STRIDE = 6,
+	SPV_DECORATION_MATRIX_STRIDE = 7,
+	SPV_DECORATION_BUILTIN = 11,
+	SPV_DECORATION_LOCATION = 30,
+	SPV_DECORATION_BINDING = 33,
+	SPV_DECORATION_DESCRIPTOR_SET = 34,
+	SPV_DECORATION_OFFSET = 35,
+
+	SPV_STORAGE_UNIFORM_CONSTANT = 0,
+	SPV_STORAGE_INPUT = 1,
+	SPV_STORAGE_UNIFORM = 2,
+	SPV_STORAGE_PUSH_CONSTANT = 9,
+	SPV_STORAGE_STORAGE_BUFFER = 12,
+
+	SPV_DIM_BUFFER = 5,
+	SPV_DIM_SUBPASS_DATA = 6,
+};
+
+#define ID_HAS_SET      0x1
+#define ID_HAS_BINDING  0x2
+#define ID_HAS_LOCATION 0x4
+#define ID_BUILTIN      0x8
+#define ID_BLOCK        0x10
+#define ID_BUFFER_BLOCK 0x20
+
+struct SpirvId
+{
+	uint32_t opcode;
+	// Pointee, component, element, column or variable type depending on opcode
+	uint32_t type_id;
+	uint32_t storage_class;
+	// Constant value, scalar width, vector size, column count, image dim or array length id
+	uint32_t value;
+	// Image "sampled" operand or integer signedness
+	uint32_t sampled;
+	uint32_t set;
+	uint32_t binding;
+	uint32_t location;
+	uint32_t array_stride;
+	uint32_t flags;
+};
+
+struct SpirvModule
+{
+	const uint32_t* words;
+	size_t word_count;
+	uint32_t id_bound;
+	struct SpirvId* ids;
+};
+
+static uint32_t type_size(const struct SpirvModule* module, uint32_t type_id, uint32_t matrix_stride);
+
+// Words up to the last operand the first pass reads, 0 for instructions it skips
+static uint32_t instruction_length(uint32_t opcode)
+{
+	switch (opcode)
+	{
+	case SPV_OP_TYPE_BOOL:
+	case SPV_OP_TYPE_SAMPLER:
+	case SPV_OP_TYPE_STRUCT:
+	case SPV_OP_TYPE_ACCELERATION_STRUCTURE:
+		return 2;
+	case SPV_OP_DECORATE:
+	case SPV_OP_TYPE_FLOAT:
+	case SPV_OP_TYPE_RUNTIME_ARRAY:
+	case SPV_OP_TYPE_SAMPLED_IMAGE:
+	case SPV_OP_TYPE_FORWARD_POINTER:
+		return 3;
+	case SPV_OP_MEMBER_DECORATE:
+	case SPV_OP_TYPE_INT:
+	case SPV_OP_TYPE_VECTOR:
+	case SPV_OP_TYPE_MATRIX:
+	case SPV_OP_TYPE_ARRAY:
+	case SPV_OP_TYPE_POINTER:
+	case SPV_OP_CONSTANT:
+	case SPV_OP_VARIABLE:
+		return 4;
+	case SPV_OP_TYPE_IMAGE:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+// Types are declared before they are used, which also keeps type_size from recursing forever
+static int is_declared_type(const struct SpirvModule* module, uint32_t type_id)
+{
+	return type_id < module->id_bound && module->ids[type_id].opcode != 0 && module->ids[type_id].opcode != SPV_OP_CONSTANT &&
+		module->ids[type_id].opcode != SPV_OP_VARIABLE;
+}
+
+static uint32_t struct_size(const struct SpirvModule* module, uint32_t struct_id)
+{
+	const uint32_t* words = module->words;
+	uint32_t size = 0;
+	const uint32_t* members = NULL;
+	uint32_t member_count = 0;
+
+	// Locate the struct declaration for its member types
+	for (size_t offset = SPV_HEADER_WORDS; offset < module->word_count; offset += words[offset] >> 16)
+	{
+		uint32_t opcode = words[offset] & 0xffff;
+		uint32_t length = words[offset] >> 16;
+		if (length == 0)
+			break;
+		if (opcode == SPV_OP_TYPE_STRUCT && words[offset + 1] == struct_id)
+		{
+			members = &words[offset + 2];
+			member_count = length - 2;
+			break;
+		}
+	}
+
+	for (uint32_t member = 0; member < member_count; member++)
+	{
+		uint32_t member_offset = 0;
+		uint32_t matrix_stride = 0;
+		uint32_t member_end;
+
+		for (size_t offset = SPV_HEADER_WORDS; offset < module->word_count; offset += words[offset] >> 16)
+		{
+			uint32_t opcode = words[offset] & 0xffff;
+			if ((words[offset] >> 16) == 0)
+				break;
+			if (opcode != SPV_OP_MEMBER_DECORATE || words[offset + 1] != struct_id || words[offset + 2] != member)
+				continue;
+			if (words[offset + 3] == SPV_DECORATION_OFFSET)
+				member_offset = words[offset + 4];
+			else if (words[offset + 3] == SPV_DECORATION_MATRIX_STRIDE)
+				matrix_stride = words[offset + 4];
+		}
+
+		member_end = member_offset + type_size(module, members[member], matrix_stride);
+		size = member_end > size ? member_end : size;
+	}
+	return size;
+}
+
+static uint32_t type_size(const struct SpirvModule* module, uint32_t type_id, uint32_t matrix_stride)
+{
+	const struct SpirvId* type = &module->ids[type_id];
+
+	switch (type->opcode)
+	{
+	case SPV_OP_TYPE_BOOL:
+		return 4;
+	case SPV_OP_TYPE_INT:
+	case SPV_OP_TYPE_FLOAT:
+		return type->value / 8;
+	case SPV_OP_TYPE_VECTOR:
+		return type->value * type_size(module, type->type_id, 0);
+	case SPV_OP_TYPE_MATRIX:
+		if (matrix_stride)
+			return type->value * matrix_stride;
+		return type->value * type_size(module, type->type_id, 0);
+	case SPV_OP_TYPE_ARRAY:
+	{
+		uint32_t length = module->ids[type->value].value;
+		if (type->array_stride)
+			return length * type->array_stride;
+		return length * type_size(module, type->type_id, matrix_stride);
+	}
+	case SPV_OP_TYPE_STRUCT:
+		return struct_size(module, type_id);
+	default:
+		return 0;
+	}
+}
+
+static VkFormat input_format(const struct SpirvModule* module, uint32_t type_id, uint32_t* size)
+{
+	static const VkFormat float_formats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+	static const VkFormat sint_formats[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+	static const VkFormat uint_formats[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+	const struct SpirvId* type = &module->ids[type_id];
+	uint32_t component_count = 1;
+
+	if (type->opcode == SPV_OP_TYPE_VECTOR)
+	{
+		component_count = type->value;
+		type = &module->ids[type->type_id];
+	}
+
+	*size = 0;
+	if (component_count < 1 || component_count > 4 || type->value != 32)
+		return VK_FORMAT_UNDEFINED;
+
+	*size = component_count * 4;
+	if (type->opcode == SPV_OP_TYPE_FLOAT)
+		return float_formats[component_count - 1];
+	if (type->opcode == SPV_OP_TYPE_INT)
+		return type->sampled ? sint_formats[component_count - 1] : uint_formats[component_count - 1];
+
+	*size = 0;
+	return VK_FORMAT_UNDEFINED;
+}
+
+static VkDescriptorType descriptor_type(const struct SpirvModule* module, uint32_t storage_class, uint32_t type_id)
+{
+	const struct SpirvId* type = &module->ids[type_id];
+
+	if (storage_class == SPV_STORAGE_STORAGE_BUFFER)
+		return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+	if (storage_class == SPV_STORAGE_UNIFORM)
+		return (type->flags & ID_BUFFER_BLOCK) ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+	switch (type->opcode)
+	{
+	case SPV_OP_TYPE_SAMPLED_IMAGE:
+		return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	case SPV_OP_TYPE_SAMPLER:
+		return VK_DESCRIPTOR_TYPE_SAMPLER;
+	case SPV_OP_TYPE_ACCELERATION_STRUCTURE:
+		return VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+	case SPV_OP_TYPE_IMAGE:
+		if (type->value == SPV_DIM_BUFFER)
+			return type->sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+		if (type->value == SPV_DIM_SUBPASS_DATA)
+			return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+		return type->sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	default:
+		return VK_DESCRIPTOR_TYPE_MAX_ENUM;
+	}
+}
+
+static void reflect_variable(const struct SpirvModule* module, uint32_t variable_id, struct ShaderReflection* reflection)
+{
+	const struct SpirvId* variable = &module->ids[variable_id];
+	// Variables are always declared through a pointer type
+	uint32_t type_id = module->ids[variable->type_id].type_id;
+	uint32_t count = 1;
+
+	switch (variable->storage_class)
+	{
+	case SPV_STORAGE_INPUT:
+	{
+		struct ReflectedInput input;
+		uint32_t i;
+
+		if (reflection->stage != VK_SHADER_STAGE_VERTEX_BIT || (variable->flags & ID_BUILTIN) || !(variable->flags & ID_HAS_LOCATION))
+			return;
+		if (reflection->input_count == MAX_REFLECTED_INPUTS)
+		{
+			printf("too many vertex inputs, location %u ignored\n", variable->location);
+			return;
+		}
+
+		input.location = variable->location;
+		input.format = input_format(module, type_id, &input.size);
+		if (input.format == VK_FORMAT_UNDEFINED)
+		{
+			printf("unsupported vertex input type at location %u\n", variable->location);
+			return;
+		}
+
+		// Insertion sort by location
+		for (i = reflection->input_count; i > 0 && reflection->inputs[i - 1].location > input.location; i--)
+		{
+			reflection->inputs[i] = reflection->inputs[i - 1];
+		}
+		reflection->inputs[i] = input;
+		reflection->input_count++;
+		return;
+	}
+	case SPV_STORAGE_PUSH_CONSTANT:
+		reflection->push_constant_offset = 0;
+		reflection->push_constant_size = type_size(module, type_id, 0);
+		return;
+	case SPV_STORAGE_UNIFORM_CONSTANT:
+	case SPV_STORAGE_UNIFORM:
+	case SPV_STORAGE_STORAGE_BUFFER:
+	{
+		struct ReflectedBinding* binding;
+
+		if (module->ids[type_id].opcode == SPV_OP_TYPE_ARRAY)
+		{
+			count = module->ids[module->ids[type_id].value].value;
+			type_id = module->ids[type_id].type_id;
+		}
+		else if (module->ids[type_id].opcode == SPV_OP_TYPE_RUNTIME_ARRAY)
+		{
+			printf("runtime descriptor array at binding %u reflected as a single descriptor\n", variable->binding);
+			type_id = module->ids[type_id].type_id;
+		}
+
+		if (!(variable->flags & ID_HAS_BINDING))
+			return;
+		if (reflection->binding_count == MAX_REFLECTED_BINDINGS)
+		{
+			printf("too many descriptor bindings, binding %u ignored\n", variable->binding);
+			return;
+		}
+
+		binding = &reflection->bindings[reflection->binding_count];
+		binding->set = (variable->flags & ID_HAS_SET) ? variable->set : 0;
+		binding->binding = variable->binding;
+		binding->type = descriptor_type(module, variable->storage_class, type_id);
+		binding->count = count;
+		binding->stages = reflection->stage;
+		if (binding->type == VK_DESCRIPTOR_TYPE_MAX_ENUM)
+		{
+			printf("unsupported descriptor type at set %u binding %u\n", binding->set, binding->binding);
+			return;
+		}
+		reflection->binding_count++;
+		return;
+	}
+	default:
+		return;
+	}
+}
+
+int reflect_spirv(const uint32_t* words, size_t word_count, VkShaderStageFlagBits stage, struct ShaderReflection* reflection)
+{
+	struct SpirvModule module;
+	size_t offset;
+
+	memset(reflection, 0, sizeof(*reflection));
+	reflection->stage = stage;
+
+	if (word_count < SPV_HEADER_WORDS || words[0] != SPV_MAGIC)
+	{
+		printf("invalid SPIR-V module\n");
+		return -1;
+	}
+
+	module.words = words;
+	module.word_count = word_count;
+	module.id_bound = words[3];
+	module.ids = (struct SpirvId*)calloc(module.id_bound, sizeof(struct SpirvId));
+	if (!module.ids)
+		return -1;
+
+	// First pass: record types, constants, variables and their decorations by result id. Every operand read and every
+	// id referenced is checked here, the second pass relies on it.
+	for (offset = SPV_HEADER_WORDS; offset < word_count; offset += words[offset] >> 16)
+	{
+		uint32_t opcode = words[offset] & 0xffff;
+		uint32_t length = words[offset] >> 16;
+		const uint32_t* operands = &words[offset + 1];
+		// Operand holding the result id, or the decoration target. Constants and variables name their result type first.
+		uint32_t result = opcode == SPV_OP_CONSTANT || opcode == SPV_OP_VARIABLE ? 1 : 0;
+		struct SpirvId* id;
+
+		if (length == 0 || offset + length > word_count)
+			goto malformed;
+		if (!instruction_length(opcode))
+			continue;
+		if (length < instruction_length(opcode) || operands[result] >= module.id_bound)
+			goto malformed;
+		id = &module.ids[operands[result]];
+		// Result ids are defined once, a forward declared pointer is defined again by its OpTypePointer
+		if (opcode != SPV_OP_DECORATE && opcode != SPV_OP_MEMBER_DECORATE && id->opcode &&
+			!(opcode == SPV_OP_TYPE_POINTER && id->opcode == SPV_OP_TYPE_FORWARD_POINTER))
+			goto malformed;
+
+		switch (opcode)
+		{
+		case SPV_OP_DECORATE:
+			// Decorations with a literal operand
+			if (length < 4 && (operands[1] == SPV_DECORATION_DESCRIPTOR_SET || operands[1] == SPV_DECORATION_BINDING ||
+				operands[1] == SPV_DECORATION_LOCATION || operands[1] == SPV_DECORATION_ARRAY_STRIDE))
+				goto malformed;
+			switch (operands[1])
+			{
+			case SPV_DECORATION_DESCRIPTOR_SET:
+				id->set = operands[2];
+				id->flags |= ID_HAS_SET;
+				break;
+			case SPV_DECORATION_BINDING:
+				id->binding = operands[2];
+				id->flags |= ID_HAS_BINDING;
+				break;
+			case SPV_DECORATION_LOCATION:
+				id->location = operands[2];
+				id->flags |= ID_HAS_LOCATION;
+				break;
+			case SPV_DECORATION_BUILTIN:
+				id->flags |= ID_BUILTIN;
+				break;
+			case SPV_DECORATION_BLOCK:
+				id->flags |= ID_BLOCK;
+				break;
+			case SPV_DECORATION_BUFFER_BLOCK:
+				id->flags |= ID_BUFFER_BLOCK;
+				break;
+			case SPV_DECORATION_ARRAY_STRIDE:
+				id->array_stride = operands[2];
+				break;
+			}
+			break;
+		case SPV_OP_MEMBER_DECORATE:
+			// struct_size reads the literal of these two
+			if (length < 5 && (operands[2] == SPV_DECORATION_OFFSET || operands[2] == SPV_DECORATION_MATRIX_STRIDE))
+				goto malformed;
+			break;
+		case SPV_OP_TYPE_STRUCT:
+			for (uint32_t member = 1; member < length - 1; member++)
+			{
+				if (!is_declared_type(&module, operands[member]))
+					goto malformed;
+			}
+			id->opcode = opcode;
+			break;
+		case SPV_OP_TYPE_BOOL:
+		case SPV_OP_TYPE_SAMPLER:
+		case SPV_OP_TYPE_ACCELERATION_STRUCTURE:
+			id->opcode = opcode;
+			break;
+		case SPV_OP_TYPE_INT:
+			id->opcode = opcode;
+			id->value = operands[1];
+			id->sampled = operands[2];
+			break;
+		case SPV_OP_TYPE_FLOAT:
+			id->opcode = opcode;
+			id->value = operands[1];
+			break;
+		case SPV_OP_TYPE_VECTOR:
+		case SPV_OP_TYPE_MATRIX:
+		case SPV_OP_TYPE_ARRAY:
+			// The array length is a constant id
+			if (!is_declared_type(&module, operands[1]) || (opcode == SPV_OP_TYPE_ARRAY && operands[2] >= module.id_bound))
+				goto malformed;
+			id->opcode = opcode;
+			id->type_id = operands[1];
+			id->value = operands[2];
+			break;
+		case SPV_OP_TYPE_RUNTIME_ARRAY:
+		case SPV_OP_TYPE_SAMPLED_IMAGE:
+			if (!is_declared_type(&module, operands[1]))
+				goto malformed;
+			id->opcode = opcode;
+			id->type_id = operands[1];
+			break;
+		case SPV_OP_TYPE_IMAGE:
+			if (!is_declared_type(&module, operands[1]))
+				goto malformed;
+			id->opcode = opcode;
+			id->type_id = operands[1];
+			id->value = operands[2];
+			id->sampled = operands[6];
+			break;
+		case SPV_OP_TYPE_FORWARD_POINTER:
+			id->opcode = opcode;
+			id->storage_class = operands[1];
+			break;
+		case SPV_OP_TYPE_POINTER:
+			// The pointee may be a struct declared later through a forward pointer
+			if (operands[2] >= module.id_bound)
+				goto malformed;
+			id->opcode = opcode;
+			id->storage_class = operands[1];
+			id->type_id = operands[2];
+			break;
+		case SPV_OP_CONSTANT:
+			if (!is_declared_type(&module, operands[0]))
+				goto malformed;
+			id->opcode = opcode;
+			id->type_id = operands[0];
+			id->value = operands[2];
+			break;
+		case SPV_OP_VARIABLE:
+			if (!is_declared_type(&module, operands[0]) || module.ids[operands[0]].opcode != SPV_OP_TYPE_POINTER)
+				goto malformed;
+			id->opcode = opcode;
+			id->type_id = operands[0];
+			id->storage_class = operands[2];
+			break;
+		}
+	}
+
+	// Second pass: every id is known now, turn the interface variables into bindings and inputs
+	for (uint32_t i = 0; i < module.id_bound; i++)
+	{
+		if (module.ids[i].opcode == SPV_OP_VARIABLE)
+		{
+			reflect_variable(&module, i, reflection);
+		}
+	}
+
+	free(module.ids);
+	return 0;
+
+malformed:
+	printf("malformed SPIR-V instruction at word %zu\n", offset);
+	free(module.ids);
+	return -1;
+}
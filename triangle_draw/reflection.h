@@ -0,0 +1,38 @@
+#pragma once
+#include "common.h"
+
+#define MAX_DESCRIPTOR_SETS 4
+#define MAX_REFLECTED_BINDINGS 16
+#define MAX_REFLECTED_INPUTS 16
+
+struct ReflectedBinding
+{
+	uint32_t set;
+	uint32_t binding;
+	VkDescriptorType type;
+	uint32_t count;
+	VkShaderStageFlags stages;
+};
+
+// Vertex shader input, format is the 32 bit format matching the GLSL type
+struct ReflectedInput
+{
+	uint32_t location;
+	VkFormat format;
+	uint32_t size;
+};
+
+struct ShaderReflection
+{
+	VkShaderStageFlagBits stage;
+	uint32_t binding_count;
+	struct ReflectedBinding bindings[MAX_REFLECTED_BINDINGS];
+	// Push constant block, size 0 when the shader has none
+	uint32_t push_constant_offset;
+	uint32_t push_constant_size;
+	// Sorted by location
+	uint32_t input_count;
+	struct ReflectedInput inputs[MAX_REFLECTED_INPUTS];
+};
+
+extern int reflect_spirv(const uint32_t* words, size_t word_count, VkShaderStageFlagBits stage, struct ShaderReflection* reflection);
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <intrin.h>
+#include <immintrin.h>
+#include "scene_graph.h"
+
+int create_scene_graph(struct SceneGraph* graph, uint32_t capacity)
+{
+	memset(graph, 0, sizeof(*graph));
+	graph->parents = (uint32_t*)malloc((size_t)capacity * sizeof(uint32_t));
+	graph->depths = (uint32_t*)malloc((size_t)capacity * sizeof(uint32_t));
+	graph->handles = (uint32_t*)malloc((size_t)capacity * sizeof(uint32_t));
+	graph->slots = (uint32_t*)malloc((size_t)capacity * sizeof(uint32_t));
+	graph->updated = (uint32_t*)malloc((size_t)capacity * sizeof(uint32_t));
+	graph->dirty = (uint8_t*)calloc(capacity, sizeof(uint8_t));
+	graph->local_transforms = (glm::mat4*)_aligned_malloc((size_t)capacity * sizeof(glm::mat4), 16);
+	graph->world_transforms = (glm::mat4*)_aligned_malloc((size_t)capacity * sizeof(glm::mat4), 16);
+	if (!graph->parents || !graph->depths || !graph->handles || !graph->slots || !graph->updated || !graph->dirty ||
+		!graph->local_transforms || !graph->world_transforms)
+	{
+		printf("cannot allocate scene graph with %u nodes\n", capacity);
+		destroy_scene_graph(graph);
+		return -1;
+	}
+	graph->capacity = capacity;
+	return 0;
+}
+
+void destroy_scene_graph(struct SceneGraph* graph)
+{
+	free(graph->parents);
+	free(graph->depths);
+	free(graph->handles);
+	free(graph->slots);
+	free(graph->updated);
+	free(graph->dirty);
+	_aligned_free(graph->local_transforms);
+	_aligned_free(graph->world_transforms);
+	memset(graph, 0, sizeof(*graph));
+}
+
+uint32_t add_scene_node(struct SceneGraph* graph, uint32_t parent, const glm::mat4& local_transform)
+{
+	uint32_t node = graph->node_count;
+	uint32_t depth = parent == SCENE_NODE_NONE ? 0 : graph->depths[graph->slots[parent]] + 1;
+
+	if (node >= graph->capacity || depth >= MAX_SCENE_DEPTH)
+	{
+		printf("cannot add scene node, %u nodes of %u, depth %u\n", node, graph->capacity, depth);
+		return SCENE_NODE_NONE;
+	}
+
+	// Appended out of depth order, the next update sorts
+	graph->parents[node] = parent == SCENE_NODE_NONE ? SCENE_NODE_NONE : graph->slots[parent];
+	graph->depths[node] = depth;
+	graph->handles[node] = node;
+	graph->slots[node] = node;
+	graph->dirty[node] = 1;
+	graph->local_transforms[node] = local_transform;
+	graph->node_count++;
+	graph->needs_sort = VK_TRUE;
+	graph->first_dirty = graph->first_dirty < node ? graph->first_dirty : node;
+	return node;
+}
+
+void set_local_transform(struct SceneGraph* graph, uint32_t node, const glm::mat4& local_transform)
+{
+	uint32_t slot = graph->slots[node];
+
+	graph->local_transforms[slot] = local_transform;
+	graph->dirty[slot] = 1;
+	graph->first_dirty = graph->first_dirty < slot ? graph->first_dirty : slot;
+}
+
+const glm::mat4& get_world_transform(const struct SceneGraph* graph, uint32_t node)
+{
+	return graph->world_transforms[graph->slots[node]];
+}
+
+// Stable counting sort by depth. Parents are shallower, so they keep coming before their children.
+static int sort_scene_graph(struct SceneGraph* graph)
+{
+	uint32_t count = graph->node_count;
+	uint32_t* order = (uint32_t*)malloc((size_t)count * sizeof(uint32_t));
+	uint32_t* scratch = (uint32_t*)malloc((size_t)count * sizeof(uint32_t));
+	uint8_t* dirty = (uint8_t*)malloc(count);
+	glm::mat4* transforms = (glm::mat4*)_aligned_malloc((size_t)count * sizeof(glm::mat4), 16);
+	uint32_t offsets[MAX_SCENE_DEPTH + 1];
+
+	if (!order || !scratch || !dirty || !transforms)
+	{
+		printf("cannot sort scene graph with %u nodes\n", count);
+		free(order);
+		free(scratch);
+		free(dirty);
+		_aligned_free(transforms);
+		return -1;
+	}
+
+	memset(offsets, 0, sizeof(offsets));
+	for (uint32_t i = 0; i < count; i++)
+		offsets[graph->depths[i] + 1]++;
+	graph->level_count = 0;
+	for (uint32_t level = 0; level < MAX_SCENE_DEPTH; level++)
+	{
+		offsets[level + 1] += offsets[level];
+		graph->level_count = offsets[level + 1] > offsets[level] ? level + 1 : graph->level_count;
+	}
+	memcpy(graph->level_starts, offsets, sizeof(offsets));
+
+	// order maps new positions to old ones, slots is rebuilt as the inverse
+	for (uint32_t i = 0; i < count; i++)
+		order[offsets[graph->depths[i]]++] = i;
+	for (uint32_t i = 0; i < count; i++)
+		graph->slots[graph->handles[order[i]]] = i;
+
+	for (uint32_t i = 0; i < count; i++)
+		scratch[i] = graph->parents[order[i]] == SCENE_NODE_NONE ? SCENE_NODE_NONE : graph->slots[graph->handles[graph->parents[order[i]]]];
+	memcpy(graph->parents, scratch, (size_t)count * sizeof(uint32_t));
+	for (uint32_t i = 0; i < count; i++)
+		scratch[i] = graph->depths[order[i]];
+	memcpy(graph->depths, scratch, (size_t)count * sizeof(uint32_t));
+	for (uint32_t i = 0; i < count; i++)
+		scratch[i] = graph->handles[order[i]];
+	memcpy(graph->handles, scratch, (size_t)count * sizeof(uint32_t));
+	for (uint32_t i = 0; i < count; i++)
+		dirty[i] = graph->dirty[order[i]];
+	memcpy(graph->dirty, dirty, count);
+	for (uint32_t i = 0; i < count; i++)
+		transforms[i] = graph->local_transforms[order[i]];
+	memcpy(graph->local_transforms, transforms, (size_t)count * sizeof(glm::mat4));
+	for (uint32_t i = 0; i < count; i++)
+		transforms[i] = graph->world_transforms[order[i]];
+	memcpy(graph->world_transforms, transforms, (size_t)count * sizeof(glm::mat4));
+
+	free(order);
+	free(scratch);
+	free(dirty);
+	_aligned_free(transforms);
+	graph->needs_sort = VK_FALSE;
+	graph->first_dirty = 0;
+	return 0;
+}
+
+// Column major, so column j of parent * local is the parent columns weighted by column j of local
+static inline void multiply_transform_sse(const float* parent, const float* local, float* world)
+{
+	__m128 c0 = _mm_load_ps(parent);
+	__m128 c1 = _mm_load_ps(parent + 4);
+	__m128 c2 = _mm_load_ps(parent + 8);
+	__m128 c3 = _mm_load_ps(parent + 12);
+
+	for (int j = 0; j < 4; j++)
+	{
+		__m128 column = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(local[j * 4])), _mm_mul_ps(c1, _mm_set1_ps(local[j * 4 + 1]))),
+			_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(local[j * 4 + 2])), _mm_mul_ps(c3, _mm_set1_ps(local[j * 4 + 3]))));
+		_mm_store_ps(world + j * 4, column);
+	}
+}
+
+// Nodes of one level never depend on each other, so the batch runs without ordering concerns
+static void update_world_transforms(struct SceneGraph* graph, const uint32_t* nodes, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t node = nodes[i];
+		uint32_t parent = graph->parents[node];
+
+		if (parent == SCENE_NODE_NONE)
+		{
+			graph->world_transforms[node] = graph->local_transforms[node];
+			continue;
+		}
+		multiply_transform_sse(&graph->world_transforms[parent][0][0], &graph->local_transforms[node][0][0],
+			&graph->world_transforms[node][0][0]);
+	}
+}
+
+uint32_t update_scene_graph(struct SceneGraph* graph)
+{
+	graph->updated_count = 0;
+	if (graph->needs_sort && sort_scene_graph(graph))
+		return 0;
+
+	for (uint32_t level = 0; level < graph->level_count && graph->first_dirty < graph->node_count; level++)
+	{
+		uint32_t begin = graph->level_starts[level] > graph->first_dirty ? graph->level_starts[level] : graph->first_dirty;
+		uint32_t batch_start = graph->updated_count;
+
+		// A parent updated on an earlier level is still flagged, so the flag reaches the whole subtree
+		for (uint32_t i = begin; i < graph->level_starts[level + 1]; i++)
+		{
+			uint32_t parent = graph->parents[i];
+
+			if (graph->dirty[i] || (parent != SCENE_NODE_NONE && graph->dirty[parent]))
+			{
+				graph->dirty[i] = 1;
+				graph->updated[graph->updated_count++] = i;
+			}
+		}
+		update_world_transforms(graph, graph->updated + batch_start, graph->updated_count - batch_start);
+	}
+
+	for (uint32_t i = 0; i < graph->updated_count; i++)
+	{
+		graph->dirty[graph->updated[i]] = 0;
+		graph->updated[i] = graph->handles[graph->updated[i]];
+	}
+	graph->first_dirty = graph->node_count;
+	return graph->updated_count;
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+#include "common.h"
+
+#define SCENE_NODE_NONE UINT32_MAX
+// Hierarchy levels, roots are depth 0
+#define MAX_SCENE_DEPTH 16
+
+// Transform hierarchy in structure of arrays form. Nodes are kept sorted by depth, so every level is one contiguous
+// range whose nodes only depend on earlier levels. Handles returned by add_scene_node stay valid across the sorts.
+struct SceneGraph
+{
+	// Per node, in depth order
+	uint32_t* parents;
+	uint32_t* depths;
+	uint32_t* handles;
+	uint8_t* dirty;
+	// 16 byte aligned for the SIMD multiply
+	glm::mat4* local_transforms;
+	glm::mat4* world_transforms;
+	uint32_t node_count;
+	uint32_t capacity;
+
+	// Node index of each handle
+	uint32_t* slots;
+	// First node of each depth, level_starts[level_count] is node_count
+	uint32_t level_starts[MAX_SCENE_DEPTH + 1];
+	uint32_t level_count;
+	VkBool32 needs_sort;
+	// Nodes before this one are clean
+	uint32_t first_dirty;
+
+	// Handles of the nodes whose world transform changed in the last update, in depth order
+	uint32_t* updated;
+	uint32_t updated_count;
+};
+
+extern int create_scene_graph(struct SceneGraph* graph, uint32_t capacity);
+extern void destroy_scene_graph(struct SceneGraph* graph);
+// Parent is a handle or SCENE_NODE_NONE. Returns the handle of the new node, SCENE_NODE_NONE when the graph is full
+// or the hierarchy too deep. Handles count up from 0 in add order.
+extern uint32_t add_scene_node(struct SceneGraph* graph, uint32_t parent, const glm::mat4& local_transform);
+// Marks the node and, on the next update, its whole subtree dirty
+extern void set_local_transform(struct SceneGraph* graph, uint32_t node, const glm::mat4& local_transform);
+extern const glm::mat4& get_world_transform(const struct SceneGraph* graph, uint32_t node);
+// Recomputes the world transforms of dirty subtrees level by level and fills updated, returns updated_count.
+// Nothing moved means nothing is multiplied.
+extern uint32_t update_scene_graph(struct SceneGraph* graph);
\ No newline at end of file
@@ -6,14 +6,75 @@
 #include <SPIRV/GlslangToSpv.h>
 
 #include<shaderc/shaderc.h>
+#include <spirv-tools/optimizer.hpp>
 #include <stdio.h>
 #include <string.h>
 #include "shader.h"
+#include "reflection.h"
 
 typedef struct SpirVBinary {
     uint32_t* words; // SPIR-V words
     size_t size; // number of words in SPIR-V binary
 } SpirVBinary;
+
+// Every SPIR-V instruction starts with a word holding (word count << 16 | opcode),
+// the module itself starts with a 5 word header.
+static uint32_t count_spirv_instructions(const uint32_t* words, size_t word_count)
+{
+    uint32_t instruction_count = 0;
+    size_t offset = 5;
+
+    while (offset < word_count)
+    {
+        uint32_t instruction_words = words[offset] >> 16;
+        if (instruction_words == 0)
+            break;
+        offset += instruction_words;
+        instruction_count++;
+    }
+    return instruction_count;
+}
+
+// Run the spirv-opt pass set selected by optimization over spirv in place and
+// report the instruction count before and after. The unoptimized binary is kept
+// if the optimizer fails.
+static bool optimize_spirv(std::vector<uint32_t>& spirv, enum ShaderOptimization optimization, const char* name)
+{
+    std::vector<uint32_t> optimized;
+    uint32_t instructions_before;
+    uint32_t instructions_after;
+
+    if (optimization == SHADER_OPTIMIZATION_NONE || spirv.empty())
+        return true;
+
+    spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_0);
+    optimizer.SetMessageConsumer([name](spv_message_level_t level, const char*, const spv_position_t& position, const char* message) {
+        if (level <= SPV_MSG_ERROR)
+            printf("(%s) spirv-opt error at word %zu: %s\n", name, position.index, message);
+    });
+
+    if (optimization == SHADER_OPTIMIZATION_SIZE)
+        optimizer.RegisterSizePasses();
+    else
+        optimizer.RegisterPerformancePasses();
+
+    if (!optimizer.Run(spirv.data(), spirv.size(), &optimized))
+    {
+        printf("(%s) spirv-opt failed, using unoptimized SPIR-V\n", name);
+        return false;
+    }
+
+    instructions_before = count_spirv_instructions(spirv.data(), spirv.size());
+    instructions_after = count_spirv_instructions(optimized.data(), optimized.size());
+    printf("(%s) %s optimization: %u -> %u instructions, %zu -> %zu bytes\n", name,
+        optimization == SHADER_OPTIMIZATION_SIZE ? "size" : "performance",
+        instructions_before, instructions_after,
+        spirv.size() * sizeof(uint32_t), optimized.size() * sizeof(uint32_t));
+
+    spirv.swap(optimized);
+    return true;
+}
+
 static shaderc_shader_kind vulkan_stage_to_shaderc_kind(VkShaderStageFlagBits stage)
 {
     switch (stage)
@@ -46,7 +107,8 @@ static shaderc_shader_kind vulkan_stage_to_shaderc_kind(VkShaderStageFlagBits st
         return shaderc_glsl_infer_from_source;
     }
 }
-static SpirVBinary compile_glsl_to_spirv(const char* shaderSource, uint32_t length, VkShaderStageFlagBits stage, const char* fileName)
+static SpirVBinary compile_glsl_to_spirv(const char* shaderSource, uint32_t length, VkShaderStageFlagBits stage, const char* fileName,
+    enum ShaderOptimization optimization)
 {
     SpirVBinary bin = {
        .words = NULL,
@@ -63,9 +125,11 @@ static SpirVBinary compile_glsl_to_spirv(const char* shaderSource, uint32_t leng
         shaderc_target_env_vulkan,
         shaderc_env_version_vulkan_1_0
     );
+    // spirv-opt runs afterwards in optimize_spirv, same as for the glslang path
+    shaderc_compile_options_set_optimization_level(options, shaderc_optimization_level_zero);
 
     result = shaderc_compile_into_spv(compiler, shaderSource, length,
-        shader_kind, fileName, "main", nullptr);
+        shader_kind, fileName, "main", options);
 
     compilation_result = shaderc_result_get_compilation_status(result);
 
@@ -80,14 +144,21 @@ static SpirVBinary compile_glsl_to_spirv(const char* shaderSource, uint32_t leng
         return bin;
     }
 
-    bin.size = shaderc_result_get_length(result);
-    bin.words = (uint32_t*)malloc(bin.size);
-    if (!bin.words)
     {
-        bin.size = 0;
-        goto exit;
+        const uint32_t* words = (const uint32_t*)shaderc_result_get_bytes(result);
+        std::vector<uint32_t> spirv(words, words + shaderc_result_get_length(result) / sizeof(uint32_t));
+
+        optimize_spirv(spirv, optimization, fileName);
+
+        bin.size = spirv.size() * sizeof(uint32_t);
+        bin.words = (uint32_t*)malloc(bin.size);
+        if (!bin.words)
+        {
+            bin.size = 0;
+            goto exit;
+        }
+        memcpy(bin.words, spirv.data(), bin.size);
     }
-    memcpy(bin.words, shaderc_result_get_bytes(result), bin.size);
 exit:
     shaderc_result_release(result);
     shaderc_compile_options_release(options);
@@ -150,7 +221,9 @@ bool compile_to_spirv(VkShaderStageFlagBits       stage,
     const char *glsl_source,
     const char* entry_point,
     std::vector<unsigned int>& spirv,
-    std::string& info_log)
+    std::string& info_log,
+    enum ShaderOptimization optimization,
+    const char* name)
 {
     const char* file_name_list[1] = { "" };
     // Initialize glslang library.
@@ -215,6 +288,8 @@ bool compile_to_spirv(VkShaderStageFlagBits       stage,
     // Shutdown glslang library.
     glslang::FinalizeProcess();
 
+    optimize_spirv(spirv, optimization, name);
+
     return true;
 }
 SpirVBinary compileShaderToSPIRV_Vulkan(glslang_stage_t stage, const char* shaderSource, const char* fileName) {
@@ -331,7 +406,8 @@ glslang_stage_t convert_vulkan_stage_to_glslang_stage(VkShaderStageFlagBits stag
         return GLSLANG_STAGE_COUNT;
     }
 }
-VkShaderModule get_shader_module(const char* file_name, VkDevice device, VkShaderStageFlagBits stage)
+VkShaderModule get_shader_module(const char* file_name, VkDevice device, VkShaderStageFlagBits stage, enum ShaderOptimization optimization,
+    struct ShaderReflection* reflection)
 {
     VkShaderModule shader_module = VK_NULL_HANDLE;
     VkShaderModuleCreateInfo module_create_info{};
@@ -360,12 +436,17 @@ VkShaderModule get_shader_module(const char* file_name, VkDevice device, VkShade
     fread(shader_str, file_length, 1, fp);
     shader_str[file_length] = '\0';
 
-    if (!compile_to_spirv(stage, shader_str, "main", spirv, info_log))
+    if (!compile_to_spirv(stage, shader_str, "main", spirv, info_log, optimization, file_name))
     {
         printf("Failed to compile shader, Error: %s", info_log.c_str());
         return VK_NULL_HANDLE;
     }
-    //spirv_binary = compile_glsl_to_spirv(shader_str, file_length, stage, file_name);
+    // Reflect the final (optimized) module, that is what the pipeline will see
+    if (reflection && reflect_spirv(spirv.data(), spirv.size(), stage, reflection))
+    {
+        printf("Failed to reflect shader %s\n", file_name);
+    }
+    //spirv_binary = compile_glsl_to_spirv(shader_str, file_length, stage, file_name, optimization);
     module_create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
     //module_create_info.codeSize = spirv_binary.size;
     //module_create_info.pCode = spirv_binary.words;
@@ -434,12 +515,13 @@ VkShaderModule get_shader_module_from_spirv(const char* file_name, VkDevice devi
     }
     return shader_module;
 }
-VkPipelineShaderStageCreateInfo load_shader(struct GraphicsContext* graphics_context,const char* shader_filename, VkShaderStageFlagBits stage)
+VkPipelineShaderStageCreateInfo load_shader(struct GraphicsContext* graphics_context,const char* shader_filename, VkShaderStageFlagBits stage,
+	struct ShaderReflection* reflection)
 {
 	VkPipelineShaderStageCreateInfo shader_stage = {};
 	shader_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	shader_stage.stage = stage;
-	shader_stage.module = get_shader_module(shader_filename, graphics_context->device, stage);
+	shader_stage.module = get_shader_module(shader_filename, graphics_context->device, stage, graphics_context->shader_optimization, reflection);
 	shader_stage.pName = "main";
 
 	return shader_stage;
@@ -1,4 +1,7 @@
 #pragma once
 #include "common.h"
 struct GraphicsContext;
-extern VkPipelineShaderStageCreateInfo load_shader(struct GraphicsContext* graphics_context, const char* shader_filename, VkShaderStageFlagBits stage);
+struct ShaderReflection;
+// reflection is optional, when given it receives the descriptor bindings, push constants and vertex inputs of the shader
+extern VkPipelineShaderStageCreateInfo load_shader(struct GraphicsContext* graphics_context, const char* shader_filename, VkShaderStageFlagBits stage,
+	struct ShaderReflection* reflection);
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "streaming.h"
+#include "culling.h"
+#include "mesh.h"
+#include "mesh_cache.h"
+#include "mapped_file.h"
+#include "index_format.h"
+#include "buffer.h"
+#include "memory.h"
+
+#define STREAMED_LOD_NONE 0xffffffffu
+
+enum LodResidency
+{
+	LOD_EVICTED,
+	// Range reserved, waiting for a streaming thread
+	LOD_QUEUED,
+	LOD_LOADING,
+	// Written to index_buffer, resident from the next update
+	LOD_LOADED,
+	LOD_RESIDENT,
+};
+
+struct StreamedLod
+{
+	enum LodResidency residency;
+	// Index range in the mesh and where it sits in index_buffer while reserved, in indices
+	uint32_t mesh_first_index;
+	uint32_t index_count;
+	uint32_t first_index;
+	// Screen space size of the biggest instance asking for the LOD, the threads load the biggest first
+	float priority;
+	// Last frame the LOD was drawn in, the least recently drawn is evicted first
+	uint64_t last_used_frame;
+};
+
+struct GeometryStreamer
+{
+	std::mutex mutex;
+	std::condition_variable work_ready;
+	bool shutting_down;
+	uint32_t worker_count;
+	std::thread workers[STREAMING_THREADS];
+
+	// Mesh indices the LODs are read from, inside the mapped mesh cache or an owned copy
+	struct MappedFile file;
+	VkBool32 file_mapped;
+	const uint32_t* source_indices;
+	uint32_t* owned_indices;
+	// Draws of the mesh, 16 bit indices are rebased per draw
+	const struct MeshDraw* draws;
+	uint32_t draw_count;
+	VkIndexType index_type;
+	uint32_t index_size;
+
+	// Persistently mapped index_buffer. Threads write reserved ranges while the GPU draws from the resident ones.
+	uint8_t* pool_data;
+	uint32_t pool_index_count;
+	// The coarsest LOD is pinned at the start of the pool
+	struct StreamedLod lods[MAX_MESH_LODS];
+	uint32_t lod_count;
+	uint64_t frame;
+};
+
+// Maps the cache the mesh was loaded from or imported to, the indices are only read when a LOD is loaded
+static int map_source_indices(struct GeometryStreamer* streamer, const struct Mesh* mesh, const char* cache_file_name)
+{
+	struct MeshCacheHeader header;
+
+	if (!cache_file_name || map_file(cache_file_name, &streamer->file))
+		return -1;
+
+	if (streamer->file.size < sizeof(header))
+		goto invalid;
+	memcpy(&header, streamer->file.data, sizeof(header));
+
+	// Written with the mesh, but the file may have been replaced since
+	if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION || header.index_stride != sizeof(uint32_t) ||
+		header.index_count != mesh->index_count || header.lod_count != mesh->lod_count ||
+		header.index_offset + (uint64_t)header.index_count * sizeof(uint32_t) > streamer->file.size)
+		goto invalid;
+	for (uint32_t i = 0; i < mesh->lod_count; i++)
+	{
+		if (header.lod_first_index[i] != mesh->lods[i].first_index || header.lod_index_count[i] != mesh->lods[i].index_count)
+			goto invalid;
+	}
+
+	streamer->source_indices = (const uint32_t*)((const uint8_t*)streamer->file.data + header.index_offset);
+	streamer->file_mapped = VK_TRUE;
+	return 0;
+
+invalid:
+	printf("mesh cache %s does not match the mesh, streaming from memory\n", cache_file_name);
+	unmap_file(&streamer->file);
+	return -1;
+}
+
+// Writes the indices of a LOD to its range of the pool, in the index type of the draws
+static void load_lod(const struct GeometryStreamer* streamer, uint32_t mesh_first_index, uint32_t index_count, uint32_t first_index)
+{
+	pack_index_range(streamer->source_indices, streamer->draws, streamer->draw_count, mesh_first_index, index_count,
+		streamer->pool_data + (size_t)first_index * streamer->index_size);
+}
+
+static uint32_t get_next_queued_lod(const struct GeometryStreamer* streamer)
+{
+	uint32_t next = STREAMED_LOD_NONE;
+
+	for (uint32_t i = 0; i < streamer->lod_count; i++)
+	{
+		if (streamer->lods[i].residency == LOD_QUEUED && (next == STREAMED_LOD_NONE || streamer->lods[i].priority > streamer->lods[next].priority))
+			next = i;
+	}
+	return next;
+}
+
+static void streaming_thread(struct GeometryStreamer* streamer)
+{
+	std::unique_lock<std::mutex> lock(streamer->mutex);
+
+	while (!streamer->shutting_down)
+	{
+		uint32_t lod = get_next_queued_lod(streamer);
+		struct StreamedLod* streamed;
+		uint32_t mesh_first_index, index_count, first_index;
+
+		if (lod == STREAMED_LOD_NONE)
+		{
+			streamer->work_ready.wait(lock);
+			continue;
+		}
+
+		// The range of a loading LOD is neither moved nor evicted
+		streamed = &streamer->lods[lod];
+		streamed->residency = LOD_LOADING;
+		mesh_first_index = streamed->mesh_first_index;
+		index_count = streamed->index_count;
+		first_index = streamed->first_index;
+		lock.unlock();
+		load_lod(streamer, mesh_first_index, index_count, first_index);
+		lock.lock();
+		streamed->residency = LOD_LOADED;
+	}
+}
+
+int create_geometry_streamer(struct GraphicsContext* graphics_context, const struct Mesh* mesh, const char* cache_file_name,
+	VkDeviceSize budget)
+{
+	struct GeometryStreamer* streamer = new struct GeometryStreamer();
+	uint32_t coarsest = mesh->lod_count - 1;
+	uint32_t streamed_index_count = mesh->index_count - mesh->lods[coarsest].index_count;
+	uint64_t budget_index_count;
+	VkDeviceSize pool_size;
+	void* pool_data;
+
+	streamer->shutting_down = false;
+	streamer->draws = graphics_context->draws;
+	streamer->draw_count = graphics_context->draw_count;
+	streamer->index_type = graphics_context->draws[0].index_type;
+	streamer->index_size = get_index_size(streamer->index_type);
+	streamer->lod_count = mesh->lod_count;
+	graphics_context->geometry_streamer = streamer;
+
+	if (map_source_indices(streamer, mesh, cache_file_name))
+	{
+		streamer->owned_indices = (uint32_t*)malloc((size_t)mesh->index_count * sizeof(uint32_t));
+		if (!streamer->owned_indices)
+		{
+			printf("cannot allocate %u streamed indices\n", mesh->index_count);
+			return -1;
+		}
+		memcpy(streamer->owned_indices, mesh->indices, (size_t)mesh->index_count * sizeof(uint32_t));
+		streamer->source_indices = streamer->owned_indices;
+	}
+
+	for (uint32_t i = 0; i < mesh->lod_count; i++)
+	{
+		streamer->lods[i].residency = LOD_EVICTED;
+		streamer->lods[i].mesh_first_index = mesh->lods[i].first_index;
+		streamer->lods[i].index_count = mesh->lods[i].index_count;
+	}
+
+	// No more than all of the finer LODs
+	budget_index_count = budget / streamer->index_size;
+	streamer->pool_index_count = mesh->lods[coarsest].index_count +
+		(uint32_t)(budget_index_count < streamed_index_count ? budget_index_count : streamed_index_count);
+	pool_size = (VkDeviceSize)streamer->pool_index_count * streamer->index_size;
+
+	graphics_context->index_buffer = create_buffer(graphics_context->device, pool_size,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+	graphics_context->index_mem = alloc_bind_bufer_memory(graphics_context, graphics_context->index_buffer,
+		pool_size, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (vkMapMemory(graphics_context->device, graphics_context->index_mem, 0, VK_WHOLE_SIZE, 0, &pool_data) != VK_SUCCESS)
+	{
+		printf("cannot map the streamed index buffer\n");
+		return -1;
+	}
+	streamer->pool_data = (uint8_t*)pool_data;
+
+	load_lod(streamer, mesh->lods[coarsest].first_index, mesh->lods[coarsest].index_count, 0);
+	streamer->lods[coarsest].residency = LOD_RESIDENT;
+	streamer->lods[coarsest].first_index = 0;
+	graphics_context->lod_index_offsets[coarsest] = -(int32_t)mesh->lods[coarsest].first_index;
+
+	for (uint32_t i = 0; i < STREAMING_THREADS; i++)
+	{
+		streamer->workers[i] = std::thread(streaming_thread, streamer);
+	}
+	streamer->worker_count = STREAMING_THREADS;
+
+	printf("streaming %u mesh LODs from %s into %.1f MB on %u threads\n", mesh->lod_count - 1,
+		streamer->file_mapped ? cache_file_name : "memory", pool_size / (1024.0 * 1024.0),
+		streamer->worker_count);
+	return 0;
+}
+
+void destroy_geometry_streamer(struct GraphicsContext* graphics_context)
+{
+	struct GeometryStreamer* streamer = graphics_context->geometry_streamer;
+
+	if (!streamer)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(streamer->mutex);
+		streamer->shutting_down = true;
+	}
+	streamer->work_ready.notify_all();
+	for (uint32_t i = 0; i < streamer->worker_count; i++)
+	{
+		streamer->workers[i].join();
+	}
+
+	if (streamer->pool_data)
+		vkUnmapMemory(graphics_context->device, graphics_context->index_mem);
+	if (streamer->file_mapped)
+		unmap_file(&streamer->file);
+	free(streamer->owned_indices);
+	delete streamer;
+	graphics_context->geometry_streamer = NULL;
+}
+
+static inline VkBool32 is_lod_reserved(const struct StreamedLod* lod)
+{
+	return lod->residency != LOD_EVICTED;
+}
+
+// First fit between the reserved ranges, there are at most MAX_MESH_LODS of them
+static uint32_t find_free_range(const struct GeometryStreamer* streamer, uint32_t index_count)
+{
+	uint32_t first = 0;
+
+	for (;;)
+	{
+		uint32_t end = first + index_count;
+		uint32_t overlap_end = 0;
+
+		if (end > streamer->pool_index_count)
+			return STREAMED_LOD_NONE;
+		for (uint32_t i = 0; i < streamer->lod_count; i++)
+		{
+			const struct StreamedLod* lod = &streamer->lods[i];
+			uint32_t lod_end = lod->first_index + lod->index_count;
+
+			if (is_lod_reserved(lod) && lod->first_index < end && lod_end > first && lod_end > overlap_end)
+				overlap_end = lod_end;
+		}
+		if (!overlap_end)
+			return first;
+		first = overlap_end;
+	}
+}
+
+// Evicts resident LODs nobody asked for this frame, least recently drawn first, until the LOD fits
+static VkBool32 reserve_lod_range(struct GeometryStreamer* streamer, uint32_t lod, const float* priorities)
+{
+	struct StreamedLod* streamed = &streamer->lods[lod];
+
+	for (;;)
+	{
+		uint32_t first_index = find_free_range(streamer, streamed->index_count);
+		uint32_t victim = STREAMED_LOD_NONE;
+
+		if (first_index != STREAMED_LOD_NONE)
+		{
+			streamed->first_index = first_index;
+			streamed->residency = LOD_QUEUED;
+			return VK_TRUE;
+		}
+
+		// The coarsest LOD is pinned
+		for (uint32_t i = 0; i + 1 < streamer->lod_count; i++)
+		{
+			if (streamer->lods[i].residency == LOD_RESIDENT && priorities[i] == 0.0f &&
+				(victim == STREAMED_LOD_NONE || streamer->lods[i].last_used_frame < streamer->lods[victim].last_used_frame))
+			{
+				victim = i;
+			}
+		}
+		if (victim == STREAMED_LOD_NONE)
+			return VK_FALSE;
+		// The device is idle and the next frame is recorded without the LOD
+		streamer->lods[victim].residency = LOD_EVICTED;
+	}
+}
+
+void get_lod_priorities(const struct CullingBounds* bounds, const uint32_t* visible, const uint32_t* lod_counts, uint32_t lod_count,
+	glm::vec3 camera_position, float* priorities)
+{
+	uint32_t first = 0;
+
+	for (uint32_t lod = 0; lod < lod_count; lod++)
+	{
+		priorities[lod] = 0.0f;
+		for (uint32_t i = first; i < first + lod_counts[lod]; i++)
+		{
+			uint32_t index = visible[i];
+			glm::vec3 center = glm::vec3(bounds->center_x[index], bounds->center_y[index], bounds->center_z[index]);
+
+			priorities[lod] = glm::max(priorities[lod], bounds->radius[index] / glm::max(glm::length(center - camera_position), 1e-6f));
+		}
+		first += lod_counts[lod];
+	}
+}
+
+void update_geometry_streaming(struct GraphicsContext* graphics_context, const float* priorities, uint32_t* resident_lods)
+{
+	struct GeometryStreamer* streamer = graphics_context->geometry_streamer;
+	uint32_t missing[MAX_MESH_LODS];
+	uint32_t missing_count = 0;
+	uint32_t resident;
+	VkBool32 queued = VK_FALSE;
+
+	streamer->frame++;
+	{
+		std::lock_guard<std::mutex> lock(streamer->mutex);
+
+		for (uint32_t lod = 0; lod < streamer->lod_count; lod++)
+		{
+			struct StreamedLod* streamed = &streamer->lods[lod];
+
+			if (streamed->residency == LOD_LOADED)
+			{
+				streamed->residency = LOD_RESIDENT;
+				graphics_context->lod_index_offsets[lod] = (int32_t)(streamed->first_index - streamed->mesh_first_index);
+			}
+			// Dropped before a thread picked it up
+			if (streamed->residency == LOD_QUEUED && priorities[lod] == 0.0f)
+				streamed->residency = LOD_EVICTED;
+			streamed->priority = priorities[lod];
+			if (streamed->residency == LOD_EVICTED && priorities[lod] > 0.0f)
+				missing[missing_count++] = lod;
+		}
+
+		// Under a tight budget the biggest on screen get the memory
+		for (uint32_t i = 1; i < missing_count; i++)
+		{
+			uint32_t lod = missing[i];
+			uint32_t j = i;
+
+			for (; j > 0 && priorities[missing[j - 1]] < priorities[lod]; j--)
+				missing[j] = missing[j - 1];
+			missing[j] = lod;
+		}
+		for (uint32_t i = 0; i < missing_count; i++)
+		{
+			queued |= reserve_lod_range(streamer, missing[i], priorities);
+		}
+
+		// The coarsest LOD is always resident
+		resident = streamer->lod_count - 1;
+		for (uint32_t lod = streamer->lod_count; lod-- > 0;)
+		{
+			if (streamer->lods[lod].residency == LOD_RESIDENT)
+				resident = lod;
+			resident_lods[lod] = resident;
+			if (priorities[lod] > 0.0f)
+				streamer->lods[resident].last_used_frame = streamer->frame;
+		}
+	}
+	if (queued)
+		streamer->work_ready.notify_all();
+}
+
+void merge_lod_counts(const uint32_t* resident_lods, uint32_t lod_count, uint32_t* lod_counts)
+{
+	for (uint32_t lod = 0; lod < lod_count; lod++)
+	{
+		if (resident_lods[lod] != lod)
+		{
+			lod_counts[resident_lods[lod]] += lod_counts[lod];
+			lod_counts[lod] = 0;
+		}
+	}
+}
+
+VkDeviceSize get_streamed_index_size(struct GraphicsContext* graphics_context)
+{
+	struct GeometryStreamer* streamer = graphics_context->geometry_streamer;
+	VkDeviceSize size = 0;
+	std::lock_guard<std::mutex> lock(streamer->mutex);
+
+	for (uint32_t i = 0; i < streamer->lod_count; i++)
+	{
+		if (is_lod_reserved(&streamer->lods[i]))
+			size += (VkDeviceSize)streamer->lods[i].index_count * streamer->index_size;
+	}
+	return size;
+}
\ No newline at end of file
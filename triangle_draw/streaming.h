@@ -0,0 +1,31 @@
+#pragma once
+#include "common.h"
+
+// Threads reading and packing streamed LODs, the render thread never waits for them
+#define STREAMING_THREADS 2
+
+struct Mesh;
+struct CullingBounds;
+struct GeometryStreamer;
+
+// Creates index_buffer with room for the coarsest LOD plus budget bytes and uploads the coarsest LOD, which stays
+// resident. The finer LODs are streamed into the rest from the mesh cache file when it matches the mesh, from a copy
+// of the mesh indices otherwise. Needs the draws of the mesh.
+extern int create_geometry_streamer(struct GraphicsContext* graphics_context, const struct Mesh* mesh, const char* cache_file_name,
+	VkDeviceSize budget);
+// Waits for the streaming threads, before index_buffer is destroyed
+extern void destroy_geometry_streamer(struct GraphicsContext* graphics_context);
+// Radius over distance of the biggest instance of each LOD in the visible list, sorted by LOD with lod_counts instances
+// per LOD. 0 for LODs without instances.
+extern void get_lod_priorities(const struct CullingBounds* bounds, const uint32_t* visible, const uint32_t* lod_counts, uint32_t lod_count,
+	glm::vec3 camera_position, float* priorities);
+// Once per frame with the device idle, with the priority each LOD was asked for at. Makes finished loads resident and
+// queues the missing LODs, the biggest on screen first, evicting the least recently drawn LODs beyond the budget.
+// resident_lods receives the LOD drawn instead of each one, the nearest resident one at least as coarse.
+// lod_index_offsets is updated with the resident LODs.
+extern void update_geometry_streaming(struct GraphicsContext* graphics_context, const float* priorities, uint32_t* resident_lods);
+// Moves the instances of each LOD to the LOD drawn instead. LODs in between are not resident, so the visible list
+// sorted by LOD stays grouped by the merged counts.
+extern void merge_lod_counts(const uint32_t* resident_lods, uint32_t lod_count, uint32_t* lod_counts);
+// Index bytes resident or being loaded, the coarsest LOD included
+extern VkDeviceSize get_streamed_index_size(struct GraphicsContext* graphics_context);
\ No newline at end of file
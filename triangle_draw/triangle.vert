@@ -42,12 +42,32 @@ layout (binding = 0) uniform UBO
 	vec4 viewPos;
 } ubo;
 
+// Object to world transform of every instance, indexed by gl_InstanceIndex
+layout(std430, binding = 2) readonly buffer Instances
+{
+	mat4 transforms[];
+} instances;
+
+// Instances that passed frustum culling, gl_InstanceIndex indexes this list
+layout(std430, binding = 3) readonly buffer VisibleInstances
+{
+	uint indices[];
+} visible_instances;
+
+// Packed vertex formats store positions normalized over the mesh bounds
+layout(push_constant) uniform Dequantization
+{
+	highp vec4 position_scale;
+	highp vec4 position_offset;
+} dequantization;
+
 void main()
 {
     //gl_Position = vec4(in_position, 0.5, 1.0);
 
     //gl_Position = ubo.projection * ubo.model * vec4(in_position, 0.5, 1.0);
-    gl_Position = ubo.projection * ubo.model * vec4(in_position, 1.0);
+    vec3 position = in_position * dequantization.position_scale.xyz + dequantization.position_offset.xyz;
+    gl_Position = ubo.projection * ubo.model * instances.transforms[visible_instances.indices[gl_InstanceIndex]] * vec4(position, 1.0);
 
     out_color = in_color;
 }
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "mesh.h"
+#include "vertex_format.h"
+
+static const char* vertex_format_names[] = { "float", "half", "snorm16" };
+
+uint32_t get_vertex_stride(enum VertexFormat vertex_format)
+{
+	return vertex_format == VERTEX_FORMAT_FLOAT ? sizeof(struct Vertex) : sizeof(struct PackedVertex);
+}
+
+static VkFormat get_position_format(enum VertexFormat vertex_format)
+{
+	switch (vertex_format)
+	{
+	case VERTEX_FORMAT_HALF:
+		return VK_FORMAT_R16G16B16A16_SFLOAT;
+	case VERTEX_FORMAT_SNORM16:
+		return VK_FORMAT_R16G16B16A16_SNORM;
+	default:
+		return VK_FORMAT_R32G32B32_SFLOAT;
+	}
+}
+
+static VkFormat get_color_format(enum VertexFormat vertex_format)
+{
+	return vertex_format == VERTEX_FORMAT_FLOAT ? VK_FORMAT_R32G32B32_SFLOAT : VK_FORMAT_R8G8B8A8_UNORM;
+}
+
+enum VertexFormat get_supported_vertex_format(VkPhysicalDevice physical_device, enum VertexFormat requested)
+{
+	VkFormatProperties position_properties;
+	VkFormatProperties color_properties;
+
+	vkGetPhysicalDeviceFormatProperties(physical_device, get_position_format(requested), &position_properties);
+	vkGetPhysicalDeviceFormatProperties(physical_device, get_color_format(requested), &color_properties);
+
+	if (!(position_properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT) ||
+		!(color_properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT))
+	{
+		printf("%s vertex format not supported, using float\n", vertex_format_names[requested]);
+		return VERTEX_FORMAT_FLOAT;
+	}
+
+	printf("using %s vertex format (%u bytes per vertex)\n", vertex_format_names[requested], get_vertex_stride(requested));
+	return requested;
+}
+
+uint32_t get_vertex_input(enum VertexFormat vertex_format, VkVertexInputBindingDescription* binding,
+	VkVertexInputAttributeDescription* attributes)
+{
+	binding->binding = 0;
+	binding->stride = get_vertex_stride(vertex_format);
+	binding->inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	// The shader reads vec3 inputs, extra components of the packed formats are ignored
+	attributes[0].location = 0;
+	attributes[0].binding = 0;
+	attributes[0].format = get_position_format(vertex_format);
+	attributes[0].offset = 0;
+	attributes[1].location = 1;
+	attributes[1].binding = 0;
+	attributes[1].format = get_color_format(vertex_format);
+	attributes[1].offset = vertex_format == VERTEX_FORMAT_FLOAT ? offsetof(struct Vertex, color) : offsetof(struct PackedVertex, color);
+	return MAX_VERTEX_FORMAT_ATTRIBUTES;
+}
+
+void get_vertex_dequantization(enum VertexFormat vertex_format, const struct Mesh* mesh, struct VertexDequantization* dequantization)
+{
+	memset(dequantization, 0, sizeof(*dequantization));
+	for (int i = 0; i < 3; i++)
+	{
+		float half_extent = (mesh->bounds_max[i] - mesh->bounds_min[i]) * 0.5f;
+
+		// Packed positions span [-1, 1] over the bounds, flat axes keep a non zero scale
+		if (vertex_format == VERTEX_FORMAT_FLOAT)
+		{
+			dequantization->position_scale[i] = 1.0f;
+		}
+		else
+		{
+			dequantization->position_scale[i] = half_extent > 0.0f ? half_extent : 1.0f;
+			dequantization->position_offset[i] = (mesh->bounds_min[i] + mesh->bounds_max[i]) * 0.5f;
+		}
+	}
+	dequantization->position_scale[3] = 1.0f;
+}
+
+// Round to nearest, values beyond the half range become infinity. Inputs are normalized, so no NaN handling.
+static uint16_t float_to_half(float value)
+{
+	uint32_t bits;
+	uint32_t sign;
+	int32_t exponent;
+	uint32_t mantissa;
+	uint32_t half;
+
+	memcpy(&bits, &value, sizeof(bits));
+	sign = (bits >> 16) & 0x8000;
+	exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+	mantissa = bits & 0x7fffff;
+
+	if (exponent >= 31)
+		return (uint16_t)(sign | 0x7c00);
+	if (exponent <= 0)
+	{
+		// Denormal half, the implicit leading bit becomes explicit
+		uint32_t shift = 14 - exponent;
+
+		if (exponent < -10)
+			return (uint16_t)sign;
+		mantissa |= 0x800000;
+		half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1)
+			half++;
+		return (uint16_t)(sign | half);
+	}
+
+	// A mantissa carry correctly rounds up into the exponent
+	half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)
+		half++;
+	return (uint16_t)half;
+}
+
+static inline uint16_t float_to_snorm16(float value)
+{
+	value = value < -1.0f ? -1.0f : value > 1.0f ? 1.0f : value;
+	return (uint16_t)(int16_t)(value * 32767.0f + (value < 0.0f ? -0.5f : 0.5f));
+}
+
+static inline uint8_t float_to_unorm8(float value)
+{
+	value = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+	return (uint8_t)(value * 255.0f + 0.5f);
+}
+
+void pack_vertices(enum VertexFormat vertex_format, const struct Mesh* mesh, const struct VertexDequantization* dequantization,
+	void* destination)
+{
+	struct PackedVertex* packed = (struct PackedVertex*)destination;
+
+	if (vertex_format == VERTEX_FORMAT_FLOAT)
+	{
+		memcpy(destination, mesh->vertices, (size_t)mesh->vertex_count * sizeof(struct Vertex));
+		return;
+	}
+
+	for (uint32_t v = 0; v < mesh->vertex_count; v++)
+	{
+		const struct Vertex* vertex = &mesh->vertices[v];
+
+		for (int i = 0; i < 3; i++)
+		{
+			float normalized = (vertex->position[i] - dequantization->position_offset[i]) / dequantization->position_scale[i];
+
+			packed[v].position[i] = vertex_format == VERTEX_FORMAT_HALF ? float_to_half(normalized) : float_to_snorm16(normalized);
+			packed[v].color[i] = float_to_unorm8(vertex->color[i]);
+		}
+		packed[v].position[3] = vertex_format == VERTEX_FORMAT_HALF ? 0x3c00 : 0x7fff;
+		packed[v].color[3] = 0xff;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+#include "common.h"
+
+#define MAX_VERTEX_FORMAT_ATTRIBUTES 2
+
+struct Mesh;
+
+// Vertex of VERTEX_FORMAT_HALF and VERTEX_FORMAT_SNORM16, 12 bytes.
+// position holds half floats or snorm16 values relative to the mesh bounds, w is 1.0.
+struct PackedVertex
+{
+	uint16_t position[4];
+	uint8_t color[4];
+};
+
+// Vertex shader push constants, position = packed position * position_scale + position_offset
+struct VertexDequantization
+{
+	float position_scale[4];
+	float position_offset[4];
+};
+
+extern uint32_t get_vertex_stride(enum VertexFormat vertex_format);
+// Falls back to VERTEX_FORMAT_FLOAT when the device cannot fetch the packed formats
+extern enum VertexFormat get_supported_vertex_format(VkPhysicalDevice physical_device, enum VertexFormat requested);
+// Binding 0 and attribute descriptions of vertex_format, returns the attribute count
+extern uint32_t get_vertex_input(enum VertexFormat vertex_format, VkVertexInputBindingDescription* binding,
+	VkVertexInputAttributeDescription* attributes);
+extern void get_vertex_dequantization(enum VertexFormat vertex_format, const struct Mesh* mesh, struct VertexDequantization* dequantization);
+// Writes mesh->vertex_count vertices of get_vertex_stride bytes to destination
+extern void pack_vertices(enum VertexFormat vertex_format, const struct Mesh* mesh, const struct VertexDequantization* dequantization,
+	void* destination);
\ No newline at end of file